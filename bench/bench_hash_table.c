@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/hash_table.h"
+#include "../src/logging.h"
+#include "../src/swiss_table.h"
+
+/**
+ * Compares the lookup speed of the chained hash table with the swiss table
+ * that the actors use as their shard index. For every table size the keys
+ * are inserted and then looked up in a random order, reporting the time and
+ * the amount of hardware cache misses per lookup.
+ *
+ * usage: hash_table_bench [key count...]
+ */
+
+#define KEY_SIZE 16
+#define MAX_LOOKUPS 10000000
+
+typedef struct Table {
+  const char *name;
+  void *(*init)(size_t size);
+  void (*destroy)(void *table);
+  void *(*get)(void *table, const char *key, size_t key_len);
+  void *(*put)(void *table, const char *key, size_t key_len, void *value);
+} Table;
+
+static void *chained_init(size_t size) { return hash_table_init(size); }
+static void chained_destroy(void *table) { hash_table_destroy(table); }
+static void *chained_get(void *table, const char *key, size_t key_len) {
+  return hash_table_get(table, key, key_len);
+}
+static void *chained_put(void *table, const char *key, size_t key_len, void *value) {
+  return hash_table_put(table, key, key_len, value);
+}
+
+static void *swiss_init(size_t size) { return swiss_table_init(size); }
+static void swiss_destroy(void *table) { swiss_table_destroy(table); }
+static void *swiss_get(void *table, const char *key, size_t key_len) {
+  return swiss_table_get(table, key, key_len);
+}
+static void *swiss_put(void *table, const char *key, size_t key_len, void *value) {
+  return swiss_table_put(table, key, key_len, value);
+}
+
+static const Table tables[] = {
+  { "chained", chained_init, chained_destroy, chained_get, chained_put },
+  { "swiss", swiss_init, swiss_destroy, swiss_get, swiss_put },
+};
+
+/**
+ * Opens a counter for the cache misses of the current thread, returns -1 if
+ * the kernel does not allow it.
+ */
+static int open_cache_miss_counter(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline double now_seconds(void) {
+  struct timespec time_spec;
+  clock_gettime(CLOCK_MONOTONIC, &time_spec);
+  return (double) time_spec.tv_sec + (double) time_spec.tv_nsec / 1e9;
+}
+
+static inline uint64_t next_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void run(const Table *table, char *keys, size_t key_count, int counter_fd) {
+  void *index = table->init(0);
+
+  double start = now_seconds();
+  for (size_t i = 0 ; i < key_count ; i++) {
+    table->put(index, keys + i * KEY_SIZE, KEY_SIZE - 1, (void*) (i + 1));
+  }
+  double insert_time = now_seconds() - start;
+
+  size_t lookups = key_count < MAX_LOOKUPS ? key_count : MAX_LOOKUPS;
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  size_t found = 0;
+
+  if (counter_fd != -1) {
+    ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  start = now_seconds();
+  for (size_t i = 0 ; i < lookups ; i++) {
+    size_t k = next_random(&state) % key_count;
+    found += table->get(index, keys + k * KEY_SIZE, KEY_SIZE - 1) != NULL;
+  }
+  double lookup_time = now_seconds() - start;
+
+  uint64_t misses = 0;
+  if (counter_fd != -1) {
+    ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+    CHECK(read(counter_fd, &misses, sizeof(misses)) != sizeof(misses),
+	  "Failed to read cache miss counter");
+  }
+
+  CHECK(found != lookups, "Only found %zu of %zu keys", found, lookups);
+
+  if (counter_fd != -1) {
+    printf("%-8s keys=%-10zu insert=%6.1fns/key lookup=%6.1fns/op cache-misses=%5.2f/op\n",
+	   table->name, key_count, insert_time * 1e9 / (double) key_count,
+	   lookup_time * 1e9 / (double) lookups, (double) misses / (double) lookups);
+  } else {
+    printf("%-8s keys=%-10zu insert=%6.1fns/key lookup=%6.1fns/op cache-misses=n/a\n",
+	   table->name, key_count, insert_time * 1e9 / (double) key_count,
+	   lookup_time * 1e9 / (double) lookups);
+  }
+  fflush(stdout);
+
+  table->destroy(index);
+}
+
+int main(int argc, char *argv[]) {
+  size_t default_counts[] = { 1000000, 10000000, 100000000 };
+  size_t count_len = argc > 1 ? (size_t) argc - 1 : 3;
+
+  int counter_fd = open_cache_miss_counter();
+  if (counter_fd == -1) {
+    LOG_WARN("Hardware cache miss counter is not available");
+  }
+
+  for (size_t c = 0 ; c < count_len ; c++) {
+    size_t key_count = argc > 1 ? (size_t) atol(argv[c + 1]) : default_counts[c];
+    char *keys = (char*) CHECK_MEM(malloc(key_count * KEY_SIZE));
+    for (size_t i = 0 ; i < key_count ; i++) {
+      snprintf(keys + i * KEY_SIZE, KEY_SIZE, "%015zu", i % 1000000000000000);
+    }
+
+    for (size_t t = 0 ; t < sizeof(tables) / sizeof(tables[0]) ; t++) {
+      run(&tables[t], keys, key_count, counter_fd);
+    }
+    free(keys);
+  }
+
+  if (counter_fd != -1) {
+    close(counter_fd);
+  }
+  return 0;
+}
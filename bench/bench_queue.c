@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/logging.h"
+#include "../src/queue.h"
+
+/**
+ * Measures how many notifications a queue sends when the reader only asks
+ * for them before it goes to sleep, compared to one for every message. A
+ * writer thread pushes the messages in bursts, with a pause between the
+ * bursts, and a reader thread drains the queue the way the actors do: it
+ * reads everything there is, announces that it is about to sleep and only
+ * then waits on the event file descriptor.
+ *
+ * usage: queue_bench [message count] [burst size] [pause micros]
+ */
+
+#define QUEUE_SIZE 1024
+
+typedef struct Bench {
+  Queue *queue;
+  size_t message_count;
+  size_t burst;
+  long pause_micros;
+  int on_demand;
+  size_t wakeups;
+} Bench;
+
+static inline double now_seconds(void) {
+  struct timespec time_spec;
+  clock_gettime(CLOCK_MONOTONIC, &time_spec);
+  return (double) time_spec.tv_sec + (double) time_spec.tv_nsec / 1e9;
+}
+
+static void *read_messages(void *arg) {
+  Bench *bench = (Bench*) arg;
+  int fd = queue_add_event_fd(bench->queue);
+  size_t received = 0;
+
+  while (1) {
+    while (queue_pop(bench->queue) != NULL) {
+      received++;
+    }
+    if (received == bench->message_count) {
+      return NULL;
+    }
+
+    int pending = bench->on_demand ? queue_prepare_sleep(bench->queue)
+      : queue_size(bench->queue) > 0;
+    if (pending) {
+      continue;
+    }
+
+    struct pollfd poll_fd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    CHECK(poll(&poll_fd, 1, -1) == -1, "Failed to poll");
+    eventfd_t count;
+    eventfd_read(fd, &count);
+    bench->wakeups++;
+  }
+}
+
+static void run(size_t message_count, size_t burst, long pause_micros, int on_demand) {
+  Bench bench = {
+    .queue = queue_init(QUEUE_SIZE),
+    .message_count = message_count,
+    .burst = burst,
+    .pause_micros = pause_micros,
+    .on_demand = on_demand,
+    .wakeups = 0,
+  };
+  if (on_demand) {
+    queue_ring_on_demand(bench.queue);
+  }
+
+  pthread_t reader;
+  double start = now_seconds();
+  CHECK(pthread_create(&reader, NULL, read_messages, &bench) != 0,
+	"Failed to start reader");
+
+  for (size_t i = 0 ; i < message_count ; i++) {
+    while (queue_push(bench.queue, (void*) (uintptr_t) (i + 1)) != QUEUE_SUCCESS) {
+      /* the reader catches up. */
+    }
+    if (pause_micros > 0 && (i + 1) % burst == 0) {
+      usleep((useconds_t) pause_micros);
+    }
+  }
+
+  pthread_join(reader, NULL);
+  double elapsed = now_seconds() - start;
+
+  long doorbells = queue_doorbells(bench.queue);
+  printf("%-9s messages=%-9zu burst=%-5zu pause=%-5ldus time=%7.1fns/msg "
+	 "doorbells=%.4f/msg wakeups=%.4f/msg\n",
+	 on_demand ? "on-demand" : "always", message_count, burst, pause_micros,
+	 elapsed * 1e9 / (double) message_count, (double) doorbells / (double) message_count,
+	 (double) bench.wakeups / (double) message_count);
+  fflush(stdout);
+  queue_destroy(bench.queue);
+}
+
+int main(int argc, char *argv[]) {
+  size_t message_count = argc > 1 ? (size_t) atol(argv[1]) : 2000000;
+  size_t burst = argc > 2 ? (size_t) atol(argv[2]) : 64;
+  long pause_micros = argc > 3 ? atol(argv[3]) : 0;
+  CHECK(message_count == 0 || burst == 0, "Invalid message count or burst size");
+
+  run(message_count, burst, pause_micros, 0);
+  run(message_count, burst, pause_micros, 1);
+  return 0;
+}
@@ -4,125 +4,549 @@
 #include <string.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <semaphore.h>
 #include <unistd.h>
 
 #include "actor.h"
-#include "client.h"
 #include "epoll_info.h"
 #include "http_request.h"
-#include "http_response.h"
-#include "io_worker.h"
+#include "kv_store.h"
 #include "logging.h"
+#include "mrmw_queue.h"
+#include "output_buffer.h"
 #include "queue.h"
 #include "request_context.h"
 #include "request_stats.h"
+#include "scan.h"
 #include "server.h"
+#include "snapshot.h"
+#include "wal.h"
 
 #define MAX_EVENTS 10
 
+/* how often the actor looks for expired keys, in milliseconds. */
+#define EXPIRE_INTERVAL_MS 10
+
+/* the most keys that are expired at once, so that a lot of keys expiring
+ * at the same time does not hold up the requests. */
+#define EXPIRE_BATCH 64
+
+/* the most requests read off of an input queue at once. */
+#define ACTOR_BATCH_SIZE 64
+
+/* how often the replies that did not fit in the queue to their worker are
+ * pushed again. */
+#define REPLY_RETRY_MS 1
+
+/* the longest TTL that a key can have, in seconds. */
+#define MAX_TTL (10L * 365 * 24 * 60 * 60)
+
+/* values that are smaller are copied into the response, which is cheaper
+ * than lending them out through the shared counter of the item. */
+#define LEND_MIN_SIZE (16 * 1024)
+
+/**
+ * Attached to every file descriptor in the actor's event loop so that the
+ * loop knows what to do once the descriptor is ready.
+ */
+typedef struct ActorEvent {
+  void (*handler) (ActorInfo *actor_info, void *data);
+  void *data;
+} ActorEvent;
+
+/**
+ * The replies for a single worker that wait for room in its reply queue.
+ */
+typedef struct ReplyBacklog {
+  void **replies;
+  size_t count;
+  size_t capacity;
+} ReplyBacklog;
+
+typedef struct ExpiryTimer {
+  int fd;
+
+  /* set when the last round stopped at the batch limit, so there are more
+   * expired keys waiting. */
+  int backlog;
+} ExpiryTimer;
+
+/**
+ * Reads the optional TTL header, the amount of seconds after which the key
+ * expires, into the wall clock time to expire at. Returns 0 if the header
+ * is invalid.
+ */
+static int parse_ttl(HttpRequest *http_request, uint64_t *expires_at) {
+  *expires_at = 0;
+  const struct phr_header *header = http_request_header(http_request, "TTL");
+  if (header == NULL) {
+    return 1;
+  }
+
+  long ttl = 0;
+  for (size_t i = 0 ; i < header->value_len ; i++) {
+    char c = header->value[i];
+    if (c < '0' || c > '9' || ttl > MAX_TTL) {
+      return 0;
+    }
+    ttl = ttl * 10 + (c - '0');
+  }
+  if (header->value_len == 0 || ttl == 0 || ttl > MAX_TTL) {
+    return 0;
+  }
+
+  *expires_at = kv_store_clock() + (uint64_t) ttl * 1000;
+  return 1;
+}
+
+int actor_request_is_stateless(HttpRequest *http_request) {
+  size_t key_len;
+  http_request_key(http_request, &key_len);
+  return key_len == 0 || key_len > KV_MAX_KEY_SIZE
+    || !(http_request_is_method(http_request, "GET")
+	 || http_request_is_method(http_request, "PUT")
+	 || http_request_is_method(http_request, "DELETE"));
+}
+
+/**
+ * Answers a request that does not touch the store, which any actor can do.
+ */
+static void handle_stateless(RequestContext *request_context) {
+  size_t key_len;
+  http_request_key(&request_context->http_request, &key_len);
+  if (key_len == 0 || key_len > KV_MAX_KEY_SIZE) {
+    context_send_response(request_context, 400, NULL, 0);
+  } else {
+    context_send_response(request_context, 405, NULL, 0);
+  }
+}
+
 /**
  * Does the actual request processing. Takes in a request context and is
  * responsible for constructing the HTTP response and storing it in the
  * output buffer.
+ *
+ * The path of the request, minus the leading slash, is the key. GET returns
+ * the stored value, PUT stores the body of the request as the value and
+ * DELETE removes the key. A PUT with a TTL header expires after that many
+ * seconds. Every change is appended to the actor's log when
+ * durability is enabled.
  */
-static void handle_request(RequestContext *request_context) {
-        HttpRequest http_request = request_context->http_request;
-
-    HttpHeader headers[10];
-    size_t header_count = 2;
+static void handle_request(ActorInfo *actor_info, RequestContext *request_context) {
+  KvStore *store = actor_info->store;
+  Wal *wal = actor_info->wal;
+  HttpRequest *http_request = &request_context->http_request;
 
+  size_t key_len;
+  const char *key = http_request_key(http_request, &key_len);
 
-    headers[0].name = "Content-Length";
-    headers[0].name_len = 14;
+  if (actor_request_is_stateless(http_request)) {
+    handle_stateless(request_context);
+  } else if (http_request_is_method(http_request, "GET")) {
+    KvItem *item = kv_store_get(store, key, key_len);
+    if (item == NULL) {
+      context_send_response(request_context, 404, NULL, 0);
+    } else if (item->value_len >= LEND_MIN_SIZE) {
+      /* the IO worker sends the value straight out of the store. */
+      OutputBuffer *output_buffer = request_context->output_buffer;
+      kv_store_lend(store, item);
+      context_send_response_head(request_context, 200, item->value_len);
+      output_buffer_append_ref(output_buffer, kv_item_value(item), item->value_len);
+      output_buffer_on_release(output_buffer, kv_store_return, item);
+    } else {
+      context_send_response(request_context, 200, kv_item_value(item), item->value_len);
+    }
+  } else if (http_request_is_method(http_request, "PUT")) {
+    if (http_request->body_len > KV_MAX_VALUE_SIZE) {
+      context_send_response(request_context, 413, NULL, 0);
+      return;
+    }
 
-    char content_length_value[10];
-    int size = sprintf(content_length_value, "%zu", http_request.path_len);
-    CHECK(size <= 0, "Failed to print content length string");
-    
-    headers[0].value = content_length_value;
-    headers[0].value_len = (size_t) size;
+    uint64_t expires_at;
+    if (!parse_ttl(http_request, &expires_at)) {
+      context_send_response(request_context, 400, NULL, 0);
+      return;
+    }
 
-    headers[1].name = "Connection";
-    headers[1].name_len = 10;
-    if (context_keep_alive(request_context) == 1) {
-      headers[1].value = "keep-alive";
-      headers[1].value_len = 10;
+    int created = kv_store_put(store, key, key_len, http_request->body,
+			       http_request->body_len, expires_at);
+    if (created == KV_PUT_TOO_LARGE) {
+      /* the value is larger than the memory of the actor, nothing was
+       * stored and nothing is logged. */
+      context_send_response(request_context, 413, NULL, 0);
+      return;
+    }
+    if (wal != NULL) {
+      wal_append_put(wal, key, key_len, http_request->body, http_request->body_len,
+		     expires_at);
+    }
+    context_send_response(request_context, created == 1 ? 201 : 200, NULL, 0);
+  } else {
+    if (kv_store_delete(store, key, key_len) == 1) {
+      if (wal != NULL) {
+	wal_append_delete(wal, key, key_len);
+      }
+      context_send_response(request_context, 200, NULL, 0);
     } else {
-      headers[1].value = "close";
-      headers[1].value_len = 5;
+      context_send_response(request_context, 404, NULL, 0);
     }
+  }
+}
 
-    http_response_init(request_context->output_buffer, 200, headers,
-		       header_count, http_request.path,
-		       http_request.path_len);
+/**
+ * Adds the items of the actor's own store to a scan.
+ */
+static void handle_scan(ActorInfo *actor_info, RequestContext *request_context) {
+  ScanRequest *scan = request_context->scan;
+  if (scan->status == 0) {
+    scan_collect(scan, actor_info->id, actor_info->store);
+  }
 }
 
-void process_epoll_event(Server *server, int actor_id, Queue *input_queue) {
-  while (1) {
-    eventfd_t num_to_read;
-    int r = eventfd_read(queue_add_event_fd(input_queue), &num_to_read);
-    
-    if (r == -1 || num_to_read == 0) {
+/**
+ * Answers a scan once every actor added its items, from the thread of the
+ * actor that was done last.
+ */
+static void finish_scan(ActorInfo *actor_info, RequestContext *request_context) {
+  ScanRequest *scan = request_context->scan;
+  request_context->actor_id = actor_info->id;
+  per_request_record_end(&request_context->time_stats, QUEUE_TIME);
+
+  if (scan->status != 0) {
+    context_send_response(request_context, scan->status, NULL, 0);
+  } else {
+    size_t body_len = scan_merge(scan);
+    context_send_response_head(request_context, 200, body_len);
+    scan_write_body(scan, request_context->output_buffer);
+    scan = NULL;
+  }
+
+  if (scan != NULL) {
+    scan_destroy(scan);
+  }
+  request_context->scan = NULL;
+}
+
+/**
+ * Hands the finished request back to the IO worker that owns the connection
+ * so that it can write out the response. A scan is only handed back by the
+ * last actor that finishes its part of it.
+ */
+static void release_request(void *waiter, void *arg) {
+  RequestContext *request_context = (RequestContext*) waiter;
+  ActorInfo *actor_info = (ActorInfo*) arg;
+
+  if (request_context->scan != NULL) {
+    if (!scan_part_done(request_context->scan)) {
       return;
     }
-    
-    for (eventfd_t i = 0 ;  i < num_to_read ; i++) {
-      RequestContext *request_context  = queue_pop(input_queue);
-      if (request_context == NULL) {
-	return;
-      }
-      request_context->actor_id = actor_id;
-      /* starts tracking how long the item stays in the queue */
-      per_request_record_end(&request_context->time_stats, QUEUE_TIME);
-      
-      /* process the actor request and generate a response. */
-      per_request_record_start(&request_context->time_stats, ACTOR_TIME);
-      
-      handle_request(request_context);
-      
-      per_request_record_end(&request_context->time_stats, ACTOR_TIME);
-
-      SocketContext *output_context = init_context(server, request_context->epoll_info);
-      output_context->data.ptr = request_context;
-      output_context->input_handler = NULL;
-      output_context->output_handler = client_handle_write;
-      output_context->error_handler = client_handle_error;
-      
-      add_output_epoll_event(request_context->epoll_info,
-			     request_context->fd,
-			     output_context);
+    finish_scan(actor_info, request_context);
+  }
+
+  /* the worker owns the connection, so the request is handed back to it on
+   * the queue between this actor and the worker, which writes it out. */
+  EpollInfo *worker = request_context->epoll_info;
+  ReplyBacklog *backlog = &actor_info->reply_backlogs[worker->id];
+  if (backlog->count == 0
+      && queue_push(worker->reply_queues[actor_info->id], request_context) == QUEUE_SUCCESS) {
+    return;
+  }
+
+  /* the worker is behind on its replies, they wait here in order till it
+   * made room. */
+  if (backlog->count == backlog->capacity) {
+    backlog->capacity = backlog->capacity == 0 ? ACTOR_BATCH_SIZE : backlog->capacity << 1;
+    backlog->replies = (void**) CHECK_MEM(realloc(backlog->replies,
+						  backlog->capacity * sizeof(void*)));
+  }
+  backlog->replies[backlog->count++] = request_context;
+  actor_info->parked_reply_count++;
+  atomic_fetch_add_explicit(&actor_info->parked_replies, 1, memory_order_relaxed);
+}
+
+/**
+ * Pushes as many of the replies that are waiting for their workers as there
+ * is room for.
+ */
+static void flush_replies(ActorInfo *actor_info) {
+  if (actor_info->parked_reply_count == 0) {
+    return;
+  }
+
+  Server *server = actor_info->server;
+  for (int i = 0 ; i < actor_info->queue_count ; i++) {
+    ReplyBacklog *backlog = &actor_info->reply_backlogs[i];
+    if (backlog->count == 0) {
+      continue;
+    }
+
+    Queue *reply_queue = server->io_epoll_infos[i]->reply_queues[actor_info->id];
+    size_t pushed = queue_push_batch(reply_queue, backlog->replies, backlog->count);
+    backlog->count -= pushed;
+    actor_info->parked_reply_count -= pushed;
+    memmove(backlog->replies, backlog->replies + pushed, backlog->count * sizeof(void*));
+  }
+}
+
+/**
+ * Handles a single request that was read off of an input queue.
+ */
+static void handle_input(ActorInfo *actor_info, Wal *wal, RequestContext *request_context) {
+  if (request_context->scan != NULL) {
+    /* every actor works on a scan at the same time, so they leave the
+     * rest of the context alone. */
+    handle_scan(actor_info, request_context);
+  } else {
+    request_context->actor_id = actor_info->id;
+    /* starts tracking how long the item stays in the queue */
+    per_request_record_end(&request_context->time_stats, QUEUE_TIME);
+
+    /* process the actor request and generate a response. */
+    per_request_record_start(&request_context->time_stats, ACTOR_TIME);
+
+    handle_request(actor_info, request_context);
+
+    per_request_record_end(&request_context->time_stats, ACTOR_TIME);
+  }
+
+  /* nothing is answered before the changes that came before it are
+   * durable, so that a client can never see data that could be lost. */
+  if (wal != NULL && wal_has_pending(wal)) {
+    wal_add_waiter(wal, request_context);
+  } else {
+    release_request(request_context, actor_info);
+  }
+}
+
+/**
+ * Handles every request in the queue. The queue only notifies the actor
+ * while it sleeps, so it is read after every wakeup. The requests are read
+ * off of the queue a batch at a time.
+ */
+static void process_input_queue(ActorInfo *actor_info, Queue *input_queue) {
+  Wal *wal = actor_info->wal;
+
+  void *batch[ACTOR_BATCH_SIZE];
+  size_t count;
+  while ((count = queue_pop_batch(input_queue, batch, ACTOR_BATCH_SIZE)) > 0) {
+    for (size_t i = 0 ; i < count ; i++) {
+      handle_input(actor_info, wal, (RequestContext*) batch[i]);
     }
   }
 }
 
+static void process_epoll_event(ActorInfo *actor_info, void *data) {
+  Queue *input_queue = (Queue*) data;
+  eventfd_t num_to_read;
+  eventfd_read(queue_add_event_fd(input_queue), &num_to_read);
+  process_input_queue(actor_info, input_queue);
+}
+
+/**
+ * Takes a request off of the shared queue. Every notification stands for a
+ * single request, so the actors that are woken up share the work.
+ */
+static void process_shared_event(ActorInfo *actor_info, void *data) {
+  void *request_context;
+  if (mrmw_queue_pop_event((MrMwQueue*) data, &request_context) == MRMW_QUEUE_SUCCESS) {
+    handle_input(actor_info, actor_info->wal, (RequestContext*) request_context);
+  }
+}
+
+static void process_wal_event(ActorInfo *actor_info, void *data) {
+  wal_handle_done((Wal*) data, release_request, actor_info);
+}
+
+/**
+ * Removes the next batch of expired keys. Expirations are not logged, an
+ * expired key that is restored after a restart expires right away.
+ */
+static void expire_keys(ActorInfo *actor_info, ExpiryTimer *timer) {
+  size_t count = kv_store_expire(actor_info->store, kv_store_clock(), EXPIRE_BATCH);
+  timer->backlog = count == EXPIRE_BATCH;
+}
+
+static void process_expiry_timer(ActorInfo *actor_info, void *data) {
+  ExpiryTimer *timer = (ExpiryTimer*) data;
+  uint64_t expirations;
+  ssize_t r = read(timer->fd, &expirations, sizeof(expirations));
+  if (r == sizeof(expirations)) {
+    expire_keys(actor_info, timer);
+  }
+}
+
+/**
+ * Registers the timer that drives the expiration of keys.
+ */
+static ExpiryTimer *add_expiry_timer(EpollInfo *epoll_info) {
+  ExpiryTimer *timer = (ExpiryTimer*) CHECK_MEM(calloc(1, sizeof(ExpiryTimer)));
+  timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  CHECK(timer->fd == -1, "Failed to create expiry timer");
+  timer->backlog = 0;
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_nsec = EXPIRE_INTERVAL_MS * 1000000L;
+  spec.it_interval.tv_nsec = EXPIRE_INTERVAL_MS * 1000000L;
+  int r = timerfd_settime(timer->fd, 0, &spec, NULL);
+  CHECK(r != 0, "Failed to arm expiry timer");
+
+  ActorEvent *event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+  event->handler = process_expiry_timer;
+  event->data = timer;
+  add_input_epoll_event(epoll_info, timer->fd, event);
+  return timer;
+}
+
+/**
+ * Starts the next snapshot, unless the previous one is still being
+ * written.
+ */
+static void process_snapshot_timer(ActorInfo *actor_info, void *data) {
+  int timer_fd = *(int*) data;
+  uint64_t expirations;
+  ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+  if (r != sizeof(expirations) || snapshot_running(actor_info->snapshot)) {
+    return;
+  }
+
+  snapshot_start(actor_info->snapshot, actor_info->store,
+		 wal_rotate(actor_info->wal));
+}
+
+static void process_snapshot_event(ActorInfo *actor_info, void *data) {
+  snapshot_handle_done((Snapshot*) data, actor_info->store);
+}
+
+/**
+ * Registers a timer that starts a snapshot every interval seconds.
+ */
+static void add_snapshot_timer(ActorInfo *actor_info, EpollInfo *epoll_info,
+			       int interval) {
+  int *timer_fd = (int*) CHECK_MEM(malloc(sizeof(int)));
+  *timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  CHECK(*timer_fd == -1, "Failed to create snapshot timer");
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = interval;
+  spec.it_interval.tv_sec = interval;
+  int r = timerfd_settime(*timer_fd, 0, &spec, NULL);
+  CHECK(r != 0, "Failed to arm snapshot timer");
+
+  ActorEvent *event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+  event->handler = process_snapshot_timer;
+  event->data = timer_fd;
+  add_input_epoll_event(epoll_info, *timer_fd, event);
+
+  event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+  event->handler = process_snapshot_event;
+  event->data = actor_info->snapshot;
+  add_input_epoll_event(epoll_info, snapshot_done_event_fd(actor_info->snapshot), event);
+}
+
 void *run_actor(void *pthread_input) {
   ActorInfo *actor_info = (ActorInfo*) pthread_input;
 
+  /* the store is created by the actor itself so that all of its memory is
+   * first touched by the core that is going to use it. */
+  actor_info->store = kv_store_init(actor_info->slab);
+  kv_store_set_memory_limit(actor_info->store,
+			    (size_t) actor_info->server->config->actor_memory * 1024 * 1024);
+  if (actor_info->server->config->ordered_index) {
+    kv_store_enable_ordered(actor_info->store);
+  }
+
+  /* every actor restores its own shard, so all of them are loaded in
+   * parallel before any request is let in. */
+  if (actor_info->wal != NULL) {
+    uint64_t generation = 0;
+    snapshot_load(actor_info->snapshot, actor_info->store, &generation);
+    wal_replay(actor_info->wal, actor_info->store, generation);
+  }
+
+  const char *name = "actor-epoll";
+  EpollInfo *epoll_info = epoll_info_init(name, actor_info->id);
+  epoll_info->busy_poll = actor_info->server->config->busy_poll;
+  epoll_info_set_queues(epoll_info, actor_info->input_queue, actor_info->queue_count);
+  actor_info->epoll_info = epoll_info;
+  actor_info->reply_backlogs =
+    (ReplyBacklog*) CHECK_MEM(calloc((size_t) actor_info->queue_count, sizeof(ReplyBacklog)));
+
   // make sure all application threads have started
   pthread_barrier_wait(actor_info->startup);
   
   LOG_INFO("Starting actor #%d", actor_info->id);
 
-  const char *name = "actor-epoll";
-  EpollInfo *epoll_info = epoll_info_init(name, actor_info->id);
-
   for (int i = 0 ; i < actor_info->queue_count ; i++) {
+    ActorEvent *event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+    event->handler = process_epoll_event;
+    event->data = actor_info->input_queue[i];
+
     int event_fd = queue_add_event_fd(actor_info->input_queue[i]);
-    add_input_epoll_event(epoll_info, event_fd, actor_info->input_queue[i]);
+    add_input_epoll_event(epoll_info, event_fd, event);
+  }
+
+  /* only one of the actors that wait on the shared queue is woken up for
+   * every request. */
+  ActorEvent *shared_event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+  shared_event->handler = process_shared_event;
+  shared_event->data = actor_info->server->shared_queue;
+  add_exclusive_input_epoll_event(epoll_info,
+				  mrmw_queue_add_event_fd(actor_info->server->shared_queue),
+				  shared_event);
+
+  if (actor_info->wal != NULL) {
+    ActorEvent *event = (ActorEvent*) CHECK_MEM(malloc(sizeof(ActorEvent)));
+    event->handler = process_wal_event;
+    event->data = actor_info->wal;
+    add_input_epoll_event(epoll_info, wal_done_event_fd(actor_info->wal), event);
+
+    int interval = actor_info->server->config->snapshot_interval;
+    if (interval > 0) {
+      add_snapshot_timer(actor_info, epoll_info, interval);
+    }
   }
 
+  ExpiryTimer *expiry_timer = add_expiry_timer(epoll_info);
+
   struct epoll_event events[MAX_EVENTS];
   while (1) {
-    int ready_amount = epoll_wait(epoll_info->epoll_fd, events, MAX_EVENTS, -1);
+    /* expired keys that are left over are removed between the requests,
+     * without waiting for the next tick of the timer. The workers do not
+     * tell the actor when they made room for its replies, so it checks
+     * back soon. */
+    int timeout = -1;
+    if (expiry_timer->backlog) {
+      timeout = 0;
+    } else if (actor_info->parked_reply_count > 0) {
+      timeout = REPLY_RETRY_MS;
+    }
+    int ready_amount = epoll_info_wait(epoll_info, events, MAX_EVENTS, timeout);
     CHECK(ready_amount == -1, "Failed to wait on epoll");
     for (int i = 0 ; i < ready_amount ; i++) {
-      Queue *input_queue = (Queue*) events[i].data.ptr;
-      process_epoll_event(actor_info->server, actor_info->id, input_queue);
+      ActorEvent *event = (ActorEvent*) events[i].data.ptr;
+      event->handler(actor_info, event->data);
     }
+
+    /* the requests that came in while the actor was awake did not notify
+     * it. */
+    for (int i = 0 ; i < actor_info->queue_count ; i++) {
+      process_input_queue(actor_info, actor_info->input_queue[i]);
+    }
+
+    if (expiry_timer->backlog) {
+      expire_keys(actor_info, expiry_timer);
+    }
+
+    /* all of the changes from this round are synced together. */
+    if (actor_info->wal != NULL) {
+      wal_flush(actor_info->wal);
+    }
+    flush_replies(actor_info);
   }
   
   return NULL;
 }
-
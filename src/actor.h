@@ -1,6 +1,14 @@
 #ifndef __actor_h__
 #define __actor_h__
 
+#include "http_request.h"
+
+/**
+ * Returns 1 if the request is answered without looking at the data of any
+ * actor, so that any of them can take it.
+ */
+int actor_request_is_stateless(HttpRequest *http_request);
+
 void  *run_actor(void *args);
 
 #endif
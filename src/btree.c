@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "logging.h"
+
+static inline uint64_t key_prefix(const char *key, size_t key_len) {
+  uint64_t prefix = 0;
+  memcpy(&prefix, key, key_len < sizeof(prefix) ? key_len : sizeof(prefix));
+  return be64toh(prefix);
+}
+
+/**
+ * Compares the key at the index of the node to the given key, in the same
+ * way as memcmp.
+ */
+static inline int compare(const BTreeNode *node, int index, uint64_t prefix,
+			  const char *key, size_t key_len) {
+  uint64_t node_prefix = node->prefixes[index];
+  if (node_prefix != prefix) {
+    return node_prefix < prefix ? -1 : 1;
+  }
+
+  size_t node_len = node->key_lens[index];
+  size_t min_len = node_len < key_len ? node_len : key_len;
+  if (min_len > sizeof(prefix)) {
+    int r = memcmp(node->keys[index] + sizeof(prefix), key + sizeof(prefix),
+		   min_len - sizeof(prefix));
+    if (r != 0) {
+      return r;
+    }
+  }
+  return node_len < key_len ? -1 : (node_len > key_len);
+}
+
+/**
+ * Returns the index of the first key of the node that is not smaller than
+ * the given key.
+ */
+static int lower_bound(const BTreeNode *node, uint64_t prefix, const char *key,
+		       size_t key_len) {
+  int low = 0;
+  int high = node->count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (compare(node, mid, prefix, key, key_len) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/**
+ * Returns the index of the child of an inner node that the given key
+ * belongs to.
+ */
+static int child_index(const BTreeNode *node, uint64_t prefix, const char *key,
+		       size_t key_len) {
+  int low = 0;
+  int high = node->count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (compare(node, mid, prefix, key, key_len) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static BTreeNode *node_init(BTree *tree, int leaf) {
+  BTreeNode *node = (BTreeNode*) CHECK_MEM(calloc(1, sizeof(BTreeNode)));
+  node->leaf = leaf;
+  node->count = 0;
+  node->prev = NULL;
+  node->next = NULL;
+  tree->node_count++;
+  return node;
+}
+
+static void node_free(BTree *tree, BTreeNode *node) {
+  tree->node_count--;
+  free(node);
+}
+
+static void separator_free(BTree *tree, BTreeNode *node, int index) {
+  tree->separator_bytes -= node->key_lens[index];
+  free((char*) node->keys[index]);
+}
+
+static void node_destroy(BTree *tree, BTreeNode *node) {
+  if (!node->leaf) {
+    for (int i = 0 ; i < node->count ; i++) {
+      separator_free(tree, node, i);
+    }
+    for (int i = 0 ; i <= node->count ; i++) {
+      node_destroy(tree, node->children[i]);
+    }
+  }
+  node_free(tree, node);
+}
+
+/**
+ * Moves the keys of the node from the index onwards by the given amount of
+ * places, without touching the values or children.
+ */
+static inline void shift_keys(BTreeNode *node, int index, int by) {
+  size_t count = (size_t) (node->count - index);
+  memmove(&node->prefixes[index + by], &node->prefixes[index], count * sizeof(uint64_t));
+  memmove(&node->keys[index + by], &node->keys[index], count * sizeof(const char*));
+  memmove(&node->key_lens[index + by], &node->key_lens[index], count * sizeof(uint32_t));
+}
+
+static inline void copy_keys(BTreeNode *to, int to_index, BTreeNode *from,
+			     int from_index, int count) {
+  memcpy(&to->prefixes[to_index], &from->prefixes[from_index], (size_t) count * sizeof(uint64_t));
+  memcpy(&to->keys[to_index], &from->keys[from_index], (size_t) count * sizeof(const char*));
+  memcpy(&to->key_lens[to_index], &from->key_lens[from_index], (size_t) count * sizeof(uint32_t));
+}
+
+static inline void set_key(BTreeNode *node, int index, uint64_t prefix,
+			   const char *key, size_t key_len) {
+  node->prefixes[index] = prefix;
+  node->keys[index] = key;
+  node->key_lens[index] = (uint32_t) key_len;
+}
+
+/**
+ * Adds the separator and the new right child to the parents of a node that
+ * was split, splitting the parents in turn when they are full. The path
+ * holds the parents of the node, and the index of the child that was taken
+ * in every one of them.
+ */
+static void insert_child(BTree *tree, BTreeNode **path, int *indexes, int depth,
+			 BTreeNode *left, uint64_t prefix, const char *key,
+			 size_t key_len, BTreeNode *right) {
+  while (depth > 0) {
+    depth--;
+    BTreeNode *parent = path[depth];
+    int index = indexes[depth];
+
+    shift_keys(parent, index, 1);
+    memmove(&parent->children[index + 2], &parent->children[index + 1],
+	    (size_t) (parent->count - index) * sizeof(BTreeNode*));
+    set_key(parent, index, prefix, key, key_len);
+    parent->children[index + 1] = right;
+    parent->count++;
+    if (parent->count < BTREE_ORDER) {
+      return;
+    }
+
+    /* the middle key moves up into the parent, the right half of the keys
+     * and children move to a new node. */
+    int mid = parent->count / 2;
+    BTreeNode *sibling = node_init(tree, 0);
+    sibling->count = parent->count - mid - 1;
+    copy_keys(sibling, 0, parent, mid + 1, sibling->count);
+    memcpy(&sibling->children[0], &parent->children[mid + 1],
+	   (size_t) (sibling->count + 1) * sizeof(BTreeNode*));
+
+    prefix = parent->prefixes[mid];
+    key = parent->keys[mid];
+    key_len = parent->key_lens[mid];
+    parent->count = mid;
+    left = parent;
+    right = sibling;
+  }
+
+  /* the root was split, so the tree grows by a level. */
+  BTreeNode *root = node_init(tree, 0);
+  root->count = 1;
+  set_key(root, 0, prefix, key, key_len);
+  root->children[0] = left;
+  root->children[1] = right;
+  tree->root = root;
+}
+
+/**
+ * Removes an empty child from its parents, removing the parents as well
+ * when it was their only child.
+ */
+static void remove_child(BTree *tree, BTreeNode **path, int *indexes, int depth) {
+  while (depth > 0) {
+    depth--;
+    BTreeNode *parent = path[depth];
+    int index = indexes[depth];
+
+    if (parent->count == 0) {
+      node_free(tree, parent);
+      if (depth == 0) {
+	tree->root = node_init(tree, 1);
+	return;
+      }
+      continue;
+    }
+
+    /* drops the separator on the left of the child, or on its right for
+     * the first child. */
+    int key_index = index > 0 ? index - 1 : 0;
+    separator_free(tree, parent, key_index);
+    shift_keys(parent, key_index + 1, -1);
+    memmove(&parent->children[index], &parent->children[index + 1],
+	    (size_t) (parent->count - index) * sizeof(BTreeNode*));
+    parent->count--;
+    break;
+  }
+
+  while (!tree->root->leaf && tree->root->count == 0) {
+    BTreeNode *root = tree->root;
+    tree->root = root->children[0];
+    node_free(tree, root);
+  }
+}
+
+BTree *btree_init(void) {
+  BTree *tree = (BTree*) CHECK_MEM(calloc(1, sizeof(BTree)));
+  tree->size = 0;
+  tree->node_count = 0;
+  tree->separator_bytes = 0;
+  tree->root = node_init(tree, 1);
+  return tree;
+}
+
+void btree_destroy(BTree *tree) {
+  node_destroy(tree, tree->root);
+  free(tree);
+}
+
+void *btree_get(BTree *tree, const char *key, size_t key_len) {
+  uint64_t prefix = key_prefix(key, key_len);
+  BTreeNode *node = tree->root;
+  while (!node->leaf) {
+    node = node->children[child_index(node, prefix, key, key_len)];
+  }
+
+  int index = lower_bound(node, prefix, key, key_len);
+  if (index < node->count && compare(node, index, prefix, key, key_len) == 0) {
+    return node->values[index];
+  }
+  return NULL;
+}
+
+void *btree_put(BTree *tree, const char *key, size_t key_len, void *value) {
+  CHECK(key_len > UINT32_MAX, "key of %zu bytes is too large", key_len);
+  BTreeNode *path[BTREE_MAX_HEIGHT];
+  int indexes[BTREE_MAX_HEIGHT];
+  int depth = 0;
+
+  uint64_t prefix = key_prefix(key, key_len);
+  BTreeNode *leaf = tree->root;
+  while (!leaf->leaf) {
+    CHECK(depth == BTREE_MAX_HEIGHT, "B+tree is too high");
+    int index = child_index(leaf, prefix, key, key_len);
+    path[depth] = leaf;
+    indexes[depth] = index;
+    depth++;
+    leaf = leaf->children[index];
+  }
+
+  int index = lower_bound(leaf, prefix, key, key_len);
+  if (index < leaf->count && compare(leaf, index, prefix, key, key_len) == 0) {
+    void *prev = leaf->values[index];
+    leaf->keys[index] = key;
+    leaf->values[index] = value;
+    return prev;
+  }
+
+  shift_keys(leaf, index, 1);
+  memmove(&leaf->values[index + 1], &leaf->values[index],
+	  (size_t) (leaf->count - index) * sizeof(void*));
+  set_key(leaf, index, prefix, key, key_len);
+  leaf->values[index] = value;
+  leaf->count++;
+  tree->size++;
+  if (leaf->count < BTREE_ORDER) {
+    return NULL;
+  }
+
+  /* moves the upper half of the keys into a new leaf right after it. */
+  int half = leaf->count / 2;
+  BTreeNode *right = node_init(tree, 1);
+  right->count = leaf->count - half;
+  copy_keys(right, 0, leaf, half, right->count);
+  memcpy(&right->values[0], &leaf->values[half], (size_t) right->count * sizeof(void*));
+  leaf->count = half;
+
+  right->prev = leaf;
+  right->next = leaf->next;
+  if (leaf->next != NULL) {
+    leaf->next->prev = right;
+  }
+  leaf->next = right;
+
+  /* the parent gets its own copy of the first key of the new leaf, as the
+   * key itself can be removed while the separator is still needed. */
+  size_t separator_len = right->key_lens[0];
+  char *separator = (char*) CHECK_MEM(malloc(separator_len > 0 ? separator_len : 1));
+  memcpy(separator, right->keys[0], separator_len);
+  tree->separator_bytes += separator_len;
+
+  insert_child(tree, path, indexes, depth, leaf, right->prefixes[0], separator,
+	       separator_len, right);
+  return NULL;
+}
+
+void *btree_remove(BTree *tree, const char *key, size_t key_len) {
+  BTreeNode *path[BTREE_MAX_HEIGHT];
+  int indexes[BTREE_MAX_HEIGHT];
+  int depth = 0;
+
+  uint64_t prefix = key_prefix(key, key_len);
+  BTreeNode *leaf = tree->root;
+  while (!leaf->leaf) {
+    int index = child_index(leaf, prefix, key, key_len);
+    path[depth] = leaf;
+    indexes[depth] = index;
+    depth++;
+    leaf = leaf->children[index];
+  }
+
+  int index = lower_bound(leaf, prefix, key, key_len);
+  if (index == leaf->count || compare(leaf, index, prefix, key, key_len) != 0) {
+    return NULL;
+  }
+
+  void *value = leaf->values[index];
+  shift_keys(leaf, index + 1, -1);
+  memmove(&leaf->values[index], &leaf->values[index + 1],
+	  (size_t) (leaf->count - index - 1) * sizeof(void*));
+  leaf->count--;
+  tree->size--;
+
+  if (leaf->count == 0 && depth > 0) {
+    if (leaf->prev != NULL) {
+      leaf->prev->next = leaf->next;
+    }
+    if (leaf->next != NULL) {
+      leaf->next->prev = leaf->prev;
+    }
+    node_free(tree, leaf);
+    remove_child(tree, path, indexes, depth);
+  }
+  return value;
+}
+
+void btree_seek(BTree *tree, const char *key, size_t key_len, BTreeIterator *iter) {
+  uint64_t prefix = key_prefix(key, key_len);
+  BTreeNode *node = tree->root;
+  while (!node->leaf) {
+    node = node->children[child_index(node, prefix, key, key_len)];
+  }
+  iter->node = node;
+  iter->index = lower_bound(node, prefix, key, key_len);
+}
+
+void *btree_next(BTreeIterator *iter, const char **key, size_t *key_len) {
+  while (iter->node != NULL && iter->index == iter->node->count) {
+    iter->node = iter->node->next;
+    iter->index = 0;
+  }
+  if (iter->node == NULL) {
+    return NULL;
+  }
+
+  int index = iter->index++;
+  *key = iter->node->keys[index];
+  *key_len = iter->node->key_lens[index];
+  return iter->node->values[index];
+}
+
+size_t btree_size(BTree *tree) {
+  return tree->size;
+}
+
+size_t btree_memory(BTree *tree) {
+  return tree->node_count * sizeof(BTreeNode) + tree->separator_bytes;
+}
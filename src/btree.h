@@ -0,0 +1,131 @@
+#ifndef __btree_h__
+#define __btree_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A B+tree that maps a sequence of bytes to a pointer and keeps the keys in
+ * byte order, so that ranges of keys can be walked in order.
+ *
+ * The values are only stored in the leaves, which are linked to each other
+ * in key order. The inner nodes only hold copies of the keys that separate
+ * their children. Like the swiss table, the keys in the leaves are not
+ * copied: the memory of a key must stay valid for as long as it is in the
+ * tree.
+ *
+ * Next to every key the node keeps its first 8 bytes as a big-endian
+ * integer, so a search through a node mostly compares integers and only
+ * follows the pointer to the key when the prefixes are the same.
+ *
+ * Nodes are not merged when they become less than half full, they are only
+ * removed once they are empty. This keeps a delete as cheap as a lookup, at
+ * the cost of some space when a lot of keys are removed out of order.
+ *
+ * There is no synchronization done, so a tree must only ever be used by the
+ * thread that created it.
+ */
+
+/* the amount of keys that makes a node split. */
+#define BTREE_ORDER 32
+
+/* more than enough levels for a tree that fits into memory. */
+#define BTREE_MAX_HEIGHT 32
+
+typedef struct BTreeNode {
+  /* 1 for the leaves, which hold the values, 0 for the inner nodes. */
+  int leaf;
+
+  /* the amount of keys in the node. An inner node has one more child. */
+  int count;
+
+  uint64_t prefixes[BTREE_ORDER];
+  const char *keys[BTREE_ORDER];
+  uint32_t key_lens[BTREE_ORDER];
+
+  union {
+    /* the values of the keys of a leaf. */
+    void *values[BTREE_ORDER];
+
+    /* the children of an inner node. Every key of child i is smaller than
+     * key i, and every key of child i + 1 is at least as large. */
+    struct BTreeNode *children[BTREE_ORDER + 1];
+  };
+
+  /* the neighbouring leaves in key order. */
+  struct BTreeNode *prev;
+  struct BTreeNode *next;
+} BTreeNode;
+
+typedef struct BTree {
+  BTreeNode *root;
+
+  /* the amount of keys stored in the tree. */
+  size_t size;
+
+  /* the amount of nodes and the bytes of the copied separator keys. */
+  size_t node_count;
+  size_t separator_bytes;
+} BTree;
+
+/**
+ * A position in the leaves of a tree. It stays valid till the next change
+ * of the tree.
+ */
+typedef struct BTreeIterator {
+  BTreeNode *node;
+  int index;
+} BTreeIterator;
+
+/**
+ * Constructs an empty tree.
+ */
+BTree *btree_init(void);
+
+/**
+ * Frees the tree. The values that are still stored are not touched.
+ */
+void btree_destroy(BTree *tree);
+
+/**
+ * Returns the value stored for the given key or NULL if there is none.
+ */
+void *btree_get(BTree *tree, const char *key, size_t key_len);
+
+/**
+ * Stores the value for the given key. When the key is already stored, its
+ * value and the memory of the key are replaced. The previous value for the
+ * key is returned so that the caller can free it, NULL if there was none.
+ */
+void *btree_put(BTree *tree, const char *key, size_t key_len, void *value);
+
+/**
+ * Removes the key from the tree and returns the value that was stored for
+ * it, NULL if the key was not found.
+ */
+void *btree_remove(BTree *tree, const char *key, size_t key_len);
+
+/**
+ * Positions the iterator right before the first key that is equal to or
+ * larger than the given key.
+ */
+void btree_seek(BTree *tree, const char *key, size_t key_len, BTreeIterator *iter);
+
+/**
+ * Returns the value of the next key of the iterator and moves past it, NULL
+ * once the end of the tree was reached. The key is returned through the
+ * arguments.
+ */
+void *btree_next(BTreeIterator *iter, const char **key, size_t *key_len);
+
+/**
+ * Returns the amount of keys in the tree.
+ */
+size_t btree_size(BTree *tree);
+
+/**
+ * The amount of bytes used by the nodes of the tree.
+ */
+size_t btree_memory(BTree *tree);
+
+#endif
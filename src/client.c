@@ -2,17 +2,23 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "actor.h"
 #include "client.h"
+#include "connection_table.h"
 #include "epoll_info.h"
 #include "input_buffer.h"
 #include "io_worker.h"
 #include "logging.h"
+#include "mrmw_queue.h"
 #include "output_buffer.h"
 #include "queue.h"
 #include "request_context.h"
 #include "request_stats.h"
+#include "router.h"
+#include "scan.h"
 #include "server.h"
 #include "server_stats.h"
 
@@ -20,70 +26,328 @@
  * Reads data off of the client's file descriptor and attempts to parse a HTTP
  * request off of it. A READ_FINISH indicates that a full http request has
  * been successfully parsed.
+ *
+ * The data is read in steps of at most the size of the buffer and parsed
+ * after every step, so that a request whose body is too large is refused
+ * once its headers are in, however fast the client sends. Nothing past
+ * the largest request that is accepted is ever buffered.
  */
 static enum ReadState try_parse_http_request(RequestContext *request_context) {
-  size_t prev_len = request_context->input_buffer->offset;
-  enum ReadState read_state = input_buffer_read_into(request_context->input_buffer,
-						     request_context->fd);
+  InputBuffer *input_buffer = request_context->input_buffer;
+  while (1) {
+    size_t prev_len = input_buffer->offset;
+    size_t max_len = input_buffer->length > prev_len ? input_buffer->length : prev_len << 1;
+    if (max_len > HTTP_MAX_REQUEST_SIZE) {
+      max_len = HTTP_MAX_REQUEST_SIZE;
+    }
 
-  switch (read_state) {
-  case READ_ERROR:
-  case CLIENT_DISCONNECT:
-    return read_state;
-  case READ_FINISH:
-  case READ_BUSY: {
-    enum ParseState parse_state = http_request_parse(request_context->input_buffer,
-						     prev_len,
+    enum ReadState read_state = input_buffer_read_into(input_buffer, request_context->fd,
+						       max_len);
+    if (read_state == READ_ERROR || read_state == CLIENT_DISCONNECT) {
+      return read_state;
+    }
+
+    enum ParseState parse_state = http_request_parse(input_buffer, 0, prev_len,
 						     &request_context->http_request);
     switch (parse_state) {
     case PARSE_FINISH:
+    case PARSE_TOO_LARGE:
+      /* a request that is too large is answered without reading its
+       * body. */
       return READ_FINISH;
     case PARSE_ERROR:
       return READ_ERROR;
     case PARSE_INCOMPLETE:
-      return READ_BUSY;
+      if (read_state == READ_BUSY) {
+	return READ_BUSY;
+      }
+      /* every request that is accepted fits, so a full buffer that does
+       * not hold one cannot be parsed. */
+      if (input_buffer->offset >= HTTP_MAX_REQUEST_SIZE) {
+	return READ_ERROR;
+      }
+      break;
     default:
       return READ_ERROR;
     }
   }
-  default:
-    return READ_ERROR;
+}
+
+static void batch_append(RequestBatch *batch, RequestContext *request_context) {
+  if (batch->count == batch->capacity) {
+    batch->capacity <<= 1;
+    batch->requests = (void**) CHECK_MEM(realloc(batch->requests,
+						 batch->capacity * sizeof(void*)));
+  }
+  batch->requests[batch->count++] = request_context;
+}
+
+/**
+ * Pushes as many of the requests for the actor onto its queue as it has
+ * room for. The rest stay in the batch in the same order.
+ */
+static void flush_batch(Server *server, EpollInfo *epoll_info, int actor_id) {
+  RequestBatch *batch = &epoll_info->request_batches[actor_id];
+  if (batch->count == 0) {
+    return;
+  }
+
+  Queue *input_queue = server->app_actors[actor_id].input_queue[epoll_info->id];
+  size_t pushed = queue_push_batch(input_queue, batch->requests, batch->count);
+  if (pushed == 0) {
+    return;
+  }
+
+  batch->count -= pushed;
+  batch->parked = batch->parked > pushed ? batch->parked - pushed : 0;
+  memmove(batch->requests, batch->requests + pushed, batch->count * sizeof(void*));
+}
+
+/**
+ * Takes the requests that did not fit in the queue of the actor out of its
+ * batch and answers them with a 503. Scans stay in the batch, as the other
+ * actors might have their part already.
+ */
+static void reject_requests(Server *server, EpollInfo *epoll_info, int actor_id) {
+  RequestBatch *batch = &epoll_info->request_batches[actor_id];
+  ActorInfo *actor_info = &server->app_actors[actor_id];
+
+  size_t kept = 0;
+  for (size_t i = 0 ; i < batch->count ; i++) {
+    RequestContext *request_context = (RequestContext*) batch->requests[i];
+    if (request_context->scan != NULL) {
+      batch->requests[kept++] = request_context;
+      continue;
+    }
+
+    atomic_fetch_add_explicit(&actor_info->rejected_requests, 1, memory_order_relaxed);
+    per_request_record_end(&request_context->time_stats, QUEUE_TIME);
+    context_send_response(request_context, 503, NULL, 0);
+    batch_append(epoll_info->rejected_requests, request_context);
+  }
+  batch->count = kept;
+  batch->parked = batch->parked < kept ? batch->parked : kept;
+}
+
+void client_flush_requests(Server *server, EpollInfo *epoll_info, ReplyHandler reply,
+			   void *data) {
+  RequestBatch *rejected = epoll_info->rejected_requests;
+  while (1) {
+    for (int i = 0 ; i < server->actor_count ; i++) {
+      flush_batch(server, epoll_info, i);
+
+      RequestBatch *batch = &epoll_info->request_batches[i];
+      if (batch->count > 0 && server->config->reject_overload) {
+	reject_requests(server, epoll_info, i);
+      }
+      if (batch->count > batch->parked) {
+	atomic_fetch_add_explicit(&server->app_actors[i].parked_requests,
+				  (long) (batch->count - batch->parked), memory_order_relaxed);
+	batch->parked = batch->count;
+      }
+    }
+
+    if (rejected->count == 0) {
+      return;
+    }
+
+    /* answering a request can start the next one of its connection, which
+     * is flushed in the next pass, or refuse it right away, which adds it
+     * to the end of the batch. */
+    for (size_t i = 0 ; i < rejected->count ; i++) {
+      reply(data, (RequestContext*) rejected->requests[i]);
+    }
+    rejected->count = 0;
+  }
+}
+
+/**
+ * Adds the request to the batch of the actor, which is pushed onto the
+ * queue of the actor once it is full or the worker is done with the round.
+ */
+static void batch_request(Server *server, EpollInfo *epoll_info, int actor_id,
+			  RequestContext *request_context) {
+  RequestBatch *batch = &epoll_info->request_batches[actor_id];
+  if (batch->count >= IO_REQUEST_BATCH_SIZE) {
+    flush_batch(server, epoll_info, actor_id);
+  }
+  batch_append(batch, request_context);
+}
+
+/**
+ * Hands a scan to every actor. The context must not be touched after the
+ * last actor has it, as the last actor to finish answers the request.
+ */
+static void send_scan(Server *server, EpollInfo *epoll_info,
+		      RequestContext *request_context) {
+  ScanRequest *scan = scan_init(&request_context->http_request, server->actor_count,
+				server->config->ordered_index);
+  request_context->scan = scan;
+
+  int part_count = scan->part_count;
+  per_request_record_start(&request_context->time_stats, QUEUE_TIME);
+  for (int i = 0 ; i < part_count ; i++) {
+    batch_request(server, epoll_info, i, request_context);
+  }
+}
+
+/**
+ * Sends a single request to the actors that have to answer it.
+ */
+static void send_request(Server *server, EpollInfo *epoll_info,
+			 RequestContext *request_context) {
+  /* a scan covers the keys of every actor, so each of them gets the
+   * request. */
+  if (scan_is_request(&request_context->http_request)) {
+    send_scan(server, epoll_info, request_context);
+    return;
+  }
+
+  /* a request that does not touch any data goes to whichever actor is
+   * free first, and to the owner of its key when the shared queue is
+   * full. */
+  per_request_record_start(&request_context->time_stats, QUEUE_TIME);
+  if (actor_request_is_stateless(&request_context->http_request)
+      && mrmw_queue_trypush(server->shared_queue, request_context) == MRMW_QUEUE_SUCCESS) {
+    return;
+  }
+
+  /* every key is owned by exactly one actor, so the request has to go to
+   * the actor that owns its key. */
+  size_t key_len;
+  const char *key = http_request_key(&request_context->http_request, &key_len);
+  int actor_id = router_actor_for_key(server->router, key, key_len);
+  batch_request(server, epoll_info, actor_id, request_context);
+}
+
+/**
+ * Parses every complete request that was pipelined behind the first one of
+ * the connection into a context of its own. The batch ends at the first
+ * request that is incomplete or closes the connection, the rest stays in
+ * the input buffer for the next batch.
+ */
+static void parse_pipelined_requests(RequestContext *connection) {
+  ConnectionTable *table = connection->epoll_info->connections;
+  InputBuffer *input_buffer = connection->input_buffer;
+  RequestContext *last = connection;
+
+  connection->next_request = NULL;
+  connection->batch_len = connection->http_request.request_len;
+  connection->pending_requests = 1;
+  connection->keep_alive = context_keep_alive(connection);
+
+  while (connection->keep_alive == 1 && connection->batch_len < input_buffer->offset
+	 && connection->pending_requests < PIPELINE_MAX_REQUESTS) {
+    RequestContext *request_context = connection_table_add_request(table, connection);
+    enum ParseState state = http_request_parse(input_buffer, connection->batch_len,
+					       connection->batch_len,
+					       &request_context->http_request);
+    if (state != PARSE_FINISH) {
+      connection_table_remove_request(table, request_context, REQUEST_SUCCESS);
+      return;
+    }
+
+    per_request_record_start(&request_context->time_stats, TOTAL_TIME);
+    last->next_request = request_context;
+    last = request_context;
+    connection->batch_len += request_context->http_request.request_len;
+    connection->pending_requests++;
+    connection->keep_alive = context_keep_alive(request_context);
+  }
+}
+
+void client_await_request(RequestContext *connection) {
+  enum ConnectionTimeout timeout = connection->timeout;
+  if (connection->http_request.body_len > 0) {
+    timeout = TIMEOUT_BODY;
+  } else if (connection->input_buffer->offset > 0) {
+    timeout = TIMEOUT_HEADER;
+  }
+  connection_table_set_timeout(connection->epoll_info->connections, connection, timeout);
+}
+
+/**
+ * Answers a request whose body is too large to be read in with a 413 and
+ * closes the connection after it, as the body is still on its way. The
+ * response goes out with the rejected requests at the end of the round.
+ */
+static void refuse_request(EpollInfo *epoll_info, RequestContext *connection) {
+  connection->next_request = NULL;
+  connection->batch_len = connection->http_request.request_len;
+  connection->pending_requests = 1;
+  connection->keep_alive = 0;
+
+  context_send_closing_response(connection, 413);
+  batch_append(epoll_info->rejected_requests, connection);
+}
+
+void client_dispatch_request(Server *server, EpollInfo *epoll_info,
+			     RequestContext *connection) {
+  /* the client is not waited on while the actors have the requests. */
+  connection_table_set_timeout(epoll_info->connections, connection, TIMEOUT_NONE);
+  if (connection->http_request.body_len > HTTP_MAX_BODY_SIZE) {
+    refuse_request(epoll_info, connection);
+    return;
+  }
+  parse_pipelined_requests(connection);
+
+  /* the next one is looked up first, as the actors own a request once it
+   * is sent. */
+  RequestContext *request_context = connection;
+  while (request_context != NULL) {
+    RequestContext *next_request = request_context->next_request;
+    send_request(server, epoll_info, request_context);
+    request_context = next_request;
   }
 }
 
-static size_t count = 0;
+RequestContext *client_finish_request(Server *server, RequestContext *request_context) {
+  RequestContext *connection = request_context->connection;
+  connection->pending_requests--;
+  if (connection->pending_requests > 0) {
+    return NULL;
+  }
+
+  /* the responses of the pipelined requests go out after the one of the
+   * first request, in the order the requests came in. */
+  request_context = connection->next_request;
+  while (request_context != NULL) {
+    RequestContext *next_request = request_context->next_request;
+    output_buffer_append_buffer(connection->output_buffer, request_context->output_buffer);
+
+    per_request_record_end(&request_context->time_stats, TOTAL_TIME);
+    server_stats_incr_total_requests(server->server_stats);
+    server_stats_record_request(server->server_stats, &request_context->time_stats);
+    connection_table_remove_request(connection->epoll_info->connections, request_context,
+				    REQUEST_SUCCESS);
+    request_context = next_request;
+  }
+  connection->next_request = NULL;
+  return connection;
+}
 
 void client_handle_read(SocketContext *context) {
   Server *server = context->server;
   EpollInfo *epoll_info = context->epoll_info;
   RequestContext *request_context = (RequestContext*) context->data.ptr;
+
+  /* the data stays in the socket till the response to the current request
+   * is written, the read after that picks it up. */
+  if (request_context->state != CONNECTION_READING) {
+    return;
+  }
   
   per_request_record_start(&request_context->time_stats, CLIENT_READ_TIME);
   enum ReadState state = try_parse_http_request(request_context);
   per_request_record_end(&request_context->time_stats, CLIENT_READ_TIME);
 
   switch (state) {
-  case READ_FINISH: {
-    /* We have to deregister the file descriptor from the event loop 
-     * before we send it off or a race condition could cause it to be
-     * closed before the input actor finishes deleting the event. */
-    delete_epoll_event(epoll_info, request_context->fd);
-
-    size_t actor_id = (count++) % (size_t) server->actor_count;
-
-    //todo fix this not to be blocking
-    ActorInfo *actor_info = &server->app_actors[actor_id];
-    Queue *input_queue = actor_info->input_queue[epoll_info->id];
-
-    per_request_record_start(&request_context->time_stats, QUEUE_TIME);
-    enum QueueResult queue_result = queue_push(input_queue, request_context);
-    CHECK(queue_result != QUEUE_SUCCESS, "Failed to send message");
-
-    /* cleans up the context that was used for reading data in. */
-    free(context);
-
+  case READ_FINISH:
+    /* the connection stays registered, the events that come in while the
+     * actors have the request are ignored. */
+    request_context->state = CONNECTION_PROCESSING;
+    client_dispatch_request(server, epoll_info, request_context);
     return;
-  }
   case READ_ERROR:
     client_close_connection(context, REQUEST_READ_ERROR);    
     return;
@@ -93,11 +357,18 @@ void client_handle_read(SocketContext *context) {
   case READ_BUSY:
     // there is still more to read off of the client request, for now go
     // back onto the event loop
+    client_await_request(request_context);
     return;
   }
 }
 
-void client_handle_write(SocketContext *context) {
+/**
+ * Writes as much of the response as the socket takes. The first attempt is
+ * made as soon as the response is ready, which nearly always writes all of
+ * it. Only the rest of a response that did not fit waits for the socket to
+ * become writable.
+ */
+static void write_response(SocketContext *context, bool first_attempt) {
   RequestContext *request_context = (RequestContext*) context->data.ptr;
     
   per_request_record_start(&request_context->time_stats, CLIENT_WRITE_TIME);
@@ -108,13 +379,20 @@ void client_handle_write(SocketContext *context) {
   switch (state) {
   case WRITE_BUSY:
     LOG_DEBUG("client write socket busy");
+    if (first_attempt) {
+      /* only a client that stops reading can hold the response, and the
+       * values lent to it, from here on. */
+      server_stats_incr_deferred_writes(context->server->server_stats);
+      connection_table_set_timeout(context->epoll_info->connections, request_context,
+				   TIMEOUT_WRITE);
+    }
     return;
   case WRITE_ERROR:
     LOG_WARN("Error while writing response to client");
     client_close_connection(context, REQUEST_WRITE_ERROR);
     return;
   case WRITE_FINISH:
-    if (context_keep_alive(request_context) == 1) {
+    if (request_context->keep_alive == 1) {
       client_reset_connection(context, REQUEST_SUCCESS);
     } else {
       client_close_connection(context, REQUEST_SUCCESS);
@@ -123,7 +401,55 @@ void client_handle_write(SocketContext *context) {
   }
 }
 
+void client_handle_write(SocketContext *context) {
+  RequestContext *request_context = (RequestContext*) context->data.ptr;
+  if (request_context->state != CONNECTION_WRITING) {
+    return;
+  }
+  write_response(context, false);
+}
+
+void client_handle_event(SocketContext *context) {
+  RequestContext *request_context = (RequestContext*) context->data.ptr;
+
+  /* the connection can be closed by a timeout or a reply earlier in the
+   * same round of events. */
+  if (request_context->fd == -1) {
+    return;
+  }
+  switch (request_context->state) {
+  case CONNECTION_READING:
+    client_handle_read(context);
+    return;
+  case CONNECTION_WRITING:
+    client_handle_write(context);
+    return;
+  case CONNECTION_PROCESSING:
+    return;
+  }
+}
+
+void client_handle_reply(RequestContext *request_context) {
+  SocketContext *context = request_context->socket_context;
+  RequestContext *connection = client_finish_request(context->server, request_context);
+  if (connection == NULL) {
+    return;
+  }
+
+  /* the socket is written to right away instead of waiting for an event,
+   * the edge-triggered registration reports when it is writable again. */
+  connection->state = CONNECTION_WRITING;
+  write_response(context, true);
+}
+
 void client_handle_error(SocketContext *context, uint32_t events) {
+  RequestContext *request_context = (RequestContext*) context->data.ptr;
+
+  /* the actors still have the request, so the connection is closed once
+   * writing the response to it fails. */
+  if (request_context->fd == -1 || request_context->state == CONNECTION_PROCESSING) {
+    return;
+  }
 
   if (events & EPOLLERR) {
     LOG_DEBUG("Error due to read size of socket closing");
@@ -140,7 +466,6 @@ void client_handle_error(SocketContext *context, uint32_t events) {
 
 void client_reset_connection(SocketContext *context, enum RequestResult result) {
   Server *server = context->server;
-  EpollInfo *epoll_info = context->epoll_info;
   RequestContext *request_context = context->data.ptr;
 
   // log the timestamp at which the request is done
@@ -153,18 +478,18 @@ void client_reset_connection(SocketContext *context, enum RequestResult result)
   context_finalize_reset(request_context, result);
 
   per_request_record_start(&request_context->time_stats, TOTAL_TIME);
+  connection_table_set_timeout(context->epoll_info->connections, request_context,
+			       TIMEOUT_KEEP_ALIVE);
 
-  /* resets the context to start accept input from client again. */
-  context->input_handler = client_handle_read;
-  context->output_handler = NULL;
-  context->error_handler = client_handle_error;
-
-  mod_input_epoll_event(epoll_info, request_context->fd, context);
+  /* the registration is edge-triggered, so the data that arrived since the
+   * last read would not cause another event. The requests that were
+   * pipelined past the last batch are still in the input buffer. */
+  request_context->state = CONNECTION_READING;
+  client_handle_read(context);
 }
 
 void client_close_connection(SocketContext *context, enum RequestResult result) {
   Server *server = context->server;
-  EpollInfo *epoll_info = context->epoll_info;
   RequestContext *request_context = (RequestContext*) context->data.ptr;
 
   // log the timestamp at which the request is done
@@ -173,10 +498,9 @@ void client_close_connection(SocketContext *context, enum RequestResult result)
   server_stats_decr_active_requests(server->server_stats);
   server_stats_incr_total_requests(server->server_stats);
   server_stats_record_request(server->server_stats, &request_context->time_stats);
-  
-  delete_epoll_event(epoll_info, request_context->fd);
 
-  // finishes up the request
-  context_finalize_destroy(request_context, result);
-  free(context);
+  // finishes up the request, closing the socket also removes it from the
+  // event loop. The socket context stays with the request context for the
+  // next connection on the same file descriptor.
+  connection_table_close(context->epoll_info->connections, request_context, result);
 }
@@ -13,13 +13,76 @@
  */
 void client_handle_read(SocketContext *context);
 
+/* the most pipelined requests of a connection that are worked on at once. */
+#define PIPELINE_MAX_REQUESTS 32
+
+/**
+ * Sends the request that was read in completely on the connection to the
+ * actors that have to answer it, together with every complete request that
+ * was pipelined behind it. The requests are collected per actor till the
+ * next client_flush_requests. The contexts must not be touched afterwards,
+ * they are handed back once their responses are ready.
+ *
+ * A request whose body is too large is answered with a 413 by the worker
+ * itself, and handed back by the next client_flush_requests.
+ */
+void client_dispatch_request(Server *server, EpollInfo *epoll_info,
+			     RequestContext *connection);
+
+/**
+ * Hands a request that the worker answered itself back to the worker, like
+ * the ones that the actors are done with.
+ */
+typedef void (*ReplyHandler) (void *data, RequestContext *request_context);
+
+/**
+ * Pushes the requests that were collected for the actors since the last
+ * flush onto their input queues, all of the requests for an actor at once.
+ * Has to be called before the worker waits for new events.
+ *
+ * The requests for an actor whose queue is full wait in the worker till
+ * the actor made room, while their connections are not read from. With
+ * reject_overload they are answered with a 503 instead and handed to the
+ * reply handler, except for scans, which always wait. The requests that
+ * were refused since the last flush are handed to it as well.
+ */
+void client_flush_requests(Server *server, EpollInfo *epoll_info, ReplyHandler reply,
+			   void *data);
+
+/**
+ * Puts the connection under the timeout of whatever it is waiting for after
+ * a read that did not complete a request: the headers, the rest of the
+ * body, or, when nothing of the next request was read yet, whatever it
+ * waited for before.
+ */
+void client_await_request(RequestContext *connection);
+
+/**
+ * Takes back a request that the actors are done with. Once the actors are
+ * done with every request of the batch, the responses are put together in
+ * order in the output buffer of the connection, which is returned. Returns
+ * NULL while the batch is not done yet.
+ */
+RequestContext *client_finish_request(Server *server, RequestContext *request_context);
+
 /**
- * Writes out as much as possible out to the active connection. Returns true if
- * the entire response was written out, false if epoll needs to be used to 
- * finish writing out the response.
+ * Writes out the rest of a response that did not fit in the socket, once
+ * epoll reports that the socket is writable again.
  */
 void client_handle_write(SocketContext *context);
 
+/**
+ * Called for every input and output event of a connection. Depending on
+ * the state of the connection it either reads or writes.
+ */
+void client_handle_event(SocketContext *context);
+
+/**
+ * Writes out the response to a request that the actors are done with right
+ * away, without waiting for epoll to report that the socket is writable.
+ */
+void client_handle_reply(RequestContext *request_context);
+
 void client_handle_error(SocketContext *context, uint32_t events);
 
 /**
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#include "config.h"
+#include "logging.h"
+
+/* the options that only have a long name. */
+enum LongOption {
+  OPTION_HEADER_TIMEOUT = 256,
+  OPTION_BODY_TIMEOUT,
+  OPTION_KEEP_ALIVE_TIMEOUT,
+  OPTION_WRITE_TIMEOUT,
+  OPTION_REJECT_OVERLOAD,
+};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+	  "usage: %s [options] [io_worker_count port]\n"
+	  "  -d, --data-dir=DIR     write a log of every change to DIR so the data\n"
+	  "                         survives a restart\n"
+	  "  -s, --snapshot-interval=SECONDS\n"
+	  "                         write a snapshot of the data every SECONDS so\n"
+	  "                         a restart does not replay the whole log\n"
+	  "                         (default 300, 0 disables snapshots)\n"
+	  "  -m, --actor-memory=MIB evict keys once the data of an actor uses more\n"
+	  "                         than MIB, the default of 0 means no limit\n"
+	  "  -o, --ordered-index    keep the keys of every actor in order so that\n"
+	  "                         ranges of keys can be scanned\n"
+	  "  -e, --io-engine=NAME   what the IO workers wait on, epoll (default) or\n"
+	  "                         uring, which falls back to epoll when io_uring\n"
+	  "                         is not available\n"
+	  "  -c, --io-cores=LIST    pin the IO workers to the cores in LIST, one for\n"
+	  "                         each worker, like 0,2,4-5, and steer every\n"
+	  "                         connection to the worker on the core that\n"
+	  "                         received it\n"
+	  "  -b, --busy-poll=MICROS keep polling for new events for MICROS before\n"
+	  "                         sleeping, trading CPU time for latency\n"
+	  "                         (default 0, which always sleeps)\n"
+	  "      --header-timeout=SECONDS\n"
+	  "                         close connections that take longer to send the\n"
+	  "                         headers of a request (default 10)\n"
+	  "      --body-timeout=SECONDS\n"
+	  "                         close connections that take longer to send the\n"
+	  "                         body of a request (default 30)\n"
+	  "      --keep-alive-timeout=SECONDS\n"
+	  "                         close connections that send no new request for\n"
+	  "                         SECONDS (default 60)\n"
+	  "      --write-timeout=SECONDS\n"
+	  "                         close connections that take longer to read a\n"
+	  "                         response (default 30), a timeout of 0 is off\n"
+	  "      --reject-overload  answer requests for an actor that is too far\n"
+	  "                         behind with a 503, instead of waiting for it\n"
+	  "  -h, --help             print this message\n",
+	  name);
+}
+
+/**
+ * Parses a list of cores, given as single cores or ranges of them separated
+ * by commas. Returns 0 if the list is invalid.
+ */
+static int parse_cores(ServerConfig *config, const char *list) {
+  int capacity = 8;
+  config->io_cores = (int*) CHECK_MEM(malloc((size_t) capacity * sizeof(int)));
+  config->io_core_count = 0;
+
+  const char *cursor = list;
+  while (1) {
+    char *end;
+    long first = strtol(cursor, &end, 10);
+    long last = first;
+    if (end == cursor || first < 0) {
+      return 0;
+    }
+    if (*end == '-') {
+      cursor = end + 1;
+      last = strtol(cursor, &end, 10);
+      if (end == cursor || last < first) {
+	return 0;
+      }
+    }
+    /* the cores that can be pinned to are the ones the machine has. */
+    if (last >= CPU_SETSIZE || last >= get_nprocs_conf()) {
+      return 0;
+    }
+
+    for (long core = first ; core <= last ; core++) {
+      if (config->io_core_count == capacity) {
+	capacity <<= 1;
+	config->io_cores = (int*) CHECK_MEM(realloc(config->io_cores,
+						    (size_t) capacity * sizeof(int)));
+      }
+      config->io_cores[config->io_core_count++] = (int) core;
+    }
+
+    if (*end == '\0') {
+      return 1;
+    }
+    if (*end != ',') {
+      return 0;
+    }
+    cursor = end + 1;
+  }
+}
+
+void config_parse(ServerConfig *config, int argc, char *argv[]) {
+  config->io_worker_count = 2;
+  config->port = 8080;
+  config->data_dir = NULL;
+  config->snapshot_interval = 300;
+  config->actor_memory = 0;
+  config->ordered_index = 0;
+  config->io_engine = IO_ENGINE_EPOLL;
+  config->io_cores = NULL;
+  config->io_core_count = 0;
+  config->busy_poll = 0;
+  config->header_timeout = 10;
+  config->body_timeout = 30;
+  config->keep_alive_timeout = 60;
+  config->write_timeout = 30;
+  config->reject_overload = 0;
+
+  static struct option options[] = {
+    { "data-dir", required_argument, NULL, 'd' },
+    { "snapshot-interval", required_argument, NULL, 's' },
+    { "actor-memory", required_argument, NULL, 'm' },
+    { "ordered-index", no_argument, NULL, 'o' },
+    { "io-engine", required_argument, NULL, 'e' },
+    { "io-cores", required_argument, NULL, 'c' },
+    { "busy-poll", required_argument, NULL, 'b' },
+    { "header-timeout", required_argument, NULL, OPTION_HEADER_TIMEOUT },
+    { "body-timeout", required_argument, NULL, OPTION_BODY_TIMEOUT },
+    { "keep-alive-timeout", required_argument, NULL, OPTION_KEEP_ALIVE_TIMEOUT },
+    { "write-timeout", required_argument, NULL, OPTION_WRITE_TIMEOUT },
+    { "reject-overload", no_argument, NULL, OPTION_REJECT_OVERLOAD },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "d:s:m:oe:c:b:h", options, NULL)) != -1) {
+    switch (opt) {
+    case 'd':
+      config->data_dir = optarg;
+      break;
+    case 's':
+      config->snapshot_interval = atoi(optarg);
+      break;
+    case 'm':
+      config->actor_memory = atol(optarg);
+      break;
+    case 'o':
+      config->ordered_index = 1;
+      break;
+    case 'e':
+      if (strcmp(optarg, "epoll") == 0) {
+	config->io_engine = IO_ENGINE_EPOLL;
+      } else if (strcmp(optarg, "uring") == 0) {
+	config->io_engine = IO_ENGINE_URING;
+      } else {
+	usage(argv[0]);
+	exit(EXIT_FAILURE);
+      }
+      break;
+    case 'c':
+      if (!parse_cores(config, optarg)) {
+	usage(argv[0]);
+	exit(EXIT_FAILURE);
+      }
+      break;
+    case 'b':
+      config->busy_poll = atoi(optarg);
+      break;
+    case OPTION_HEADER_TIMEOUT:
+      config->header_timeout = atoi(optarg);
+      break;
+    case OPTION_BODY_TIMEOUT:
+      config->body_timeout = atoi(optarg);
+      break;
+    case OPTION_KEEP_ALIVE_TIMEOUT:
+      config->keep_alive_timeout = atoi(optarg);
+      break;
+    case OPTION_WRITE_TIMEOUT:
+      config->write_timeout = atoi(optarg);
+      break;
+    case OPTION_REJECT_OVERLOAD:
+      config->reject_overload = 1;
+      break;
+    case 'h':
+      usage(argv[0]);
+      exit(EXIT_SUCCESS);
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (argc - optind == 2) {
+    config->io_worker_count = atoi(argv[optind]);
+    config->port = (uint16_t) atoi(argv[optind + 1]);
+  } else if (argc != optind) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  CHECK(config->io_worker_count <= 0, "Invalid amount of IO workers: %d",
+	config->io_worker_count);
+  CHECK(config->snapshot_interval < 0, "Invalid snapshot interval: %d",
+	config->snapshot_interval);
+  CHECK(config->actor_memory < 0, "Invalid actor memory: %ld", config->actor_memory);
+  CHECK(config->header_timeout < 0 || config->body_timeout < 0
+	|| config->keep_alive_timeout < 0 || config->write_timeout < 0,
+	"Invalid timeout: %d/%d/%d/%d", config->header_timeout, config->body_timeout,
+	config->keep_alive_timeout, config->write_timeout);
+  CHECK(config->busy_poll < 0, "Invalid busy poll time: %d", config->busy_poll);
+  CHECK(config->io_cores != NULL && config->io_core_count != config->io_worker_count,
+	"Expected a core for each of the %d IO workers, got %d",
+	config->io_worker_count, config->io_core_count);
+}
@@ -0,0 +1,68 @@
+#ifndef __config_h__
+#define __config_h__
+
+#include <stdint.h>
+
+/* the ways in which the IO workers can wait for their sockets. */
+enum IoEngine {
+  IO_ENGINE_EPOLL,
+  IO_ENGINE_URING,
+};
+
+/**
+ * The settings of the server that are given on the command line.
+ */
+typedef struct ServerConfig {
+  /* the number of threads used to read/write client requests. */
+  int io_worker_count;
+
+  /* the port that the server listens on. */
+  uint16_t port;
+
+  /* the directory that the actors write their logs to. Durability is
+   * disabled when this is NULL. */
+  const char *data_dir;
+
+  /* the amount of seconds between two snapshots of each actor's data, 0
+   * disables snapshots. Only used when there is a data directory. */
+  int snapshot_interval;
+
+  /* the most memory in MiB that the data of each actor may use before
+   * keys are evicted, 0 if there is no limit. */
+  long actor_memory;
+
+  /* 1 when every actor keeps its keys in order, which scans need. */
+  int ordered_index;
+
+  /* what the IO workers use to wait for their sockets. */
+  enum IoEngine io_engine;
+
+  /* the core that every IO worker is pinned to, NULL when the workers are
+   * not pinned. Holds a core for every IO worker. */
+  int *io_cores;
+  int io_core_count;
+
+  /* the amount of microseconds that the IO workers and the actors keep
+   * polling for new events before they go to sleep, 0 to always sleep. */
+  int busy_poll;
+
+  /* the seconds that a connection gets to send the headers of a request,
+   * the rest of its body, and the next request after a response, and to
+   * read a response, 0 to wait forever. */
+  int header_timeout;
+  int body_timeout;
+  int keep_alive_timeout;
+  int write_timeout;
+
+  /* 1 when a request for an actor whose queue is full is answered with a
+   * 503 right away, instead of waiting till the actor makes room. */
+  int reject_overload;
+} ServerConfig;
+
+/**
+ * Fills in the config from the command line arguments, using the defaults
+ * for anything that was not given. Exits the process on invalid arguments.
+ */
+void config_parse(ServerConfig *config, int argc, char *argv[]);
+
+#endif
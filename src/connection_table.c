@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "connection_table.h"
+#include "logging.h"
+#include "request_context.h"
+#include "timer_wheel.h"
+
+static uint64_t current_tick(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000) / TIMEOUT_TICK_MS;
+}
+
+ConnectionTable *connection_table_init(size_t capacity) {
+  ConnectionTable *table = (ConnectionTable*) CHECK_MEM(calloc(1, sizeof(ConnectionTable)));
+  table->connections = (RequestContext**) CHECK_MEM(calloc(capacity, sizeof(RequestContext*)));
+  table->capacity = capacity;
+  table->free_requests = NULL;
+  table->allocations = 0;
+  table->timers = timer_wheel_init(current_tick());
+  memset(table->timeouts, 0, sizeof(table->timeouts));
+  table->timer_fd = -1;
+  return table;
+}
+
+void connection_table_destroy(ConnectionTable *table) {
+  for (size_t i = 0 ; i < table->capacity ; i++) {
+    if (table->connections[i] != NULL) {
+      context_destroy(table->connections[i]);
+    }
+  }
+  while (table->free_requests != NULL) {
+    RequestContext *next_request = table->free_requests->next_request;
+    context_destroy(table->free_requests);
+    table->free_requests = next_request;
+  }
+  if (table->timer_fd != -1) {
+    close(table->timer_fd);
+  }
+  timer_wheel_destroy(table->timers);
+  free(table->connections);
+  free(table);
+}
+
+/**
+ * Makes room for the given file descriptor, doubling the capacity.
+ */
+static void grow(ConnectionTable *table, size_t fd) {
+  size_t capacity = table->capacity;
+  while (capacity <= fd) {
+    capacity *= 2;
+  }
+  table->connections =
+    (RequestContext**) CHECK_MEM(realloc(table->connections, capacity * sizeof(RequestContext*)));
+  memset(table->connections + table->capacity, 0,
+	 (capacity - table->capacity) * sizeof(RequestContext*));
+  table->capacity = capacity;
+}
+
+RequestContext *connection_table_open(ConnectionTable *table, int fd,
+				      EpollInfo *epoll_info) {
+  if ((size_t) fd >= table->capacity) {
+    grow(table, (size_t) fd);
+  }
+
+  RequestContext *context = table->connections[fd];
+  if (context == NULL) {
+    context = init_request_context(fd, epoll_info);
+    table->connections[fd] = context;
+    table->allocations++;
+  } else {
+    context_open(context, fd, epoll_info);
+  }
+  return context;
+}
+
+RequestContext *connection_table_get(ConnectionTable *table, int fd) {
+  if (fd < 0 || (size_t) fd >= table->capacity) {
+    return NULL;
+  }
+  RequestContext *context = table->connections[fd];
+  if (context == NULL || context->fd != fd) {
+    return NULL;
+  }
+  return context;
+}
+
+void connection_table_close(ConnectionTable *table, RequestContext *connection,
+			    enum RequestResult result) {
+  if (connection->timer.next != NULL) {
+    timer_wheel_remove(table->timers, &connection->timer);
+  }
+  connection->timeout = TIMEOUT_NONE;
+  context_finalize_close(connection, result);
+}
+
+RequestContext *connection_table_add_request(ConnectionTable *table,
+					     RequestContext *connection) {
+  RequestContext *context = table->free_requests;
+  if (context == NULL) {
+    table->allocations++;
+    return init_pipelined_context(connection);
+  }
+
+  table->free_requests = context->next_request;
+  context_open_pipelined(context, connection);
+  return context;
+}
+
+void connection_table_remove_request(ConnectionTable *table,
+				     RequestContext *request_context,
+				     enum RequestResult result) {
+  context_finalize_pipelined(request_context, result);
+  request_context->next_request = table->free_requests;
+  table->free_requests = request_context;
+}
+
+static inline uint64_t seconds_to_ticks(int seconds) {
+  return (uint64_t) seconds * 1000 / TIMEOUT_TICK_MS;
+}
+
+void connection_table_set_timeouts(ConnectionTable *table, int header_timeout,
+				   int body_timeout, int keep_alive_timeout,
+				   int write_timeout) {
+  table->timeouts[TIMEOUT_HEADER] = seconds_to_ticks(header_timeout);
+  table->timeouts[TIMEOUT_BODY] = seconds_to_ticks(body_timeout);
+  table->timeouts[TIMEOUT_KEEP_ALIVE] = seconds_to_ticks(keep_alive_timeout);
+  table->timeouts[TIMEOUT_WRITE] = seconds_to_ticks(write_timeout);
+  if (table->timer_fd != -1 || (header_timeout == 0 && body_timeout == 0
+				&& keep_alive_timeout == 0 && write_timeout == 0)) {
+    return;
+  }
+
+  table->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  CHECK(table->timer_fd == -1, "Failed to create timeout timer");
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_nsec = TIMEOUT_TICK_MS * 1000000L;
+  spec.it_interval.tv_nsec = TIMEOUT_TICK_MS * 1000000L;
+  int r = timerfd_settime(table->timer_fd, 0, &spec, NULL);
+  CHECK(r != 0, "Failed to arm timeout timer");
+}
+
+void connection_table_set_timeout(ConnectionTable *table, RequestContext *connection,
+				  enum ConnectionTimeout timeout) {
+  if (connection->timeout == timeout || connection->timeout == TIMEOUT_EXPIRED) {
+    return;
+  }
+
+  if (connection->timer.next != NULL) {
+    timer_wheel_remove(table->timers, &connection->timer);
+  }
+  connection->timeout = timeout;
+  if (table->timeouts[timeout] > 0) {
+    timer_wheel_add(table->timers, &connection->timer,
+		    current_tick() + table->timeouts[timeout]);
+  }
+}
+
+uint64_t connection_table_tick(ConnectionTable *table) {
+  uint64_t expirations;
+  ssize_t r = read(table->timer_fd, &expirations, sizeof(expirations));
+  CHECK(r == -1 && errno != EAGAIN, "Failed to read timeout timer");
+  return current_tick();
+}
+
+RequestContext *connection_table_expire(ConnectionTable *table, uint64_t now) {
+  TimerNode *node = timer_wheel_expire(table->timers, now);
+  if (node == NULL) {
+    return NULL;
+  }
+
+  RequestContext *connection = TIMER_NODE_ENTRY(node, RequestContext, timer);
+  connection->timeout = TIMEOUT_EXPIRED;
+  return connection;
+}
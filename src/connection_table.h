@@ -0,0 +1,126 @@
+#ifndef __connection_table_h__
+#define __connection_table_h__
+
+#include <stddef.h>
+
+#include "epoll_info.h"
+#include "request_context.h"
+
+/**
+ * Keeps the contexts of the connections of an IO worker around, so that a
+ * worker that is busy does not allocate anything per connection or request.
+ *
+ * The contexts of the connections are indexed by their file descriptor.
+ * Once a connection is closed, its context stays in the table, along with
+ * its buffers and socket context, and is opened again by the next
+ * connection that gets the same file descriptor. As the kernel hands out
+ * the lowest free descriptor, the table stays about as large as the most
+ * connections that were open at once.
+ *
+ * The contexts of pipelined requests are kept on a free list instead. Only
+ * the thread of the worker touches the table.
+ *
+ * The table also enforces how long a connection may take to send the
+ * headers and the body of a request, and how long it may stay idle between
+ * requests. The timer of every connection is embedded in its context and
+ * kept in a timing wheel that is advanced by a timer file descriptor, which
+ * the worker waits on along with its sockets. A timer is only moved when
+ * the connection starts waiting for something else, not on every read.
+ */
+
+/* the amount of file descriptors the table has room for at first. */
+#define CONNECTION_TABLE_SIZE 1024
+
+/* the milliseconds in a tick of the wheel of the timeouts. */
+#define TIMEOUT_TICK_MS 100
+
+typedef struct ConnectionTable {
+  /* the context of every file descriptor that a connection was opened on,
+   * NULL for the others. */
+  RequestContext **connections;
+  size_t capacity;
+
+  /* the contexts of the pipelined requests that are done, linked through
+   * their next_request. */
+  RequestContext *free_requests;
+
+  /* the amount of contexts that had to be allocated. */
+  size_t allocations;
+
+  /* the timers of the connections that wait under a timeout, and the
+   * length of every kind of timeout in ticks, 0 if it is disabled. */
+  TimerWheel *timers;
+  uint64_t timeouts[TIMEOUT_EXPIRED];
+
+  /* fires every tick while any timeout is enabled, -1 otherwise. */
+  int timer_fd;
+} ConnectionTable;
+
+ConnectionTable *connection_table_init(size_t capacity);
+
+/**
+ * Frees the table and every context in it. The connections must be closed.
+ */
+void connection_table_destroy(ConnectionTable *table);
+
+/**
+ * Returns the context for a new connection on the given file descriptor,
+ * reusing the one of the last connection on it.
+ */
+RequestContext *connection_table_open(ConnectionTable *table, int fd,
+				      EpollInfo *epoll_info);
+
+/**
+ * Returns the context of the open connection on the given file descriptor,
+ * or NULL if there is none.
+ */
+RequestContext *connection_table_get(ConnectionTable *table, int fd);
+
+/**
+ * Closes the connection, keeping its context for the next one.
+ */
+void connection_table_close(ConnectionTable *table, RequestContext *connection,
+			    enum RequestResult result);
+
+/**
+ * Returns a context for a request that was pipelined on the connection.
+ */
+RequestContext *connection_table_add_request(ConnectionTable *table,
+					     RequestContext *connection);
+
+/**
+ * Finishes a pipelined request and keeps its context for the next one.
+ */
+void connection_table_remove_request(ConnectionTable *table,
+				     RequestContext *request_context,
+				     enum RequestResult result);
+
+/**
+ * Sets the length of the timeouts in seconds, 0 disables a timeout. Creates
+ * the timer file descriptor when any of them is enabled.
+ */
+void connection_table_set_timeouts(ConnectionTable *table, int header_timeout,
+				   int body_timeout, int keep_alive_timeout,
+				   int write_timeout);
+
+/**
+ * Puts the connection under the given timeout, which starts counting now.
+ * Nothing changes if the connection is already under it.
+ */
+void connection_table_set_timeout(ConnectionTable *table, RequestContext *connection,
+				  enum ConnectionTimeout timeout);
+
+/**
+ * Reads the timer file descriptor after it fired, and returns the current
+ * tick.
+ */
+uint64_t connection_table_tick(ConnectionTable *table);
+
+/**
+ * Returns the next connection whose timeout passed by the given tick, or
+ * NULL once there are no more. The connection is marked as expired, the
+ * caller has to close it.
+ */
+RequestContext *connection_table_expire(ConnectionTable *table, uint64_t now);
+
+#endif
@@ -7,6 +7,17 @@
 
 #include "epoll_info.h"
 #include "logging.h"
+#include "queue.h"
+
+/* only the thread that owns the event loop changes the counters. */
+static inline void count(atomic_long *counter) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+			memory_order_relaxed);
+}
+
+static inline void count_ctl(EpollInfo *epoll) {
+  count(&epoll->ctl_count);
+}
 
 EpollInfo *epoll_info_init(const char *name, int id) {
   EpollInfo *epoll_info = (EpollInfo*) CHECK_MEM(calloc(1, sizeof(EpollInfo)));
@@ -15,6 +26,15 @@ EpollInfo *epoll_info_init(const char *name, int id) {
   epoll_info->epoll_fd = epoll_fd;
   epoll_info->name = name;
   epoll_info->id = id;
+  epoll_info->reply_queues = NULL;
+  epoll_info->reply_queue_count = 0;
+  epoll_info->queues = NULL;
+  epoll_info->queue_count = 0;
+  epoll_info->connections = NULL;
+  epoll_info->ctl_count = ATOMIC_VAR_INIT(0);
+  epoll_info->busy_poll = 0;
+  epoll_info->spin_wakeups = ATOMIC_VAR_INIT(0);
+  epoll_info->sleep_wakeups = ATOMIC_VAR_INIT(0);
   return epoll_info;
 }
 
@@ -23,6 +43,72 @@ void epoll_info_destroy(EpollInfo *epoll_info) {
   free(epoll_info);
 }
 
+void epoll_info_set_queues(EpollInfo *epoll, Queue **queues, int queue_count) {
+  epoll->queues = queues;
+  epoll->queue_count = queue_count;
+  for (int i = 0 ; i < queue_count ; i++) {
+    queue_ring_on_demand(queues[i]);
+  }
+}
+
+int epoll_info_queues_pending(EpollInfo *epoll) {
+  for (int i = 0 ; i < epoll->queue_count ; i++) {
+    if (queue_size(epoll->queues[i]) > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int epoll_info_prepare_sleep(EpollInfo *epoll) {
+  for (int i = 0 ; i < epoll->queue_count ; i++) {
+    if (queue_prepare_sleep(epoll->queues[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int epoll_info_keep_polling(EpollInfo *epoll, struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long micros = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+  return micros < epoll->busy_poll;
+}
+
+void epoll_info_count_wakeup(EpollInfo *epoll, int slept) {
+  count(slept ? &epoll->sleep_wakeups : &epoll->spin_wakeups);
+}
+
+int epoll_info_wait(EpollInfo *epoll, struct epoll_event *events, int max_events,
+		    int timeout) {
+  if (timeout != 0 && epoll->busy_poll > 0) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+      int ready_amount = epoll_wait(epoll->epoll_fd, events, max_events, 0);
+      if (ready_amount != 0 || epoll_info_queues_pending(epoll)) {
+	if (ready_amount >= 0) {
+	  epoll_info_count_wakeup(epoll, 0);
+	}
+	return ready_amount;
+      }
+    } while (epoll_info_keep_polling(epoll, &start));
+  }
+
+  /* the messages that were pushed before the announcement did not notify
+   * the loop, so it must not sleep while there are any. */
+  if (timeout != 0 && epoll_info_prepare_sleep(epoll)) {
+    return 0;
+  }
+
+  int ready_amount = epoll_wait(epoll->epoll_fd, events, max_events, timeout);
+  if (ready_amount > 0 && timeout != 0) {
+    epoll_info_count_wakeup(epoll, 1);
+  }
+  return ready_amount;
+}
+
 void add_input_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
   struct epoll_event event;
   memset(&event, 0, sizeof(event));
@@ -32,6 +118,31 @@ void add_input_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
   LOG_DEBUG("Add input event on %s for fd=%d", epoll->name, fd);
   int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_ADD, fd, &event);
   CHECK(r == -1, "Failed to add input epoll event for %s", epoll->name);
+  count_ctl(epoll);
+}
+
+void add_exclusive_input_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLEXCLUSIVE;
+  event.data.ptr = ptr;
+
+  LOG_DEBUG("Add exclusive input event on %s for fd=%d", epoll->name, fd);
+  int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  CHECK(r == -1, "Failed to add exclusive input epoll event for %s", epoll->name);
+  count_ctl(epoll);
+}
+
+void add_connection_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLERR | EPOLLRDHUP | EPOLLHUP | EPOLLPRI;
+  event.data.ptr = ptr;
+
+  LOG_DEBUG("Add connection event on %s for fd=%d", epoll->name, fd);
+  int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  CHECK(r == -1, "Failed to add connection epoll event for %s", epoll->name);
+  count_ctl(epoll);
 }
 
 void add_output_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
@@ -43,6 +154,7 @@ void add_output_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
   LOG_DEBUG("Add output event on %s for fd=%d", epoll->name, fd);
   int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_ADD, fd, &event);
   CHECK(r == -1, "Failed to add output epoll event for %s", epoll->name);
+  count_ctl(epoll);
 }
 
 void mod_input_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
@@ -54,6 +166,7 @@ void mod_input_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
   LOG_DEBUG("Modify input event on %s for fd=%d", epoll->name, fd);
   int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_MOD, fd, &event);
   CHECK(r == -1, "Failed to modify input epoll event for %s", epoll->name);
+  count_ctl(epoll);
 }
 
 void mod_output_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
@@ -65,6 +178,7 @@ void mod_output_epoll_event(EpollInfo *epoll, int fd, void *ptr) {
   LOG_DEBUG("Modify output event on %s for fd=%d", epoll->name, fd);
   int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_MOD, fd, &event);
   CHECK(r == -1, "Failed to modify output event for %s", epoll->name);
+  count_ctl(epoll);
 }
 
 void delete_epoll_event(EpollInfo *epoll, int fd) {
@@ -73,5 +187,6 @@ void delete_epoll_event(EpollInfo *epoll, int fd) {
   LOG_DEBUG("Delete event on %s for fd=%d", epoll->name, fd);
   int r = epoll_ctl(epoll->epoll_fd, EPOLL_CTL_DEL, fd, &event);
   CHECK(r == -1, "Failed to delete event for %s", epoll->name);
+  count_ctl(epoll);
 }
 
@@ -1,8 +1,10 @@
 #ifndef __epoll_info_h__
 #define __epoll_info_h__
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <sys/epoll.h>
+#include <time.h>
 
 typedef struct EpollInfo {
   /* The file descriptor that is used to run the epoll event loop */
@@ -11,6 +13,43 @@ typedef struct EpollInfo {
   const char *name;
 
   int id;
+
+  /* the requests that the actors are done with, with a queue for every
+   * actor so that each has a single reader and a single writer. NULL for
+   * event loops that are not IO workers. */
+  struct Queue **reply_queues;
+  int reply_queue_count;
+
+  /* the requests that an IO worker read since it last handed them to the
+   * actors, with a batch for every actor. NULL for the other event loops. */
+  struct RequestBatch *request_batches;
+
+  /* the requests that the worker answers itself, as the queue of their
+   * actor was full or they were too large. NULL for the other event
+   * loops. */
+  struct RequestBatch *rejected_requests;
+
+  /* the contexts of the connections of an IO worker, NULL for the other
+   * event loops. */
+  struct ConnectionTable *connections;
+
+  /* the queues that the event loop reads every time it wakes up, which
+   * only notify it once it is about to go to sleep. */
+  struct Queue **queues;
+  int queue_count;
+
+  /* the amount of epoll_ctl calls made on the event loop, read by the
+   * stats thread. */
+  atomic_long ctl_count;
+
+  /* the amount of microseconds to keep polling for new events before
+   * going to sleep, 0 to always sleep. */
+  long busy_poll;
+
+  /* the amount of waits that found events while polling and the amount
+   * that had to go to sleep, read by the stats thread. */
+  atomic_long spin_wakeups;
+  atomic_long sleep_wakeups;
   
 } EpollInfo;
 
@@ -22,6 +61,44 @@ EpollInfo *epoll_info_init(const char *name, int id);
 
 void epoll_info_destroy(EpollInfo *epoll_info);
 
+/**
+ * Waits for events like epoll_wait. With busy polling, the events are
+ * polled for without sleeping for up to busy_poll microseconds first.
+ * Returns 0 without sleeping when any of the queues of the event loop has
+ * messages, which the caller has to check for after every wait.
+ */
+int epoll_info_wait(EpollInfo *epoll, struct epoll_event *events, int max_events,
+		    int timeout);
+
+/**
+ * Makes the queues of the event loop only notify it when it sleeps. The
+ * loop has to read the queues every time it wakes up.
+ */
+void epoll_info_set_queues(EpollInfo *epoll, struct Queue **queues, int queue_count);
+
+/**
+ * Returns 1 if any of the queues of the event loop has messages.
+ */
+int epoll_info_queues_pending(EpollInfo *epoll);
+
+/**
+ * Announces to the queues of the event loop that it is about to sleep.
+ * Returns 1 if any of them has messages, in which case the loop must not go
+ * to sleep.
+ */
+int epoll_info_prepare_sleep(EpollInfo *epoll);
+
+/**
+ * Returns 1 while a busy poll that started at the given time has time left.
+ */
+int epoll_info_keep_polling(EpollInfo *epoll, struct timespec *start);
+
+/**
+ * Counts a wait that ended in events, with slept set when it had to go to
+ * sleep for them.
+ */
+void epoll_info_count_wakeup(EpollInfo *epoll, int slept);
+
 /**
  * Checks to see if the given epoll event contains an error.
  */
@@ -33,6 +110,20 @@ enum EpollError check_epoll_errors(EpollInfo *epoll, struct epoll_event *event);
  */ 
 void add_input_epoll_event(EpollInfo *epoll, int fd, void *ptr);
 
+/**
+ * Registers a file descriptor that the event loops of several threads wait
+ * on, of which only one is woken up when it is ready.
+ */
+void add_exclusive_input_epoll_event(EpollInfo *epoll, int fd, void *ptr);
+
+/**
+ * Registers a client connection for its whole lifetime. The registration is
+ * edge-triggered for both input and output, so it never has to change: the
+ * handlers are told about every new chance to read or write, and have to
+ * keep going till the socket would block.
+ */
+void add_connection_epoll_event(EpollInfo *epoll, int fd, void *ptr);
+
 /**
  * Registers the given file descriptor to start accepting write requests. 
  * Adds the given pointer to the event.
@@ -0,0 +1,41 @@
+#ifndef __hash_h__
+#define __hash_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Hashes an arbitrary sequence of bytes into 64 bits. The function consumes
+ * 8 bytes per step and finishes with an avalanche step so that both the high
+ * and low bits of the result are well distributed.
+ */
+static inline uint64_t hash_bytes(const void *data, size_t len) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const unsigned char *bytes = (const unsigned char*) data;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+
+  while (len >= 8) {
+    uint64_t k;
+    memcpy(&k, bytes, sizeof(k));
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+    bytes += 8;
+    len -= 8;
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, bytes, len);
+  h ^= tail;
+  h *= m;
+
+  h ^= h >> 47;
+  h *= m;
+  h ^= h >> 47;
+  return h;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_table.h"
+#include "logging.h"
+
+#define MIN_BUCKETS 16
+
+static inline size_t pow_2_size(size_t value) {
+  size_t size = MIN_BUCKETS;
+  while (size < value) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/**
+ * Finds the link that points to the node of the given key. This allows the
+ * caller to either read the node or unlink it.
+ */
+static inline HashNode **find_node(HashTable *table, uint64_t hash,
+				   const char *key, size_t key_len) {
+  HashNode **link = &table->buckets[hash & (table->bucket_count - 1)];
+  while (*link != NULL) {
+    HashNode *node = *link;
+    if (node->hash == hash && node->key_len == key_len
+	&& memcmp(node->key, key, key_len) == 0) {
+      return link;
+    }
+    link = &node->next;
+  }
+  return link;
+}
+
+/**
+ * Doubles the amount of buckets once the table reaches a load factor of 1.
+ */
+static void maybe_grow(HashTable *table) {
+  if (table->size < table->bucket_count) {
+    return;
+  }
+
+  size_t bucket_count = table->bucket_count << 1;
+  HashNode **buckets = (HashNode**) CHECK_MEM(calloc(bucket_count, sizeof(HashNode*)));
+
+  for (size_t i = 0 ; i < table->bucket_count ; i++) {
+    HashNode *node = table->buckets[i];
+    while (node != NULL) {
+      HashNode *next = node->next;
+      size_t index = node->hash & (bucket_count - 1);
+      node->next = buckets[index];
+      buckets[index] = node;
+      node = next;
+    }
+  }
+
+  free(table->buckets);
+  table->buckets = buckets;
+  table->bucket_count = bucket_count;
+}
+
+HashTable *hash_table_init(size_t initial_size) {
+  HashTable *table = (HashTable*) CHECK_MEM(calloc(1, sizeof(HashTable)));
+  table->bucket_count = pow_2_size(initial_size);
+  table->buckets = (HashNode**) CHECK_MEM(calloc(table->bucket_count, sizeof(HashNode*)));
+  table->size = 0;
+  return table;
+}
+
+void hash_table_destroy(HashTable *table) {
+  for (size_t i = 0 ; i < table->bucket_count ; i++) {
+    HashNode *node = table->buckets[i];
+    while (node != NULL) {
+      HashNode *next = node->next;
+      free(node);
+      node = next;
+    }
+  }
+  free(table->buckets);
+  free(table);
+}
+
+void *hash_table_get(HashTable *table, const char *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  HashNode *node = *find_node(table, hash, key, key_len);
+  return node == NULL ? NULL : node->value;
+}
+
+void *hash_table_put(HashTable *table, const char *key, size_t key_len,
+		     void *value) {
+  uint64_t hash = hash_bytes(key, key_len);
+  HashNode **link = find_node(table, hash, key, key_len);
+
+  if (*link != NULL) {
+    HashNode *node = *link;
+    void *prev = node->value;
+    /* the new value owns the memory of the key from now on. */
+    node->key = key;
+    node->value = value;
+    return prev;
+  }
+
+  HashNode *node = (HashNode*) CHECK_MEM(malloc(sizeof(HashNode)));
+  node->next = NULL;
+  node->hash = hash;
+  node->key = key;
+  node->key_len = key_len;
+  node->value = value;
+  *link = node;
+  table->size++;
+
+  maybe_grow(table);
+  return NULL;
+}
+
+void *hash_table_remove(HashTable *table, const char *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  HashNode **link = find_node(table, hash, key, key_len);
+
+  HashNode *node = *link;
+  if (node == NULL) {
+    return NULL;
+  }
+
+  void *value = node->value;
+  *link = node->next;
+  free(node);
+  table->size--;
+  return value;
+}
+
+size_t hash_table_size(HashTable *table) {
+  return table->size;
+}
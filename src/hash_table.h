@@ -0,0 +1,70 @@
+#ifndef __hash_table_h__
+#define __hash_table_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A chained hash table that maps a sequence of bytes to a pointer. Every
+ * entry is stored in its own node that is linked into its bucket.
+ *
+ * The table does not copy the keys it is given. The memory of a key must stay
+ * valid for as long as it is in the table, which is normally done by storing
+ * the key inside of the value that it points to.
+ *
+ * There is no synchronization done, so a table must only ever be used by the
+ * thread that created it.
+ */
+
+typedef struct HashNode {
+  struct HashNode *next;
+  uint64_t hash;
+  const char *key;
+  size_t key_len;
+  void *value;
+} HashNode;
+
+typedef struct HashTable {
+  /* the array of buckets, the length is always a power of 2. */
+  HashNode **buckets;
+  size_t bucket_count;
+
+  /* the amount of entries currently stored in the table. */
+  size_t size;
+} HashTable;
+
+/**
+ * Constructs a hash table with room for at least the given amount of entries
+ * before it needs to grow.
+ */
+HashTable *hash_table_init(size_t initial_size);
+
+/**
+ * Frees the table. The values that are still stored are not touched.
+ */
+void hash_table_destroy(HashTable *table);
+
+/**
+ * Returns the value stored for the given key or NULL if there is none.
+ */
+void *hash_table_get(HashTable *table, const char *key, size_t key_len);
+
+/**
+ * Stores the value for the given key. The previous value for the key is
+ * returned so that the caller can free it, NULL if there was none.
+ */
+void *hash_table_put(HashTable *table, const char *key, size_t key_len,
+		     void *value);
+
+/**
+ * Removes the key from the table and returns the value that was stored for
+ * it, NULL if the key was not found.
+ */
+void *hash_table_remove(HashTable *table, const char *key, size_t key_len);
+
+/**
+ * Returns the amount of entries in the table.
+ */
+size_t hash_table_size(HashTable *table);
+
+#endif
@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
 
 #include "http_request.h"
 #include "input_buffer.h"
@@ -8,9 +11,46 @@
 #include "picohttpparser.h"
 
 
-enum ParseState http_request_parse(InputBuffer *buffer, size_t prev_len,
+/**
+ * Parses the value of the Content-Length header. Returns -1 if the header
+ * value is not a valid length.
+ */
+static ssize_t content_length(const struct phr_header *header) {
+  if (header->value_len == 0 || header->value_len > 18) {
+    return -1;
+  }
+
+  ssize_t length = 0;
+  for (size_t i = 0 ; i < header->value_len ; i++) {
+    char c = header->value[i];
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    length = length * 10 + (c - '0');
+  }
+  return length;
+}
+
+enum ParseState http_request_parse(InputBuffer *buffer, size_t start, size_t prev_len,
 				   HttpRequest *request) {
-  int result = phr_parse_request(buffer->buffer, buffer->length,
+  /* the parser uses the header count as the capacity of the array. */
+  request->num_headers = NUM_HEADERS;
+  request->body = NULL;
+  request->body_len = 0;
+  request->request_len = 0;
+
+  const char *data = buffer->buffer + start;
+  size_t data_len = buffer->offset - start;
+  prev_len = prev_len > start ? prev_len - start : 0;
+
+  /* the parser only looks for the end of the headers after prev_len, so
+   * once the headers are complete and only the body is missing, it has to
+   * start from the beginning again. */
+  if (prev_len > 0 && memmem(data, prev_len, "\r\n\r\n", 4) != NULL) {
+    prev_len = 0;
+  }
+
+  int result = phr_parse_request(data, data_len,
 				 &request->method, &request->method_len,
 				 &request->path, &request->path_len,
 				 &request->minor_version,
@@ -21,10 +61,70 @@ enum ParseState http_request_parse(InputBuffer *buffer, size_t prev_len,
   case -1:
     return PARSE_ERROR;
   case -2:
-    return PARSE_INCOMPLETE;
+    /* the headers are not complete yet, and are never going to be within
+     * the limit. */
+    return data_len > HTTP_MAX_HEADER_SIZE ? PARSE_ERROR : PARSE_INCOMPLETE;
   default:
-    return PARSE_FINISH;
+    break;
+  }
+
+  size_t header_len = (size_t) result;
+  if (header_len > HTTP_MAX_HEADER_SIZE) {
+    return PARSE_ERROR;
+  }
+  const struct phr_header *header = http_request_header(request, "Content-Length");
+  if (header != NULL) {
+    ssize_t body_len = content_length(header);
+    if (body_len < 0) {
+      return PARSE_ERROR;
+    }
+    request->body_len = (size_t) body_len;
+  }
+
+  /* the headers are all there is to a request that is refused. */
+  if (request->body_len > HTTP_MAX_BODY_SIZE) {
+    request->request_len = header_len;
+    return PARSE_TOO_LARGE;
+  }
+
+  if (data_len - header_len < request->body_len) {
+    return PARSE_INCOMPLETE;
+  }
+
+  request->body = data + header_len;
+  request->request_len = header_len + request->body_len;
+  return PARSE_FINISH;
+}
+
+int http_request_is_method(HttpRequest *request, const char *method) {
+  size_t method_len = strlen(method);
+  if (request->method_len != method_len) {
+    return 0;
+  }
+  return strncmp(request->method, method, method_len) == 0;
+}
+
+const char *http_request_key(HttpRequest *request, size_t *key_len) {
+  const char *key = request->path;
+  *key_len = request->path_len;
+  if (*key_len > 0 && key[0] == '/') {
+    key++;
+    (*key_len)--;
+  }
+  return key;
+}
+
+const struct phr_header *http_request_header(HttpRequest *request,
+					     const char *name) {
+  size_t name_len = strlen(name);
+  for (size_t i = 0 ; i < request->num_headers ; i++) {
+    struct phr_header *header = &request->headers[i];
+    if (header->name_len == name_len
+	&& strncasecmp(header->name, name, name_len) == 0) {
+      return header;
+    }
   }
+  return NULL;
 }
 
 void http_request_print(HttpRequest *request) {
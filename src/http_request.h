@@ -6,6 +6,17 @@
 
 #define NUM_HEADERS 100
 
+/* the largest request line and headers that are read in, a request with
+ * larger ones is a parse error. */
+#define HTTP_MAX_HEADER_SIZE (64 * 1024)
+
+/* the largest body that is read in, which is the largest value that can be
+ * stored. Requests with a larger one are refused before it is buffered. */
+#define HTTP_MAX_BODY_SIZE (64 * 1024 * 1024)
+
+/* the most that has to be buffered to parse any request that is accepted. */
+#define HTTP_MAX_REQUEST_SIZE (HTTP_MAX_HEADER_SIZE + HTTP_MAX_BODY_SIZE)
+
 typedef struct HttpRequest {
   const char *method;
   size_t method_len;
@@ -17,6 +28,15 @@ typedef struct HttpRequest {
 
   struct phr_header headers[NUM_HEADERS];
   size_t num_headers;
+
+  /* the payload sent after the headers, sized by the Content-Length
+   * header. This points into the input buffer. */
+  const char *body;
+  size_t body_len;
+
+  /* the total amount of bytes that this request used in the input
+   * buffer, headers and body included. */
+  size_t request_len;
   
 } HttpRequest;
 
@@ -24,15 +44,38 @@ enum ParseState {
   PARSE_FINISH,
   PARSE_ERROR,
   PARSE_INCOMPLETE,
+  /* the headers are complete, but the body is larger than
+   * HTTP_MAX_BODY_SIZE. Nothing of the body is read in. */
+  PARSE_TOO_LARGE,
 };
 
 /**
- * Tries to parse out an HTTP request from the given buffer.
+ * Tries to parse out an HTTP request from the given buffer, starting at the
+ * given offset. The data up to prev_len was already looked at before.
  *  Returns a enumeration detailing if there is more work to do or not.
+ *  A request is only finished once its entire body has been read in.
  */
-enum ParseState http_request_parse(InputBuffer *buffer, size_t prev_len,
+enum ParseState http_request_parse(InputBuffer *buffer, size_t start, size_t prev_len,
 				   HttpRequest *request);
 
+/**
+ * Returns 1 if the request uses the given method and 0 otherwise.
+ */
+int http_request_is_method(HttpRequest *request, const char *method);
+
+/**
+ * Returns the key that the request is for, which is the path without the
+ * leading slash. The length of the key is stored in key_len.
+ */
+const char *http_request_key(HttpRequest *request, size_t *key_len);
+
+/**
+ * Looks up the value of the header with the given name, ignoring case. 
+ * Returns NULL if the header was not sent.
+ */
+const struct phr_header *http_request_header(HttpRequest *request,
+					     const char *name);
+
 void http_request_print(HttpRequest *request);
 
 #endif
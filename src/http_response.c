@@ -49,6 +49,9 @@ static inline const char *get_reason(int status_code) {
   case 408: return "Request Time-out";
   case 409: return "Conflict";
   case 410: return "Gone";
+  case 411: return "Length Required";
+  case 412: return "Precondition Failed";
+  case 413: return "Request Entity Too Large";
 
   // 5xx: Server Error - The server failed to fulfill an apparently valid request  
   case 500: return "Internal Server Error";
@@ -65,13 +68,27 @@ void http_response_init(OutputBuffer *buffer, int status_code,
 			HttpHeader headers[10], size_t header_count,
 			const char *body, size_t body_len) {
 
+  /* the response is put together out of fixed pieces, which is a lot
+   * cheaper than formatting it. */
   const char *reason_phrase = get_reason(status_code);
-  output_buffer_append(buffer, "HTTP/1.1 %d %s\r\n", status_code, reason_phrase);
+  char status[3] = {
+    (char) ('0' + (status_code / 100) % 10),
+    (char) ('0' + (status_code / 10) % 10),
+    (char) ('0' + status_code % 10),
+  };
+  output_buffer_append_bytes(buffer, "HTTP/1.1 ", 9);
+  output_buffer_append_bytes(buffer, status, 3);
+  output_buffer_append_bytes(buffer, " ", 1);
+  output_buffer_append_bytes(buffer, reason_phrase, strlen(reason_phrase));
+  output_buffer_append_bytes(buffer, "\r\n", 2);
 
   for (size_t i = 0 ; i < header_count ; i++) {
-    output_buffer_append(buffer, "%.*s: %.*s\r\n",
-			 (int) headers[i].name_len, headers[i].name,
-			 (int) headers[i].value_len, headers[i].value);
+    output_buffer_append_bytes(buffer, headers[i].name, headers[i].name_len);
+    output_buffer_append_bytes(buffer, ": ", 2);
+    output_buffer_append_bytes(buffer, headers[i].value, headers[i].value_len);
+    output_buffer_append_bytes(buffer, "\r\n", 2);
   }
-  output_buffer_append(buffer, "\r\n%.*s", (int) body_len, body);
+  output_buffer_append_bytes(buffer, "\r\n", 2);
+  /* the body can contain binary data so it is copied as is. */
+  output_buffer_append_bytes(buffer, body, body_len);
 }
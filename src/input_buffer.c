@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "input_buffer.h"
@@ -31,17 +32,32 @@ void input_buffer_reset(InputBuffer *buffer) {
   buffer->offset = 0;
 }
 
+void input_buffer_consume(InputBuffer *buffer, size_t len) {
+  if (len >= buffer->offset) {
+    buffer->offset = 0;
+    return;
+  }
+  memmove(buffer->buffer, buffer->buffer + len, buffer->offset - len);
+  buffer->offset -= len;
+}
+
 void input_buffer_destroy(InputBuffer *buffer) {
   free(buffer->buffer);
   free(buffer);
 }
 
-enum ReadState input_buffer_read_into(InputBuffer *buffer, int fd) {
+enum ReadState input_buffer_read_into(InputBuffer *buffer, int fd, size_t max_len) {
   while (1) {
+    if (buffer->offset >= max_len) {
+      return READ_FINISH;
+    }
     resize(buffer);
 
     void *start_addr = buffer->buffer + buffer->offset;
     size_t num_to_read = buffer->length - buffer->offset;
+    if (num_to_read > max_len - buffer->offset) {
+      num_to_read = max_len - buffer->offset;
+    }
     ssize_t bytes_read = read(fd, start_addr, num_to_read);
 
     switch (bytes_read) {
@@ -59,3 +75,15 @@ enum ReadState input_buffer_read_into(InputBuffer *buffer, int fd) {
     }
   }
 }
+
+void input_buffer_append(InputBuffer *buffer, const char *data, size_t len) {
+  if (buffer->length - buffer->offset < len) {
+    while (buffer->length - buffer->offset < len) {
+      buffer->length <<= 1;
+    }
+    buffer->buffer = (char*) CHECK_MEM(realloc(buffer->buffer, buffer->length));
+    buffer->resize_count++;
+  }
+  memcpy(buffer->buffer + buffer->offset, data, len);
+  buffer->offset += len;
+}
@@ -1,6 +1,8 @@
 #ifndef __input_buffer_h__
 #define __input_buffer_h__
 
+#include <stddef.h>
+
 enum ReadState {
   READ_FINISH,
   READ_BUSY,
@@ -33,6 +35,12 @@ InputBuffer *input_buffer_init(size_t initial_size);
  */
 void input_buffer_reset(InputBuffer *buffer);
 
+/**
+ * Drops the given amount of bytes off the front of the buffer, moving the
+ * rest of the data to the beginning.
+ */
+void input_buffer_consume(InputBuffer *buffer, size_t len);
+
 /**
  * Cleans up all memory associated with this buffer.
  */
@@ -40,8 +48,16 @@ void input_buffer_destroy(InputBuffer *buffer);
 
 /**
  * Reads as much as possible into the input buffer from the socket
- * associated with the given file descriptor.
+ * associated with the given file descriptor, till the buffer holds max_len
+ * bytes. Returns READ_BUSY once the socket is drained and READ_FINISH when
+ * it stopped at max_len, with the rest of the data still in the socket.
+ */
+enum ReadState input_buffer_read_into(InputBuffer *buffer, int fd, size_t max_len);
+
+/**
+ * Copies the given bytes to the end of the buffer, for data that was read
+ * in somewhere else.
  */
-enum ReadState input_buffer_read_into(InputBuffer *buffer, int fd);
+void input_buffer_append(InputBuffer *buffer, const char *data, size_t len);
 
 #endif
@@ -1,12 +1,11 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -15,6 +14,7 @@
 #include <unistd.h>
 
 #include "client.h"
+#include "connection_table.h"
 #include "epoll_info.h"
 #include "input_buffer.h"
 #include "io_worker.h"
@@ -34,11 +34,44 @@ SocketContext *init_context(Server *server, EpollInfo *epoll_info) {
   return socket_context;
 }
 
+void init_reply_queues(EpollInfo *epoll_info, int actor_count) {
+  epoll_info->reply_queue_count = actor_count;
+  epoll_info->reply_queues =
+    (Queue**) CHECK_MEM(calloc((size_t) actor_count, sizeof(Queue*)));
+  for (int i = 0 ; i < actor_count ; i++) {
+    epoll_info->reply_queues[i] = queue_init(IO_REPLY_QUEUE_SIZE);
+  }
+}
+
+static void init_request_batch(RequestBatch *batch) {
+  batch->capacity = IO_REQUEST_BATCH_SIZE;
+  batch->requests = (void**) CHECK_MEM(calloc(batch->capacity, sizeof(void*)));
+  batch->count = 0;
+  batch->parked = 0;
+}
+
+void init_request_batches(EpollInfo *epoll_info, int actor_count) {
+  epoll_info->request_batches =
+    (RequestBatch*) CHECK_MEM(calloc((size_t) actor_count, sizeof(RequestBatch)));
+  for (int i = 0 ; i < actor_count ; i++) {
+    init_request_batch(&epoll_info->request_batches[i]);
+  }
+  epoll_info->rejected_requests = (RequestBatch*) CHECK_MEM(calloc(1, sizeof(RequestBatch)));
+  init_request_batch(epoll_info->rejected_requests);
+}
+
+void init_timeouts(EpollInfo *epoll_info, ServerConfig *config) {
+  connection_table_set_timeouts(epoll_info->connections, config->header_timeout,
+				config->body_timeout, config->keep_alive_timeout,
+				config->write_timeout);
+}
+
 void handle_accept_read(SocketContext *context) {
   while (1) {
-    struct sockaddr_in in_addr;
-    socklen_t size = sizeof(in_addr);
-    int conn_sock = accept(context->data.fd, (struct sockaddr *) &in_addr, &size);
+    struct sockaddr_storage addr;
+    socklen_t size = sizeof(addr);
+    int conn_sock = accept4(context->data.fd, (struct sockaddr *) &addr, &size,
+			    SOCK_NONBLOCK);
     if (conn_sock == -1) {
       if (ERROR_BLOCK) {
 	return;
@@ -54,30 +87,73 @@ void handle_accept_read(SocketContext *context) {
     r = setsockopt(conn_sock, SOL_TCP, TCP_QUICKACK, &opt, sizeof(opt));
     CHECK(r == -1, "Failed to set options on TCP_QUICKACK");
     
-    fcntl(conn_sock, F_SETFL, O_NONBLOCK);
-    
-    char* hbuf = (char*) CHECK_MEM(calloc(NI_MAXHOST, sizeof(char)));
-    char sbuf[NI_MAXSERV];
-    
-    r = getnameinfo((struct sockaddr*) &in_addr, size, hbuf,
-		    NI_MAXHOST * sizeof(char), sbuf,
-		    sizeof(sbuf), NI_NUMERICHOST | NI_NUMERICSERV);
-    CHECK(r == -1, "Failed to get host name");
+    RequestContext *request_context =
+      connection_table_open(context->epoll_info->connections, conn_sock, context->epoll_info);
+    connection_table_set_timeout(context->epoll_info->connections, request_context,
+				 TIMEOUT_HEADER);
+
+    /* the address is only formatted if the request gets logged. */
+    memcpy(&request_context->remote_addr, &addr, size);
+    request_context->remote_addr_len = size;
     
     /* increments the counter of the total active requests. */
     server_stats_incr_active_requests(context->server->server_stats);
-
-    RequestContext *request_context = init_request_context(conn_sock, hbuf,
-							   context->epoll_info);
     per_request_record_start(&request_context->time_stats, TOTAL_TIME);
-    
-    SocketContext *connection_context = init_context(context->server, context->epoll_info);
+
+    /* the socket context is kept along with the request context once the
+     * connection is closed. */
+    if (request_context->socket_context == NULL) {
+      request_context->socket_context = init_context(context->server, context->epoll_info);
+    }
+    SocketContext *connection_context = request_context->socket_context;
     connection_context->data.ptr = request_context;
-    connection_context->input_handler = client_handle_read;
-    connection_context->output_handler = NULL;
+    connection_context->input_handler = client_handle_event;
+    connection_context->output_handler = client_handle_event;
     connection_context->error_handler = client_handle_error;
 
-    add_input_epoll_event(context->epoll_info, request_context->fd, connection_context);
+    /* the connection stays registered the same way till it is closed. */
+    add_connection_epoll_event(context->epoll_info, request_context->fd, connection_context);
+  }
+}
+
+/**
+ * Starts writing out the responses that an actor is done with. Everything
+ * the actor finished since the last time is written out in one go.
+ */
+static void process_reply_queue(Queue *reply_queue) {
+  RequestContext *request_context;
+  while ((request_context = (RequestContext*) queue_pop(reply_queue)) != NULL) {
+    client_handle_reply(request_context);
+  }
+}
+
+/**
+ * Writes out the 503 of a request whose actor was too far behind.
+ */
+static void reply_rejected(void *data, RequestContext *request_context) {
+  client_handle_reply(request_context);
+}
+
+void handle_reply_read(SocketContext *context) {
+  Queue *reply_queue = (Queue*) context->data.ptr;
+  eventfd_t count;
+  eventfd_read(queue_add_event_fd(reply_queue), &count);
+  process_reply_queue(reply_queue);
+}
+
+/**
+ * Closes the connections that took too long to send a request or to read a
+ * response. Connections whose requests are with the actors are never under
+ * a timeout.
+ */
+void handle_timeout_read(SocketContext *context) {
+  ConnectionTable *table = context->epoll_info->connections;
+  uint64_t now = connection_table_tick(table);
+
+  RequestContext *connection;
+  while ((connection = connection_table_expire(table, now)) != NULL) {
+    server_stats_incr_timeouts(context->server->server_stats);
+    client_close_connection(connection->socket_context, REQUEST_TIMEOUT);
   }
 }
 
@@ -94,12 +170,19 @@ void *io_event_loop(void *pthread_input) {
   int sock_fd = args->sock_fd;
   Server *server = args->server;
 
+  const char *name = "IO-Thread";
+  EpollInfo *epoll_info = epoll_info_init(name, args->id);
+  init_reply_queues(epoll_info, server->actor_count);
+  init_request_batches(epoll_info, server->actor_count);
+  epoll_info->connections = connection_table_init(CONNECTION_TABLE_SIZE);
+  init_timeouts(epoll_info, server->config);
+  epoll_info->busy_poll = server->config->busy_poll;
+  epoll_info_set_queues(epoll_info, epoll_info->reply_queues, epoll_info->reply_queue_count);
+  server->io_epoll_infos[args->id] = epoll_info;
+
   /* make sure all application threads have started */
   pthread_barrier_wait(&server->startup);
   LOG_INFO("Starting IO thread");
-    
-  const char *name = "IO-Thread";
-  EpollInfo *epoll_info = epoll_info_init(name, args->id);
 
   /* Adds the epoll event for listening for new connections */
   SocketContext *context = init_context(server, epoll_info);
@@ -109,9 +192,29 @@ void *io_event_loop(void *pthread_input) {
   context->error_handler = handle_accept_error;
   add_input_epoll_event(epoll_info, sock_fd, context);  
 
+  /* the actors hand back the finished requests through the reply queues. */
+  for (int i = 0 ; i < epoll_info->reply_queue_count ; i++) {
+    SocketContext *reply_context = init_context(server, epoll_info);
+    reply_context->data.ptr = epoll_info->reply_queues[i];
+    reply_context->input_handler = handle_reply_read;
+    reply_context->output_handler = NULL;
+    reply_context->error_handler = handle_accept_error;
+    add_input_epoll_event(epoll_info, queue_add_event_fd(epoll_info->reply_queues[i]),
+			  reply_context);
+  }
+
+  if (epoll_info->connections->timer_fd != -1) {
+    SocketContext *timer_context = init_context(server, epoll_info);
+    timer_context->data.ptr = NULL;
+    timer_context->input_handler = handle_timeout_read;
+    timer_context->output_handler = NULL;
+    timer_context->error_handler = handle_accept_error;
+    add_input_epoll_event(epoll_info, epoll_info->connections->timer_fd, timer_context);
+  }
+
   struct epoll_event events[MAX_EVENTS];
   while (1) {
-    int ready_amount = epoll_wait(epoll_info->epoll_fd, events, MAX_EVENTS, -1);
+    int ready_amount = epoll_info_wait(epoll_info, events, MAX_EVENTS, -1);
 
     if (ready_amount == -1) {
       LOG_WARN("Failed to wait on epoll");
@@ -136,15 +239,16 @@ void *io_event_loop(void *pthread_input) {
 	continue;
       }
 
+      /* a handler can close the connection and free its context, so only
+       * one of them is called per event. Connections use the same handler
+       * for both, which does whatever the state of the connection needs. */
       if (events[i].events & EPOLLIN) {
 	if (socket_context->input_handler != NULL) {
 	  socket_context->input_handler(socket_context);
 	} else {
 	  LOG_WARN("epoll event did not have an input handler attached");
 	}
-      }
-      
-      if (events[i].events & EPOLLOUT) {
+      } else if (events[i].events & EPOLLOUT) {
 	if (socket_context->output_handler != NULL) {
 	  socket_context->output_handler(socket_context);
 	} else {
@@ -152,6 +256,15 @@ void *io_event_loop(void *pthread_input) {
 	}
       }
     }
+
+    /* the replies that came in while the worker was awake did not notify
+     * it. */
+    for (int i = 0 ; i < epoll_info->reply_queue_count ; i++) {
+      process_reply_queue(epoll_info->reply_queues[i]);
+    }
+
+    /* every request read during the round goes out at once. */
+    client_flush_requests(server, epoll_info, reply_rejected, NULL);
   }
   return NULL;
 }
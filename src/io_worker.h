@@ -28,6 +28,26 @@ typedef struct SocketContext {
   EpollInfo *epoll_info;  
 } SocketContext;
 
+/* the most finished requests a single actor can hand back to a worker at
+ * once. */
+#define IO_REPLY_QUEUE_SIZE 16384
+
+/* the most requests that a worker collects for a single actor before it
+ * tries to push them onto the input queue of the actor. */
+#define IO_REQUEST_BATCH_SIZE 64
+
+typedef struct RequestBatch {
+  /* the requests in the order that they were read. Only grows past
+   * IO_REQUEST_BATCH_SIZE while the queue of the actor is full. */
+  void **requests;
+  size_t count;
+  size_t capacity;
+
+  /* the amount of requests at the front that were already counted as
+   * waiting for the actor. */
+  size_t parked;
+} RequestBatch;
+
 typedef struct IoWorkerArgs {
   /* unique ID of the worker */
   int id;
@@ -39,6 +59,23 @@ typedef struct IoWorkerArgs {
 
 SocketContext *init_context(Server *server, EpollInfo *epoll_info);
 
+/**
+ * Creates the queue that every actor hands the finished requests of the
+ * worker back on.
+ */
+void init_reply_queues(EpollInfo *epoll_info, int actor_count);
+
+/**
+ * Creates the batches that the worker collects the requests for every actor
+ * in, and the one for the requests that it rejects.
+ */
+void init_request_batches(EpollInfo *epoll_info, int actor_count);
+
+/**
+ * Sets up the timeouts of the connections of the worker from the config.
+ */
+void init_timeouts(EpollInfo *epoll_info, ServerConfig *config);
+
 /**
  * Runs the event loop in the current thread to process
  * requests off the specified socket.
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btree.h"
+#include "kv_store.h"
+#include "logging.h"
+#include "slab.h"
+#include "swiss_table.h"
+#include "timer_wheel.h"
+
+#define INITIAL_SIZE 1024
+
+/* the counters only have a single writer. */
+#define COUNTER_ADD(COUNTER, VALUE)					\
+  atomic_store_explicit((COUNTER),					\
+			atomic_load_explicit((COUNTER), memory_order_relaxed) + (VALUE), \
+			memory_order_relaxed);
+
+static inline size_t item_size(size_t key_len, size_t value_len) {
+  return sizeof(KvItem) + key_len + value_len;
+}
+
+static KvItem *item_init(KvStore *store, const char *key, size_t key_len,
+			 const char *value, size_t value_len, uint64_t expires_at) {
+  KvItem *item = (KvItem*) slab_alloc(store->slab, item_size(key_len, value_len));
+  atomic_init(&item->lent, 0);
+  item->expires_at = expires_at;
+  item->key_len = (uint32_t) key_len;
+  item->value_len = (uint32_t) value_len;
+  memcpy(item->data, key, key_len);
+  memcpy(item->data + key_len, value, value_len);
+  return item;
+}
+
+static inline int item_is_mapped(KvStore *store, KvItem *item) {
+  return (const char*) item >= store->mapped_start
+    && (const char*) item < store->mapped_end;
+}
+
+static inline int item_is_expired(KvStore *store, KvItem *item) {
+  return item->expires_at != 0 && item->expires_at <= store->now;
+}
+
+static inline void item_add_timer(KvStore *store, KvItem *item) {
+  if (item->expires_at != 0) {
+    timer_wheel_add(store->timers, &item->timer, item->expires_at);
+  }
+}
+
+/**
+ * Stores the item in the index and the ordered keys, and returns the item
+ * that it replaced.
+ */
+static KvItem *index_put(KvStore *store, KvItem *item) {
+  if (store->ordered != NULL) {
+    btree_put(store->ordered, kv_item_key(item), item->key_len, item);
+  }
+  return (KvItem*) swiss_table_put(store->index, kv_item_key(item), item->key_len, item);
+}
+
+static KvItem *index_remove(KvStore *store, const char *key, size_t key_len) {
+  if (store->ordered != NULL) {
+    btree_remove(store->ordered, key, key_len);
+  }
+  return (KvItem*) swiss_table_remove(store->index, key, key_len);
+}
+
+/**
+ * Whether another thread is still reading the value of the item. The
+ * acquire makes sure its reads are done before the item is freed.
+ */
+static inline int item_is_lent(KvItem *item) {
+  return atomic_load_explicit(&item->lent, memory_order_acquire) > 0;
+}
+
+/**
+ * Frees the items that were kept around for the readers in other threads,
+ * once there are none anymore. Items that are still lent out stay.
+ */
+static void release_retired(KvStore *store) {
+  if (store->retired_count == 0 || store->pinned) {
+    return;
+  }
+  size_t kept = 0;
+  for (size_t i = 0 ; i < store->retired_count ; i++) {
+    KvItem *item = store->retired[i];
+    if (item_is_lent(item)) {
+      store->retired[kept++] = item;
+      continue;
+    }
+    size_t size = item_size(item->key_len, item->value_len);
+    store->retired_bytes -= size;
+    slab_free(store->slab, item, size);
+  }
+  store->retired_count = kept;
+}
+
+/**
+ * Frees an item that is neither in the index nor in the timing wheel
+ * anymore.
+ */
+static void item_free(KvStore *store, KvItem *item) {
+  size_t size = item_size(item->key_len, item->value_len);
+  store->item_bytes -= size;
+  if (item_is_mapped(store, item)) {
+    return;
+  }
+
+  if (store->pinned || item_is_lent(item)) {
+    if (store->retired_count == store->retired_capacity) {
+      store->retired_capacity = store->retired_capacity == 0 ? 1024 : store->retired_capacity << 1;
+      store->retired = (KvItem**) CHECK_MEM(realloc(store->retired,
+						    store->retired_capacity * sizeof(KvItem*)));
+    }
+    store->retired[store->retired_count++] = item;
+    store->retired_bytes += size;
+    return;
+  }
+  slab_free(store->slab, item, size);
+}
+
+static void item_destroy(KvStore *store, KvItem *item) {
+  if (item->expires_at != 0) {
+    timer_wheel_remove(store->timers, &item->timer);
+  }
+  item_free(store, item);
+}
+
+/**
+ * Whether an item of the given size fits within the memory limit of the
+ * store at all, with every other item evicted. Only the index stays.
+ */
+static inline int item_fits(KvStore *store, size_t size) {
+  return store->memory_limit == 0
+    || size + swiss_table_memory(store->index) <= store->memory_limit;
+}
+
+/**
+ * The room that an item of the given size takes on top of the item that
+ * it replaces, if there is one.
+ */
+static inline size_t room_needed(KvItem *prev, size_t size) {
+  if (prev == NULL) {
+    return size;
+  }
+  size_t prev_size = item_size(prev->key_len, prev->value_len);
+  return size > prev_size ? size - prev_size : 0;
+}
+
+/**
+ * Evicts items till there is room for an item of the given size within the
+ * memory limit of the store.
+ */
+static void make_room(KvStore *store, size_t size) {
+  if (store->memory_limit == 0) {
+    return;
+  }
+
+  while (kv_store_memory(store) + size > store->memory_limit) {
+    KvItem *item = (KvItem*) swiss_table_clock(store->index, &store->clock_hand);
+    if (item == NULL) {
+      return;
+    }
+    index_remove(store, kv_item_key(item), item->key_len);
+    item_destroy(store, item);
+    COUNTER_ADD(&store->evictions, 1);
+  }
+}
+
+KvStore *kv_store_init(Slab *slab) {
+  KvStore *store = (KvStore*) CHECK_MEM(calloc(1, sizeof(KvStore)));
+  store->slab = slab;
+  store->index = swiss_table_init(INITIAL_SIZE);
+  store->ordered = NULL;
+  store->now = kv_store_clock();
+  store->timers = timer_wheel_init(store->now);
+  store->item_bytes = 0;
+  store->memory_limit = 0;
+  store->clock_hand = 0;
+  store->hits = ATOMIC_VAR_INIT(0);
+  store->misses = ATOMIC_VAR_INIT(0);
+  store->evictions = ATOMIC_VAR_INIT(0);
+  store->expirations = ATOMIC_VAR_INIT(0);
+  store->pinned = 0;
+  store->retired = NULL;
+  store->retired_count = 0;
+  store->retired_capacity = 0;
+  store->retired_bytes = 0;
+  store->mapped_start = NULL;
+  store->mapped_end = NULL;
+  return store;
+}
+
+void kv_store_destroy(KvStore *store) {
+  /* no value may be lent out anymore at this point. */
+  for (size_t i = 0 ; i < store->retired_count ; i++) {
+    KvItem *item = store->retired[i];
+    slab_free(store->slab, item, item_size(item->key_len, item->value_len));
+  }
+  free(store->retired);
+  store->retired = NULL;
+
+  SwissTable *index = store->index;
+  for (size_t i = 0 ; i < index->capacity ; i++) {
+    KvItem *item = (KvItem*) swiss_table_slot_value(index, i);
+    if (item != NULL) {
+      item_destroy(store, item);
+    }
+  }
+  swiss_table_destroy(index);
+  if (store->ordered != NULL) {
+    btree_destroy(store->ordered);
+  }
+  timer_wheel_destroy(store->timers);
+  free(store);
+}
+
+KvItem *kv_store_get(KvStore *store, const char *key, size_t key_len) {
+  KvItem *item = (KvItem*) swiss_table_touch(store->index, key, key_len);
+  if (item == NULL) {
+    COUNTER_ADD(&store->misses, 1);
+    return NULL;
+  }
+  if (!item_is_expired(store, item)) {
+    COUNTER_ADD(&store->hits, 1);
+    return item;
+  }
+
+  /* expired items that the timing wheel did not get to yet are removed
+   * once they are looked up. */
+  index_remove(store, key, key_len);
+  item_destroy(store, item);
+  COUNTER_ADD(&store->expirations, 1);
+  COUNTER_ADD(&store->misses, 1);
+  return NULL;
+}
+
+int kv_store_put(KvStore *store, const char *key, size_t key_len,
+		 const char *value, size_t value_len, uint64_t expires_at) {
+  CHECK(key_len > KV_MAX_KEY_SIZE, "key of %zu bytes is too large", key_len);
+  CHECK(value_len > KV_MAX_VALUE_SIZE, "value of %zu bytes is too large", value_len);
+
+  size_t size = item_size(key_len, value_len);
+  if (!item_fits(store, size)) {
+    return KV_PUT_TOO_LARGE;
+  }
+
+  /* the previous item is looked up first, the clock could evict it while
+   * making room and turn the replacement into a create. */
+  KvItem *prev = (KvItem*) swiss_table_get(store->index, key, key_len);
+  int created = prev == NULL || item_is_expired(store, prev);
+  make_room(store, room_needed(prev, size));
+
+  KvItem *item = item_init(store, key, key_len, value, value_len, expires_at);
+  store->item_bytes += size;
+  item_add_timer(store, item);
+
+  prev = index_put(store, item);
+  if (prev != NULL) {
+    item_destroy(store, prev);
+  }
+
+  /* the index may have grown to fit the item. */
+  make_room(store, 0);
+  return created;
+}
+
+int kv_store_delete(KvStore *store, const char *key, size_t key_len) {
+  KvItem *item = index_remove(store, key, key_len);
+  if (item == NULL) {
+    return 0;
+  }
+  int expired = item_is_expired(store, item);
+  item_destroy(store, item);
+  return !expired;
+}
+
+size_t kv_store_expire(KvStore *store, uint64_t now, size_t max) {
+  store->now = now;
+
+  /* runs every tick, so the items that waited on lent values are freed
+   * soon after they come back. */
+  release_retired(store);
+
+  size_t count = 0;
+  TimerNode *node;
+  while (count < max && (node = timer_wheel_expire(store->timers, now)) != NULL) {
+    KvItem *item = TIMER_NODE_ENTRY(node, KvItem, timer);
+    KvItem *removed = index_remove(store, kv_item_key(item), item->key_len);
+    CHECK(removed != item, "Expired item is not in the index");
+    item_free(store, item);
+    count++;
+  }
+  COUNTER_ADD(&store->expirations, (long) count);
+  return count;
+}
+
+uint64_t kv_store_clock(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+size_t kv_store_size(KvStore *store) {
+  return swiss_table_size(store->index);
+}
+
+size_t kv_store_memory(KvStore *store) {
+  size_t memory = store->item_bytes + store->retired_bytes + swiss_table_memory(store->index);
+  if (store->ordered != NULL) {
+    memory += btree_memory(store->ordered);
+  }
+  return memory;
+}
+
+void kv_store_set_memory_limit(KvStore *store, size_t memory_limit) {
+  store->memory_limit = memory_limit;
+  make_room(store, 0);
+}
+
+void kv_store_enable_ordered(KvStore *store) {
+  CHECK(kv_store_size(store) != 0, "Can only order an empty store");
+  if (store->ordered == NULL) {
+    store->ordered = btree_init();
+  }
+}
+
+size_t kv_store_scan(KvStore *store, const char *start, size_t start_len,
+		     const char *end, size_t end_len, KvItem **items, size_t max) {
+  CHECK(store->ordered == NULL, "Can only scan an ordered store");
+  BTreeIterator iter;
+  btree_seek(store->ordered, start, start_len, &iter);
+
+  size_t count = 0;
+  const char *key;
+  size_t key_len;
+  KvItem *item;
+  while (count < max && (item = (KvItem*) btree_next(&iter, &key, &key_len)) != NULL) {
+    if (end_len > 0) {
+      int r = memcmp(key, end, key_len < end_len ? key_len : end_len);
+      if (r > 0 || (r == 0 && key_len >= end_len)) {
+	break;
+      }
+    }
+    /* expired items are left for the timing wheel, as removing them here
+     * would change the tree under the iterator. */
+    if (!item_is_expired(store, item)) {
+      items[count++] = item;
+    }
+  }
+  return count;
+}
+
+void kv_store_reserve(KvStore *store, size_t count) {
+  CHECK(kv_store_size(store) != 0, "Can only reserve room in an empty store");
+  swiss_table_destroy(store->index);
+  store->index = swiss_table_init(count > INITIAL_SIZE ? count : INITIAL_SIZE);
+}
+
+void kv_store_set_mapped(KvStore *store, const char *start, const char *end) {
+  CHECK(store->mapped_start != NULL, "Store already has a mapped range");
+  store->mapped_start = start;
+  store->mapped_end = end;
+}
+
+void kv_store_put_item(KvStore *store, KvItem *item) {
+  CHECK(!item_is_mapped(store, item), "Item is outside of the mapped range");
+  size_t size = item_size(item->key_len, item->value_len);
+  if (!item_fits(store, size)) {
+    /* like an eviction, the key is gone after the restart. */
+    COUNTER_ADD(&store->evictions, 1);
+    return;
+  }
+
+  KvItem *prev = (KvItem*) swiss_table_get(store->index, kv_item_key(item), item->key_len);
+  make_room(store, room_needed(prev, size));
+  store->item_bytes += size;
+  item_add_timer(store, item);
+
+  prev = index_put(store, item);
+  if (prev != NULL) {
+    item_destroy(store, prev);
+  }
+  make_room(store, 0);
+}
+
+KvItem **kv_store_pin(KvStore *store, size_t *count) {
+  CHECK(store->pinned, "Store is already pinned");
+  SwissTable *index = store->index;
+  KvItem **items = (KvItem**) CHECK_MEM(malloc((index->size + 1) * sizeof(KvItem*)));
+
+  size_t item_count = 0;
+  for (size_t i = 0 ; i < index->capacity ; i++) {
+    KvItem *item = (KvItem*) swiss_table_slot_value(index, i);
+    if (item != NULL) {
+      items[item_count++] = item;
+    }
+  }
+
+  store->pinned = 1;
+  *count = item_count;
+  return items;
+}
+
+void kv_store_unpin(KvStore *store) {
+  store->pinned = 0;
+  release_retired(store);
+}
+
+void kv_store_lend(KvStore *store, KvItem *item) {
+  atomic_fetch_add_explicit(&item->lent, 1, memory_order_relaxed);
+}
+
+void kv_store_return(void *item) {
+  /* the release makes sure the reads of the value are done before the
+   * actor sees the count drop and frees the item. */
+  atomic_fetch_sub_explicit(&((KvItem*) item)->lent, 1, memory_order_release);
+}
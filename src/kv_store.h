@@ -0,0 +1,256 @@
+#ifndef __kv_store_h__
+#define __kv_store_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "btree.h"
+#include "slab.h"
+#include "swiss_table.h"
+#include "timer_wheel.h"
+
+/**
+ * The in-memory key-value shard owned by a single actor. Every actor has its
+ * own store and no other thread is allowed to touch it, so none of the
+ * operations use any form of synchronization.
+ *
+ * A store can be given a memory limit. Once storing an item would go over
+ * it, items are evicted with the CLOCK algorithm: every lookup sets the
+ * access bit of the key in the index, and the clock hand sweeps over the
+ * index evicting the first key that was not accessed since it last passed.
+ *
+ * A store can also keep its keys in order in a B+tree next to the hash
+ * index, which allows scanning ranges of keys. Lookups only ever use the
+ * hash index.
+ *
+ * The values of items can be lent out to other threads, which send them
+ * out without copying them. The only shared state is the count of loans
+ * in every item, an item that is removed while its value is lent out is
+ * kept around till the last loan comes back. Such items still count
+ * towards the memory of the store.
+ */
+
+/* the largest value that is allowed to be stored. */
+#define KV_MAX_VALUE_SIZE (64 * 1024 * 1024)
+
+/* the largest key that is allowed to be stored. */
+#define KV_MAX_KEY_SIZE 4096
+
+/* returned by kv_store_put for an item larger than the memory limit. */
+#define KV_PUT_TOO_LARGE (-1)
+
+/**
+ * A single key / value pair. The key and value are stored back to back in the
+ * same slab object, so an entry is only a single allocation.
+ */
+typedef struct KvItem {
+  /* links the item into the store's timing wheel while it has an
+   * expiration. Only ever used by the actor, so it is left out of
+   * snapshots. */
+  TimerNode timer;
+
+  /* the amount of threads that are still reading the value, only
+   * decremented by those threads. */
+  atomic_uint lent;
+
+  /* the wall clock time in milliseconds at which the item expires, 0 if
+   * it never does. */
+  uint64_t expires_at;
+  uint32_t key_len;
+  uint32_t value_len;
+  char data[];
+} KvItem;
+
+/* where the part of an item that is the same for every reader starts. */
+#define KV_ITEM_SHARED_OFFSET offsetof(KvItem, expires_at)
+
+typedef struct KvStore {
+  /* the allocator of the owning actor that the items are stored in. */
+  Slab *slab;
+
+  /* maps the keys to the KvItem that holds them. */
+  SwissTable *index;
+
+  /* the keys in byte order, NULL unless the store is ordered. */
+  BTree *ordered;
+
+  /* the items that have an expiration, by the time that they expire. */
+  TimerWheel *timers;
+
+  /* the time of the last call to kv_store_expire, items that expired
+   * before it are not returned anymore. */
+  uint64_t now;
+
+  /* the amount of bytes used by the stored items. */
+  size_t item_bytes;
+
+  /* the most bytes that the items and the index may use, 0 if there is
+   * no limit. */
+  size_t memory_limit;
+
+  /* the position of the CLOCK hand in the slots of the index. */
+  size_t clock_hand;
+
+  /* counters that are only written by the actor and read by the stats
+   * thread. */
+  atomic_long hits;
+  atomic_long misses;
+  atomic_long evictions;
+  atomic_long expirations;
+
+  /* while pinned, the items that are replaced or removed are kept in the
+   * retired list instead of being freed, so that another thread can keep
+   * reading them. Items whose value is lent out are kept there as well
+   * till it comes back. */
+  int pinned;
+  KvItem **retired;
+  size_t retired_count;
+  size_t retired_capacity;
+
+  /* the amount of bytes used by the retired items. */
+  size_t retired_bytes;
+
+  /* the items inside of this range live in a mapped snapshot file and are
+   * never handed back to the slab. */
+  const char *mapped_start;
+  const char *mapped_end;
+} KvStore;
+
+/**
+ * Constructs an empty store whose items are allocated out of the given
+ * slab.
+ */
+KvStore *kv_store_init(Slab *slab);
+
+/**
+ * Frees the store and all of the items inside of it.
+ */
+void kv_store_destroy(KvStore *store);
+
+/**
+ * Looks up the item stored for the given key, returns NULL if the key does
+ * not exist or has expired. The item is only valid till the next
+ * modification of the store.
+ */
+KvItem *kv_store_get(KvStore *store, const char *key, size_t key_len);
+
+/**
+ * Stores the given value for the key, replacing any previous value. The
+ * key and value are copied into the store. The item expires at the given
+ * wall clock time in milliseconds, or never when it is 0. Returns 1 if the
+ * key did not exist yet and 0 if an existing value was replaced. Returns
+ * KV_PUT_TOO_LARGE without changing anything when the item would not fit
+ * within the memory limit even with every other item evicted.
+ */
+int kv_store_put(KvStore *store, const char *key, size_t key_len,
+		 const char *value, size_t value_len, uint64_t expires_at);
+
+/**
+ * Removes the given key. Returns 1 if the key was removed and 0 if it did
+ * not exist.
+ */
+int kv_store_delete(KvStore *store, const char *key, size_t key_len);
+
+/**
+ * Removes up to max items that expired at or before the given wall clock
+ * time in milliseconds and returns how many were removed. Items that are
+ * left over stay invisible to kv_store_get and are removed by the next
+ * call.
+ */
+size_t kv_store_expire(KvStore *store, uint64_t now, size_t max);
+
+/**
+ * The current wall clock time in milliseconds, the time base of the
+ * expirations.
+ */
+uint64_t kv_store_clock(void);
+
+/**
+ * The amount of keys that are stored.
+ */
+size_t kv_store_size(KvStore *store);
+
+/**
+ * The amount of bytes used by the items and the index of the store,
+ * including the removed items that are still lent out or pinned.
+ */
+size_t kv_store_memory(KvStore *store);
+
+/**
+ * Limits the amount of bytes that the store uses, evicting items as soon
+ * as it is over the limit. A limit of 0 means there is no limit.
+ */
+void kv_store_set_memory_limit(KvStore *store, size_t memory_limit);
+
+/**
+ * Keeps the keys of the store in order as well, which kv_store_scan needs.
+ * The store must still be empty.
+ */
+void kv_store_enable_ordered(KvStore *store);
+
+/**
+ * Fills the array with up to max items whose keys are equal to or larger
+ * than start and smaller than end, in key order, and returns how many were
+ * found. An end of length 0 means that there is no upper bound. The items
+ * are only valid till the next modification of the store, and the store
+ * must be ordered.
+ */
+size_t kv_store_scan(KvStore *store, const char *start, size_t start_len,
+		     const char *end, size_t end_len, KvItem **items, size_t max);
+
+/**
+ * Makes room for the given amount of keys up front so that the index does
+ * not have to grow while they are added. The store must still be empty.
+ */
+void kv_store_reserve(KvStore *store, size_t count);
+
+/**
+ * Marks the memory range as holding items that are not owned by the slab,
+ * the mapping of a snapshot file. Items in the range are added with
+ * kv_store_put_item and are never freed.
+ */
+void kv_store_set_mapped(KvStore *store, const char *start, const char *end);
+
+/**
+ * Adds an existing item to the store, replacing any previous item for its
+ * key. The item must live inside of the mapped range. An item that does
+ * not fit within the memory limit on its own is left out and counted as
+ * evicted.
+ */
+void kv_store_put_item(KvStore *store, KvItem *item);
+
+/**
+ * Returns a newly allocated array of every item in the store and pins them:
+ * till kv_store_unpin is called no item is freed, so another thread can read
+ * the items of the array while the store keeps changing.
+ */
+KvItem **kv_store_pin(KvStore *store, size_t *count);
+
+/**
+ * Frees every item that was replaced or removed while the store was pinned.
+ */
+void kv_store_unpin(KvStore *store);
+
+/**
+ * Lends the value of the item out to another thread, which has to hand it
+ * back with kv_store_return once it does not read it anymore. The item is
+ * not freed till then, even when it is removed from the store.
+ */
+void kv_store_lend(KvStore *store, KvItem *item);
+
+/**
+ * Hands back the value of an item that was lent out. Can be called from
+ * any thread.
+ */
+void kv_store_return(void *item);
+
+static inline const char *kv_item_key(const KvItem *item) {
+  return item->data;
+}
+
+static inline const char *kv_item_value(const KvItem *item) {
+  return item->data + item->key_len;
+}
+
+#endif
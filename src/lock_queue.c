@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "logging.h"
+#include "queue.h"
+
+typedef struct Queue {
+  /* max size of the queue */
+  size_t max_size;
+  /* how many items are currently in the queue */
+  size_t current_size;
+  /* stores the pointers to items in the queue */
+  void **ring_buffer;
+  /* the offset in the buffer where items will be added to */
+  size_t enqueue_offset;
+  /* the offset in the buffer where items will be removed from */
+  size_t dequeue_offset;
+  
+  pthread_mutex_t lock;
+
+  int add_event;
+
+  /* set when the event file descriptor is only notified on demand, and
+   * then the flag that the reader sets before it goes to sleep. Both are
+   * guarded by the lock. */
+  int on_demand;
+  int sleeping;
+
+  /* the amount of notifications that were sent. */
+  atomic_long doorbells;
+  
+} Queue;
+
+
+static inline int is_full(Queue *queue) {
+  return queue->current_size == queue->max_size;
+}
+
+static inline int is_empty(Queue *queue) {
+  return queue->current_size == 0;
+}
+
+Queue *queue_init(size_t max_size) {
+  Queue *queue = (Queue*) CHECK_MEM(calloc(1, sizeof(Queue)));
+  queue->max_size = max_size;
+  queue->ring_buffer = CHECK_MEM(calloc(max_size, sizeof(void*)));
+
+  int r = pthread_mutex_init(&queue->lock, NULL);
+  CHECK(r != 0, "Failed to create mutex");
+
+  queue->add_event = eventfd(0, EFD_NONBLOCK);
+  queue->on_demand = 0;
+  queue->sleeping = 0;
+  queue->doorbells = ATOMIC_VAR_INIT(0);
+  
+  return queue;
+}
+
+void queue_destroy(Queue *queue) {
+  free(queue->ring_buffer);
+
+  int r = pthread_mutex_destroy(&queue->lock);
+  CHECK(r != 0, "Failed to destory mutex");
+  close(queue->add_event);
+  
+  free(queue);
+}
+
+size_t queue_size(Queue *queue) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  size_t size = queue->current_size;
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+
+  return size;
+}
+
+int queue_add_event_fd(Queue *queue) {
+  return queue->add_event;
+}
+
+void queue_ring_on_demand(Queue *queue) {
+  queue->on_demand = 1;
+}
+
+int queue_prepare_sleep(Queue *queue) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  queue->sleeping = 1;
+  int pending = !is_empty(queue);
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+  return pending;
+}
+
+long queue_doorbells(Queue *queue) {
+  return atomic_load_explicit(&queue->doorbells, memory_order_relaxed);
+}
+
+enum QueueResult queue_push(Queue *queue, void *ptr) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  if (is_full(queue)) {
+    r = pthread_mutex_unlock(&queue->lock);
+    CHECK(r != 0, "Failed to unlock mutex");
+    return QUEUE_FAILURE;
+  }
+
+  queue->ring_buffer[queue->enqueue_offset] = ptr;
+  queue->enqueue_offset = (queue->enqueue_offset + 1) % queue->max_size;
+  queue->current_size++;
+
+  int ring = !queue->on_demand || queue->sleeping;
+  queue->sleeping = 0;
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+
+  if (ring) {
+    r = eventfd_write(queue->add_event, 1);
+    CHECK(r != 0, "Failed to send event notification");
+    atomic_fetch_add_explicit(&queue->doorbells, 1, memory_order_relaxed);
+  }
+  return QUEUE_SUCCESS;
+}
+
+size_t queue_push_batch(Queue *queue, void **ptrs, size_t count) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  size_t room = queue->max_size - queue->current_size;
+  if (count > room) {
+    count = room;
+  }
+  for (size_t i = 0 ; i < count ; i++) {
+    queue->ring_buffer[queue->enqueue_offset] = ptrs[i];
+    queue->enqueue_offset = (queue->enqueue_offset + 1) % queue->max_size;
+  }
+  queue->current_size += count;
+
+  int ring = count > 0 && (!queue->on_demand || queue->sleeping);
+  if (count > 0) {
+    queue->sleeping = 0;
+  }
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+
+  if (ring) {
+    r = eventfd_write(queue->add_event, count);
+    CHECK(r != 0, "Failed to send event notification");
+    atomic_fetch_add_explicit(&queue->doorbells, 1, memory_order_relaxed);
+  }
+  return count;
+}
+
+void *queue_pop(Queue *queue) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  if (is_empty(queue)) {
+    r = pthread_mutex_unlock(&queue->lock);
+    CHECK(r != 0, "Failed to unlock mutex");
+    return NULL;
+  }
+
+  void *ptr = queue->ring_buffer[queue->dequeue_offset];
+  queue->dequeue_offset = (queue->dequeue_offset + 1) % queue->max_size;
+  queue->current_size--;
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+  return ptr;
+}
+
+size_t queue_pop_batch(Queue *queue, void **ptrs, size_t max_count) {
+  int r = pthread_mutex_lock(&queue->lock);
+  CHECK(r != 0, "Failed to lock mutex");
+
+  if (max_count > queue->current_size) {
+    max_count = queue->current_size;
+  }
+  for (size_t i = 0 ; i < max_count ; i++) {
+    ptrs[i] = queue->ring_buffer[queue->dequeue_offset];
+    queue->dequeue_offset = (queue->dequeue_offset + 1) % queue->max_size;
+  }
+  queue->current_size -= max_count;
+
+  r = pthread_mutex_unlock(&queue->lock);
+  CHECK(r != 0, "Failed to unlock mutex");
+  return max_count;
+}
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/filter.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -11,18 +12,26 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "actor.h"
+#include "config.h"
 #include "io_worker.h"
 #include "logging.h"
+#include "mrmw_queue.h"
 #include "queue.h"
 #include "request_context.h"
+#include "router.h"
 #include "server.h"
 #include "server_stats.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "wal.h"
 #include "stats_thread.h"
+#include "uring_worker.h"
 
 static int create_socket(uint16_t port, int queue_length) {
   int opt = 1;
@@ -56,11 +65,74 @@ static int create_socket(uint16_t port, int queue_length) {
   return sock;
 }
 
+/**
+ * Attaches a program to the group of listening sockets that picks the
+ * socket of the IO worker that is pinned to the core that received the
+ * connection. The sockets are numbered in the order they were bound in,
+ * which is the order of the workers. Connections that arrive on any other
+ * core are spread over the workers by the core.
+ */
+static void attach_steering_program(int sock, ServerConfig *config) {
+  int worker_count = config->io_core_count;
+  size_t len = 0;
+  struct sock_filter *code =
+    (struct sock_filter*) CHECK_MEM(calloc((size_t) worker_count * 2 + 3,
+					   sizeof(struct sock_filter)));
+
+  code[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+					      (uint32_t) (SKF_AD_OFF + SKF_AD_CPU));
+  for (int i = 0 ; i < worker_count ; i++) {
+    code[len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+						(uint32_t) config->io_cores[i], 0, 1);
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, (uint32_t) i);
+  }
+  code[len++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+					      (uint32_t) worker_count);
+  code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+  struct sock_fprog program = {
+    .len = (unsigned short) len,
+    .filter = code,
+  };
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+		 sizeof(program)) == -1) {
+    LOG_WARN("Failed to attach the steering program, connections are spread "
+	     "by their hash");
+  }
+  free(code);
+}
+
+/**
+ * Lets the kernel busy poll the device queue of the socket for up to the
+ * given time on reads that would block. The connections that are accepted
+ * on the socket inherit the setting. Raising it past the net.core.busy_read
+ * sysctl needs CAP_NET_ADMIN, without which the workers only spin in user
+ * space.
+ */
+static void enable_busy_poll(int sock, int micros) {
+  if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &micros, sizeof(micros)) == -1) {
+    LOG_WARN("Failed to set SO_BUSY_POLL, only polling in user space");
+  }
+}
+
 void create_actor(Server *server, int id, ActorInfo *actor) {
   actor->id = id;
   actor->server = server;
   actor->queue_count = server->io_worker_count;
   actor->startup = &server->startup;
+  actor->slab = slab_init();
+  actor->wal = NULL;
+  actor->snapshot = NULL;
+  actor->epoll_info = NULL;
+  atomic_init(&actor->parked_requests, 0);
+  atomic_init(&actor->rejected_requests, 0);
+  atomic_init(&actor->parked_replies, 0);
+  actor->reply_backlogs = NULL;
+  actor->parked_reply_count = 0;
+  if (server->config->data_dir != NULL) {
+    actor->wal = wal_init(server->config->data_dir, id);
+    actor->snapshot = snapshot_init(server->config->data_dir, id, server->actor_count);
+  }
   actor->input_queue = CHECK_MEM(malloc(((size_t) server->io_worker_count) * sizeof(size_t)));
 
   for (int i = 0 ; i < server->io_worker_count ; i++) {
@@ -94,7 +166,12 @@ pthread_t create_io_worker(int id, int sock_fd, Server *server) {
   args->server = server;
   
   pthread_t thread;
-  int r = pthread_create(&thread, NULL, io_event_loop, args);
+  void *(*event_loop) (void*) = io_event_loop;
+  if (server->config->io_engine == IO_ENGINE_URING) {
+    event_loop = uring_event_loop;
+  }
+
+  int r = pthread_create(&thread, NULL, event_loop, args);
   CHECK(r != 0, "Failed to create input actor thread");
 
   // input actor thread is not detached so that we can call
@@ -106,6 +183,18 @@ pthread_t create_io_worker(int id, int sock_fd, Server *server) {
   r = pthread_setname_np(thread, name);
   CHECK(r != 0, "Failed to set input actor name");
 
+  ServerConfig *config = server->config;
+  if (config->io_cores != NULL) {
+    int core = config->io_cores[id];
+    CHECK(core < 0 || core >= CPU_SETSIZE, "Core %d of IO worker %d is out of range", core, id);
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET((size_t) core, &cpu_set);
+    r = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpu_set);
+    CHECK(r != 0, "Failed to set cpu affinity of IO worker %d to %d", id,
+	  config->io_cores[id]);
+  }
+
   return thread;
 }
 
@@ -124,28 +213,37 @@ int main(int argc, char* argv[]) {
   int queue_length = 10;
   int cores = get_nprocs();
   pid_t pid = getpid();
+  int r;
   
-  int io_worker_count;
-  uint16_t port;
-  
-  if (argc == 3) {
-    io_worker_count = atoi(argv[1]);
-    port = (uint16_t) atoi(argv[2]);
-  } else {
-    io_worker_count = 2;
-    port = 8080;
-  }
+  ServerConfig config;
+  config_parse(&config, argc, argv);
+  int io_worker_count = config.io_worker_count;
+  uint16_t port = config.port;
       
   LOG_INFO("starting up pid=%d port=%d", pid, port);
 
+  if (config.data_dir != NULL) {
+    r = mkdir(config.data_dir, 0755);
+    CHECK(r != 0 && errno != EEXIST, "Failed to create data directory %s",
+	  config.data_dir);
+    snapshot_check_actor_count(config.data_dir, cores);
+  }
+
   struct Server server;
+  server.config = &config;
   server.server_stats = server_stats_init();
   server.io_worker_count = io_worker_count;
   server.actor_count = cores;
   server.app_actors = (ActorInfo*) CHECK_MEM(calloc((size_t) cores, sizeof(ActorInfo)));
+  server.router = router_init(server.actor_count, ROUTER_SHARD_COUNT, NULL);
+  server.shared_queue = mrmw_queue_init(SHARED_QUEUE_SIZE);
+  server.io_epoll_infos =
+    (EpollInfo**) CHECK_MEM(calloc((size_t) io_worker_count, sizeof(EpollInfo*)));
 
-  int r = pthread_barrier_init(&server.startup, NULL,
-			       (uint) (server.actor_count + server.io_worker_count));
+  /* the stats thread waits as well, so that it only reads the stores
+   * once the actors created them. */
+  r = pthread_barrier_init(&server.startup, NULL,
+			       (uint) (server.actor_count + server.io_worker_count + 1));
   CHECK(r != 0, "Failed to construct pthread barrier");
 
   create_stats(&server);
@@ -154,10 +252,22 @@ int main(int argc, char* argv[]) {
     create_actor(&server, i, &server.app_actors[i]);
   }
 
+  /* every socket is bound before any worker starts, so that the steering
+   * program sees the whole group. */
+  int *sock_fds = (int*) CHECK_MEM(calloc((size_t) io_worker_count, sizeof(int)));
+  for (int i = 0 ; i < io_worker_count ; i++) {
+    sock_fds[i] = create_socket(port, queue_length);
+    if (config.busy_poll > 0) {
+      enable_busy_poll(sock_fds[i], config.busy_poll);
+    }
+  }
+  if (config.io_cores != NULL) {
+    attach_steering_program(sock_fds[0], &config);
+  }
+
   pthread_t io_thread;
   for (int i = 0 ; i < io_worker_count ; i++) {
-    int sock_fd = create_socket(port, queue_length);
-    io_thread = create_io_worker(i, sock_fd, &server);
+    io_thread = create_io_worker(i, sock_fds[i], &server);
   }
   
   void *ptr;
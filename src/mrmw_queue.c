@@ -1,116 +1,264 @@
 #define _GNU_SOURCE
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <stdlib.h>
+#include <string.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
+
 #include "logging.h"
-#include "queue.h"
+#include "mrmw_queue.h"
+
+/* the size of a cache line, which the offsets of the writers and the
+ * readers are kept apart by. */
+#define CACHE_LINE_SIZE 64
+
+typedef struct MrMwCell {
+  /* equal to the offset that the next push onto the cell has, and to the
+   * offset + 1 once the cell holds the item of that push. */
+  _Atomic size_t sequence;
+  void *data;
+} MrMwCell;
+
+typedef struct MrMwQueue {
+  /* the offset that the next item is added at. It only grows, and is
+   * wrapped with the mask when the cells are accessed. */
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t enqueue_offset;
+
+  /* the offset that the next item is removed from. */
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t dequeue_offset;
 
-typedef struct Queue {
   /* max size of the queue */
-  size_t max_size;
-  /* how many items are currently in the queue */
-  size_t current_size;
+  _Alignas(CACHE_LINE_SIZE) size_t max_size;
+  size_t mask;
   /* stores the pointers to items in the queue */
-  void **ring_buffer;
-  /* the offset in the buffer where items will be added to */
-  size_t enqueue_offset;
-  /* the offset in the buffer where items will be removed from */
-  size_t dequeue_offset;
-  
-  pthread_mutex_t lock;
+  MrMwCell *cells;
 
+  /* a semaphore that counts every item that was added. */
   int add_event;
-  
-} Queue;
 
+  /* the number of threads waiting to push to the queue but cannot due
+   * to there not being enough space */
+  atomic_size_t num_waiting_full;
+  /* the number of threads waiting to pop from the queue but cannot due
+   * to there not being any items available */
+  atomic_size_t num_waiting_empty;
 
-static inline int is_full(Queue *queue) {
-  return queue->current_size == queue->max_size;
-}
+  /* only used by the blocking operations to wait on. */
+  pthread_mutex_t lock;
+  pthread_cond_t is_empty;
+  pthread_cond_t is_full;
+} MrMwQueue;
 
-static inline int is_empty(Queue *queue) {
-  return queue->current_size == 0;
+static inline size_t pow_2_size(size_t value) {
+  value--;
+  value |= value >> 1;
+  value |= value >> 2;
+  value |= value >> 4;
+  value |= value >> 8;
+  value |= value >> 16;
+  value |= value >> 32;
+  value++;
+  return value;
 }
 
-Queue *queue_init(size_t max_size) {
-  Queue *queue = (Queue*) CHECK_MEM(calloc(1, sizeof(Queue)));
+MrMwQueue *mrmw_queue_init(size_t max_size) {
+  max_size = pow_2_size(max_size < 2 ? 2 : max_size);
+
+  MrMwQueue *queue = NULL;
+  int r = posix_memalign((void**) &queue, CACHE_LINE_SIZE, sizeof(MrMwQueue));
+  CHECK(r != 0, "Failed to malloc an aligned queue");
+  memset(queue, 0, sizeof(MrMwQueue));
+
   queue->max_size = max_size;
-  queue->ring_buffer = CHECK_MEM(calloc(max_size, sizeof(void*)));
+  queue->mask = max_size - 1;
+  queue->cells = (MrMwCell*) CHECK_MEM(calloc(max_size, sizeof(MrMwCell)));
+  for (size_t i = 0 ; i < max_size ; i++) {
+    atomic_init(&queue->cells[i].sequence, i);
+  }
+  atomic_init(&queue->enqueue_offset, 0);
+  atomic_init(&queue->dequeue_offset, 0);
+  atomic_init(&queue->num_waiting_full, 0);
+  atomic_init(&queue->num_waiting_empty, 0);
 
-  int r = pthread_mutex_init(&queue->lock, NULL);
-  CHECK(r != 0, "Failed to create mutex");
+  queue->add_event = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE);
+  CHECK(queue->add_event == -1, "Failed to create the event file descriptor");
 
-  queue->add_event = eventfd(0, EFD_NONBLOCK);
-  
+  r = pthread_mutex_init(&queue->lock, NULL);
+  CHECK(r != 0, "Failed to create mutex");
+  r = pthread_cond_init(&queue->is_empty, NULL);
+  CHECK(r != 0, "Failed to create condition");
+  r = pthread_cond_init(&queue->is_full, NULL);
+  CHECK(r != 0, "Failed to create condition");
   return queue;
 }
 
-void queue_destroy(Queue *queue) {
-  free(queue->ring_buffer);
-
-  int r = pthread_mutex_destroy(&queue->lock);
-  CHECK(r != 0, "Failed to destory mutex");
+void mrmw_queue_destroy(MrMwQueue *queue) {
+  pthread_cond_destroy(&queue->is_full);
+  pthread_cond_destroy(&queue->is_empty);
+  pthread_mutex_destroy(&queue->lock);
   close(queue->add_event);
-  
+  free(queue->cells);
   free(queue);
 }
 
-size_t queue_size(Queue *queue) {
-  int r = pthread_mutex_lock(&queue->lock);
-  CHECK(r != 0, "Failed to lock mutex");
+size_t mrmw_queue_size(MrMwQueue *queue) {
+  size_t dequeue = atomic_load_explicit(&queue->dequeue_offset, memory_order_acquire);
+  size_t enqueue = atomic_load_explicit(&queue->enqueue_offset, memory_order_acquire);
+  return enqueue >= dequeue ? enqueue - dequeue : 0;
+}
 
-  size_t size = queue->current_size;
+int mrmw_queue_add_event_fd(MrMwQueue *queue) {
+  return queue->add_event;
+}
 
-  r = pthread_mutex_unlock(&queue->lock);
-  CHECK(r != 0, "Failed to unlock mutex");
+/**
+ * Wakes up a thread that blocks on the condition. The waiters announce
+ * themselves before they check the queue one last time, and the fence
+ * orders the change to the queue before the check for waiters, so that
+ * either the waiter sees the change or it is woken up.
+ */
+static void wake_waiter(MrMwQueue *queue, atomic_size_t *num_waiting,
+			pthread_cond_t *condition) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(num_waiting, memory_order_relaxed) == 0) {
+    return;
+  }
 
-  return size;
+  pthread_mutex_lock(&queue->lock);
+  pthread_cond_signal(condition);
+  pthread_mutex_unlock(&queue->lock);
 }
 
-int queue_add_event_fd(Queue *queue) {
-  return queue->add_event;
+/**
+ * Adds the item if there is room, without waking up anybody.
+ */
+static enum MrMwQueueResult try_push(MrMwQueue *queue, void *ptr) {
+  MrMwCell *cell;
+  size_t offset = atomic_load_explicit(&queue->enqueue_offset, memory_order_relaxed);
+  while (1) {
+    cell = &queue->cells[offset & queue->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) offset;
+
+    if (diff == 0) {
+      /* the cell is free, so it is taken if no other writer got it. */
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_offset, &offset, offset + 1,
+						memory_order_relaxed, memory_order_relaxed)) {
+	break;
+      }
+    } else if (diff < 0) {
+      /* the cell still holds an item from the last time around. */
+      return MRMW_QUEUE_FAIL;
+    } else {
+      offset = atomic_load_explicit(&queue->enqueue_offset, memory_order_relaxed);
+    }
+  }
+
+  cell->data = ptr;
+  atomic_store_explicit(&cell->sequence, offset + 1, memory_order_release);
+
+  int r = eventfd_write(queue->add_event, 1);
+  CHECK(r != 0, "Failed to send event notification");
+  return MRMW_QUEUE_SUCCESS;
 }
 
-enum QueueResult queue_push(Queue *queue, void *ptr) {
-  int r = pthread_mutex_lock(&queue->lock);
-  CHECK(r != 0, "Failed to lock mutex");
+/**
+ * Removes the next item if there is one, without waking up anybody.
+ */
+static enum MrMwQueueResult try_pop(MrMwQueue *queue, void **ptr) {
+  MrMwCell *cell;
+  size_t offset = atomic_load_explicit(&queue->dequeue_offset, memory_order_relaxed);
+  while (1) {
+    cell = &queue->cells[offset & queue->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) (offset + 1);
 
-  if (is_full(queue)) {
-    r = pthread_mutex_unlock(&queue->lock);
-    CHECK(r != 0, "Failed to unlock mutex");
-    return QUEUE_FAILURE;
+    if (diff == 0) {
+      /* the cell holds an item, which is taken if no other reader got it. */
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_offset, &offset, offset + 1,
+						memory_order_relaxed, memory_order_relaxed)) {
+	break;
+      }
+    } else if (diff < 0) {
+      /* nothing was pushed onto the cell yet. */
+      return MRMW_QUEUE_FAIL;
+    } else {
+      offset = atomic_load_explicit(&queue->dequeue_offset, memory_order_relaxed);
+    }
   }
 
-  queue->ring_buffer[queue->enqueue_offset] = ptr;
-  queue->enqueue_offset = (queue->enqueue_offset + 1) % queue->max_size;
-  queue->current_size++;
+  *ptr = cell->data;
+  /* hands the cell to the writer that gets to it the next time around. */
+  atomic_store_explicit(&cell->sequence, offset + queue->mask + 1, memory_order_release);
+  return MRMW_QUEUE_SUCCESS;
+}
+
+enum MrMwQueueResult mrmw_queue_trypush(MrMwQueue *queue, void *ptr) {
+  if (try_push(queue, ptr) != MRMW_QUEUE_SUCCESS) {
+    return MRMW_QUEUE_FAIL;
+  }
+  wake_waiter(queue, &queue->num_waiting_empty, &queue->is_empty);
+  return MRMW_QUEUE_SUCCESS;
+}
 
-  r = eventfd_write(queue->add_event, 1);
-  CHECK(r != 0, "Failed to send event notification");
+enum MrMwQueueResult mrmw_queue_trypop(MrMwQueue *queue, void **ptr) {
+  if (try_pop(queue, ptr) != MRMW_QUEUE_SUCCESS) {
+    return MRMW_QUEUE_FAIL;
+  }
+  wake_waiter(queue, &queue->num_waiting_full, &queue->is_full);
+  return MRMW_QUEUE_SUCCESS;
+}
+
+enum MrMwQueueResult mrmw_queue_pop_event(MrMwQueue *queue, void **ptr) {
+  eventfd_t count;
+  if (eventfd_read(queue->add_event, &count) != 0) {
+    return MRMW_QUEUE_FAIL;
+  }
 
-  r = pthread_mutex_unlock(&queue->lock);
-  CHECK(r != 0, "Failed to unlock mutex");
-  return QUEUE_SUCCESS;
+  /* the notification is only sent once the item is in its cell, but the
+   * cell at the head can still belong to a writer that took its offset
+   * earlier and did not fill it yet. */
+  while (try_pop(queue, ptr) != MRMW_QUEUE_SUCCESS) {
+    sched_yield();
+  }
+  wake_waiter(queue, &queue->num_waiting_full, &queue->is_full);
+  return MRMW_QUEUE_SUCCESS;
 }
 
-void *queue_pop(Queue *queue) {
-  int r = pthread_mutex_lock(&queue->lock);
-  CHECK(r != 0, "Failed to lock mutex");
+void mrmw_queue_push(MrMwQueue *queue, void *ptr) {
+  if (mrmw_queue_trypush(queue, ptr) == MRMW_QUEUE_SUCCESS) {
+    return;
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  atomic_fetch_add_explicit(&queue->num_waiting_full, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (try_push(queue, ptr) != MRMW_QUEUE_SUCCESS) {
+    pthread_cond_wait(&queue->is_full, &queue->lock);
+  }
+  atomic_fetch_sub_explicit(&queue->num_waiting_full, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&queue->lock);
 
-  if (is_empty(queue)) {
-    r = pthread_mutex_unlock(&queue->lock);
-    CHECK(r != 0, "Failed to unlock mutex");
-    return NULL;
+  wake_waiter(queue, &queue->num_waiting_empty, &queue->is_empty);
+}
+
+void mrmw_queue_pop(MrMwQueue *queue, void **data) {
+  if (mrmw_queue_trypop(queue, data) == MRMW_QUEUE_SUCCESS) {
+    return;
   }
 
-  void *ptr = queue->ring_buffer[queue->dequeue_offset];
-  queue->dequeue_offset = (queue->dequeue_offset + 1) % queue->max_size;
-  queue->current_size--;
+  pthread_mutex_lock(&queue->lock);
+  atomic_fetch_add_explicit(&queue->num_waiting_empty, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (try_pop(queue, data) != MRMW_QUEUE_SUCCESS) {
+    pthread_cond_wait(&queue->is_empty, &queue->lock);
+  }
+  atomic_fetch_sub_explicit(&queue->num_waiting_empty, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&queue->lock);
 
-  r = pthread_mutex_unlock(&queue->lock);
-  CHECK(r != 0, "Failed to unlock mutex");
-  return ptr;
+  wake_waiter(queue, &queue->num_waiting_full, &queue->is_full);
 }
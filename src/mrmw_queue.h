@@ -1,40 +1,31 @@
 #ifndef __mrmw_queue_h__
 #define __mrmw_queue_h__
 
-#include <sys/eventfd.h>
+#include <stddef.h>
+
+/**
+ * A bounded queue that any number of threads can push onto and pop from at
+ * the same time. It is a ring of slots that each carry a sequence number,
+ * which tells the writers and the readers whose turn it is on the slot, so
+ * that pushing and popping only takes a compare-and-swap on the offset and
+ * no lock.
+ *
+ * Readers can either block on the queue with mrmw_queue_pop, or wait on its
+ * event file descriptor, which is a semaphore that counts every message
+ * that is added.
+ */
 
 enum MrMwQueueResult {
   MRMW_QUEUE_SUCCESS,
   MRMW_QUEUE_FAIL,
 };
 
-typedef struct MrMwQueue {
-  /* max size of the queue */
-  size_t max_size;
-  /* how many items are currently in the queue */
-  size_t current_size;
-  /* stores the pointers to items in the queue */
-  void **ring_buffer;
-  /* the offset in the buffer where items will be added to */
-  size_t enqueue_offset;
-  /* the offset in the buffer where items will be removed from */
-  size_t dequeue_offset;
-  /* the number of threads waiting to push to the queue but cannot due
-   * to there not being enough space */
-  size_t num_waiting_full;
-  /* the number of threads waiting to pop from the queue but cannot due
-   * to there not being any items available */
-  size_t num_waiting_empty;
-  
-  pthread_mutex_t lock;
-  pthread_cond_t is_empty;
-  pthread_cond_t is_full;
-} MrMwQueue;
-
-
-/**
- * Creates a concurrent queue that has a max capacity of max_size. Operations
- * will block if more than that many items try to be added to the queue.
+typedef struct MrMwQueue MrMwQueue;
+
+/**
+ * Creates a concurrent queue that has a max capacity of max_size, rounded up
+ * to a power of two. Operations will block if more than that many items try
+ * to be added to the queue.
  */
 MrMwQueue *mrmw_queue_init(size_t max_size);
 
@@ -42,20 +33,47 @@ void mrmw_queue_destroy(MrMwQueue *queue);
 
 /**
  * Gets the current amount of items that are in the queue. This is a
- * thread-safe operation.
+ * thread-safe operation, but the amount can be outdated by the time it is
+ * returned.
  */
 size_t mrmw_queue_size(MrMwQueue *queue);
 
+/**
+ * Returns the event file descriptor that is notified for every message that
+ * is added. It is a semaphore, so every read takes one notification, after
+ * which one message can be popped.
+ */
+int mrmw_queue_add_event_fd(MrMwQueue *queue);
+
 /**
  * Enqueues an item onto the queue. This blocks till the operation can
  * complete.
  */
 void mrmw_queue_push(MrMwQueue *queue, void *ptr);
 
+/**
+ * Tries to enqueue an item onto the queue, failing when it is full.
+ */
 enum MrMwQueueResult mrmw_queue_trypush(MrMwQueue *queue, void *ptr);
 
+/**
+ * Dequeues an item from the queue into data. This blocks till there is an
+ * item.
+ */
 void mrmw_queue_pop(MrMwQueue *queue, void **data);
 
+/**
+ * Tries to dequeue an item from the queue into ptr, failing when it is
+ * empty.
+ */
 enum MrMwQueueResult mrmw_queue_trypop(MrMwQueue *queue, void **ptr);
 
+/**
+ * Takes a notification off of the event file descriptor and dequeues the
+ * item that it stands for into ptr, failing when there is no notification.
+ * The item is waited for when its writer did not finish adding it yet, so
+ * every reader has to go through the notifications for this to hold.
+ */
+enum MrMwQueueResult mrmw_queue_pop_event(MrMwQueue *queue, void **ptr);
+
 #endif
@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "logging.h"
@@ -25,8 +27,47 @@ static inline void resize(OutputBuffer *buffer, size_t min_size) {
 }
 
 
+/**
+ * Looks up a part of the output. The even parts are the bytes of the buffer
+ * in between the references, the odd parts are the references.
+ */
+static inline void get_part(OutputBuffer *buffer, size_t index, const char **data,
+			    size_t *len) {
+  size_t ref = index >> 1;
+  if (index & 1) {
+    *data = buffer->refs[ref].data;
+    *len = buffer->refs[ref].len;
+    return;
+  }
+
+  size_t from = ref == 0 ? 0 : buffer->refs[ref - 1].offset;
+  size_t to = ref == buffer->ref_count ? buffer->write_into_offset : buffer->refs[ref].offset;
+  *data = buffer->buffer + from;
+  *len = to - from;
+}
+
+static void add_ref(OutputBuffer *buffer, const char *data, size_t len) {
+  if (buffer->ref_count == buffer->ref_capacity) {
+    buffer->ref_capacity = buffer->ref_capacity == 0 ? 8 : buffer->ref_capacity << 1;
+    buffer->refs = (OutputRef*) CHECK_MEM(realloc(buffer->refs,
+						  buffer->ref_capacity * sizeof(OutputRef)));
+  }
+  OutputRef *ref = &buffer->refs[buffer->ref_count++];
+  ref->offset = buffer->write_into_offset;
+  ref->data = data;
+  ref->len = len;
+  buffer->ref_bytes += len;
+}
+
+static void release_all(OutputBuffer *buffer) {
+  for (size_t i = 0 ; i < buffer->release_count ; i++) {
+    buffer->releases[i].release(buffer->releases[i].arg);
+  }
+  buffer->release_count = 0;
+}
+
 OutputBuffer *output_buffer_init(size_t size) {
-  OutputBuffer *buffer = (OutputBuffer*) CHECK_MEM(malloc(sizeof(OutputBuffer)));
+  OutputBuffer *buffer = (OutputBuffer*) CHECK_MEM(calloc(1, sizeof(OutputBuffer)));
   buffer->buffer = (char*) CHECK_MEM(malloc(size * sizeof(char)));
   buffer->length = size;
   buffer->write_from_offset = 0;
@@ -36,20 +77,83 @@ OutputBuffer *output_buffer_init(size_t size) {
 }
 
 void output_buffer_destroy(OutputBuffer *buffer) {
+  release_all(buffer);
+  free(buffer->refs);
+  free(buffer->releases);
+  free(buffer->iov);
   free(buffer->buffer);
   free(buffer);
 }
 
 void output_buffer_reset(OutputBuffer *buffer) {
+  release_all(buffer);
   buffer->write_from_offset = 0;
   buffer->write_into_offset = 0;
+  buffer->ref_count = 0;
+  buffer->ref_bytes = 0;
+  buffer->part_index = 0;
+  buffer->part_offset = 0;
+}
+
+size_t output_buffer_size(OutputBuffer *buffer) {
+  return buffer->write_into_offset + buffer->ref_bytes;
+}
+
+struct msghdr *output_buffer_prepare(OutputBuffer *buffer) {
+  if (buffer->iov == NULL) {
+    buffer->iov =
+      (struct iovec*) CHECK_MEM(malloc(OUTPUT_BUFFER_IOV_MAX * sizeof(struct iovec)));
+  }
+
+  size_t count = 0;
+  size_t offset = buffer->part_offset;
+  size_t part_count = (buffer->ref_count << 1) + 1;
+  for (size_t i = buffer->part_index ; i < part_count && count < OUTPUT_BUFFER_IOV_MAX ; i++) {
+    const char *data;
+    size_t len;
+    get_part(buffer, i, &data, &len);
+    if (len > offset) {
+      buffer->iov[count].iov_base = (void*) (data + offset);
+      buffer->iov[count].iov_len = len - offset;
+      count++;
+    }
+    offset = 0;
+  }
+
+  memset(&buffer->msg, 0, sizeof(struct msghdr));
+  buffer->msg.msg_iov = buffer->iov;
+  buffer->msg.msg_iovlen = count;
+  return &buffer->msg;
+}
+
+void output_buffer_advance(OutputBuffer *buffer, size_t len) {
+  buffer->write_from_offset += len;
+  size_t part_count = (buffer->ref_count << 1) + 1;
+  while (buffer->part_index < part_count) {
+    const char *data;
+    size_t part_len;
+    get_part(buffer, buffer->part_index, &data, &part_len);
+    if (buffer->part_offset + len < part_len) {
+      buffer->part_offset += len;
+      return;
+    }
+    len -= part_len - buffer->part_offset;
+    buffer->part_offset = 0;
+
+    /* the last part is where the next bytes are appended, so it stays the
+     * current one. */
+    if (buffer->part_index == part_count - 1) {
+      buffer->part_offset = part_len;
+      return;
+    }
+    buffer->part_index++;
+  }
 }
 
 enum WriteState output_buffer_write_to(OutputBuffer *buffer, int fd) {
-  while (buffer->write_from_offset < buffer->write_into_offset) {
-    void *start_addr = buffer->buffer + buffer->write_from_offset;
-    size_t num_to_write = buffer->write_into_offset - buffer->write_from_offset;
-    ssize_t bytes_written = write(fd, start_addr, num_to_write);
+  while (buffer->write_from_offset < output_buffer_size(buffer)) {
+    struct msghdr *msg = output_buffer_prepare(buffer);
+    ssize_t bytes_written = sendmsg(fd, msg, MSG_NOSIGNAL);
 
     switch (bytes_written) {
     case -1:
@@ -61,7 +165,7 @@ enum WriteState output_buffer_write_to(OutputBuffer *buffer, int fd) {
     case 0:
       return WRITE_ERROR;
     default:
-      buffer->write_from_offset += (size_t) bytes_written;
+      output_buffer_advance(buffer, (size_t) bytes_written);
       break;
     }
   }
@@ -79,7 +183,7 @@ void output_buffer_append(OutputBuffer *buffer, const char *fmt, ...) {
     int written = vsnprintf(start_addr, max_to_write, fmt, args);
     CHECK(written < 0, "Failed to construct output buffer");
 
-    if ((size_t) written > max_to_write) {
+    if ((size_t) written >= max_to_write) {
       resize(buffer, buffer->write_into_offset + ((size_t) written) + 1);
     } else {
       buffer->write_into_offset += (size_t) written;
@@ -88,3 +192,53 @@ void output_buffer_append(OutputBuffer *buffer, const char *fmt, ...) {
     va_end(args);
   }
 }
+
+void output_buffer_append_bytes(OutputBuffer *buffer, const char *data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  size_t min_size = buffer->write_into_offset + len;
+  if (min_size > buffer->length) {
+    resize(buffer, min_size);
+  }
+  memcpy(buffer->buffer + buffer->write_into_offset, data, len);
+  buffer->write_into_offset += len;
+}
+
+void output_buffer_append_ref(OutputBuffer *buffer, const char *data, size_t len) {
+  if (len < OUTPUT_BUFFER_REF_MIN) {
+    output_buffer_append_bytes(buffer, data, len);
+    return;
+  }
+  add_ref(buffer, data, len);
+}
+
+void output_buffer_on_release(OutputBuffer *buffer, void (*release) (void *arg),
+			      void *arg) {
+  if (buffer->release_count == buffer->release_capacity) {
+    buffer->release_capacity = buffer->release_capacity == 0 ? 4 : buffer->release_capacity << 1;
+    buffer->releases =
+      (OutputRelease*) CHECK_MEM(realloc(buffer->releases,
+					 buffer->release_capacity * sizeof(OutputRelease)));
+  }
+  buffer->releases[buffer->release_count].release = release;
+  buffer->releases[buffer->release_count].arg = arg;
+  buffer->release_count++;
+}
+
+void output_buffer_append_buffer(OutputBuffer *buffer, OutputBuffer *other) {
+  size_t from = 0;
+  for (size_t i = 0 ; i < other->ref_count ; i++) {
+    OutputRef *ref = &other->refs[i];
+    output_buffer_append_bytes(buffer, other->buffer + from, ref->offset - from);
+    add_ref(buffer, ref->data, ref->len);
+    from = ref->offset;
+  }
+  output_buffer_append_bytes(buffer, other->buffer + from, other->write_into_offset - from);
+
+  for (size_t i = 0 ; i < other->release_count ; i++) {
+    output_buffer_on_release(buffer, other->releases[i].release, other->releases[i].arg);
+  }
+  other->release_count = 0;
+}
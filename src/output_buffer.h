@@ -1,12 +1,38 @@
 #ifndef __output_buffer_h__
 #define __output_buffer_h__
 
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/* the most parts of the output that are handed to a single send. */
+#define OUTPUT_BUFFER_IOV_MAX 64
+
+/* data that is smaller is copied, which is cheaper than sending it as a
+ * part of its own. */
+#define OUTPUT_BUFFER_REF_MIN 1024
+
 enum WriteState {
   WRITE_FINISH = 0,
   WRITE_BUSY = 1,
   WRITE_ERROR = 2,
 };
 
+/* data that is sent out of memory that the buffer does not own, without
+ * copying it into the buffer. */
+typedef struct OutputRef {
+  /* the bytes of the buffer that are sent before the data. */
+  size_t offset;
+  const char *data;
+  size_t len;
+} OutputRef;
+
+/* called once the output does not need the memory it references anymore. */
+typedef struct OutputRelease {
+  void (*release) (void *arg);
+  void *arg;
+} OutputRelease;
+
 typedef struct OutputBuffer {
   /* the pointer to the head of the buffer. This should not be directly
    * accessed by clients. */
@@ -15,7 +41,8 @@ typedef struct OutputBuffer {
   /* stores the total size of this buffer. */
   size_t length;
 
-  /* stores the offset when writing out of this buffer. */
+  /* stores the offset when writing out of this buffer, counting the
+   * referenced data as well. */
   size_t write_from_offset;
 
   /* stores the offset when writing into this buffer. */
@@ -24,6 +51,29 @@ typedef struct OutputBuffer {
   /* the number of times the buffer was resized. */
   size_t resize_count;
 
+  /* the data sent in between the bytes of the buffer, in order. */
+  OutputRef *refs;
+  size_t ref_count;
+  size_t ref_capacity;
+  size_t ref_bytes;
+
+  /* called when the buffer is reset or destroyed. */
+  OutputRelease *releases;
+  size_t release_count;
+  size_t release_capacity;
+
+  /* the part of the output that is written next, where the parts are the
+   * bytes of the buffer and the references in between them, and how much
+   * of that part is written already. */
+  size_t part_index;
+  size_t part_offset;
+
+  /* the parts of the output that are not written yet, set up by
+   * output_buffer_prepare. They stay valid till the next call, so that a
+   * send can be queued with them. The parts are allocated on first use. */
+  struct iovec *iov;
+  struct msghdr msg;
+
 } OutputBuffer;
 
 /**
@@ -44,11 +94,29 @@ void output_buffer_reset(OutputBuffer *buffer);
 
 /**
  * Attempts to write as much as possible of this buffer to a socket described
- * by the given file descriptor. The return value indicates if there is more
- * work to do or not.
+ * by the given file descriptor. The bytes of the buffer and the referenced
+ * data are written together with a single sendmsg, and a partial write
+ * picks up where it stopped, even in the middle of a part. The return value
+ * indicates if there is more work to do or not.
  */
 enum WriteState output_buffer_write_to(OutputBuffer *buffer, int fd);
 
+/**
+ * The amount of bytes of output, including the referenced data.
+ */
+size_t output_buffer_size(OutputBuffer *buffer);
+
+/**
+ * Sets up the message of the buffer with the parts of the output that are
+ * not written yet, as many as fit.
+ */
+struct msghdr *output_buffer_prepare(OutputBuffer *buffer);
+
+/**
+ * Marks the given amount of bytes as written.
+ */
+void output_buffer_advance(OutputBuffer *buffer, size_t len);
+
 /**
  * Writes the given format string and its given arguments to the 
  * output buffer, extending the underlying data structure if needed
@@ -57,4 +125,30 @@ enum WriteState output_buffer_write_to(OutputBuffer *buffer, int fd);
 void output_buffer_append(OutputBuffer *buffer, const char *fmt, ...)
   __attribute__ ((format (printf, 2, 3)));
 
+/**
+ * Copies the given bytes to the end of the output buffer as is, extending
+ * the underlying data structure if needed.
+ */
+void output_buffer_append_bytes(OutputBuffer *buffer, const char *data, size_t len);
+
+/**
+ * Adds the given data to the output without copying it, unless it is small.
+ * The data has to stay valid till the buffer is reset or destroyed, which
+ * can be tied to it with output_buffer_on_release.
+ */
+void output_buffer_append_ref(OutputBuffer *buffer, const char *data, size_t len);
+
+/**
+ * Calls the given function once the buffer is reset or destroyed.
+ */
+void output_buffer_on_release(OutputBuffer *buffer, void (*release) (void *arg),
+			      void *arg);
+
+/**
+ * Moves the output of another buffer to the end of this one. The referenced
+ * data of the other buffer is not copied, its release is moved over as
+ * well.
+ */
+void output_buffer_append_buffer(OutputBuffer *buffer, OutputBuffer *other);
+
 #endif
@@ -9,6 +9,12 @@
  * queue is full, then push operation will fail. To allow the receiver of
  * messages to wait for new data, the queue exposes an event file descriptor and
  * sends a notification on it every time that there is a new message.
+ *
+ * A reader that checks the queue every time it wakes up anyway can have the
+ * notification only sent while it sleeps. Before it goes to sleep, the
+ * reader announces it and checks the queue once more, and the next writer
+ * that sees the announcement rings the event file descriptor. A busy reader
+ * then costs the writers no syscalls at all.
  */
 
 enum QueueResult {
@@ -43,10 +49,30 @@ size_t queue_size(Queue *queue);
  */
 int queue_add_event_fd(Queue *queue);
 
+/**
+ * Makes the queue only notify the event file descriptor once the reader
+ * announced with queue_prepare_sleep that it is about to sleep, instead of
+ * on every push. Has to be called before anything is pushed.
+ */
+void queue_ring_on_demand(Queue *queue);
+
+/**
+ * Announces that the reader is about to sleep on the event file descriptor.
+ * Returns 1 if the queue is not empty, in which case the reader must not go
+ * to sleep, as the messages in it might not have sent a notification.
+ */
+int queue_prepare_sleep(Queue *queue);
+
+/**
+ * The amount of notifications sent on the event file descriptor.
+ */
+long queue_doorbells(Queue *queue);
+
 /**
  * Tries to add a new message to the queue. This will return a failure result if
  * the queue is full. If a message is successfully inserted, then a notification
- * is sent to the event file descriptor.
+ * is sent to the event file descriptor, unless it is only sent on demand and
+ * the reader is not about to sleep.
  *
  * If a successful status code is returned, then the data that was passed in has
  * been added and for concurrency control, the caller thread must not use that
@@ -54,10 +80,24 @@ int queue_add_event_fd(Queue *queue);
  */
 enum QueueResult queue_push(Queue *queue, void *ptr);
 
+/**
+ * Tries to add count messages to the queue at once. As many of them as there
+ * is room for are added in order and published together, with at most one
+ * notification for all of them. Returns the amount of messages added, the
+ * rest are still owned by the caller.
+ */
+size_t queue_push_batch(Queue *queue, void **ptrs, size_t count);
+
 /**
  * Tries to read a new message from the queue. It returns the next payload. 
  * Null is returned if the queue is empty.
  */
 void *queue_pop(Queue *queue);
 
+/**
+ * Reads up to max_count messages from the queue into ptrs at once. Returns
+ * the amount of messages read, 0 if the queue is empty.
+ */
+size_t queue_pop_batch(Queue *queue, void **ptrs, size_t max_count);
+
 #endif
@@ -1,13 +1,17 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <netdb.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "http_request.h"
+#include "http_response.h"
 #include "input_buffer.h"
 #include "logging.h"
 #include "output_buffer.h"
@@ -17,6 +21,9 @@
 
 #define BUF_SIZE 1024
 
+/* the largest buffers that are kept along with a context that is done. */
+#define MAX_KEPT_SIZE (64 * 1024)
+
 inline static char* request_result_name(enum RequestResult result) {
   switch (result) {
   case REQUEST_SUCCESS:
@@ -29,30 +36,82 @@ inline static char* request_result_name(enum RequestResult result) {
     return "CLIENT_ERROR";
   case REQUEST_WRITE_ERROR:
     return "WRITE_ERROR";
+  case REQUEST_TIMEOUT:
+    return "TIMEOUT";
   default:
     return "UNKNOWN";
   }
 }
 
-RequestContext *init_request_context(int fd, char* host_name, EpollInfo* epoll_info) {
+RequestContext *init_request_context(int fd, EpollInfo* epoll_info) {
   RequestContext *context =
     (RequestContext*) CHECK_MEM(calloc(1, sizeof(struct RequestContext)));
-  context->remote_host = host_name;
+  context->input_buffer = input_buffer_init(BUF_SIZE);
+  context->output_buffer = output_buffer_init(BUF_SIZE);
+  context->socket_context = NULL;
+
+  context_open(context, fd, epoll_info);
+  return context;
+}
+
+void context_open(RequestContext *context, int fd, EpollInfo *epoll_info) {
+  context->remote_addr_len = 0;
   context->fd = fd;
   context->actor_id = -1;
 
-  context->input_buffer = input_buffer_init(BUF_SIZE);
-  context->output_buffer = output_buffer_init(BUF_SIZE);
+  input_buffer_reset(context->input_buffer);
+  output_buffer_reset(context->output_buffer);
 
   context->http_request.num_headers = NUM_HEADERS;
+  context->scan = NULL;
   per_request_clear_time(&context->time_stats);
 
   context->epoll_info = epoll_info;
-  
+  context->state = CONNECTION_READING;
+
+  context->connection = context;
+  context->next_request = NULL;
+  context->batch_len = 0;
+  context->pending_requests = 0;
+  context->keep_alive = 0;
+
+  context->timeout = TIMEOUT_NONE;
+  context->timer.next = NULL;
+  context->timer.prev = NULL;
+}
+
+RequestContext *init_pipelined_context(RequestContext *connection) {
+  RequestContext *context =
+    (RequestContext*) CHECK_MEM(calloc(1, sizeof(struct RequestContext)));
+  context->input_buffer = NULL;
+  context->output_buffer = output_buffer_init(BUF_SIZE);
+
+  context_open_pipelined(context, connection);
   return context;
 }
 
+void context_open_pipelined(RequestContext *context, RequestContext *connection) {
+  context->fd = connection->fd;
+  context->actor_id = -1;
+
+  output_buffer_reset(context->output_buffer);
+
+  context->http_request.num_headers = NUM_HEADERS;
+  context->scan = NULL;
+  per_request_clear_time(&context->time_stats);
+
+  context->epoll_info = connection->epoll_info;
+  context->socket_context = connection->socket_context;
+  context->state = CONNECTION_PROCESSING;
+
+  context->connection = connection;
+  context->next_request = NULL;
+}
+
 size_t context_bytes_read(RequestContext *context) {
+  if (context->input_buffer == NULL) {
+    return context->http_request.request_len;
+  }
   return context->input_buffer->offset;
 }
 
@@ -60,36 +119,124 @@ size_t context_bytes_written(RequestContext *context) {
   return context->output_buffer->write_from_offset;
 }
 
+/**
+ * Returns 1 when the comma separated list of the header value holds the
+ * token, ignoring case and the spaces around it.
+ */
+static int header_has_token(const struct phr_header *header, const char *token) {
+  size_t token_len = strlen(token);
+  const char *value = header->value;
+  const char *end = header->value + header->value_len;
+
+  while (value < end) {
+    while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) {
+      value++;
+    }
+    const char *start = value;
+    while (value < end && *value != ',') {
+      value++;
+    }
+    const char *last = value;
+    while (last > start && (last[-1] == ' ' || last[-1] == '\t')) {
+      last--;
+    }
+    if ((size_t) (last - start) == token_len && strncasecmp(start, token, token_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int context_keep_alive(RequestContext *context) {
-  HttpRequest http_request = context->http_request;
+  HttpRequest *http_request = &context->http_request;
 
-  for (size_t i = 0 ; i < http_request.num_headers ; i++) {
-    struct phr_header header = http_request.headers[i];
+  /* HTTP/1.1 connections are persistent unless the client closes them,
+   * HTTP/1.0 ones only when the client asks for it. */
+  int keep_alive = http_request->minor_version >= 1;
+  for (size_t i = 0 ; i < http_request->num_headers ; i++) {
+    const struct phr_header *header = &http_request->headers[i];
 
     // "Connection" is 10 characters long
-    if (header.name_len != 10) {
-      continue;
-    }
-    
-    if (strncmp(header.name, "Connection", 10) != 0) {
+    if (header->name_len != 10 || strncasecmp(header->name, "Connection", 10) != 0) {
       continue;
     }
 
-    // "Keep-Alive" is 10 characters long
-    if (header.value_len != 10) {
-      continue;
+    if (header_has_token(header, "close")) {
+      return 0;
     }
+    if (header_has_token(header, "keep-alive")) {
+      keep_alive = 1;
+    }
+  }
+  return keep_alive;
+}
 
-    if (strncmp(header.value, "Keep-Alive", 10) != 0) {
-      continue;
+static void send_head(RequestContext *request_context, int status_code, size_t body_len,
+		      int keep_alive) {
+  HttpHeader headers[10];
+  size_t header_count = 2;
+
+  headers[0].name = "Content-Length";
+  headers[0].name_len = 14;
+
+  char content_length_value[21];
+  int size = sprintf(content_length_value, "%zu", body_len);
+  CHECK(size <= 0, "Failed to print content length string");
+    
+  headers[0].value = content_length_value;
+  headers[0].value_len = (size_t) size;
+
+  headers[1].name = "Connection";
+  headers[1].name_len = 10;
+  if (keep_alive == 1) {
+    headers[1].value = "keep-alive";
+    headers[1].value_len = 10;
+  } else {
+    headers[1].value = "close";
+    headers[1].value_len = 5;
+  }
+
+  http_response_init(request_context->output_buffer, status_code, headers,
+		     header_count, NULL, 0);
+}
+
+void context_send_response_head(RequestContext *request_context, int status_code,
+				size_t body_len) {
+  send_head(request_context, status_code, body_len, context_keep_alive(request_context));
+}
+
+void context_send_response(RequestContext *request_context, int status_code,
+			   const char *body, size_t body_len) {
+  context_send_response_head(request_context, status_code, body_len);
+  output_buffer_append_bytes(request_context->output_buffer, body, body_len);
+}
+
+void context_send_closing_response(RequestContext *request_context, int status_code) {
+  send_head(request_context, status_code, 0, 0);
+}
+
+void context_remote_host(RequestContext *context, char *host, size_t host_len) {
+  RequestContext *connection = context->connection;
+  if (connection->remote_addr_len == 0) {
+    socklen_t len = sizeof(connection->remote_addr);
+    if (getpeername(connection->fd, (struct sockaddr*) &connection->remote_addr, &len) == 0) {
+      connection->remote_addr_len = len;
     }
+  }
 
-    return 1;
+  if (connection->remote_addr_len == 0
+      || getnameinfo((struct sockaddr*) &connection->remote_addr, connection->remote_addr_len,
+		     host, (socklen_t) host_len, NULL, 0, NI_NUMERICHOST) != 0) {
+    snprintf(host, host_len, "unknown");
   }
-  return 0;
 }
 
 void context_print_finish(RequestContext *context, enum RequestResult result) {  
+#ifdef DEBUG
+  // the address is only formatted when it is going to be printed
+  char remote_host[NI_MAXHOST];
+  context_remote_host(context, remote_host, sizeof(remote_host));
+#endif
   LOG_DEBUG("\n"
 	   "Request Stats : result=%s fd=%d remote_host=%s actor=%d "
 	   "bytes_read=%zu bytes_written=%zu\n"
@@ -97,10 +244,10 @@ void context_print_finish(RequestContext *context, enum RequestResult result) {
 	   "actor_micros=%ld client_write_micros=%ld queue_micros=%ld",
 	   request_result_name(result),
 	   context->fd,
-	   context->remote_host,
+	   remote_host,
 	   context->actor_id,
-	   context->input_buffer->offset,
-	   context->output_buffer->write_into_offset,
+	   context_bytes_read(context),
+	   output_buffer_size(context->output_buffer),
 	   per_request_get_time(&context->time_stats, TOTAL_TIME),
 	   per_request_get_time(&context->time_stats, CLIENT_READ_TIME),
 	   per_request_get_time(&context->time_stats, ACTOR_TIME),
@@ -113,27 +260,63 @@ void context_finalize_reset(RequestContext *context, enum RequestResult result)
 
   context->actor_id = -1;
   
-  // reset the input buffer
-  input_buffer_reset(context->input_buffer);
+  // drops the requests that were answered, keeping the ones that were
+  // pipelined after them
+  input_buffer_consume(context->input_buffer, context->batch_len);
   output_buffer_reset(context->output_buffer);
+  context->batch_len = 0;
   
   per_request_clear_time(&context->time_stats);
 }
 
-void context_finalize_destroy(RequestContext *context, enum RequestResult result) {
-  context_print_finish(context, result);
+/**
+ * Empties the buffers for the next time the context is opened. Buffers that
+ * grew past MAX_KEPT_SIZE for a large request are given back, so that idle
+ * contexts do not hold on to them.
+ */
+static void trim_buffers(RequestContext *context) {
+  if (context->input_buffer != NULL) {
+    if (context->input_buffer->length > MAX_KEPT_SIZE) {
+      input_buffer_destroy(context->input_buffer);
+      context->input_buffer = input_buffer_init(BUF_SIZE);
+    } else {
+      input_buffer_reset(context->input_buffer);
+    }
+  }
 
-  // free allocated memory for the request
-  input_buffer_destroy(context->input_buffer);
-  output_buffer_destroy(context->output_buffer);
+  if (context->output_buffer->length > MAX_KEPT_SIZE) {
+    output_buffer_destroy(context->output_buffer);
+    context->output_buffer = output_buffer_init(BUF_SIZE);
+  } else {
+    output_buffer_reset(context->output_buffer);
+  }
+}
+
+void context_finalize_close(RequestContext *context, enum RequestResult result) {
+  context_print_finish(context, result);
 
-  // free the buffer for the address of the remote hosr
-  free(context->remote_host);
+  // hands back the values that the response still points to
+  trim_buffers(context);
 
   int r = close(context->fd);
   CHECK(r != 0, "Failed to close client connection");
 
+  context->fd = -1;
   context->epoll_info = NULL;
-  
+}
+
+void context_finalize_pipelined(RequestContext *context, enum RequestResult result) {
+  context_print_finish(context, result);
+
+  // the connection owns the socket and everything else
+  trim_buffers(context);
+  context->connection = NULL;
+}
+
+void context_destroy(RequestContext *context) {
+  if (context->input_buffer != NULL) {
+    input_buffer_destroy(context->input_buffer);
+  }
+  output_buffer_destroy(context->output_buffer);
   free(context);
 }
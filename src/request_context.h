@@ -2,12 +2,14 @@
 #define __request_context_h__
 
 #include <stdint.h>
+#include <sys/socket.h>
 
 #include "epoll_info.h"
 #include "http_request.h"
 #include "input_buffer.h"
 #include "output_buffer.h"
 #include "request_stats.h"
+#include "timer_wheel.h"
 
 enum RequestResult {
   REQUEST_SUCCESS,
@@ -15,12 +17,42 @@ enum RequestResult {
   REQUEST_READ_ERROR,
   REQUEST_CLIENT_ERROR,
   REQUEST_WRITE_ERROR,
+  REQUEST_TIMEOUT,
+};
+
+/* who is working on the request of a connection. */
+enum ConnectionState {
+  /* the IO worker is reading in the request. */
+  CONNECTION_READING,
+  /* the request is with the actors, the IO worker must not touch it. */
+  CONNECTION_PROCESSING,
+  /* the IO worker is writing out the response. */
+  CONNECTION_WRITING,
+};
+
+/* the timeout that a connection is under while it waits on the client. */
+enum ConnectionTimeout {
+  /* the actors or the client have the connection, nothing is waited for. */
+  TIMEOUT_NONE,
+  /* waiting for the headers of a request. */
+  TIMEOUT_HEADER,
+  /* waiting for the rest of the body of a request. */
+  TIMEOUT_BODY,
+  /* waiting for the next request after a response. */
+  TIMEOUT_KEEP_ALIVE,
+  /* waiting for the client to read the rest of a response. */
+  TIMEOUT_WRITE,
+  /* the timeout passed and the connection is being closed. */
+  TIMEOUT_EXPIRED,
 };
 
 typedef struct RequestContext {
 
-  /* the address of the client */
-  char *remote_host;
+  /* the address of the client, only set on the connection. It is only
+   * formatted when it gets logged, and looked up then if the worker did
+   * not get it along with the connection, which leaves the length 0. */
+  struct sockaddr_storage remote_addr;
+  socklen_t remote_addr_len;
   /* the file descriptor to communicate to the client with */
   int fd;
 
@@ -33,6 +65,10 @@ typedef struct RequestContext {
   /* the parsed HTTP request for this request */
   HttpRequest http_request;
 
+  /* set when the request is a scan, which is sent to every actor at once.
+   * Only the actor that finishes last touches the rest of the context. */
+  struct ScanRequest *scan;
+
   /* used to store the response that will be sent out to the client */
   OutputBuffer *output_buffer;
   
@@ -40,18 +76,65 @@ typedef struct RequestContext {
   PerRequestStats time_stats;
 
   /* The io worker epoll event that for this request. Once the actor is done
-   * processing the request, they immediately register it on the output loop
-   * to skip a queue. */
+   * processing the request, it pushes the request onto its reply queue
+   * of the event loop. */
   EpollInfo *epoll_info;
+
+  /* the context that the connection is registered with in the event loop,
+   * for as long as the connection is open. */
+  struct SocketContext *socket_context;
+
+  enum ConnectionState state;
+
+  /* the context that owns the connection the request was read on. Every
+   * request that was pipelined after the first one of a batch gets a
+   * context of its own, which shares the socket and the input buffer of
+   * the first one. The first one points to itself. */
+  struct RequestContext *connection;
+
+  /* the next request of the same batch, in the order they were read. */
+  struct RequestContext *next_request;
+
+  /* only used on the connection. The amount of bytes of the input buffer
+   * that the requests of the batch take up, the amount of them that the
+   * actors are not done with yet, and if the connection stays open once
+   * the responses are written. */
+  size_t batch_len;
+  int pending_requests;
+  int keep_alive;
+
+  /* only used on the connection. The timeout it is waiting under, and its
+   * timer in the wheel of the IO worker. The timer is only in the wheel
+   * while its next is set. */
+  enum ConnectionTimeout timeout;
+  TimerNode timer;
   
 } RequestContext;
 
 /**
  * Constructs a RequestContext to listen handle a client's request on
- * given file descriptor. The host_name is the name of the remote host
- * for the given client.
+ * given file descriptor. The caller fills in the remote_addr if it has it.
+ */
+RequestContext *init_request_context(int fd, EpollInfo *epoll_info);
+
+/**
+ * Sets up a context that was used for an earlier connection for a new
+ * connection on the given file descriptor, keeping its buffers.
  */
-RequestContext *init_request_context(int fd, char* host_name, EpollInfo *epoll_info);
+void context_open(RequestContext *context, int fd, EpollInfo *epoll_info);
+
+/**
+ * Constructs a context for a request that was pipelined behind the ones
+ * before it on the given connection. It only has an output buffer of its
+ * own, the request is read out of the input buffer of the connection.
+ */
+RequestContext *init_pipelined_context(RequestContext *connection);
+
+/**
+ * Sets up a context that was used for an earlier pipelined request for the
+ * next one on the given connection.
+ */
+void context_open_pipelined(RequestContext *context, RequestContext *connection);
 
 /**
  * The number of bytes read as input from the client.
@@ -65,10 +148,38 @@ size_t context_bytes_written(RequestContext *context);
 
 /** 
  * Returns 1 when the connection should be kept alive and 0 if the socket
- * should be closed after the response.
+ * should be closed after the response. HTTP/1.1 requests keep it alive
+ * unless they carry "Connection: close", HTTP/1.0 ones only with
+ * "Connection: keep-alive". The header is matched regardless of case.
  */
 int context_keep_alive(RequestContext *context);
 
+/**
+ * Stores the status line and headers of a HTTP response with a body of the
+ * given length into the output buffer of the request. The body has to be
+ * appended right after.
+ */
+void context_send_response_head(RequestContext *request_context, int status_code,
+				size_t body_len);
+
+/**
+ * Stores a HTTP response with the given status code and body into the
+ * output buffer of the request.
+ */
+void context_send_response(RequestContext *request_context, int status_code,
+			   const char *body, size_t body_len);
+
+/**
+ * Stores a HTTP response without a body into the output buffer of the
+ * request, which tells the client that the connection is closed after it.
+ */
+void context_send_closing_response(RequestContext *request_context, int status_code);
+
+/**
+ * Formats the numeric address of the client of the connection into host.
+ */
+void context_remote_host(RequestContext *context, char *host, size_t host_len);
+
 /**
  * Generates info-level output of the request.
  */
@@ -76,6 +187,21 @@ void context_print_finish(RequestContext *context, enum RequestResult result);
 
 void context_finalize_reset(RequestContext *context, enum RequestResult result);
 
-void context_finalize_destroy(RequestContext *context, enum RequestResult result);
+/**
+ * Closes the socket of the connection. The context and its buffers are
+ * kept, so that they can be opened again for another connection.
+ */
+void context_finalize_close(RequestContext *context, enum RequestResult result);
+
+/**
+ * Finishes the context of a pipelined request, leaving the connection open.
+ * The context is kept, so that it can be opened again for another request.
+ */
+void context_finalize_pipelined(RequestContext *context, enum RequestResult result);
+
+/**
+ * Frees the context and its buffers.
+ */
+void context_destroy(RequestContext *context);
 
 #endif
@@ -0,0 +1,50 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include "hash.h"
+#include "logging.h"
+#include "router.h"
+
+static uint64_t default_hash(const void *key, size_t key_len) {
+  /* the high bits are used since the shard tables inside of the actors
+   * use the low bits of the same hash function. */
+  return hash_bytes(key, key_len) >> 32;
+}
+
+Router *router_init(int actor_count, size_t shard_count, RouterHash hash) {
+  CHECK(actor_count <= 0, "Router needs at least one actor");
+  CHECK(shard_count == 0 || (shard_count & (shard_count - 1)) != 0,
+	"Shard count %zu is not a power of 2", shard_count);
+
+  Router *router = (Router*) CHECK_MEM(calloc(1, sizeof(Router)));
+  router->hash = hash == NULL ? default_hash : hash;
+  router->shard_count = shard_count;
+  router->actor_count = actor_count;
+  router->shard_owner = (int*) CHECK_MEM(calloc(shard_count, sizeof(int)));
+
+  for (size_t i = 0 ; i < shard_count ; i++) {
+    router->shard_owner[i] = (int) (i % (size_t) actor_count);
+  }
+  return router;
+}
+
+void router_destroy(Router *router) {
+  free(router->shard_owner);
+  free(router);
+}
+
+void router_assign_shard(Router *router, size_t shard, int actor_id) {
+  CHECK(shard >= router->shard_count, "Shard %zu does not exist", shard);
+  CHECK(actor_id < 0 || actor_id >= router->actor_count,
+	"Actor %d does not exist", actor_id);
+  router->shard_owner[shard] = actor_id;
+}
+
+size_t router_shard_for_key(Router *router, const char *key, size_t key_len) {
+  return router->hash(key, key_len) & (router->shard_count - 1);
+}
+
+int router_actor_for_key(Router *router, const char *key, size_t key_len) {
+  return router->shard_owner[router_shard_for_key(router, key, key_len)];
+}
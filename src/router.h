@@ -0,0 +1,60 @@
+#ifndef __router_h__
+#define __router_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Decides which actor owns a key. Keys are hashed onto a fixed amount of
+ * virtual shards and every virtual shard is owned by exactly one actor, so
+ * every request for the same key always ends up on the same actor.
+ *
+ * The router is built before any thread is started and is read-only
+ * afterwards, so it can be shared by all of the IO workers without any
+ * synchronization.
+ */
+
+/* the default amount of virtual shards, must be a power of 2. */
+#define ROUTER_SHARD_COUNT 4096
+
+typedef uint64_t (*RouterHash)(const void *key, size_t key_len);
+
+typedef struct Router {
+  /* the function used to map a key onto a virtual shard. */
+  RouterHash hash;
+
+  /* the amount of virtual shards, always a power of 2. */
+  size_t shard_count;
+
+  /* maps every virtual shard to the id of the actor that owns it. */
+  int *shard_owner;
+
+  /* the amount of actors that the shards are spread over. */
+  int actor_count;
+} Router;
+
+/**
+ * Constructs a router that spreads the given amount of virtual shards evenly
+ * over the actors. When hash is NULL the default hash function is used.
+ */
+Router *router_init(int actor_count, size_t shard_count, RouterHash hash);
+
+void router_destroy(Router *router);
+
+/**
+ * Changes the actor that owns the given virtual shard. This must only be
+ * done before the router is used by any other thread.
+ */
+void router_assign_shard(Router *router, size_t shard, int actor_id);
+
+/**
+ * Returns the virtual shard that the key belongs to.
+ */
+size_t router_shard_for_key(Router *router, const char *key, size_t key_len);
+
+/**
+ * Returns the id of the actor that owns the given key.
+ */
+int router_actor_for_key(Router *router, const char *key, size_t key_len);
+
+#endif
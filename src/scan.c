@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_request.h"
+#include "kv_store.h"
+#include "logging.h"
+#include "output_buffer.h"
+#include "scan.h"
+
+/* the most bytes of the line with the lengths of an item. */
+#define ITEM_HEADER_SIZE 24
+
+static inline int name_is(const char *name, size_t name_len, const char *expected) {
+  return name_len == strlen(expected) && memcmp(name, expected, name_len) == 0;
+}
+
+static int parse_limit(const char *value, size_t value_len, size_t *limit) {
+  size_t result = 0;
+  for (size_t i = 0 ; i < value_len ; i++) {
+    if (value[i] < '0' || value[i] > '9' || result > SCAN_MAX_LIMIT) {
+      return 0;
+    }
+    result = result * 10 + (size_t) (value[i] - '0');
+  }
+  if (value_len == 0 || result == 0 || result > SCAN_MAX_LIMIT) {
+    return 0;
+  }
+  *limit = result;
+  return 1;
+}
+
+/**
+ * Sets the end of the range to the first key that does not start with the
+ * prefix anymore. A prefix made up of only 0xff bytes has no such key.
+ */
+static void set_prefix_end(ScanRequest *scan, const char *prefix, size_t prefix_len) {
+  while (prefix_len > 0 && (unsigned char) prefix[prefix_len - 1] == 0xff) {
+    prefix_len--;
+  }
+  scan->end = (char*) CHECK_MEM(malloc(prefix_len + 1));
+  memcpy(scan->end, prefix, prefix_len);
+  scan->end_len = prefix_len;
+  if (prefix_len > 0) {
+    scan->end[prefix_len - 1]++;
+  }
+}
+
+/**
+ * Reads the range and limit out of the query of the path. The values are
+ * used as they are, without any decoding. Returns 0 when the query is
+ * invalid.
+ */
+static int parse_query(ScanRequest *scan, const char *query, size_t query_len) {
+  const char *prefix = NULL;
+  size_t prefix_len = 0;
+  const char *end = "";
+  size_t end_len = 0;
+  int has_range = 0;
+
+  const char *query_end = query + query_len;
+  while (query < query_end) {
+    const char *param_end = (const char*) memchr(query, '&', (size_t) (query_end - query));
+    if (param_end == NULL) {
+      param_end = query_end;
+    }
+
+    if (param_end != query) {
+      const char *equals = (const char*) memchr(query, '=', (size_t) (param_end - query));
+      if (equals == NULL) {
+	return 0;
+      }
+      size_t name_len = (size_t) (equals - query);
+      const char *value = equals + 1;
+      size_t value_len = (size_t) (param_end - value);
+
+      if (name_is(query, name_len, "start")) {
+	scan->start = value;
+	scan->start_len = value_len;
+	has_range = 1;
+      } else if (name_is(query, name_len, "end")) {
+	end = value;
+	end_len = value_len;
+	has_range = 1;
+      } else if (name_is(query, name_len, "prefix")) {
+	prefix = value;
+	prefix_len = value_len;
+      } else if (name_is(query, name_len, "limit")) {
+	if (!parse_limit(value, value_len, &scan->limit)) {
+	  return 0;
+	}
+      } else {
+	return 0;
+      }
+    }
+    query = param_end + 1;
+  }
+
+  if (prefix != NULL) {
+    if (has_range) {
+      return 0;
+    }
+    scan->start = prefix;
+    scan->start_len = prefix_len;
+    set_prefix_end(scan, prefix, prefix_len);
+    return 1;
+  }
+
+  scan->end = (char*) CHECK_MEM(malloc(end_len + 1));
+  memcpy(scan->end, end, end_len);
+  scan->end_len = end_len;
+  return 1;
+}
+
+int scan_is_request(HttpRequest *request) {
+  if (!http_request_is_method(request, "GET")) {
+    return 0;
+  }
+  return request->path_len > 0 && request->path[0] == '/'
+    && (request->path_len == 1 || request->path[1] == '?');
+}
+
+ScanRequest *scan_init(HttpRequest *request, int actor_count, int ordered) {
+  ScanRequest *scan =
+    (ScanRequest*) CHECK_MEM(calloc(1, sizeof(ScanRequest)
+				    + (size_t) actor_count * sizeof(ScanPart)));
+  scan->status = 0;
+  scan->start = "";
+  scan->start_len = 0;
+  scan->end = NULL;
+  scan->end_len = 0;
+  scan->limit = SCAN_DEFAULT_LIMIT;
+  scan->part_count = actor_count;
+  scan->merged = NULL;
+  scan->merged_count = 0;
+
+  const char *query = request->path_len > 2 ? request->path + 2 : "";
+  size_t query_len = request->path_len > 2 ? request->path_len - 2 : 0;
+  if (!ordered) {
+    scan->status = 501;
+  } else if (!parse_query(scan, query, query_len)) {
+    scan->status = 400;
+  }
+
+  if (scan->status != 0) {
+    scan->part_count = 1;
+  }
+  atomic_init(&scan->pending, scan->part_count);
+  return scan;
+}
+
+void scan_destroy(ScanRequest *scan) {
+  for (int i = 0 ; i < scan->part_count ; i++) {
+    free(scan->parts[i].data);
+    free(scan->parts[i].entries);
+  }
+  free(scan->end);
+  free(scan->merged);
+  free(scan);
+}
+
+void scan_collect(ScanRequest *scan, int actor_id, KvStore *store) {
+  ScanPart *part = &scan->parts[actor_id];
+  KvItem **items = (KvItem**) CHECK_MEM(malloc(scan->limit * sizeof(KvItem*)));
+  size_t count = kv_store_scan(store, scan->start, scan->start_len, scan->end,
+			       scan->end_len, items, scan->limit);
+
+  /* the items are copied, as the store keeps changing while the other
+   * actors are still working on their parts. */
+  size_t data_size = 0;
+  for (size_t i = 0 ; i < count ; i++) {
+    data_size += ITEM_HEADER_SIZE + items[i]->key_len + items[i]->value_len + 1;
+  }
+  part->data = (char*) CHECK_MEM(malloc(data_size + 1));
+  part->entries = (ScanEntry*) CHECK_MEM(malloc((count + 1) * sizeof(ScanEntry)));
+  part->data_len = 0;
+  part->entry_count = count;
+  part->cursor = 0;
+
+  for (size_t i = 0 ; i < count ; i++) {
+    KvItem *item = items[i];
+    ScanEntry *entry = &part->entries[i];
+    char *data = part->data + part->data_len;
+
+    int header_len = sprintf(data, "%u %u\n", item->key_len, item->value_len);
+    CHECK(header_len <= 0, "Failed to print scan item header");
+    memcpy(data + header_len, kv_item_key(item), item->key_len);
+    memcpy(data + (size_t) header_len + item->key_len, kv_item_value(item), item->value_len);
+    data[(size_t) header_len + item->key_len + item->value_len] = '\n';
+
+    entry->offset = part->data_len;
+    entry->len = (size_t) header_len + item->key_len + item->value_len + 1;
+    entry->key_offset = part->data_len + (size_t) header_len;
+    entry->key_len = item->key_len;
+    part->data_len += entry->len;
+  }
+  free(items);
+}
+
+int scan_part_done(ScanRequest *scan) {
+  /* the release makes the part visible to the last actor, which acquires
+   * all of them. */
+  return atomic_fetch_sub_explicit(&scan->pending, 1, memory_order_acq_rel) == 1;
+}
+
+/**
+ * Returns 1 if the next key of part a comes before the next key of part b.
+ * Every key is owned by a single actor, so the keys are never equal.
+ */
+static inline int part_less(ScanRequest *scan, int a, int b) {
+  ScanPart *part_a = &scan->parts[a];
+  ScanPart *part_b = &scan->parts[b];
+  ScanEntry *entry_a = &part_a->entries[part_a->cursor];
+  ScanEntry *entry_b = &part_b->entries[part_b->cursor];
+
+  size_t min_len = entry_a->key_len < entry_b->key_len ? entry_a->key_len : entry_b->key_len;
+  int r = memcmp(part_a->data + entry_a->key_offset, part_b->data + entry_b->key_offset,
+		 min_len);
+  return r < 0 || (r == 0 && entry_a->key_len < entry_b->key_len);
+}
+
+static void sift_down(ScanRequest *scan, int *heap, int heap_len, int index) {
+  while (1) {
+    int smallest = index;
+    int left = 2 * index + 1;
+    int right = left + 1;
+    if (left < heap_len && part_less(scan, heap[left], heap[smallest])) {
+      smallest = left;
+    }
+    if (right < heap_len && part_less(scan, heap[right], heap[smallest])) {
+      smallest = right;
+    }
+    if (smallest == index) {
+      return;
+    }
+    int tmp = heap[index];
+    heap[index] = heap[smallest];
+    heap[smallest] = tmp;
+    index = smallest;
+  }
+}
+
+size_t scan_merge(ScanRequest *scan) {
+  /* a min-heap of the parts that have items left, by their next key. */
+  int *heap = (int*) CHECK_MEM(malloc((size_t) scan->part_count * sizeof(int)));
+  int heap_len = 0;
+  for (int i = 0 ; i < scan->part_count ; i++) {
+    if (scan->parts[i].entry_count > 0) {
+      heap[heap_len++] = i;
+    }
+  }
+  for (int i = heap_len / 2 - 1 ; i >= 0 ; i--) {
+    sift_down(scan, heap, heap_len, i);
+  }
+
+  scan->merged = (struct iovec*) CHECK_MEM(malloc(scan->limit * sizeof(struct iovec)));
+  scan->merged_count = 0;
+  size_t body_len = 0;
+  while (heap_len > 0 && scan->merged_count < scan->limit) {
+    ScanPart *part = &scan->parts[heap[0]];
+    ScanEntry *entry = &part->entries[part->cursor++];
+    scan->merged[scan->merged_count].iov_base = part->data + entry->offset;
+    scan->merged[scan->merged_count].iov_len = entry->len;
+    scan->merged_count++;
+    body_len += entry->len;
+
+    if (part->cursor == part->entry_count) {
+      heap[0] = heap[--heap_len];
+    }
+    sift_down(scan, heap, heap_len, 0);
+  }
+
+  free(heap);
+  return body_len;
+}
+
+static void release_scan(void *scan) {
+  scan_destroy((ScanRequest*) scan);
+}
+
+void scan_write_body(ScanRequest *scan, OutputBuffer *buffer) {
+  for (size_t i = 0 ; i < scan->merged_count ; i++) {
+    output_buffer_append_ref(buffer, scan->merged[i].iov_base, scan->merged[i].iov_len);
+  }
+  output_buffer_on_release(buffer, release_scan, scan);
+}
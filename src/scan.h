@@ -0,0 +1,130 @@
+#ifndef __scan_h__
+#define __scan_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "http_request.h"
+#include "kv_store.h"
+#include "output_buffer.h"
+
+/**
+ * Scans over a range of keys of every actor.
+ *
+ * A scan is a GET on the root path, with the range given in the query:
+ *
+ *   GET /?start=a&end=b&limit=10   the keys from a up to, but not including, b
+ *   GET /?prefix=user/             the keys that start with user/
+ *
+ * As the keys are spread over the actors by their hash, every actor holds a
+ * part of any range. The IO worker hands the same request to every actor,
+ * which copies the matching items of its own store in key order into its
+ * part of the scan. The actor that finishes its part last merges the sorted
+ * parts with a k-way merge and answers the request. No locks are taken, the
+ * parts are handed over by the counter of the actors that are not done yet.
+ *
+ * Every item of the response body is written as the length of the key and
+ * of the value on a line of their own, followed by the key, the value and a
+ * newline.
+ */
+
+/* the amount of items returned when the request does not give a limit. */
+#define SCAN_DEFAULT_LIMIT 100
+
+/* the most items a single scan can return. */
+#define SCAN_MAX_LIMIT 10000
+
+typedef struct ScanEntry {
+  /* where the item starts in the data of the part, and its length. */
+  size_t offset;
+  size_t len;
+
+  /* where the key of the item starts in the data of the part. */
+  size_t key_offset;
+  size_t key_len;
+} ScanEntry;
+
+typedef struct ScanPart {
+  /* the items of a single actor, already in the format of the response. */
+  char *data;
+  size_t data_len;
+
+  ScanEntry *entries;
+  size_t entry_count;
+
+  /* the next entry to merge. */
+  size_t cursor;
+} ScanPart;
+
+typedef struct ScanRequest {
+  /* the status to answer with right away, without scanning, 0 for a valid
+   * scan. */
+  int status;
+
+  /* the range of keys, which points into the path of the request. */
+  const char *start;
+  size_t start_len;
+  char *end;
+  size_t end_len;
+
+  size_t limit;
+
+  /* the amount of actors whose part is not done yet. */
+  atomic_int pending;
+
+  /* the actors that the request has to be sent to. */
+  int part_count;
+
+  /* the items of the response in key order, set up by scan_merge. */
+  struct iovec *merged;
+  size_t merged_count;
+
+  ScanPart parts[];
+} ScanRequest;
+
+/**
+ * Returns 1 if the request is a scan instead of a request for a single key.
+ */
+int scan_is_request(HttpRequest *request);
+
+/**
+ * Parses the range of the scan out of the request. A scan that can not be
+ * done has its status set to the one to answer with and only goes to the
+ * first actor.
+ */
+ScanRequest *scan_init(HttpRequest *request, int actor_count, int ordered);
+
+/**
+ * Frees the scan and all of the parts.
+ */
+void scan_destroy(ScanRequest *scan);
+
+/**
+ * Copies the items in the range of the store into the part of the given
+ * actor.
+ */
+void scan_collect(ScanRequest *scan, int actor_id, KvStore *store);
+
+/**
+ * Marks the part of an actor as done. Returns 1 for the last actor, which
+ * is the one that has to answer the request. The others must not touch the
+ * request anymore.
+ */
+int scan_part_done(ScanRequest *scan);
+
+/**
+ * Merges the parts of every actor in key order and returns the length of
+ * the response body.
+ */
+size_t scan_merge(ScanRequest *scan);
+
+/**
+ * Adds the merged items to the output as the response body. The larger
+ * items are sent straight out of the parts, so the scan is freed along
+ * with the buffer.
+ */
+void scan_write_body(ScanRequest *scan, OutputBuffer *buffer);
+
+#endif
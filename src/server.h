@@ -2,10 +2,21 @@
 #define __server_h__
 
 #include <pthread.h>
+#include <stdatomic.h>
 
+#include "config.h"
+#include "kv_store.h"
+#include "mrmw_queue.h"
+#include "router.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "wal.h"
 #include "server_stats.h"
 #include "queue.h"
 
+/* the most requests that can wait in the shared queue of the actors. */
+#define SHARED_QUEUE_SIZE 4096
+
 typedef struct ActorInfo {
   /* unique identifier for the given actor. */
   int id;
@@ -21,6 +32,40 @@ typedef struct ActorInfo {
    * this queue. */
   Queue **input_queue;
 
+  /* the shard of the key-value data that this actor owns. Only the
+   * actor's thread is allowed to access it. */
+  KvStore *store;
+
+  /* the allocator for the items of the store. Only the actor's thread
+   * allocates from it, the stats thread only reads its counters. */
+  Slab *slab;
+
+  /* the log that every change is written to, NULL when durability is
+   * disabled. */
+  Wal *wal;
+
+  /* writes the periodic snapshots of the store, NULL when durability is
+   * disabled. */
+  Snapshot *snapshot;
+
+  /* the requests for the actor that had to wait because its queue was
+   * full, and the ones that were answered with a 503 for it. Counted by the
+   * IO workers, read by the stats thread. */
+  atomic_long parked_requests;
+  atomic_long rejected_requests;
+
+  /* the replies that had to wait because the reply queue to their worker
+   * was full. Counted by the actor, read by the stats thread. */
+  atomic_long parked_replies;
+
+  /* the replies that wait for room in the reply queue to every worker, in
+   * order. Only used by the actor's thread. */
+  struct ReplyBacklog *reply_backlogs;
+  size_t parked_reply_count;
+
+  /* the event loop of the actor, set before the startup barrier. */
+  struct EpollInfo *epoll_info;
+
   /* this is just a reference to the pthread_barrier_t owned by the
    * server struct. */
   pthread_barrier_t *startup;
@@ -28,6 +73,9 @@ typedef struct ActorInfo {
 } ActorInfo;
 
 typedef struct Server {
+  /* the settings given on the command line. */
+  ServerConfig *config;
+
   ServerWideStats *server_stats;
   
   /* the number of threads used to read/write client requests. */
@@ -39,6 +87,16 @@ typedef struct Server {
   /* the list of the actors running. */
   ActorInfo *app_actors;
 
+  /* decides which actor owns each key. */
+  Router *router;
+
+  /* the requests that do not touch the data of any actor, which the first
+   * actor that is free takes. */
+  MrMwQueue *shared_queue;
+
+  /* the epoll info of every IO worker, set before the startup barrier. */
+  struct EpollInfo **io_epoll_infos;
+
   /* used to block all threads till the application actors have
    * started. */
   pthread_barrier_t startup;
@@ -21,6 +21,8 @@ ServerWideStats *server_stats_init() {
   
   stats->active_connections = ATOMIC_VAR_INIT(0);
   stats->total_requests_processed = ATOMIC_VAR_INIT(0);
+  stats->deferred_writes = ATOMIC_VAR_INIT(0);
+  stats->timeouts = ATOMIC_VAR_INIT(0);
   return stats;
 }
 
@@ -78,3 +80,19 @@ inline void server_stats_decr_total_requests(ServerWideStats *stats) {
 inline long server_stats_get_total_requests(ServerWideStats *stats) {
   return atomic_load_explicit(&stats->total_requests_processed, memory_order_relaxed);
 }
+
+inline void server_stats_incr_deferred_writes(ServerWideStats *stats) {
+  atomic_fetch_add_explicit(&stats->deferred_writes, 1, memory_order_relaxed);
+}
+
+inline long server_stats_get_deferred_writes(ServerWideStats *stats) {
+  return atomic_load_explicit(&stats->deferred_writes, memory_order_relaxed);
+}
+
+inline void server_stats_incr_timeouts(ServerWideStats *stats) {
+  atomic_fetch_add_explicit(&stats->timeouts, 1, memory_order_relaxed);
+}
+
+inline long server_stats_get_timeouts(ServerWideStats *stats) {
+  return atomic_load_explicit(&stats->timeouts, memory_order_relaxed);
+}
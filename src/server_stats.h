@@ -16,6 +16,14 @@ typedef struct ServerWideStats {
 
   /* The total number of requests that have been handled cumulatively */
   atomic_long total_requests_processed;
+
+  /* The number of responses that did not fit in the socket right away
+   * and had to wait for it to become writable. */
+  atomic_long deferred_writes;
+
+  /* The number of connections that were closed because they took too
+   * long to send a request. */
+  atomic_long timeouts;
   
 } ServerWideStats;
 
@@ -73,4 +81,28 @@ void server_stats_decr_total_requests(ServerWideStats *server_stats);
  */
 long server_stats_get_total_requests(ServerWideStats *server_stats);
 
+/**
+ * Increments the count of responses that had to wait for the socket
+ * to become writable.
+ */
+void server_stats_incr_deferred_writes(ServerWideStats *server_stats);
+
+/**
+ * Returns the amount of responses that had to wait for the socket
+ * to become writable.
+ */
+long server_stats_get_deferred_writes(ServerWideStats *server_stats);
+
+/**
+ * Increments the count of connections that were closed because they
+ * took too long to send a request.
+ */
+void server_stats_incr_timeouts(ServerWideStats *server_stats);
+
+/**
+ * Returns the amount of connections that were closed because they took
+ * too long to send a request.
+ */
+long server_stats_get_timeouts(ServerWideStats *server_stats);
+
 #endif
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "slab.h"
+
+/* the smallest size class, every class is a multiple of this. */
+#define MIN_SIZE 16
+
+/* the first classes are spaced MIN_SIZE apart up to this size. */
+#define LINEAR_SIZE 64
+
+/* the counters only have a single writer, so a relaxed load and store is
+ * enough and avoids a locked instruction on every allocation. */
+#define COUNTER_ADD(COUNTER, VALUE)					\
+  atomic_store_explicit((COUNTER),					\
+			atomic_load_explicit((COUNTER), memory_order_relaxed) + (VALUE), \
+			memory_order_relaxed);
+
+size_t slab_size_class(size_t size) {
+  if (size <= LINEAR_SIZE) {
+    return size == 0 ? 0 : (size - 1) / MIN_SIZE;
+  }
+
+  /* every power of 2 is split into 4 classes. */
+  size_t x = size - 1;
+  size_t lg = (size_t) (63 - __builtin_clzl(x));
+  return (lg - 6) * 4 + (x >> (lg - 2));
+}
+
+static size_t class_size(size_t size_class) {
+  if (size_class < 4) {
+    return (size_class + 1) * MIN_SIZE;
+  }
+  size_t lg = size_class / 4 + 5;
+  return ((size_t) 1 << lg) + (size_class % 4 + 1) * ((size_t) 1 << (lg - 2));
+}
+
+/**
+ * Hands out the next object from a newly allocated page.
+ */
+static void *alloc_page(Slab *slab, SlabClass *slab_class) {
+  char *page;
+  int r = posix_memalign((void**) &page, 4096, SLAB_PAGE_SIZE);
+  CHECK(r != 0, "Failed to allocate a slab page");
+
+  /* the unused tail of the previous page is given up. */
+  slab_class->page_cursor = page + slab_class->size;
+  slab_class->page_end = page + SLAB_PAGE_SIZE;
+
+  COUNTER_ADD(&slab->page_count, 1);
+  COUNTER_ADD(&slab_class->total, (long) (SLAB_PAGE_SIZE / slab_class->size));
+  return page;
+}
+
+Slab *slab_init(void) {
+  Slab *slab = (Slab*) CHECK_MEM(calloc(1, sizeof(Slab)));
+  for (size_t i = 0 ; i < SLAB_CLASS_COUNT ; i++) {
+    SlabClass *slab_class = &slab->classes[i];
+    slab_class->size = class_size(i);
+    slab_class->free_list = NULL;
+    slab_class->page_cursor = NULL;
+    slab_class->page_end = NULL;
+    slab_class->used = ATOMIC_VAR_INIT(0);
+    slab_class->total = ATOMIC_VAR_INIT(0);
+  }
+  CHECK(slab->classes[SLAB_CLASS_COUNT - 1].size != SLAB_MAX_SIZE,
+	"Largest size class does not match the max size");
+
+  slab->page_count = ATOMIC_VAR_INIT(0);
+  slab->large_bytes = ATOMIC_VAR_INIT(0);
+  return slab;
+}
+
+void slab_destroy(Slab *slab) {
+  /* the pages are not tracked individually, they are only released when
+   * the process exits. */
+  free(slab);
+}
+
+void *slab_alloc(Slab *slab, size_t size) {
+  if (UNLIKELY(size > SLAB_MAX_SIZE)) {
+    COUNTER_ADD(&slab->large_bytes, (long) size);
+    return CHECK_MEM(malloc(size));
+  }
+
+  SlabClass *slab_class = &slab->classes[slab_size_class(size)];
+  COUNTER_ADD(&slab_class->used, 1);
+
+  SlabObject *object = slab_class->free_list;
+  if (object != NULL) {
+    slab_class->free_list = object->next;
+    return object;
+  }
+
+  if ((size_t) (slab_class->page_end - slab_class->page_cursor) >= slab_class->size) {
+    void *ptr = slab_class->page_cursor;
+    slab_class->page_cursor += slab_class->size;
+    return ptr;
+  }
+
+  return alloc_page(slab, slab_class);
+}
+
+void slab_free(Slab *slab, void *ptr, size_t size) {
+  if (UNLIKELY(size > SLAB_MAX_SIZE)) {
+    COUNTER_ADD(&slab->large_bytes, -(long) size);
+    free(ptr);
+    return;
+  }
+
+  SlabClass *slab_class = &slab->classes[slab_size_class(size)];
+  COUNTER_ADD(&slab_class->used, -1);
+
+  SlabObject *object = (SlabObject*) ptr;
+  object->next = slab_class->free_list;
+  slab_class->free_list = object;
+}
@@ -0,0 +1,87 @@
+#ifndef __slab_h__
+#define __slab_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * A slab allocator that is owned by a single actor. Memory is carved out of
+ * large pages into objects of a fixed set of size classes and freed objects
+ * are kept on a free list per class, so both allocating and freeing are O(1)
+ * and never touch memory of another thread.
+ *
+ * Pages are never given back, which keeps the resident memory of an actor
+ * predictable under churn. Objects larger than the biggest size class are
+ * passed on to the general allocator.
+ *
+ * Only the owning actor is allowed to allocate and free, the counters are
+ * atomics so that the stats thread can read them at any time.
+ */
+
+/* the size of the pages that the objects are carved out of. */
+#define SLAB_PAGE_SIZE (1024 * 1024)
+
+/* the largest object that is served out of a size class. */
+#define SLAB_MAX_SIZE (256 * 1024)
+
+/* the size classes go up in steps of a quarter of a power of 2. */
+#define SLAB_CLASS_COUNT 52
+
+typedef struct SlabObject {
+  struct SlabObject *next;
+} SlabObject;
+
+typedef struct SlabClass {
+  /* the size of every object in this class. */
+  size_t size;
+
+  /* objects that have been freed and can be handed out again. */
+  SlabObject *free_list;
+
+  /* the part of the current page that has not been handed out yet. */
+  char *page_cursor;
+  char *page_end;
+
+  /* the amount of objects that are currently handed out. */
+  atomic_long used;
+
+  /* the amount of objects that have been carved out of pages. */
+  atomic_long total;
+} SlabClass;
+
+typedef struct Slab {
+  SlabClass classes[SLAB_CLASS_COUNT];
+
+  /* the amount of pages that have been allocated. */
+  atomic_long page_count;
+
+  /* the amount of bytes that were handed to the general allocator since
+   * they did not fit any size class. */
+  atomic_long large_bytes;
+} Slab;
+
+Slab *slab_init(void);
+
+/**
+ * Frees every page of the slab, all objects become invalid.
+ */
+void slab_destroy(Slab *slab);
+
+/**
+ * Allocates an object of at least the given size.
+ */
+void *slab_alloc(Slab *slab, size_t size);
+
+/**
+ * Gives an object back to the slab. The size must be the same as the size
+ * that was used to allocate it.
+ */
+void slab_free(Slab *slab, void *ptr, size_t size);
+
+/**
+ * Returns the size class that an object of the given size is served from.
+ * The size must not be larger than SLAB_MAX_SIZE.
+ */
+size_t slab_size_class(size_t size);
+
+#endif
@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "kv_store.h"
+#include "logging.h"
+#include "queue.h"
+#include "snapshot.h"
+#include "wal.h"
+
+#define SNAPSHOT_MAGIC "JLPSNAP1"
+
+/* only a single snapshot is ever in flight. */
+#define QUEUE_SIZE 2
+
+/* the counters only have a single writer. */
+#define COUNTER_ADD(COUNTER, VALUE)					\
+  atomic_store_explicit((COUNTER),					\
+			atomic_load_explicit((COUNTER), memory_order_relaxed) + (VALUE), \
+			memory_order_relaxed);
+
+/**
+ * Buffers the items into blocks so that the checksum of every block can be
+ * computed before it is written out.
+ */
+typedef struct SnapshotWriter {
+  int fd;
+  const char *path;
+  char *block;
+  size_t block_len;
+  uint64_t offset;
+  uint64_t checksum;
+} SnapshotWriter;
+
+static inline uint64_t checksum_add(uint64_t checksum, const char *block, size_t len) {
+  return (checksum ^ hash_bytes(block, len)) * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline size_t padded_size(size_t size) {
+  return (size + SNAPSHOT_ALIGNMENT - 1) & ~((size_t) SNAPSHOT_ALIGNMENT - 1);
+}
+
+static inline size_t item_size(const KvItem *item) {
+  return sizeof(KvItem) + item->key_len + item->value_len;
+}
+
+static double now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec * 1000.0 + (double) now.tv_nsec / 1000000.0;
+}
+
+static void write_fully(int fd, const char *path, const char *data, size_t len,
+			uint64_t offset) {
+  while (len > 0) {
+    ssize_t written = pwrite(fd, data, len, (off_t) offset);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    CHECK(written <= 0, "Failed to write snapshot %s", path);
+    data += written;
+    len -= (size_t) written;
+    offset += (uint64_t) written;
+  }
+}
+
+static void writer_flush_block(SnapshotWriter *writer) {
+  if (writer->block_len == 0) {
+    return;
+  }
+  writer->checksum = checksum_add(writer->checksum, writer->block, writer->block_len);
+  write_fully(writer->fd, writer->path, writer->block, writer->block_len,
+	      sizeof(SnapshotHeader) + writer->offset);
+  writer->offset += writer->block_len;
+  writer->block_len = 0;
+}
+
+static void writer_append(SnapshotWriter *writer, const char *data, size_t len) {
+  while (len > 0) {
+    size_t amount = SNAPSHOT_BLOCK_SIZE - writer->block_len;
+    if (amount > len) {
+      amount = len;
+    }
+    memcpy(writer->block + writer->block_len, data, amount);
+    writer->block_len += amount;
+    data += amount;
+    len -= amount;
+
+    if (writer->block_len == SNAPSHOT_BLOCK_SIZE) {
+      writer_flush_block(writer);
+    }
+  }
+}
+
+static void sync_dir(const char *dir) {
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  CHECK(fd == -1, "Failed to open directory %s", dir);
+  int r = fsync(fd);
+  CHECK(r != 0, "Failed to sync directory %s", dir);
+  close(fd);
+}
+
+/**
+ * Writes the pinned items to a temporary file and moves it into place once
+ * it is durable, so that a crash never leaves a partial snapshot behind.
+ */
+static void *snapshot_loop(void *pthread_input) {
+  Snapshot *snapshot = (Snapshot*) pthread_input;
+  double start = now_ms();
+
+  char name[16];
+  snprintf(name, sizeof(name), "snap-%d", snapshot->actor_id);
+  pthread_setname_np(pthread_self(), name);
+
+  SnapshotWriter writer;
+  writer.path = snapshot->tmp_path;
+  writer.fd = open(writer.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  CHECK(writer.fd == -1, "Failed to open snapshot %s", writer.path);
+  writer.block = (char*) CHECK_MEM(malloc(SNAPSHOT_BLOCK_SIZE));
+  writer.block_len = 0;
+  writer.offset = 0;
+  writer.checksum = 0;
+
+  /* the fields in front of the shared part of an item are changed by the
+   * actor at any time, so they are not read here. */
+  static const char zeros[KV_ITEM_SHARED_OFFSET + SNAPSHOT_ALIGNMENT] = { 0 };
+  for (size_t i = 0 ; i < snapshot->item_count ; i++) {
+    KvItem *item = snapshot->items[i];
+    size_t size = item_size(item);
+    writer_append(&writer, zeros, KV_ITEM_SHARED_OFFSET);
+    writer_append(&writer, (const char*) item + KV_ITEM_SHARED_OFFSET,
+		  size - KV_ITEM_SHARED_OFFSET);
+    writer_append(&writer, zeros, padded_size(size) - size);
+  }
+  writer_flush_block(&writer);
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.actor_id = snapshot->actor_id;
+  header.actor_count = snapshot->actor_count;
+  header.generation = snapshot->generation;
+  header.item_count = snapshot->item_count;
+  header.data_len = writer.offset;
+  header.checksum = writer.checksum;
+  write_fully(writer.fd, writer.path, (const char*) &header, sizeof(header), 0);
+
+  int r = fsync(writer.fd);
+  CHECK(r != 0, "Failed to sync snapshot %s", writer.path);
+  close(writer.fd);
+  free(writer.block);
+
+  r = rename(snapshot->tmp_path, snapshot->path);
+  CHECK(r != 0, "Failed to move snapshot into %s", snapshot->path);
+  sync_dir(snapshot->dir);
+
+  /* everything before the generation is in the snapshot now. */
+  wal_remove_logs(snapshot->dir, snapshot->actor_id, snapshot->generation);
+
+  COUNTER_ADD(&snapshot->snapshot_count, 1);
+  COUNTER_ADD(&snapshot->snapshot_bytes, (long) (sizeof(header) + writer.offset));
+  LOG_INFO("Wrote snapshot of %zu items (%lu bytes) to %s in %.1lf ms",
+	   snapshot->item_count, sizeof(header) + writer.offset, snapshot->path,
+	   now_ms() - start);
+
+  enum QueueResult result = queue_push(snapshot->done_queue, snapshot);
+  CHECK(result != QUEUE_SUCCESS, "Failed to hand back finished snapshot");
+  return NULL;
+}
+
+void snapshot_check_actor_count(const char *dir, int actor_count) {
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/actors", dir);
+  FILE *file = fopen(path, "re");
+  if (file != NULL) {
+    int stored = 0;
+    int r = fscanf(file, "%d", &stored);
+    fclose(file);
+    CHECK(r != 1, "Failed to read the number of actors from %s", path);
+    CHECK(stored != actor_count, "Data directory %s was written by %d actors but there "
+	  "are %d now, keys would be looked up at the wrong actor", dir, stored, actor_count);
+    return;
+  }
+  CHECK(errno != ENOENT, "Failed to open %s", path);
+
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, PATH_MAX, "%s/actors.tmp", dir);
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  CHECK(fd == -1, "Failed to open %s", tmp_path);
+  char buffer[16];
+  int len = snprintf(buffer, sizeof(buffer), "%d\n", actor_count);
+  write_fully(fd, tmp_path, buffer, (size_t) len, 0);
+  int r = fsync(fd);
+  CHECK(r != 0, "Failed to sync %s", tmp_path);
+  close(fd);
+
+  r = rename(tmp_path, path);
+  CHECK(r != 0, "Failed to move %s into place", path);
+  sync_dir(dir);
+}
+
+Snapshot *snapshot_init(const char *dir, int actor_id, int actor_count) {
+  Snapshot *snapshot = (Snapshot*) CHECK_MEM(calloc(1, sizeof(Snapshot)));
+  snapshot->actor_id = actor_id;
+  snapshot->actor_count = actor_count;
+
+  snapshot->dir = CHECK_MEM(strdup(dir));
+  snapshot->path = (char*) CHECK_MEM(calloc(PATH_MAX, sizeof(char)));
+  snprintf(snapshot->path, PATH_MAX, "%s/actor-%d.snap", dir, actor_id);
+  snapshot->tmp_path = (char*) CHECK_MEM(calloc(PATH_MAX, sizeof(char)));
+  snprintf(snapshot->tmp_path, PATH_MAX, "%s/actor-%d.snap.tmp", dir, actor_id);
+
+  snapshot->running = 0;
+  snapshot->items = NULL;
+  snapshot->item_count = 0;
+  snapshot->generation = 0;
+  snapshot->done_queue = queue_init(QUEUE_SIZE);
+  snapshot->snapshot_count = ATOMIC_VAR_INIT(0);
+  snapshot->snapshot_bytes = ATOMIC_VAR_INIT(0);
+  return snapshot;
+}
+
+/**
+ * Checks that the mapped file is a complete snapshot of this actor.
+ */
+static int validate(Snapshot *snapshot, const char *data, size_t file_size) {
+  const SnapshotHeader *header = (const SnapshotHeader*) data;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+      || header->version != SNAPSHOT_VERSION
+      || header->actor_id != snapshot->actor_id
+      || header->data_len != file_size - sizeof(SnapshotHeader)) {
+    return 0;
+  }
+
+  const char *items = data + sizeof(SnapshotHeader);
+  uint64_t checksum = 0;
+  for (uint64_t offset = 0 ; offset < header->data_len ; offset += SNAPSHOT_BLOCK_SIZE) {
+    size_t len = header->data_len - offset;
+    if (len > SNAPSHOT_BLOCK_SIZE) {
+      len = SNAPSHOT_BLOCK_SIZE;
+    }
+    checksum = checksum_add(checksum, items + offset, len);
+  }
+  return checksum == header->checksum;
+}
+
+int snapshot_load(Snapshot *snapshot, KvStore *store, uint64_t *generation) {
+  int fd = open(snapshot->path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 && errno == ENOENT) {
+    return 0;
+  }
+  CHECK(fd == -1, "Failed to open snapshot %s", snapshot->path);
+
+  double start = now_ms();
+  struct stat stat_buf;
+  int r = fstat(fd, &stat_buf);
+  CHECK(r != 0, "Failed to stat snapshot %s", snapshot->path);
+
+  size_t file_size = (size_t) stat_buf.st_size;
+  /* the logs before the snapshot are gone, so starting without it would
+   * silently lose data. */
+  CHECK(file_size < sizeof(SnapshotHeader),
+	"Snapshot %s is truncated, move it away to start without it", snapshot->path);
+
+  /* the mapping is never removed, the items are used right where they are.
+   * It is private and writable so that the actor can link items into its
+   * timing wheel, which copies only the pages that are written to. */
+  char *data = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE,
+		    fd, 0);
+  CHECK(data == MAP_FAILED, "Failed to map snapshot %s", snapshot->path);
+  close(fd);
+
+  CHECK(!validate(snapshot, data, file_size),
+	"Snapshot %s is damaged, move it away to start without it", snapshot->path);
+
+  const SnapshotHeader *header = (const SnapshotHeader*) data;
+  CHECK(header->actor_count != snapshot->actor_count,
+	"Snapshot %s was written by %d actors but there are %d now", snapshot->path,
+	header->actor_count, snapshot->actor_count);
+  kv_store_reserve(store, header->item_count);
+  kv_store_set_mapped(store, data, data + file_size);
+
+  size_t offset = sizeof(SnapshotHeader);
+  for (uint64_t i = 0 ; i < header->item_count ; i++) {
+    CHECK(file_size - offset < sizeof(KvItem), "Item %lu is outside of snapshot %s",
+	  i, snapshot->path);
+    KvItem *item = (KvItem*) (data + offset);
+    size_t size = item_size(item);
+    CHECK(item->key_len > KV_MAX_KEY_SIZE || item->value_len > KV_MAX_VALUE_SIZE
+	  || size > file_size - offset, "Item %lu is invalid in snapshot %s",
+	  i, snapshot->path);
+
+    kv_store_put_item(store, item);
+    offset += padded_size(size);
+  }
+  madvise(data, file_size, MADV_RANDOM);
+
+  *generation = header->generation;
+  LOG_INFO("Loaded %lu items (%zu bytes) from %s in %.1lf ms", header->item_count,
+	   file_size, snapshot->path, now_ms() - start);
+  return 1;
+}
+
+int snapshot_running(Snapshot *snapshot) {
+  return snapshot->running;
+}
+
+void snapshot_start(Snapshot *snapshot, KvStore *store, uint64_t generation) {
+  CHECK(snapshot->running, "Snapshot of actor %d is already running", snapshot->actor_id);
+
+  snapshot->running = 1;
+  snapshot->generation = generation;
+  snapshot->items = kv_store_pin(store, &snapshot->item_count);
+
+  pthread_t thread;
+  int r = pthread_create(&thread, NULL, snapshot_loop, snapshot);
+  CHECK(r != 0, "Failed to create snapshot thread");
+
+  r = pthread_detach(thread);
+  CHECK(r != 0, "Failed to detach snapshot thread");
+}
+
+int snapshot_done_event_fd(Snapshot *snapshot) {
+  return queue_add_event_fd(snapshot->done_queue);
+}
+
+void snapshot_handle_done(Snapshot *snapshot, KvStore *store) {
+  eventfd_t num_to_read;
+  eventfd_read(snapshot_done_event_fd(snapshot), &num_to_read);
+
+  while (queue_pop(snapshot->done_queue) != NULL) {
+    kv_store_unpin(store);
+    free(snapshot->items);
+    snapshot->items = NULL;
+    snapshot->item_count = 0;
+    snapshot->running = 0;
+  }
+}
@@ -0,0 +1,132 @@
+#ifndef __snapshot_h__
+#define __snapshot_h__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kv_store.h"
+#include "queue.h"
+
+/**
+ * Point-in-time snapshots of the store of a single actor.
+ *
+ * A snapshot file is a header followed by every item of the store, written
+ * out in exactly the same layout as a KvItem in memory and aligned to
+ * SNAPSHOT_ALIGNMENT, with the fields that only the actor uses zeroed.
+ * Loading a snapshot therefore does not parse or copy anything: the file is
+ * mapped, its checksum is verified and the items are added to the index
+ * right where they are in the mapping. Restarting is
+ * bounded by how fast the file can be read.
+ *
+ * Taking a snapshot starts a new generation of the write-ahead log. The
+ * actor collects the pointers of all of its items and pins them, then a
+ * separate thread writes them out while the actor keeps serving requests.
+ * Every change made after that point goes to the new log generation, so the
+ * snapshot together with the logs from its generation onwards hold all of
+ * the data. Once the snapshot is durable the older logs are removed.
+ */
+
+/* the size of the blocks that the checksum is computed over. */
+#define SNAPSHOT_BLOCK_SIZE (1024 * 1024)
+
+/* every item in the file starts at a multiple of this. */
+#define SNAPSHOT_ALIGNMENT 8
+
+#define SNAPSHOT_VERSION 4
+
+typedef struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t actor_id;
+
+  /* the first log generation whose changes are not in the snapshot. */
+  uint64_t generation;
+
+  uint64_t item_count;
+
+  /* the amount of bytes of items that follow the header. */
+  uint64_t data_len;
+
+  /* combined hash of every block of SNAPSHOT_BLOCK_SIZE bytes of items. */
+  uint64_t checksum;
+
+  /* the number of actors the keys were spread over. */
+  int32_t actor_count;
+
+  uint8_t padding[12];
+} SnapshotHeader;
+
+typedef struct Snapshot {
+  int actor_id;
+  int actor_count;
+
+  /* the final and the temporary path of the snapshot file. */
+  char *dir;
+  char *path;
+  char *tmp_path;
+
+  /* 1 while a snapshot is being written. */
+  int running;
+
+  /* the items that are being written, pinned in the store till the
+   * snapshot is done. */
+  KvItem **items;
+  size_t item_count;
+  uint64_t generation;
+
+  /* used by the writer thread to tell the actor that it is done. */
+  Queue *done_queue;
+
+  /* the amount of snapshots and bytes written, read by the stats thread. */
+  atomic_long snapshot_count;
+  atomic_long snapshot_bytes;
+} Snapshot;
+
+/**
+ * Records the number of actors in the data directory the first time it is
+ * used, and exits when the directory was written with another number. The
+ * owner of a key depends on it, so the snapshots and logs of every actor
+ * only hold its keys for that number of actors.
+ */
+void snapshot_check_actor_count(const char *dir, int actor_count);
+
+/**
+ * Sets up the snapshots of the given actor, one of actor_count, inside of
+ * the directory. Nothing is read or written yet.
+ */
+Snapshot *snapshot_init(const char *dir, int actor_id, int actor_count);
+
+/**
+ * Maps the latest snapshot of the actor and adds all of its items to the
+ * store, which must be empty. Returns 1 and sets the generation of the first
+ * log to replay on top of it when a snapshot was loaded, 0 when there is no
+ * snapshot. Exits when the snapshot is truncated or damaged, since the logs it
+ * replaced are already gone, or when it was written with another number of
+ * actors.
+ */
+int snapshot_load(Snapshot *snapshot, KvStore *store, uint64_t *generation);
+
+/**
+ * Returns 1 while a snapshot is still being written.
+ */
+int snapshot_running(Snapshot *snapshot);
+
+/**
+ * Starts writing a snapshot of the current contents of the store in the
+ * background. The generation is the first log generation that is not
+ * covered by the snapshot. Only one snapshot can be written at a time.
+ */
+void snapshot_start(Snapshot *snapshot, KvStore *store, uint64_t generation);
+
+/**
+ * The file descriptor that becomes readable when a snapshot is done.
+ */
+int snapshot_done_event_fd(Snapshot *snapshot);
+
+/**
+ * Finishes a snapshot that was written, unpinning the items of the store.
+ */
+void snapshot_handle_done(Snapshot *snapshot, KvStore *store);
+
+#endif
@@ -4,23 +4,45 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "logging.h"
 #include "queue.h"
 
+/* the size of a cache line, which the offsets that the writer and the reader
+ * change are kept apart by, so that they do not keep taking the line away
+ * from each other. */
+#define CACHE_LINE_SIZE 64
+
 typedef struct Queue {
-  /* the max amount of elements allowed in the mailbox. */
-  size_t max_size;
-  size_t mask;
+  /* the offset into the ring buffer that items should be added to. It only
+   * grows, and is wrapped with the mask when the ring buffer is accessed. */
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t push_offset;
 
-  /* the offset into the ring buffer that items should be added to. */
-  _Atomic size_t push_offset;
+  /* the last pop offset that the writer read, so that it only has to read
+   * the offset of the reader again once the queue looks full. */
+  size_t cached_pop_offset;
+
+  /* the amount of notifications that were sent. */
+  atomic_long doorbells;
 
   /* the offset info the ring buffer that items should be removed from. */
-  _Atomic size_t pop_offset;
-  
+  _Alignas(CACHE_LINE_SIZE) _Atomic size_t pop_offset;
+
+  /* the last push offset that the reader read, so that it only has to read
+   * the offset of the writer again once the queue looks empty. */
+  size_t cached_push_offset;
+
+  /* the flag that the reader sets before it goes to sleep, when the event
+   * file descriptor is only notified on demand. */
+  _Alignas(CACHE_LINE_SIZE) atomic_int sleeping;
+
+  /* the max amount of elements allowed in the mailbox. */
+  _Alignas(CACHE_LINE_SIZE) size_t max_size;
+  size_t mask;
+
   /* the internal buffer used to store the messages. This should never be 
    * accessed by any external caller. By using a ring buffer, we prevent
    * any memory allocations being required during the request. */
@@ -29,7 +51,9 @@ typedef struct Queue {
   /* the event file descriptor used to detect when a new message was added
    * to the mailbox. */
   int add_event;
-  
+
+  /* set when the event file descriptor is only notified on demand. */
+  bool on_demand;
 } Queue;
 
 const char *queue_result_name(enum QueueResult result) {
@@ -52,20 +76,30 @@ static inline size_t pow_2_size(size_t value) {
 }
 
 Queue *queue_init(size_t size) {
-  // memalign must be a power of two
+  // the offsets are wrapped with a mask, so the size must be a power of two
   size = pow_2_size(size);
 
-  Queue *queue = (Queue*) CHECK_MEM(calloc(1, sizeof(Queue)));
+  Queue *queue = NULL;
+  int r = posix_memalign((void**) &queue, CACHE_LINE_SIZE, sizeof(Queue));
+  CHECK(r != 0, "Failed to malloc an aligned queue");
+  memset(queue, 0, sizeof(Queue));
+
   queue->max_size = size;
   queue->mask = size - 1;
   queue->push_offset = ATOMIC_VAR_INIT(0);
+  queue->cached_pop_offset = 0;
   queue->pop_offset = ATOMIC_VAR_INIT(0);
+  queue->cached_push_offset = 0;
 
-  /* aligns the items in the queue to the word. */
-  int r = posix_memalign((void**) &queue->ring_buffer, sizeof(size_t), size);
+  /* starts the items of the queue on a cache line of their own. */
+  r = posix_memalign((void**) &queue->ring_buffer, CACHE_LINE_SIZE,
+		     size * sizeof(void*));
   CHECK(r != 0, "Failed to malloc an aligned memory region");
 
   queue->add_event = eventfd(0, EFD_NONBLOCK);
+  queue->on_demand = false;
+  queue->sleeping = ATOMIC_VAR_INIT(0);
+  queue->doorbells = ATOMIC_VAR_INIT(0);
 
   LOG_DEBUG("Queue of size %zu created", queue->max_size);
   return queue;
@@ -80,56 +114,135 @@ int queue_add_event_fd(Queue *queue) {
   return queue->add_event;
 }
 
+void queue_ring_on_demand(Queue *queue) {
+  queue->on_demand = true;
+}
+
+int queue_prepare_sleep(Queue *queue) {
+  atomic_store_explicit(&queue->sleeping, 1, memory_order_relaxed);
+
+  /* pairs with the fence in ring_doorbell: either the writer sees the flag,
+   * or this sees the message that the writer pushed. */
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load_explicit(&queue->push_offset, memory_order_acquire)
+    != atomic_load_explicit(&queue->pop_offset, memory_order_relaxed);
+}
+
+long queue_doorbells(Queue *queue) {
+  return atomic_load_explicit(&queue->doorbells, memory_order_relaxed);
+}
+
+static inline void ring_doorbell(Queue *queue, size_t count) {
+  if (queue->on_demand) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->sleeping, memory_order_relaxed) == 0
+	|| atomic_exchange_explicit(&queue->sleeping, 0, memory_order_relaxed) == 0) {
+      return;
+    }
+  }
+
+  /* Uses the event file descriptor as the notification system */
+  int r = eventfd_write(queue->add_event, count);
+  CHECK(r != 0, "Failed to send event notification");
+  atomic_fetch_add_explicit(&queue->doorbells, 1, memory_order_relaxed);
+}
+
 void queue_print(Queue *queue) {
   LOG_INFO("Queue: size=%zu", queue_size(queue));
 }
 
 size_t queue_size(Queue *queue) {
-  size_t push = atomic_load(&queue->push_offset);
-  size_t pop = atomic_load(&queue->pop_offset);
-  if (push >= pop) {
-    return push - pop;
-  } else {
-    return queue->max_size - pop + push;
-  }
+  size_t pop = atomic_load_explicit(&queue->pop_offset, memory_order_acquire);
+  size_t push = atomic_load_explicit(&queue->push_offset, memory_order_acquire);
+  return push - pop;
 }
 
 enum QueueResult queue_push(Queue *queue, void *ptr) {
   size_t push_offset = atomic_load_explicit(&queue->push_offset,
-					    __ATOMIC_RELAXED);
-  size_t pop_offset = atomic_load_explicit(&queue->pop_offset,
-					   __ATOMIC_ACQUIRE);
-
-  if (((push_offset + 1) & queue->mask) == pop_offset) {
-    return QUEUE_FAILURE;
-  } else {
-    queue->ring_buffer[push_offset] = ptr;
-    atomic_store_explicit(&queue->push_offset,
-			  (push_offset + 1) & queue->mask,
-			  __ATOMIC_RELEASE);
-
-    /* Uses the event file descriptor as the notification system */
-    int r = eventfd_write(queue->add_event, 1);
-    CHECK(r != 0, "Failed to send event notification");
-    return QUEUE_SUCCESS;
+					    memory_order_relaxed);
+
+  if (push_offset - queue->cached_pop_offset == queue->max_size) {
+    queue->cached_pop_offset = atomic_load_explicit(&queue->pop_offset,
+						    memory_order_acquire);
+    if (push_offset - queue->cached_pop_offset == queue->max_size) {
+      return QUEUE_FAILURE;
+    }
   }
+
+  queue->ring_buffer[push_offset & queue->mask] = ptr;
+  atomic_store_explicit(&queue->push_offset, push_offset + 1,
+			memory_order_release);
+
+  ring_doorbell(queue, 1);
+  return QUEUE_SUCCESS;
 }
 
-void *queue_pop(Queue *queue) {
-  size_t pop_offset = atomic_load_explicit(&queue->pop_offset,
-					   __ATOMIC_RELAXED);
+size_t queue_push_batch(Queue *queue, void **ptrs, size_t count) {
   size_t push_offset = atomic_load_explicit(&queue->push_offset,
-					    __ATOMIC_ACQUIRE);
+					    memory_order_relaxed);
 
-  if (pop_offset == push_offset) {
-    return NULL;
-  } else {
-    void *ptr = queue->ring_buffer[pop_offset];
+  size_t room = queue->max_size - (push_offset - queue->cached_pop_offset);
+  if (room < count) {
+    queue->cached_pop_offset = atomic_load_explicit(&queue->pop_offset,
+						    memory_order_acquire);
+    room = queue->max_size - (push_offset - queue->cached_pop_offset);
+  }
+  if (count > room) {
+    count = room;
+  }
+  if (count == 0) {
+    return 0;
+  }
 
-    atomic_store_explicit(&queue->pop_offset,
-			  (pop_offset + 1) & queue->mask,
-			  __ATOMIC_RELEASE);
-    return ptr;
+  for (size_t i = 0 ; i < count ; i++) {
+    queue->ring_buffer[(push_offset + i) & queue->mask] = ptrs[i];
   }
+  atomic_store_explicit(&queue->push_offset, push_offset + count,
+			memory_order_release);
+
+  ring_doorbell(queue, count);
+  return count;
 }
 
+void *queue_pop(Queue *queue) {
+  size_t pop_offset = atomic_load_explicit(&queue->pop_offset,
+					   memory_order_relaxed);
+
+  if (pop_offset == queue->cached_push_offset) {
+    queue->cached_push_offset = atomic_load_explicit(&queue->push_offset,
+						     memory_order_acquire);
+    if (pop_offset == queue->cached_push_offset) {
+      return NULL;
+    }
+  }
+
+  void *ptr = queue->ring_buffer[pop_offset & queue->mask];
+  atomic_store_explicit(&queue->pop_offset, pop_offset + 1,
+			memory_order_release);
+  return ptr;
+}
+
+size_t queue_pop_batch(Queue *queue, void **ptrs, size_t max_count) {
+  size_t pop_offset = atomic_load_explicit(&queue->pop_offset,
+					   memory_order_relaxed);
+
+  size_t available = queue->cached_push_offset - pop_offset;
+  if (available < max_count) {
+    queue->cached_push_offset = atomic_load_explicit(&queue->push_offset,
+						     memory_order_acquire);
+    available = queue->cached_push_offset - pop_offset;
+  }
+  if (max_count > available) {
+    max_count = available;
+  }
+  if (max_count == 0) {
+    return 0;
+  }
+
+  for (size_t i = 0 ; i < max_count ; i++) {
+    ptrs[i] = queue->ring_buffer[(pop_offset + i) & queue->mask];
+  }
+  atomic_store_explicit(&queue->pop_offset, pop_offset + max_count,
+			memory_order_release);
+  return max_count;
+}
@@ -1,42 +1,254 @@
 #define _GNU_SOURCE
 
 #include <locale.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+#include "epoll_info.h"
 #include "logging.h"
+#include "mrmw_queue.h"
 #include "queue.h"
 #include "request_stats.h"
 #include "server.h"
 #include "server_stats.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "wal.h"
 
 static size_t queue_usage(Server *server) {
   size_t size = 0;
   for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
     for (int queue_id = 0 ; queue_id < server->io_worker_count ; queue_id++) {
       size += queue_size(server->app_actors[actor_id].input_queue[queue_id]);
+      size += queue_size(server->io_epoll_infos[queue_id]->reply_queues[actor_id]);
     }
   }
-  return size;
+  return size + mrmw_queue_size(server->shared_queue);
+}
+
+/**
+ * Prints how many times the IO workers changed their epoll registrations,
+ * in total and for every request.
+ */
+static void print_epoll_usage(Server *server) {
+  long ctl_calls = 0;
+  for (int i = 0 ; i < server->io_worker_count ; i++) {
+    ctl_calls += atomic_load_explicit(&server->io_epoll_infos[i]->ctl_count,
+				      memory_order_relaxed);
+  }
+  long requests = server_stats_get_total_requests(server->server_stats);
+  LOG_INFO("Epoll : ctl calls: %'ld per request: %.2lf", ctl_calls,
+	   requests > 0 ? (double) ctl_calls / (double) requests : 0.0);
+}
+
+/**
+ * Prints how many notifications the queues between the IO workers and the
+ * actors sent, in total and for every request.
+ */
+static void print_doorbell_usage(Server *server) {
+  long doorbells = 0;
+  for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
+    for (int queue_id = 0 ; queue_id < server->io_worker_count ; queue_id++) {
+      doorbells += queue_doorbells(server->app_actors[actor_id].input_queue[queue_id]);
+      doorbells += queue_doorbells(server->io_epoll_infos[queue_id]->reply_queues[actor_id]);
+    }
+  }
+  long requests = server_stats_get_total_requests(server->server_stats);
+  LOG_INFO("Queue : doorbells: %'ld per request: %.2lf", doorbells,
+	   requests > 0 ? (double) doorbells / (double) requests : 0.0);
+}
+
+/**
+ * Prints how many requests had to wait for an actor whose queue was full,
+ * and how many were answered with a 503 for it, for every actor.
+ */
+static void print_overload_usage(Server *server) {
+  char buffer[4096];
+  size_t offset = 0;
+  long parked = 0;
+  long rejected = 0;
+  long parked_replies = 0;
+
+  for (int actor_id = 0 ; actor_id < server->actor_count && offset < sizeof(buffer) ; actor_id++) {
+    ActorInfo *actor_info = &server->app_actors[actor_id];
+    long actor_parked = atomic_load_explicit(&actor_info->parked_requests, memory_order_relaxed);
+    long actor_rejected = atomic_load_explicit(&actor_info->rejected_requests,
+					       memory_order_relaxed);
+    long actor_parked_replies = atomic_load_explicit(&actor_info->parked_replies,
+						     memory_order_relaxed);
+    parked += actor_parked;
+    rejected += actor_rejected;
+    parked_replies += actor_parked_replies;
+    if (actor_parked == 0 && actor_rejected == 0 && actor_parked_replies == 0) {
+      continue;
+    }
+
+    int written = snprintf(buffer + offset, sizeof(buffer) - offset,
+			   "\n        actor %d: parked: %'ld rejected: %'ld parked replies: %'ld",
+			   actor_id, actor_parked, actor_rejected, actor_parked_replies);
+    CHECK(written < 0, "Failed to print overload usage");
+    offset += (size_t) written;
+  }
+  buffer[offset < sizeof(buffer) ? offset : sizeof(buffer) - 1] = '\0';
+
+  LOG_INFO("Overload : parked: %'ld rejected: %'ld parked replies: %'ld%s", parked, rejected,
+	   parked_replies, buffer);
+}
+
+static void sum_wakeups(EpollInfo *epoll_info, long *spins, long *sleeps) {
+  *spins += atomic_load_explicit(&epoll_info->spin_wakeups, memory_order_relaxed);
+  *sleeps += atomic_load_explicit(&epoll_info->sleep_wakeups, memory_order_relaxed);
+}
+
+static inline double spin_percent(long spins, long sleeps) {
+  return spins + sleeps > 0 ? 100.0 * (double) spins / (double) (spins + sleeps) : 0.0;
+}
+
+/**
+ * Prints how often the IO workers and the actors found new events while
+ * busy polling, and how often they had to go to sleep for them.
+ */
+static void print_busy_poll_usage(Server *server) {
+  long io_spins = 0;
+  long io_sleeps = 0;
+  for (int i = 0 ; i < server->io_worker_count ; i++) {
+    sum_wakeups(server->io_epoll_infos[i], &io_spins, &io_sleeps);
+  }
+
+  long actor_spins = 0;
+  long actor_sleeps = 0;
+  for (int i = 0 ; i < server->actor_count ; i++) {
+    sum_wakeups(server->app_actors[i].epoll_info, &actor_spins, &actor_sleeps);
+  }
+
+  LOG_INFO("Busy poll : io spins: %'ld sleeps: %'ld (%.1lf%% spun) "
+	   "actor spins: %'ld sleeps: %'ld (%.1lf%% spun)",
+	   io_spins, io_sleeps, spin_percent(io_spins, io_sleeps),
+	   actor_spins, actor_sleeps, spin_percent(actor_spins, actor_sleeps));
+}
+
+/**
+ * Prints the occupancy of every size class of the slab allocators, summed
+ * up over all of the actors. Classes that were never used are skipped.
+ */
+static void print_slab_usage(Server *server) {
+  char buffer[4096];
+  size_t offset = 0;
+  long pages = 0;
+  long large_bytes = 0;
+
+  for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
+    Slab *slab = server->app_actors[actor_id].slab;
+    pages += atomic_load_explicit(&slab->page_count, memory_order_relaxed);
+    large_bytes += atomic_load_explicit(&slab->large_bytes, memory_order_relaxed);
+  }
+
+  for (size_t i = 0 ; i < SLAB_CLASS_COUNT && offset < sizeof(buffer) ; i++) {
+    long used = 0;
+    long total = 0;
+    for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
+      SlabClass *slab_class = &server->app_actors[actor_id].slab->classes[i];
+      used += atomic_load_explicit(&slab_class->used, memory_order_relaxed);
+      total += atomic_load_explicit(&slab_class->total, memory_order_relaxed);
+    }
+    if (total == 0) {
+      continue;
+    }
+    size_t class_size = server->app_actors[0].slab->classes[i].size;
+    int written = snprintf(buffer + offset, sizeof(buffer) - offset,
+			   "\n        %zu bytes: %'ld / %'ld (%.1lf%%)",
+			   class_size, used, total, 100.0 * (double) used / (double) total);
+    CHECK(written < 0, "Failed to print slab usage");
+    offset += (size_t) written;
+  }
+  buffer[offset < sizeof(buffer) ? offset : sizeof(buffer) - 1] = '\0';
+
+  LOG_INFO("Slab  : pages: %'ld (%'ld MiB) large: %'ld bytes%s",
+	   pages, pages * (SLAB_PAGE_SIZE / (1024 * 1024)), large_bytes, buffer);
+}
+
+/**
+ * Prints how well the writes of the actors are being grouped together
+ * into a single sync, and how much was written to snapshots.
+ */
+static void print_wal_usage(Server *server) {
+  long syncs = 0;
+  long records = 0;
+  long snapshots = 0;
+  long snapshot_bytes = 0;
+  for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
+    Wal *wal = server->app_actors[actor_id].wal;
+    syncs += atomic_load_explicit(&wal->sync_count, memory_order_relaxed);
+    records += atomic_load_explicit(&wal->record_count, memory_order_relaxed);
+
+    Snapshot *snapshot = server->app_actors[actor_id].snapshot;
+    snapshots += atomic_load_explicit(&snapshot->snapshot_count, memory_order_relaxed);
+    snapshot_bytes += atomic_load_explicit(&snapshot->snapshot_bytes, memory_order_relaxed);
+  }
+  LOG_INFO("Wal   : syncs: %'ld records: %'ld records per sync: %.1lf "
+	   "snapshots: %'ld (%'ld MiB)",
+	   syncs, records, syncs == 0 ? 0.0 : (double) records / (double) syncs,
+	   snapshots, snapshot_bytes / (1024 * 1024));
+}
+
+/**
+ * Prints how often the lookups of the actors found their key and how many
+ * keys were pushed out by the memory limit or expired.
+ */
+static void print_store_usage(Server *server) {
+  long hits = 0;
+  long misses = 0;
+  long evictions = 0;
+  long expirations = 0;
+  for (int actor_id = 0 ; actor_id < server->actor_count ; actor_id++) {
+    KvStore *store = server->app_actors[actor_id].store;
+    hits += atomic_load_explicit(&store->hits, memory_order_relaxed);
+    misses += atomic_load_explicit(&store->misses, memory_order_relaxed);
+    evictions += atomic_load_explicit(&store->evictions, memory_order_relaxed);
+    expirations += atomic_load_explicit(&store->expirations, memory_order_relaxed);
+  }
+  long lookups = hits + misses;
+  LOG_INFO("Store : hits: %'ld misses: %'ld hit rate: %.1lf%% evictions: %'ld expired: %'ld",
+	   hits, misses, lookups == 0 ? 0.0 : 100.0 * (double) hits / (double) lookups,
+	   evictions, expirations);
 }
 
 void *stats_loop(void *pthread_input) {
   Server *server = (Server*) pthread_input;
 
+  pthread_barrier_wait(&server->startup);
+
   while (1) {
     sleep(5);
     setlocale(LC_NUMERIC, "");
     LOG_INFO("-------------------------------------------------------\n"
-	     "Stats : total requests: %'lu active requests: %'lu queue size: %lu\n"
+	     "Stats : total requests: %'lu active requests: %'lu queue size: %lu "
+	     "deferred writes: %'lu timeouts: %'lu\n"
              "Time  : total: %'.0lfus client read: %'.0lfus client write: %'.0lfus "
 	     "actor: %'.0lfus queue: %'.0lfus",
 	     server_stats_get_total_requests(server->server_stats),
 	     server_stats_get_active_requests(server->server_stats),
 	     queue_usage(server),
+	     server_stats_get_deferred_writes(server->server_stats),
+	     server_stats_get_timeouts(server->server_stats),
 	     server_stats_get_time(server->server_stats, TOTAL_TIME),
 	     server_stats_get_time(server->server_stats, CLIENT_READ_TIME),
 	     server_stats_get_time(server->server_stats, CLIENT_WRITE_TIME),
 	     server_stats_get_time(server->server_stats, ACTOR_TIME),
 	     server_stats_get_time(server->server_stats, QUEUE_TIME));
+    print_epoll_usage(server);
+    print_doorbell_usage(server);
+    print_overload_usage(server);
+    if (server->config->busy_poll > 0) {
+      print_busy_poll_usage(server);
+    }
+    print_store_usage(server);
+    print_slab_usage(server);
+    if (server->config->data_dir != NULL) {
+      print_wal_usage(server);
+    }
   }
 
   return NULL;
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+#include "logging.h"
+#include "swiss_table.h"
+
+#define CTRL_EMPTY ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+#define MIN_CAPACITY SWISS_GROUP_SIZE
+
+/* the table is rehashed once 7/8th of the slots have been used. */
+static inline size_t max_load(size_t capacity) {
+  return capacity - capacity / 8;
+}
+
+static inline int8_t hash_h2(uint64_t hash) {
+  return (int8_t) (hash & 0x7f);
+}
+
+static inline size_t hash_h1(uint64_t hash) {
+  return (size_t) (hash >> 7);
+}
+
+#ifdef __SSE2__
+
+/* returns a bit mask of the slots in the group whose control byte is h2. */
+static inline uint32_t group_match(const int8_t *group, int8_t h2) {
+  __m128i ctrl = _mm_load_si128((const __m128i*) group);
+  return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+}
+
+static inline uint32_t group_match_empty(const int8_t *group) {
+  return group_match(group, CTRL_EMPTY);
+}
+
+/* both empty and deleted control bytes have the sign bit set. */
+static inline uint32_t group_match_empty_or_deleted(const int8_t *group) {
+  __m128i ctrl = _mm_load_si128((const __m128i*) group);
+  return (uint32_t) _mm_movemask_epi8(ctrl);
+}
+
+#else
+
+static inline uint32_t group_match(const int8_t *group, int8_t h2) {
+  uint32_t mask = 0;
+  for (uint32_t i = 0 ; i < SWISS_GROUP_SIZE ; i++) {
+    mask |= (uint32_t) (group[i] == h2) << i;
+  }
+  return mask;
+}
+
+static inline uint32_t group_match_empty(const int8_t *group) {
+  return group_match(group, CTRL_EMPTY);
+}
+
+static inline uint32_t group_match_empty_or_deleted(const int8_t *group) {
+  uint32_t mask = 0;
+  for (uint32_t i = 0 ; i < SWISS_GROUP_SIZE ; i++) {
+    mask |= (uint32_t) (group[i] < 0) << i;
+  }
+  return mask;
+}
+
+#endif
+
+static inline size_t slot_key_len(const SwissSlot *slot) {
+  return slot->key_len & ~SWISS_ACCESSED;
+}
+
+static inline const char *slot_key(const SwissSlot *slot) {
+  if (slot_key_len(slot) <= SWISS_INLINE_KEY_SIZE) {
+    return slot->key_data;
+  }
+  const char *key;
+  memcpy(&key, slot->key_data + SWISS_PREFIX_SIZE, sizeof(key));
+  return key;
+}
+
+/**
+ * Stores the entry in the slot, an entry that was just stored counts as
+ * accessed.
+ */
+static inline void slot_set(SwissSlot *slot, const char *key, size_t key_len,
+			    void *value) {
+  slot->value = value;
+  slot->key_len = (uint32_t) key_len | SWISS_ACCESSED;
+  if (key_len <= SWISS_INLINE_KEY_SIZE) {
+    memcpy(slot->key_data, key, key_len);
+  } else {
+    memcpy(slot->key_data, key, SWISS_PREFIX_SIZE);
+    memcpy(slot->key_data + SWISS_PREFIX_SIZE, &key, sizeof(key));
+  }
+}
+
+/**
+ * Compares the key of the slot with the given key. The prefix of long keys is
+ * checked first so that the full key is only loaded on a likely match.
+ */
+static inline bool slot_equals(const SwissSlot *slot, const char *key,
+			       size_t key_len) {
+  if (slot_key_len(slot) != key_len) {
+    return false;
+  }
+  if (key_len <= SWISS_INLINE_KEY_SIZE) {
+    return memcmp(slot->key_data, key, key_len) == 0;
+  }
+  if (memcmp(slot->key_data, key, SWISS_PREFIX_SIZE) != 0) {
+    return false;
+  }
+  return memcmp(slot_key(slot), key, key_len) == 0;
+}
+
+static void alloc_arrays(SwissTable *table, size_t capacity) {
+  int r = posix_memalign((void**) &table->ctrl, SWISS_GROUP_SIZE, capacity);
+  CHECK(r != 0, "Failed to allocate control bytes");
+  memset(table->ctrl, CTRL_EMPTY, capacity);
+
+  r = posix_memalign((void**) &table->slots, 64, capacity * sizeof(SwissSlot));
+  CHECK(r != 0, "Failed to allocate slots");
+
+  table->capacity = capacity;
+  table->growth_left = max_load(capacity) - table->size;
+}
+
+/**
+ * Returns the index of the slot holding the key or the capacity of the
+ * table if the key is not stored.
+ */
+static size_t find_slot(SwissTable *table, uint64_t hash, const char *key,
+			size_t key_len) {
+  size_t group_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+  size_t group = hash_h1(hash) & group_mask;
+  int8_t h2 = hash_h2(hash);
+
+  for (size_t probe = 1 ; probe <= group_mask + 1 ; probe++) {
+    const int8_t *ctrl = table->ctrl + group * SWISS_GROUP_SIZE;
+    uint32_t match = group_match(ctrl, h2);
+    while (match != 0) {
+      size_t index = group * SWISS_GROUP_SIZE + (size_t) __builtin_ctz(match);
+      if (LIKELY(slot_equals(&table->slots[index], key, key_len))) {
+	return index;
+      }
+      match &= match - 1;
+    }
+
+    /* a probe sequence never continues past a group with an empty slot. */
+    if (group_match_empty(ctrl) != 0) {
+      break;
+    }
+    group = (group + probe) & group_mask;
+  }
+  return table->capacity;
+}
+
+/**
+ * Returns the index of the first empty or deleted slot in the probe sequence
+ * of the hash. The table always has at least one free slot.
+ */
+static size_t find_free_slot(SwissTable *table, uint64_t hash) {
+  size_t group_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+  size_t group = hash_h1(hash) & group_mask;
+
+  for (size_t probe = 1 ; ; probe++) {
+    uint32_t match = group_match_empty_or_deleted(table->ctrl + group * SWISS_GROUP_SIZE);
+    if (match != 0) {
+      return group * SWISS_GROUP_SIZE + (size_t) __builtin_ctz(match);
+    }
+    group = (group + probe) & group_mask;
+  }
+}
+
+/**
+ * Moves every entry into a new set of arrays. The table only doubles in size
+ * when it is actually full, otherwise this just clears out the deleted slots.
+ */
+static void rehash(SwissTable *table) {
+  int8_t *old_ctrl = table->ctrl;
+  SwissSlot *old_slots = table->slots;
+  size_t old_capacity = table->capacity;
+
+  size_t capacity = old_capacity;
+  if (table->size * 16 >= max_load(old_capacity) * 7) {
+    capacity <<= 1;
+  }
+  alloc_arrays(table, capacity);
+
+  for (size_t i = 0 ; i < old_capacity ; i++) {
+    if (old_ctrl[i] < 0) {
+      continue;
+    }
+    SwissSlot *slot = &old_slots[i];
+    const char *key = slot_key(slot);
+    uint64_t hash = hash_bytes(key, slot_key_len(slot));
+    size_t index = find_free_slot(table, hash);
+    table->ctrl[index] = hash_h2(hash);
+    table->slots[index] = *slot;
+  }
+
+  free(old_ctrl);
+  free(old_slots);
+}
+
+SwissTable *swiss_table_init(size_t initial_size) {
+  SwissTable *table = (SwissTable*) CHECK_MEM(calloc(1, sizeof(SwissTable)));
+
+  size_t capacity = MIN_CAPACITY;
+  while (max_load(capacity) < initial_size) {
+    capacity <<= 1;
+  }
+  table->size = 0;
+  alloc_arrays(table, capacity);
+  return table;
+}
+
+void swiss_table_destroy(SwissTable *table) {
+  free(table->ctrl);
+  free(table->slots);
+  free(table);
+}
+
+void *swiss_table_get(SwissTable *table, const char *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  size_t index = find_slot(table, hash, key, key_len);
+  if (index == table->capacity) {
+    return NULL;
+  }
+  return table->slots[index].value;
+}
+
+void *swiss_table_touch(SwissTable *table, const char *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  size_t index = find_slot(table, hash, key, key_len);
+  if (index == table->capacity) {
+    return NULL;
+  }
+  table->slots[index].key_len |= SWISS_ACCESSED;
+  return table->slots[index].value;
+}
+
+void *swiss_table_put(SwissTable *table, const char *key, size_t key_len,
+		      void *value) {
+  uint64_t hash = hash_bytes(key, key_len);
+  size_t index = find_slot(table, hash, key, key_len);
+
+  if (index != table->capacity) {
+    /* the key is rewritten as well since the new value owns the memory of
+     * long keys from now on. */
+    SwissSlot *slot = &table->slots[index];
+    void *prev = slot->value;
+    slot_set(slot, key, key_len, value);
+    return prev;
+  }
+
+  index = find_free_slot(table, hash);
+  if (UNLIKELY(table->growth_left == 0 && table->ctrl[index] == CTRL_EMPTY)) {
+    rehash(table);
+    index = find_free_slot(table, hash);
+  }
+
+  if (table->ctrl[index] == CTRL_EMPTY) {
+    table->growth_left--;
+  }
+  table->ctrl[index] = hash_h2(hash);
+  slot_set(&table->slots[index], key, key_len, value);
+  table->size++;
+  return NULL;
+}
+
+void *swiss_table_remove(SwissTable *table, const char *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  size_t index = find_slot(table, hash, key, key_len);
+  if (index == table->capacity) {
+    return NULL;
+  }
+
+  void *value = table->slots[index].value;
+  table->size--;
+
+  /* when the group still has an empty slot, no probe sequence could have
+   * passed over this group so the slot can be made empty again instead of
+   * leaving a tombstone behind. */
+  const int8_t *group = table->ctrl + (index & ~((size_t) SWISS_GROUP_SIZE - 1));
+  if (group_match_empty(group) != 0) {
+    table->ctrl[index] = CTRL_EMPTY;
+    table->growth_left++;
+  } else {
+    table->ctrl[index] = CTRL_DELETED;
+  }
+  return value;
+}
+
+size_t swiss_table_size(SwissTable *table) {
+  return table->size;
+}
+
+void *swiss_table_slot_value(SwissTable *table, size_t index) {
+  if (table->ctrl[index] < 0) {
+    return NULL;
+  }
+  return table->slots[index].value;
+}
+
+void *swiss_table_clock(SwissTable *table, size_t *hand) {
+  if (table->size == 0) {
+    return NULL;
+  }
+
+  /* after one round every access bit is cleared, so the second round is
+   * guaranteed to find an entry. */
+  size_t mask = table->capacity - 1;
+  while (1) {
+    size_t index = (*hand)++ & mask;
+    if (table->ctrl[index] < 0) {
+      continue;
+    }
+    SwissSlot *slot = &table->slots[index];
+    if (slot->key_len & SWISS_ACCESSED) {
+      slot->key_len &= ~SWISS_ACCESSED;
+      continue;
+    }
+    return slot->value;
+  }
+}
+
+size_t swiss_table_memory(SwissTable *table) {
+  return table->capacity * (sizeof(int8_t) + sizeof(SwissSlot));
+}
@@ -0,0 +1,127 @@
+#ifndef __swiss_table_h__
+#define __swiss_table_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * An open-addressing hash table that maps a sequence of bytes to a pointer,
+ * laid out the same way as the "swiss table" design.
+ *
+ * Next to the array of slots there is an array of control bytes, one per
+ * slot. A control byte either marks the slot as empty / deleted or stores 7
+ * bits of the hash of the key in the slot. Slots are grouped by 16 and a
+ * lookup compares the control bytes of a whole group at once with SSE2, so
+ * that only the slots whose hash bits match are ever looked at.
+ *
+ * Keys of up to SWISS_INLINE_KEY_SIZE bytes are copied into the slot itself.
+ * Longer keys are not copied: the slot stores the first bytes of the key and
+ * a pointer to it, so the memory of a long key must stay valid for as long
+ * as it is in the table. The table never allocates memory per entry.
+ *
+ * Every slot also has an access bit for the CLOCK algorithm, which is set
+ * when the entry is stored or touched and cleared as the clock hand sweeps
+ * over the slots.
+ *
+ * There is no synchronization done, so a table must only ever be used by the
+ * thread that created it.
+ */
+
+#define SWISS_GROUP_SIZE 16
+
+/* the longest key that is stored inside of the slot. */
+#define SWISS_INLINE_KEY_SIZE 20
+
+/* the amount of bytes of a long key that are kept in the slot. */
+#define SWISS_PREFIX_SIZE (SWISS_INLINE_KEY_SIZE - sizeof(const char*))
+
+/* the bit of the key length that marks the slot as accessed. */
+#define SWISS_ACCESSED (1u << 31)
+
+typedef struct SwissSlot {
+  void *value;
+  /* the length of the key, plus the SWISS_ACCESSED bit. */
+  uint32_t key_len;
+  /* holds either the whole key or its prefix followed by a pointer to the
+   * full key, depending on the length of the key. */
+  char key_data[SWISS_INLINE_KEY_SIZE];
+} SwissSlot;
+
+typedef struct SwissTable {
+  /* one control byte for every slot. */
+  int8_t *ctrl;
+  SwissSlot *slots;
+
+  /* the amount of slots, always a power of 2 and a multiple of the group
+   * size. */
+  size_t capacity;
+
+  /* the amount of keys stored in the table. */
+  size_t size;
+
+  /* the amount of empty slots that can still be used before the table
+   * has to be rehashed. */
+  size_t growth_left;
+} SwissTable;
+
+/**
+ * Constructs a table with room for at least the given amount of entries
+ * before it needs to grow.
+ */
+SwissTable *swiss_table_init(size_t initial_size);
+
+/**
+ * Frees the table. The values that are still stored are not touched.
+ */
+void swiss_table_destroy(SwissTable *table);
+
+/**
+ * Returns the value stored for the given key or NULL if there is none.
+ */
+void *swiss_table_get(SwissTable *table, const char *key, size_t key_len);
+
+/**
+ * Same as swiss_table_get, but marks the entry as accessed as well.
+ */
+void *swiss_table_touch(SwissTable *table, const char *key, size_t key_len);
+
+/**
+ * Stores the value for the given key. The previous value for the key is
+ * returned so that the caller can free it, NULL if there was none.
+ */
+void *swiss_table_put(SwissTable *table, const char *key, size_t key_len,
+		      void *value);
+
+/**
+ * Removes the key from the table and returns the value that was stored for
+ * it, NULL if the key was not found.
+ */
+void *swiss_table_remove(SwissTable *table, const char *key, size_t key_len);
+
+/**
+ * Returns the amount of entries in the table.
+ */
+size_t swiss_table_size(SwissTable *table);
+
+/**
+ * Returns the value stored in the slot at the given index, NULL if the slot
+ * is not in use. Together with the capacity this allows iterating over all
+ * of the entries of the table.
+ */
+void *swiss_table_slot_value(SwissTable *table, size_t index);
+
+/**
+ * Moves the clock hand over the slots, starting at the slot that it points
+ * to. Entries that were accessed since the hand last passed them lose their
+ * access bit and are skipped. The value of the first entry that was not
+ * accessed is returned, without removing it, and the hand is left right
+ * after it. Returns NULL if the table is empty.
+ */
+void *swiss_table_clock(SwissTable *table, size_t *hand);
+
+/**
+ * The amount of bytes used by the arrays of the table.
+ */
+size_t swiss_table_memory(SwissTable *table);
+
+#endif
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "timer_wheel.h"
+
+#define SLOT_MASK ((uint64_t) TIMER_WHEEL_SLOTS - 1)
+
+/* the amount of bits of the ticks that are covered by all of the levels. */
+#define RANGE_BITS (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)
+
+static inline unsigned slot_of(uint64_t tick, int level) {
+  return (unsigned) ((tick >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK);
+}
+
+static inline void list_init(TimerNode *head) {
+  head->next = head;
+  head->prev = head;
+}
+
+static inline int list_is_empty(const TimerNode *head) {
+  return head->next == head;
+}
+
+static inline void list_append(TimerNode *head, TimerNode *node) {
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+/**
+ * Puts the timer into the slot that matches its expiration relative to the
+ * current time of the wheel. Timers that are further out than the levels
+ * reach wait in the overflow list.
+ */
+static void place(TimerWheel *wheel, TimerNode *node) {
+  uint64_t expires = node->expires < wheel->now ? wheel->now : node->expires;
+  uint64_t diff = expires ^ wheel->now;
+  if ((diff >> RANGE_BITS) != 0) {
+    list_append(&wheel->overflow, node);
+    return;
+  }
+
+  int level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / TIMER_WHEEL_SLOT_BITS;
+  unsigned slot = slot_of(expires, level);
+  list_append(&wheel->slots[level][slot], node);
+  wheel->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * Places every timer of the list again, relative to the current time.
+ */
+static void replace_all(TimerWheel *wheel, TimerNode *head) {
+  TimerNode *node = head->next;
+  list_init(head);
+  while (node != head) {
+    TimerNode *next = node->next;
+    place(wheel, node);
+    node = next;
+  }
+}
+
+/**
+ * Returns the first tick after the current one at which a timer expires or
+ * has to be moved down a level. Timers of lower levels always come before
+ * the ones of higher levels.
+ */
+static uint64_t next_event(TimerWheel *wheel) {
+  for (int level = 0 ; level < TIMER_WHEEL_LEVELS ; level++) {
+    unsigned current = slot_of(wheel->now, level);
+    uint64_t later = current == SLOT_MASK ? 0 : wheel->occupied[level] & (~0ULL << (current + 1));
+    if (later != 0) {
+      int shift = level * TIMER_WHEEL_SLOT_BITS;
+      uint64_t base = wheel->now >> (shift + TIMER_WHEEL_SLOT_BITS) << (shift + TIMER_WHEEL_SLOT_BITS);
+      return base | ((uint64_t) __builtin_ctzll(later) << shift);
+    }
+  }
+
+  if (!list_is_empty(&wheel->overflow)) {
+    return ((wheel->now >> RANGE_BITS) + 1) << RANGE_BITS;
+  }
+  return UINT64_MAX;
+}
+
+/**
+ * Moves the timers of every slot that starts at the current tick down to
+ * the lower levels, highest level first.
+ */
+static void cascade(TimerWheel *wheel) {
+  if ((wheel->now & ((1ULL << RANGE_BITS) - 1)) == 0) {
+    replace_all(wheel, &wheel->overflow);
+  }
+
+  for (int level = TIMER_WHEEL_LEVELS - 1 ; level > 0 ; level--) {
+    uint64_t below = (1ULL << (level * TIMER_WHEEL_SLOT_BITS)) - 1;
+    unsigned slot = slot_of(wheel->now, level);
+    if ((wheel->now & below) != 0 || (wheel->occupied[level] & (1ULL << slot)) == 0) {
+      continue;
+    }
+    wheel->occupied[level] &= ~(1ULL << slot);
+    replace_all(wheel, &wheel->slots[level][slot]);
+  }
+}
+
+TimerWheel *timer_wheel_init(uint64_t now) {
+  TimerWheel *wheel = (TimerWheel*) CHECK_MEM(calloc(1, sizeof(TimerWheel)));
+  wheel->now = now;
+  wheel->size = 0;
+  for (int level = 0 ; level < TIMER_WHEEL_LEVELS ; level++) {
+    wheel->occupied[level] = 0;
+    for (int slot = 0 ; slot < TIMER_WHEEL_SLOTS ; slot++) {
+      list_init(&wheel->slots[level][slot]);
+    }
+  }
+  list_init(&wheel->overflow);
+  return wheel;
+}
+
+void timer_wheel_destroy(TimerWheel *wheel) {
+  free(wheel);
+}
+
+void timer_wheel_add(TimerWheel *wheel, TimerNode *node, uint64_t expires) {
+  node->expires = expires;
+  place(wheel, node);
+  wheel->size++;
+}
+
+void timer_wheel_remove(TimerWheel *wheel, TimerNode *node) {
+  TimerNode *next = node->next;
+  node->prev->next = next;
+  next->prev = node->prev;
+  node->next = NULL;
+  node->prev = NULL;
+  wheel->size--;
+
+  /* only the head of a list can end up pointing to itself. */
+  if (list_is_empty(next) && next != &wheel->overflow) {
+    size_t index = (size_t) (next - &wheel->slots[0][0]);
+    wheel->occupied[index / TIMER_WHEEL_SLOTS] &= ~(1ULL << (index % TIMER_WHEEL_SLOTS));
+  }
+}
+
+TimerNode *timer_wheel_expire(TimerWheel *wheel, uint64_t now) {
+  while (wheel->now <= now) {
+    TimerNode *head = &wheel->slots[0][slot_of(wheel->now, 0)];
+    if (!list_is_empty(head)) {
+      TimerNode *node = head->next;
+      timer_wheel_remove(wheel, node);
+      return node;
+    }
+
+    uint64_t next = next_event(wheel);
+    if (next > now) {
+      /* nothing happens before the given tick, so the time can jump. */
+      wheel->now = now + 1;
+      if (next == wheel->now) {
+	cascade(wheel);
+      }
+      return NULL;
+    }
+    wheel->now = next;
+    cascade(wheel);
+  }
+  return NULL;
+}
+
+size_t timer_wheel_size(TimerWheel *wheel) {
+  return wheel->size;
+}
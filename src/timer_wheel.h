@@ -0,0 +1,89 @@
+#ifndef __timer_wheel_h__
+#define __timer_wheel_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A hierarchical timing wheel. Time is counted in ticks, the unit of which
+ * is up to the caller.
+ *
+ * Every level has TIMER_WHEEL_SLOTS slots, and a slot of a level spans as
+ * many ticks as the whole level below it. A timer is stored in the lowest
+ * level in which it shares the slot of every higher level with the current
+ * time. Once the current time reaches a slot of a higher level, the timers
+ * in it are moved down. Adding and removing a timer is O(1), and every
+ * timer is moved down at most once per level.
+ *
+ * The wheel does not allocate anything per timer: the TimerNode is embedded
+ * in whatever the timer is for. Use TIMER_NODE_ENTRY to get back to it.
+ */
+
+#define TIMER_WHEEL_LEVELS 6
+
+/* the amount of slots per level, the bits of the occupancy mask. */
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+#define TIMER_NODE_ENTRY(node, type, member)			\
+  ((type*) ((char*) (node) - offsetof(type, member)))
+
+typedef struct TimerNode {
+  struct TimerNode *next;
+  struct TimerNode *prev;
+  uint64_t expires;
+} TimerNode;
+
+typedef struct TimerWheel {
+  /* every timer that expires before this tick was handed out already. */
+  uint64_t now;
+
+  /* the amount of timers in the wheel. */
+  size_t size;
+
+  /* a bit for every slot of a level that holds at least one timer. */
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+
+  /* the heads of the circular lists of timers of every slot. */
+  TimerNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+  /* the timers that are too far out for the highest level, placed again
+   * every time the highest level wraps around. */
+  TimerNode overflow;
+} TimerWheel;
+
+/**
+ * Constructs an empty wheel that starts at the given tick.
+ */
+TimerWheel *timer_wheel_init(uint64_t now);
+
+/**
+ * Frees the wheel. The timers that are still in it are not touched.
+ */
+void timer_wheel_destroy(TimerWheel *wheel);
+
+/**
+ * Adds a timer that expires at the given tick. A tick in the past expires
+ * the next time the wheel is advanced.
+ */
+void timer_wheel_add(TimerWheel *wheel, TimerNode *node, uint64_t expires);
+
+/**
+ * Removes a timer that is in the wheel.
+ */
+void timer_wheel_remove(TimerWheel *wheel, TimerNode *node);
+
+/**
+ * Advances the wheel towards the given tick and returns the next timer that
+ * expired on the way, after removing it from the wheel. Returns NULL once
+ * every timer up to and including the tick was handed out. Callers can stop
+ * at any point and continue later, which bounds the work done at once.
+ */
+TimerNode *timer_wheel_expire(TimerWheel *wheel, uint64_t now);
+
+/**
+ * The amount of timers in the wheel.
+ */
+size_t timer_wheel_size(TimerWheel *wheel);
+
+#endif
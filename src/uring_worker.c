@@ -0,0 +1,634 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "connection_table.h"
+#include "epoll_info.h"
+#include "http_request.h"
+#include "input_buffer.h"
+#include "io_worker.h"
+#include "logging.h"
+#include "output_buffer.h"
+#include "queue.h"
+#include "request_context.h"
+#include "request_stats.h"
+#include "server.h"
+#include "server_stats.h"
+#include "uring_worker.h"
+
+/* the amount of entries in the submission queue. */
+#define RING_ENTRIES 4096
+
+/* the buffers that reads pick from, the count must be a power of 2. */
+#define BUFFER_COUNT 1024
+#define BUFFER_SIZE 4096
+#define BUFFER_GROUP 0
+
+/* the operation is stored in the lowest bits of the user data of an entry,
+ * the rest is the pointer that it is for. */
+#define OP_MASK 7ULL
+
+enum RingOp {
+  OP_ACCEPT = 0,
+  OP_RECV = 1,
+  OP_SEND = 2,
+  OP_REPLY = 3,
+  OP_TIMER = 4,
+};
+
+typedef struct Ring {
+  int fd;
+
+  /* the submission queue, shared with the kernel. */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+
+  /* the tail including the entries that were not submitted yet. */
+  unsigned sq_local_tail;
+
+  /* the completion queue, shared with the kernel. */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+
+  /* the ring of buffers that the kernel picks from for reads. */
+  struct io_uring_buf_ring *buf_ring;
+  unsigned short buf_tail;
+  char *buffers;
+} Ring;
+
+typedef struct UringWorker {
+  Ring ring;
+  Server *server;
+  EpollInfo *epoll_info;
+  int sock_fd;
+} UringWorker;
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+				     unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+					unsigned nr_args) {
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ring_destroy(Ring *ring) {
+  if (ring->buf_ring != NULL) {
+    munmap(ring->buf_ring, BUFFER_COUNT * sizeof(struct io_uring_buf));
+  }
+  free(ring->buffers);
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ptr != NULL) {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  if (ring->sq_ptr != NULL) {
+    munmap(ring->sq_ptr, ring->sq_size);
+  }
+  if (ring->fd != -1) {
+    close(ring->fd);
+  }
+}
+
+static inline void buffer_recycle(Ring *ring, unsigned short id) {
+  struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (BUFFER_COUNT - 1)];
+  buf->addr = (uint64_t) (uintptr_t) (ring->buffers + (size_t) id * BUFFER_SIZE);
+  buf->len = BUFFER_SIZE;
+  buf->bid = id;
+  ring->buf_tail++;
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Sets up the ring and the buffers that are provided to the kernel. Returns
+ * -1 when the kernel lacks io_uring or any of the features that are used,
+ * leaving the ring cleaned up.
+ */
+static int ring_init(Ring *ring) {
+  memset(ring, 0, sizeof(Ring));
+  ring->fd = -1;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = sys_io_uring_setup(RING_ENTRIES, &params);
+  if (ring->fd < 0) {
+    LOG_WARN("io_uring_setup failed: %s", strerror(errno));
+    ring->fd = -1;
+    return -1;
+  }
+  if ((params.features & IORING_FEAT_NODROP) == 0) {
+    LOG_WARN("io_uring can drop completions on this kernel");
+    ring_destroy(ring);
+    return -1;
+  }
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, ring->fd,
+					   IORING_OFF_SQES);
+  if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    LOG_WARN("Failed to map the io_uring queues");
+    ring->sq_ptr = ring->sq_ptr == MAP_FAILED ? NULL : ring->sq_ptr;
+    ring->cq_ptr = ring->cq_ptr == MAP_FAILED ? NULL : ring->cq_ptr;
+    ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+    ring_destroy(ring);
+    return -1;
+  }
+
+  char *sq = (char*) ring->sq_ptr;
+  ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_local_tail = *ring->sq_tail;
+
+  /* the entries are always used in order, so the indirection array maps
+   * every slot to itself. */
+  unsigned *array = (unsigned*) (sq + params.sq_off.array);
+  for (unsigned i = 0 ; i < params.sq_entries ; i++) {
+    array[i] = i;
+  }
+
+  char *cq = (char*) ring->cq_ptr;
+  ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  /* provided buffer rings came with multishot accept, so the kernel
+   * supports everything once this works. */
+  void *buf_ring = mmap(NULL, BUFFER_COUNT * sizeof(struct io_uring_buf),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring == MAP_FAILED) {
+    ring_destroy(ring);
+    return -1;
+  }
+  ring->buf_ring = (struct io_uring_buf_ring*) buf_ring;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) buf_ring;
+  reg.ring_entries = BUFFER_COUNT;
+  reg.bgid = BUFFER_GROUP;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    LOG_WARN("io_uring does not support provided buffer rings: %s", strerror(errno));
+    ring_destroy(ring);
+    return -1;
+  }
+
+  ring->buffers = (char*) CHECK_MEM(malloc((size_t) BUFFER_COUNT * BUFFER_SIZE));
+  ring->buf_tail = 0;
+  for (unsigned short i = 0 ; i < BUFFER_COUNT ; i++) {
+    buffer_recycle(ring, i);
+  }
+  return 0;
+}
+
+/**
+ * Hands every queued entry to the kernel, and waits for the given amount of
+ * completions.
+ */
+static void ring_submit(Ring *ring, unsigned wait) {
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && wait == 0) {
+    return;
+  }
+  int r = sys_io_uring_enter(ring->fd, to_submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+
+  /* busy means that the completions have to be handled first. */
+  CHECK(r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY,
+	"Failed to enter io_uring");
+}
+
+static struct io_uring_sqe *ring_get_sqe(Ring *ring) {
+  if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+    ring_submit(ring, 0);
+    CHECK(ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries,
+	  "Submission queue of io_uring is full");
+  }
+
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  ring->sq_local_tail++;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+static inline uint64_t user_data(void *ptr, enum RingOp op) {
+  return (uint64_t) (uintptr_t) ptr | op;
+}
+
+static void prep_accept(UringWorker *worker) {
+  struct io_uring_sqe *sqe = ring_get_sqe(&worker->ring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = worker->sock_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = user_data(worker, OP_ACCEPT);
+}
+
+static void prep_recv(UringWorker *worker, RequestContext *request_context) {
+  struct io_uring_sqe *sqe = ring_get_sqe(&worker->ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = request_context->fd;
+  sqe->len = BUFFER_SIZE;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = user_data(request_context, OP_RECV);
+}
+
+static void prep_send(UringWorker *worker, RequestContext *request_context) {
+  OutputBuffer *output = request_context->output_buffer;
+  struct io_uring_sqe *sqe = ring_get_sqe(&worker->ring);
+  sqe->fd = request_context->fd;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  if (output->ref_count == 0) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (uint64_t) (uintptr_t) (output->buffer + output->write_from_offset);
+    sqe->len = (uint32_t) (output->write_into_offset - output->write_from_offset);
+  } else {
+    /* the message stays in the buffer till the send completes. */
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t) (uintptr_t) output_buffer_prepare(output);
+    sqe->len = 1;
+  }
+  sqe->user_data = user_data(request_context, OP_SEND);
+}
+
+static void prep_reply_poll(UringWorker *worker, Queue *reply_queue) {
+  struct io_uring_sqe *sqe = ring_get_sqe(&worker->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = queue_add_event_fd(reply_queue);
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = user_data(reply_queue, OP_REPLY);
+}
+
+static void prep_timer_poll(UringWorker *worker) {
+  struct io_uring_sqe *sqe = ring_get_sqe(&worker->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = worker->epoll_info->connections->timer_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = user_data(worker, OP_TIMER);
+}
+
+static void close_connection(UringWorker *worker, RequestContext *request_context,
+			     enum RequestResult result) {
+  Server *server = worker->server;
+  if (request_context->timeout == TIMEOUT_EXPIRED) {
+    result = REQUEST_TIMEOUT;
+  }
+  per_request_record_end(&request_context->time_stats, TOTAL_TIME);
+
+  server_stats_decr_active_requests(server->server_stats);
+  server_stats_incr_total_requests(server->server_stats);
+  server_stats_record_request(server->server_stats, &request_context->time_stats);
+
+  connection_table_close(worker->epoll_info->connections, request_context, result);
+}
+
+/**
+ * Hands the request in the input buffer to the actors once it is complete,
+ * and reads more of it otherwise.
+ */
+static void parse_request(UringWorker *worker, RequestContext *request_context,
+			  size_t prev_len) {
+  enum ParseState state = http_request_parse(request_context->input_buffer, 0, prev_len,
+					     &request_context->http_request);
+  switch (state) {
+  case PARSE_FINISH:
+  case PARSE_TOO_LARGE:
+    client_dispatch_request(worker->server, worker->epoll_info, request_context);
+    return;
+  case PARSE_INCOMPLETE:
+    client_await_request(request_context);
+    prep_recv(worker, request_context);
+    return;
+  case PARSE_ERROR:
+  default:
+    close_connection(worker, request_context, REQUEST_READ_ERROR);
+    return;
+  }
+}
+
+static void reset_connection(UringWorker *worker, RequestContext *request_context) {
+  Server *server = worker->server;
+  per_request_record_end(&request_context->time_stats, TOTAL_TIME);
+
+  server_stats_incr_total_requests(server->server_stats);
+  server_stats_record_request(server->server_stats, &request_context->time_stats);
+
+  context_finalize_reset(request_context, REQUEST_SUCCESS);
+  per_request_record_start(&request_context->time_stats, TOTAL_TIME);
+  connection_table_set_timeout(worker->epoll_info->connections, request_context,
+			       TIMEOUT_KEEP_ALIVE);
+
+  /* the requests that were pipelined past the last batch are still in the
+   * input buffer. */
+  if (request_context->input_buffer->offset > 0) {
+    parse_request(worker, request_context, 0);
+  } else {
+    prep_recv(worker, request_context);
+  }
+}
+
+static void handle_accept(UringWorker *worker, int res, uint32_t flags) {
+  /* the accept stops being multishot when it runs into an error. */
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    prep_accept(worker);
+  }
+  if (res < 0) {
+    LOG_WARN("Failed to accept connection: %s", strerror(-res));
+    return;
+  }
+
+  int conn_sock = res;
+  int opt = 1;
+  int r = setsockopt(conn_sock, SOL_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  CHECK(r == -1, "Failed to set options on TCP_NODELAY");
+
+  /* a multishot accept has nowhere to put the address of every connection,
+   * so it is only looked up if the request gets logged. */
+  RequestContext *request_context =
+    connection_table_open(worker->epoll_info->connections, conn_sock, worker->epoll_info);
+  connection_table_set_timeout(worker->epoll_info->connections, request_context,
+			       TIMEOUT_HEADER);
+
+  server_stats_incr_active_requests(worker->server->server_stats);
+  per_request_record_start(&request_context->time_stats, TOTAL_TIME);
+  prep_recv(worker, request_context);
+}
+
+static void handle_recv(UringWorker *worker, RequestContext *request_context,
+			int res, uint32_t flags) {
+  Ring *ring = &worker->ring;
+  if (res <= 0) {
+    if ((flags & IORING_CQE_F_BUFFER) != 0) {
+      buffer_recycle(ring, (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+    if (res == -ENOBUFS) {
+      /* every buffer is taken right now, they are handed back by the
+       * completions that come next. */
+      prep_recv(worker, request_context);
+    } else {
+      close_connection(worker, request_context,
+		       res == 0 ? REQUEST_CLIENT_ERROR : REQUEST_READ_ERROR);
+    }
+    return;
+  }
+
+  per_request_record_start(&request_context->time_stats, CLIENT_READ_TIME);
+  unsigned short id = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+  size_t prev_len = request_context->input_buffer->offset;
+  input_buffer_append(request_context->input_buffer,
+		      ring->buffers + (size_t) id * BUFFER_SIZE, (size_t) res);
+  buffer_recycle(ring, id);
+
+  parse_request(worker, request_context, prev_len);
+  per_request_record_end(&request_context->time_stats, CLIENT_READ_TIME);
+}
+
+static void handle_send(UringWorker *worker, RequestContext *request_context, int res) {
+  if (res < 0) {
+    LOG_WARN("Error while writing response to client");
+    close_connection(worker, request_context, REQUEST_WRITE_ERROR);
+    return;
+  }
+
+  OutputBuffer *output = request_context->output_buffer;
+  output_buffer_advance(output, (size_t) res);
+  if (output->write_from_offset < output_buffer_size(output)) {
+    prep_send(worker, request_context);
+    return;
+  }
+
+  per_request_record_end(&request_context->time_stats, CLIENT_WRITE_TIME);
+  if (request_context->keep_alive == 1) {
+    reset_connection(worker, request_context);
+  } else {
+    close_connection(worker, request_context, REQUEST_SUCCESS);
+  }
+}
+
+/**
+ * Starts sending out the responses of the connection once the actors are
+ * done with every request of its batch.
+ */
+static void handle_finished_request(UringWorker *worker, RequestContext *request_context) {
+  RequestContext *connection = client_finish_request(worker->server, request_context);
+  if (connection != NULL) {
+    /* the send waits in the kernel for as long as the client does not
+     * read, so it is always under the timeout. */
+    connection_table_set_timeout(worker->epoll_info->connections, connection,
+				 TIMEOUT_WRITE);
+    per_request_record_start(&connection->time_stats, CLIENT_WRITE_TIME);
+    prep_send(worker, connection);
+  }
+}
+
+/**
+ * Starts sending out every response that an actor is done with.
+ */
+static void process_reply_queue(UringWorker *worker, Queue *reply_queue) {
+  RequestContext *request_context;
+  while ((request_context = (RequestContext*) queue_pop(reply_queue)) != NULL) {
+    handle_finished_request(worker, request_context);
+  }
+}
+
+/**
+ * Sends out the 503 of a request whose actor was too far behind.
+ */
+static void reply_rejected(void *data, RequestContext *request_context) {
+  handle_finished_request((UringWorker*) data, request_context);
+}
+
+static void handle_reply(UringWorker *worker, Queue *reply_queue, uint32_t flags) {
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    prep_reply_poll(worker, reply_queue);
+  }
+
+  eventfd_t count;
+  eventfd_read(queue_add_event_fd(reply_queue), &count);
+  process_reply_queue(worker, reply_queue);
+}
+
+/**
+ * Shuts down the connections that took too long to send a request or to
+ * read a response. Their receive or send is still in flight, so they are
+ * closed once it completes.
+ */
+static void handle_timer(UringWorker *worker, uint32_t flags) {
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    prep_timer_poll(worker);
+  }
+
+  ConnectionTable *table = worker->epoll_info->connections;
+  uint64_t now = connection_table_tick(table);
+
+  RequestContext *connection;
+  while ((connection = connection_table_expire(table, now)) != NULL) {
+    server_stats_incr_timeouts(worker->server->server_stats);
+    shutdown(connection->fd, SHUT_RDWR);
+  }
+}
+
+static void handle_completion(UringWorker *worker, struct io_uring_cqe *cqe) {
+  void *ptr = (void*) (uintptr_t) (cqe->user_data & ~OP_MASK);
+  switch ((enum RingOp) (cqe->user_data & OP_MASK)) {
+  case OP_ACCEPT:
+    handle_accept(worker, cqe->res, cqe->flags);
+    return;
+  case OP_RECV:
+    handle_recv(worker, (RequestContext*) ptr, cqe->res, cqe->flags);
+    return;
+  case OP_SEND:
+    handle_send(worker, (RequestContext*) ptr, cqe->res);
+    return;
+  case OP_REPLY:
+    handle_reply(worker, (Queue*) ptr, cqe->flags);
+    return;
+  case OP_TIMER:
+    handle_timer(worker, cqe->flags);
+    return;
+  }
+}
+
+/**
+ * Submits everything that was queued while handling the last completions,
+ * together with the wait for the next ones. With busy polling, the
+ * completion queue is polled first, which does not take a syscall.
+ */
+static void wait_completions(UringWorker *worker) {
+  Ring *ring = &worker->ring;
+  EpollInfo *epoll_info = worker->epoll_info;
+  if (epoll_info->busy_poll == 0) {
+    /* the replies that were pushed before the announcement did not notify
+     * the worker, so it must not sleep while there are any. */
+    ring_submit(ring, epoll_info_prepare_sleep(epoll_info) ? 0 : 1);
+    return;
+  }
+
+  ring_submit(ring, 0);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    if (*ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)
+	|| epoll_info_queues_pending(epoll_info)) {
+      epoll_info_count_wakeup(epoll_info, 0);
+      return;
+    }
+  } while (epoll_info_keep_polling(epoll_info, &start));
+
+  if (!epoll_info_prepare_sleep(epoll_info)) {
+    ring_submit(ring, 1);
+    epoll_info_count_wakeup(epoll_info, 1);
+  }
+}
+
+void *uring_event_loop(void *pthread_input) {
+  IoWorkerArgs *args = (IoWorkerArgs*) pthread_input;
+  Server *server = args->server;
+
+  UringWorker *worker = (UringWorker*) CHECK_MEM(calloc(1, sizeof(UringWorker)));
+  if (ring_init(&worker->ring) != 0) {
+    LOG_WARN("io_uring is not available, falling back to epoll");
+    free(worker);
+    return io_event_loop(pthread_input);
+  }
+  worker->server = server;
+  worker->sock_fd = args->sock_fd;
+
+  /* the ring waits for connections itself. */
+  int flags = fcntl(worker->sock_fd, F_GETFL);
+  fcntl(worker->sock_fd, F_SETFL, flags & ~O_NONBLOCK);
+
+  EpollInfo *epoll_info = (EpollInfo*) CHECK_MEM(calloc(1, sizeof(EpollInfo)));
+  epoll_info->epoll_fd = -1;
+  epoll_info->name = "IO-Ring";
+  epoll_info->id = args->id;
+  init_reply_queues(epoll_info, server->actor_count);
+  init_request_batches(epoll_info, server->actor_count);
+  epoll_info->connections = connection_table_init(CONNECTION_TABLE_SIZE);
+  init_timeouts(epoll_info, server->config);
+  epoll_info->busy_poll = server->config->busy_poll;
+  epoll_info_set_queues(epoll_info, epoll_info->reply_queues, epoll_info->reply_queue_count);
+  server->io_epoll_infos[args->id] = epoll_info;
+  worker->epoll_info = epoll_info;
+
+  /* make sure all application threads have started */
+  pthread_barrier_wait(&server->startup);
+  LOG_INFO("Starting IO thread on io_uring");
+
+  prep_accept(worker);
+  for (int i = 0 ; i < epoll_info->reply_queue_count ; i++) {
+    prep_reply_poll(worker, epoll_info->reply_queues[i]);
+  }
+  if (epoll_info->connections->timer_fd != -1) {
+    prep_timer_poll(worker);
+  }
+
+  Ring *ring = &worker->ring;
+  while (1) {
+    wait_completions(worker);
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+      head++;
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+      handle_completion(worker, &cqe);
+    }
+
+    /* the replies that came in while the worker was awake did not notify
+     * it. */
+    for (int i = 0 ; i < epoll_info->reply_queue_count ; i++) {
+      process_reply_queue(worker, epoll_info->reply_queues[i]);
+    }
+
+    /* every request read during the round goes out at once. */
+    client_flush_requests(server, epoll_info, reply_rejected, worker);
+  }
+
+  ring_destroy(ring);
+  return NULL;
+}
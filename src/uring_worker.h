@@ -0,0 +1,30 @@
+#ifndef __uring_worker_h__
+#define __uring_worker_h__
+
+/**
+ * An IO worker that runs on io_uring instead of epoll.
+ *
+ * Instead of waiting for readiness and then making a syscall per accept,
+ * read and write, every operation is queued on the ring and all of the
+ * operations queued during a round are submitted together with the wait for
+ * the next completions, in a single syscall.
+ *
+ * A single multishot accept keeps accepting connections. Reads pick one of
+ * the buffers that the worker provides to the kernel through a buffer ring,
+ * so no memory is tied up by idle connections, and the data is copied into
+ * the input buffer of the connection. A connection only ever has a single
+ * operation in flight, so it can be closed as soon as that one completes.
+ *
+ * The actors can not queue operations on the ring of the worker, so they
+ * push the finished requests onto their reply queue of the worker, whose
+ * event file descriptors are polled through the ring.
+ */
+
+/**
+ * Runs the event loop in the current thread to process requests off the
+ * socket given in the IoWorkerArgs. Falls back to the epoll event loop when
+ * the kernel does not support everything that is needed.
+ */
+void *uring_event_loop(void *pthread_input);
+
+#endif
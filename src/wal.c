@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "kv_store.h"
+#include "logging.h"
+#include "output_buffer.h"
+#include "queue.h"
+#include "wal.h"
+
+#define BATCH_SIZE (64 * 1024)
+
+/* the checksum covers everything in the record after the checksum field. */
+#define CHECKSUM_OFFSET sizeof(uint32_t)
+
+/* amount of batches in the queues, only two are ever in use at once. */
+#define QUEUE_SIZE 4
+
+/* the counters only have a single writer. */
+#define COUNTER_ADD(COUNTER, VALUE)					\
+  atomic_store_explicit((COUNTER),					\
+			atomic_load_explicit((COUNTER), memory_order_relaxed) + (VALUE), \
+			memory_order_relaxed);
+
+static WalBatch *batch_init(void) {
+  WalBatch *batch = (WalBatch*) CHECK_MEM(calloc(1, sizeof(WalBatch)));
+  batch->records = output_buffer_init(BATCH_SIZE);
+  batch->waiter_capacity = 64;
+  batch->waiters = (void**) CHECK_MEM(calloc(batch->waiter_capacity, sizeof(void*)));
+  batch->waiter_count = 0;
+  return batch;
+}
+
+static inline int batch_is_empty(WalBatch *batch) {
+  return batch->records->write_into_offset == 0;
+}
+
+static void batch_reset(WalBatch *batch) {
+  output_buffer_reset(batch->records);
+  batch->waiter_count = 0;
+}
+
+static void log_path(char *path, const char *dir, int actor_id, uint64_t generation) {
+  snprintf(path, PATH_MAX, "%s/actor-%d-%lu.log", dir, actor_id, generation);
+}
+
+static int compare_generations(const void *a, const void *b) {
+  uint64_t left = *(const uint64_t*) a;
+  uint64_t right = *(const uint64_t*) b;
+  return (left > right) - (left < right);
+}
+
+/**
+ * Finds the generations of all of the log files of the actor, returned in
+ * ascending order. The caller frees the array.
+ */
+static uint64_t *list_generations(const char *dir, int actor_id, size_t *count) {
+  DIR *dir_stream = opendir(dir);
+  CHECK(dir_stream == NULL, "Failed to open directory %s", dir);
+
+  size_t capacity = 16;
+  uint64_t *generations = (uint64_t*) CHECK_MEM(malloc(capacity * sizeof(uint64_t)));
+  *count = 0;
+
+  struct dirent *entry;
+  while ((entry = readdir(dir_stream)) != NULL) {
+    int id;
+    uint64_t generation;
+    int end = -1;
+    sscanf(entry->d_name, "actor-%d-%lu.log%n", &id, &generation, &end);
+    if (end == -1 || entry->d_name[end] != '\0' || id != actor_id) {
+      continue;
+    }
+
+    if (*count == capacity) {
+      capacity <<= 1;
+      generations = (uint64_t*) CHECK_MEM(realloc(generations, capacity * sizeof(uint64_t)));
+    }
+    generations[(*count)++] = generation;
+  }
+  closedir(dir_stream);
+
+  qsort(generations, *count, sizeof(uint64_t), compare_generations);
+  return generations;
+}
+
+static uint32_t record_checksum(const char *record, size_t record_len) {
+  return (uint32_t) hash_bytes(record + CHECKSUM_OFFSET, record_len - CHECKSUM_OFFSET);
+}
+
+/**
+ * The amount of bytes between the header and the key of a record.
+ */
+static inline size_t record_extra_len(uint8_t op) {
+  return op == WAL_PUT_TTL ? sizeof(uint64_t) : 0;
+}
+
+static void append_record(Wal *wal, enum WalOp op, const char *key, size_t key_len,
+			  const char *value, size_t value_len, uint64_t expires_at) {
+  OutputBuffer *records = wal->current->records;
+  size_t start = records->write_into_offset;
+
+  WalRecord header;
+  memset(&header, 0, sizeof(header));
+  header.op = (uint8_t) op;
+  header.key_len = (uint32_t) key_len;
+  header.value_len = (uint32_t) value_len;
+
+  output_buffer_append_bytes(records, (const char*) &header, sizeof(header));
+  if (op == WAL_PUT_TTL) {
+    output_buffer_append_bytes(records, (const char*) &expires_at, sizeof(expires_at));
+  }
+  output_buffer_append_bytes(records, key, key_len);
+  output_buffer_append_bytes(records, value, value_len);
+
+  char *record = records->buffer + start;
+  uint32_t checksum = record_checksum(record, records->write_into_offset - start);
+  memcpy(record, &checksum, sizeof(checksum));
+
+  COUNTER_ADD(&wal->record_count, 1);
+}
+
+/**
+ * Switches the flush thread over to the log file of the given generation.
+ */
+static void open_generation(Wal *wal, uint64_t generation) {
+  if (wal->fd != -1) {
+    close(wal->fd);
+  }
+
+  log_path(wal->path, wal->dir, wal->actor_id, generation);
+  wal->fd = open(wal->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  CHECK(wal->fd == -1, "Failed to open log %s", wal->path);
+  wal->fd_generation = generation;
+
+  /* the new file itself has to survive a crash as well. */
+  int dir_fd = open(wal->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  CHECK(dir_fd == -1, "Failed to open directory %s", wal->dir);
+  int r = fsync(dir_fd);
+  CHECK(r != 0, "Failed to sync directory %s", wal->dir);
+  close(dir_fd);
+}
+
+/**
+ * Writes the whole batch out to the log and waits till it is on disk.
+ */
+static void write_batch(Wal *wal, WalBatch *batch) {
+  if (wal->fd == -1 || wal->fd_generation != batch->generation) {
+    open_generation(wal, batch->generation);
+  }
+
+  OutputBuffer *records = batch->records;
+  while (records->write_from_offset < records->write_into_offset) {
+    ssize_t written = write(wal->fd, records->buffer + records->write_from_offset,
+			    records->write_into_offset - records->write_from_offset);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    CHECK(written <= 0, "Failed to write to log %s", wal->path);
+    records->write_from_offset += (size_t) written;
+  }
+
+  int r = fdatasync(wal->fd);
+  CHECK(r != 0, "Failed to sync log %s", wal->path);
+}
+
+/**
+ * The flush thread, the only place where the actor's log is written to.
+ */
+static void *flush_loop(void *pthread_input) {
+  Wal *wal = (Wal*) pthread_input;
+  struct pollfd poll_fd;
+  poll_fd.fd = queue_add_event_fd(wal->flush_queue);
+  poll_fd.events = POLLIN;
+
+  while (1) {
+    int r = poll(&poll_fd, 1, -1);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    CHECK(r == -1, "Failed to wait on flush queue");
+
+    eventfd_t num_to_read;
+    eventfd_read(poll_fd.fd, &num_to_read);
+
+    WalBatch *batch;
+    while ((batch = (WalBatch*) queue_pop(wal->flush_queue)) != NULL) {
+      write_batch(wal, batch);
+      COUNTER_ADD(&wal->sync_count, 1);
+
+      enum QueueResult result = queue_push(wal->done_queue, batch);
+      CHECK(result != QUEUE_SUCCESS, "Failed to hand back durable batch");
+    }
+  }
+  return NULL;
+}
+
+Wal *wal_init(const char *dir, int actor_id) {
+  Wal *wal = (Wal*) CHECK_MEM(calloc(1, sizeof(Wal)));
+  wal->actor_id = actor_id;
+  wal->dir = CHECK_MEM(strdup(dir));
+  wal->generation = 0;
+
+  wal->fd = -1;
+  wal->fd_generation = 0;
+  wal->path = (char*) CHECK_MEM(calloc(PATH_MAX, sizeof(char)));
+
+  wal->current = batch_init();
+  wal->flushing = NULL;
+  wal->spare = batch_init();
+  wal->flush_queue = queue_init(QUEUE_SIZE);
+  wal->done_queue = queue_init(QUEUE_SIZE);
+  wal->sync_count = ATOMIC_VAR_INIT(0);
+  wal->record_count = ATOMIC_VAR_INIT(0);
+
+  int r = pthread_create(&wal->flush_thread, NULL, flush_loop, wal);
+  CHECK(r != 0, "Failed to create flush thread");
+
+  r = pthread_detach(wal->flush_thread);
+  CHECK(r != 0, "Failed to detach flush thread");
+
+  char name[16];
+  snprintf(name, sizeof(name), "wal-%d", actor_id);
+  r = pthread_setname_np(wal->flush_thread, name);
+  CHECK(r != 0, "Failed to set flush thread name");
+
+  return wal;
+}
+
+/**
+ * Applies the records of a single log file, cutting off a torn tail.
+ */
+static void replay_file(const char *path, KvStore *store) {
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  CHECK(fd == -1, "Failed to open log %s", path);
+
+  struct stat stat_buf;
+  int r = fstat(fd, &stat_buf);
+  CHECK(r != 0, "Failed to stat log %s", path);
+
+  size_t file_size = (size_t) stat_buf.st_size;
+  if (file_size == 0) {
+    close(fd);
+    return;
+  }
+
+  char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  CHECK(data == MAP_FAILED, "Failed to map log %s", path);
+  madvise(data, file_size, MADV_SEQUENTIAL);
+
+  size_t offset = 0;
+  size_t count = 0;
+  while (file_size - offset >= sizeof(WalRecord)) {
+    WalRecord header;
+    memcpy(&header, data + offset, sizeof(header));
+
+    size_t extra_len = record_extra_len(header.op);
+    size_t record_len = sizeof(header) + extra_len + header.key_len + header.value_len;
+    if (header.key_len > KV_MAX_KEY_SIZE || header.value_len > KV_MAX_VALUE_SIZE
+	|| record_len > file_size - offset
+	|| record_checksum(data + offset, record_len) != header.checksum) {
+      break;
+    }
+
+    const char *key = data + offset + sizeof(header) + extra_len;
+    const char *value = key + header.key_len;
+    uint64_t expires_at;
+    switch (header.op) {
+    case WAL_PUT:
+      kv_store_put(store, key, header.key_len, value, header.value_len, 0);
+      break;
+    case WAL_PUT_TTL:
+      memcpy(&expires_at, data + offset + sizeof(header), sizeof(expires_at));
+      kv_store_put(store, key, header.key_len, value, header.value_len, expires_at);
+      break;
+    case WAL_DELETE:
+      kv_store_delete(store, key, header.key_len);
+      break;
+    default:
+      FAIL("Unknown operation %d in log %s", header.op, path);
+    }
+    offset += record_len;
+    count++;
+  }
+
+  munmap(data, file_size);
+
+  if (offset != file_size) {
+    LOG_WARN("Cutting off %zu bytes of torn records from %s", file_size - offset, path);
+    r = ftruncate(fd, (off_t) offset);
+    CHECK(r != 0, "Failed to truncate log %s", path);
+  }
+  close(fd);
+  LOG_INFO("Replayed %zu records from %s", count, path);
+}
+
+void wal_replay(Wal *wal, KvStore *store, uint64_t generation) {
+  size_t count;
+  uint64_t *generations = list_generations(wal->dir, wal->actor_id, &count);
+
+  char path[PATH_MAX];
+  wal->generation = generation;
+  for (size_t i = 0 ; i < count ; i++) {
+    if (generations[i] < generation) {
+      continue;
+    }
+    log_path(path, wal->dir, wal->actor_id, generations[i]);
+    replay_file(path, store);
+    wal->generation = generations[i] + 1;
+  }
+  free(generations);
+
+  wal_remove_logs(wal->dir, wal->actor_id, generation);
+}
+
+uint64_t wal_rotate(Wal *wal) {
+  return ++wal->generation;
+}
+
+void wal_remove_logs(const char *dir, int actor_id, uint64_t generation) {
+  size_t count;
+  uint64_t *generations = list_generations(dir, actor_id, &count);
+
+  char path[PATH_MAX];
+  for (size_t i = 0 ; i < count && generations[i] < generation ; i++) {
+    log_path(path, dir, actor_id, generations[i]);
+    int r = unlink(path);
+    CHECK(r != 0 && errno != ENOENT, "Failed to remove log %s", path);
+  }
+  free(generations);
+}
+
+void wal_append_put(Wal *wal, const char *key, size_t key_len,
+		    const char *value, size_t value_len, uint64_t expires_at) {
+  append_record(wal, expires_at == 0 ? WAL_PUT : WAL_PUT_TTL, key, key_len,
+		value, value_len, expires_at);
+}
+
+void wal_append_delete(Wal *wal, const char *key, size_t key_len) {
+  append_record(wal, WAL_DELETE, key, key_len, NULL, 0, 0);
+}
+
+int wal_has_pending(Wal *wal) {
+  return !batch_is_empty(wal->current) || wal->flushing != NULL;
+}
+
+void wal_add_waiter(Wal *wal, void *waiter) {
+  WalBatch *batch = batch_is_empty(wal->current) ? wal->flushing : wal->current;
+  CHECK(batch == NULL, "No pending batch to wait on");
+
+  if (batch->waiter_count == batch->waiter_capacity) {
+    batch->waiter_capacity <<= 1;
+    batch->waiters = (void**) CHECK_MEM(realloc(batch->waiters,
+						batch->waiter_capacity * sizeof(void*)));
+  }
+  batch->waiters[batch->waiter_count++] = waiter;
+}
+
+void wal_flush(Wal *wal) {
+  if (wal->flushing != NULL || batch_is_empty(wal->current)) {
+    return;
+  }
+
+  wal->flushing = wal->current;
+  wal->flushing->generation = wal->generation;
+  wal->current = wal->spare;
+  wal->spare = NULL;
+
+  enum QueueResult result = queue_push(wal->flush_queue, wal->flushing);
+  CHECK(result != QUEUE_SUCCESS, "Failed to hand batch to flush thread");
+}
+
+int wal_done_event_fd(Wal *wal) {
+  return queue_add_event_fd(wal->done_queue);
+}
+
+void wal_handle_done(Wal *wal, void (*release)(void *waiter, void *arg), void *arg) {
+  eventfd_t num_to_read;
+  eventfd_read(wal_done_event_fd(wal), &num_to_read);
+
+  WalBatch *batch;
+  while ((batch = (WalBatch*) queue_pop(wal->done_queue)) != NULL) {
+    CHECK(batch != wal->flushing, "Durable batch was not being flushed");
+
+    for (size_t i = 0 ; i < batch->waiter_count ; i++) {
+      release(batch->waiters[i], arg);
+    }
+    batch_reset(batch);
+    wal->spare = batch;
+    wal->flushing = NULL;
+  }
+
+  wal_flush(wal);
+}
@@ -0,0 +1,160 @@
+#ifndef __wal_h__
+#define __wal_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kv_store.h"
+#include "output_buffer.h"
+#include "queue.h"
+
+/**
+ * The write-ahead log of a single actor. Every change to the actor's store is
+ * appended to the log before the response for it is sent back.
+ *
+ * The actor never blocks on the disk. Records are collected into a batch and
+ * the batch is handed to a dedicated flush thread that writes and syncs it.
+ * While a batch is being flushed, every new record goes into the next batch,
+ * so a single sync covers all of the requests that arrived during the
+ * previous one (group commit).
+ *
+ * The requests that have to wait for a batch to be durable are attached to it
+ * as waiters and handed back to the actor once the sync finished. The flush
+ * thread notifies the actor through the event file descriptor of a queue.
+ *
+ * The log is split up into generations, one file per generation. Taking a
+ * snapshot starts a new generation so that the files of the older ones can
+ * be removed once the snapshot is durable.
+ */
+
+enum WalOp {
+  WAL_PUT = 1,
+  WAL_DELETE = 2,
+  /* a put whose header is followed by the 8 byte expiration time. */
+  WAL_PUT_TTL = 3,
+};
+
+typedef struct WalRecord {
+  /* checksum of the rest of the header plus the key and value. */
+  uint32_t checksum;
+  uint8_t op;
+  uint8_t padding[3];
+  uint32_t key_len;
+  uint32_t value_len;
+} WalRecord;
+
+typedef struct WalBatch {
+  /* the encoded records of the batch. */
+  OutputBuffer *records;
+
+  /* the requests that can only be answered once the batch is durable. */
+  void **waiters;
+  size_t waiter_count;
+  size_t waiter_capacity;
+
+  /* the log generation that the batch is written to. */
+  uint64_t generation;
+} WalBatch;
+
+typedef struct Wal {
+  int actor_id;
+  char *dir;
+
+  /* the generation that new batches are written to. */
+  uint64_t generation;
+
+  /* the log file of the generation that was written last, only used by
+   * the flush thread. */
+  int fd;
+  uint64_t fd_generation;
+  char *path;
+
+  /* the batch that records are currently appended to. */
+  WalBatch *current;
+
+  /* the batch that the flush thread is working on, NULL if idle. */
+  WalBatch *flushing;
+
+  /* a batch kept around for reuse so that no memory is allocated. */
+  WalBatch *spare;
+
+  /* used to hand batches to the flush thread. */
+  Queue *flush_queue;
+
+  /* used by the flush thread to hand back durable batches. */
+  Queue *done_queue;
+
+  pthread_t flush_thread;
+
+  /* the amount of syncs and records written, read by the stats thread. */
+  atomic_long sync_count;
+  atomic_long record_count;
+} Wal;
+
+/**
+ * Sets up the log of the given actor inside of the directory and starts the
+ * flush thread. The log files are only opened once they are written to.
+ */
+Wal *wal_init(const char *dir, int actor_id);
+
+/**
+ * Applies every valid record of the logs of the given generation and newer
+ * to the store, oldest first. A torn record at the end of a log, from a
+ * crash during a write, is cut off. Logs of older generations are covered
+ * by a snapshot and are removed. New records go to a generation after the
+ * newest existing one. This must be called before anything is appended.
+ */
+void wal_replay(Wal *wal, KvStore *store, uint64_t generation);
+
+/**
+ * Starts a new generation: every batch that is handed to the flush thread
+ * from now on goes to a new log file. Returns the new generation.
+ */
+uint64_t wal_rotate(Wal *wal);
+
+/**
+ * Removes the log files of the actor that are older than the given
+ * generation. Can be called from any thread.
+ */
+void wal_remove_logs(const char *dir, int actor_id, uint64_t generation);
+
+/**
+ * Appends a put of the key, which expires at the given time in milliseconds
+ * or never when it is 0.
+ */
+void wal_append_put(Wal *wal, const char *key, size_t key_len,
+		    const char *value, size_t value_len, uint64_t expires_at);
+
+void wal_append_delete(Wal *wal, const char *key, size_t key_len);
+
+/**
+ * Returns 1 when there are records that are not durable yet.
+ */
+int wal_has_pending(Wal *wal);
+
+/**
+ * Attaches a request to the newest batch that holds records. The request is
+ * handed back through wal_handle_done once that batch is durable.
+ */
+void wal_add_waiter(Wal *wal, void *waiter);
+
+/**
+ * Hands the current batch to the flush thread, unless a flush is already in
+ * progress or there is nothing to flush.
+ */
+void wal_flush(Wal *wal);
+
+/**
+ * The file descriptor that becomes readable when a batch is durable.
+ */
+int wal_done_event_fd(Wal *wal);
+
+/**
+ * Collects the durable batches and calls release for every request that was
+ * waiting on them. The next batch is handed to the flush thread afterwards.
+ */
+void wal_handle_done(Wal *wal, void (*release)(void *waiter, void *arg), void *arg);
+
+#endif
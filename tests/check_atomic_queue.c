@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+#include "../src/logging.h"
+#include "../src/queue.h"
+
+#define STRESS_MESSAGES 2000000
+#define THROUGHPUT_MESSAGES 4000000
+
+typedef struct Producer {
+  Queue *queue;
+  size_t count;
+  size_t full;
+} Producer;
+
+static void *produce(void *arg) {
+  Producer *producer = (Producer*) arg;
+  for (size_t i = 1 ; i <= producer->count ; i++) {
+    while (queue_push(producer->queue, (void*) (uintptr_t) i) != QUEUE_SUCCESS) {
+      producer->full++;
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static double now_seconds(void) {
+  struct timespec time_spec;
+  clock_gettime(CLOCK_MONOTONIC, &time_spec);
+  return (double) time_spec.tv_sec + (double) time_spec.tv_nsec / 1e9;
+}
+
+/* pops count messages while they are pushed from another thread, and checks
+ * that every one of them arrives once and in order. */
+static void consume_in_order(Queue *queue, size_t count) {
+  Producer producer = { .queue = queue, .count = count, .full = 0 };
+  pthread_t thread;
+  ck_assert_int_eq(pthread_create(&thread, NULL, produce, &producer), 0);
+
+  size_t expected = 1;
+  while (expected <= count) {
+    void *ptr = queue_pop(queue);
+    if (ptr != NULL) {
+      ck_assert_uint_eq((uintptr_t) ptr, expected);
+      expected++;
+    } else {
+      sched_yield();
+    }
+  }
+
+  pthread_join(thread, NULL);
+  ck_assert_ptr_eq(queue_pop(queue), NULL);
+  ck_assert_uint_eq(queue_size(queue), 0);
+}
+
+START_TEST(queue_push_pop) {
+  Queue *queue = queue_init(10);
+
+  queue_push(queue, (void*) 5);
+  queue_push(queue, (void*) 6);
+  queue_push(queue, (void*) 7);
+  ck_assert_uint_eq(queue_size(queue), 3);
+
+  ck_assert_uint_eq((uintptr_t) queue_pop(queue), 5);
+  ck_assert_uint_eq((uintptr_t) queue_pop(queue), 6);
+  ck_assert_uint_eq((uintptr_t) queue_pop(queue), 7);
+  ck_assert_ptr_eq(queue_pop(queue), NULL);
+
+  queue_destroy(queue);
+} END_TEST
+
+START_TEST(queue_full) {
+  Queue *queue = queue_init(4);
+
+  for (int round = 0 ; round < 3 ; round++) {
+    for (uintptr_t i = 1 ; i <= 4 ; i++) {
+      ck_assert_int_eq(queue_push(queue, (void*) i), QUEUE_SUCCESS);
+    }
+    ck_assert_int_eq(queue_push(queue, (void*) 5), QUEUE_FAILURE);
+    ck_assert_uint_eq(queue_size(queue), 4);
+
+    ck_assert_uint_eq((uintptr_t) queue_pop(queue), 1);
+    ck_assert_int_eq(queue_push(queue, (void*) 5), QUEUE_SUCCESS);
+    for (uintptr_t i = 2 ; i <= 5 ; i++) {
+      ck_assert_uint_eq((uintptr_t) queue_pop(queue), i);
+    }
+    ck_assert_ptr_eq(queue_pop(queue), NULL);
+  }
+
+  queue_destroy(queue);
+} END_TEST
+
+START_TEST(queue_batch) {
+  Queue *queue = queue_init(8);
+  void *in[10] = { (void*) 1, (void*) 2, (void*) 3, (void*) 4, (void*) 5,
+		   (void*) 6, (void*) 7, (void*) 8, (void*) 9, (void*) 10 };
+  void *out[10];
+
+  /* only what fits is added, with a single notification. */
+  ck_assert_uint_eq(queue_push_batch(queue, in, 5), 5);
+  ck_assert_uint_eq(queue_push_batch(queue, in + 5, 5), 3);
+  ck_assert_uint_eq(queue_push_batch(queue, in + 8, 2), 0);
+  ck_assert_int_eq(queue_doorbells(queue), 2);
+
+  eventfd_t val;
+  eventfd_read(queue_add_event_fd(queue), &val);
+  ck_assert_uint_eq(val, 8);
+
+  ck_assert_uint_eq(queue_pop_batch(queue, out, 3), 3);
+  ck_assert_uint_eq((uintptr_t) out[0], 1);
+  ck_assert_uint_eq((uintptr_t) out[2], 3);
+
+  /* wraps around the end of the ring buffer. */
+  ck_assert_uint_eq(queue_push_batch(queue, in + 8, 2), 2);
+  ck_assert_uint_eq(queue_pop_batch(queue, out, 10), 7);
+  for (uintptr_t i = 0 ; i < 7 ; i++) {
+    ck_assert_uint_eq((uintptr_t) out[i], i + 4);
+  }
+  ck_assert_uint_eq(queue_pop_batch(queue, out, 10), 0);
+
+  queue_destroy(queue);
+} END_TEST
+
+START_TEST(queue_stress) {
+  /* a small queue keeps the writer running into a full queue. */
+  Queue *queue = queue_init(8);
+  consume_in_order(queue, STRESS_MESSAGES);
+  queue_destroy(queue);
+
+  queue = queue_init(1024);
+  consume_in_order(queue, STRESS_MESSAGES);
+  queue_destroy(queue);
+} END_TEST
+
+START_TEST(queue_stress_on_demand) {
+  Queue *queue = queue_init(64);
+  queue_ring_on_demand(queue);
+  int fd = queue_add_event_fd(queue);
+
+  Producer producer = { .queue = queue, .count = STRESS_MESSAGES, .full = 0 };
+  pthread_t thread;
+  ck_assert_int_eq(pthread_create(&thread, NULL, produce, &producer), 0);
+
+  size_t expected = 1;
+  while (expected <= STRESS_MESSAGES) {
+    void *ptr;
+    while ((ptr = queue_pop(queue)) != NULL) {
+      ck_assert_uint_eq((uintptr_t) ptr, expected);
+      expected++;
+    }
+    if (expected > STRESS_MESSAGES || queue_prepare_sleep(queue)) {
+      continue;
+    }
+
+    /* a lost notification leaves the reader asleep with messages queued. */
+    struct pollfd poll_fd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    ck_assert_int_eq(poll(&poll_fd, 1, 5000), 1);
+    eventfd_t count;
+    eventfd_read(fd, &count);
+  }
+
+  pthread_join(thread, NULL);
+  ck_assert_int_le(queue_doorbells(queue), STRESS_MESSAGES);
+  queue_destroy(queue);
+} END_TEST
+
+START_TEST(queue_throughput) {
+  Queue *queue = queue_init(1024);
+  queue_ring_on_demand(queue);
+
+  double start = now_seconds();
+  consume_in_order(queue, THROUGHPUT_MESSAGES);
+  double elapsed = now_seconds() - start;
+
+  printf("SPSC queue: %.1f ns/message, %.1fM messages/s\n",
+	 elapsed * 1e9 / THROUGHPUT_MESSAGES, THROUGHPUT_MESSAGES / elapsed / 1e6);
+  queue_destroy(queue);
+} END_TEST
+
+Suite *queue_suite(void) {
+  Suite *suite = suite_create("atomic queue suite");
+  TCase *tc_core = tcase_create("Core");
+  tcase_set_timeout(tc_core, 60);
+
+  tcase_add_test(tc_core, queue_push_pop);
+  tcase_add_test(tc_core, queue_full);
+  tcase_add_test(tc_core, queue_batch);
+  tcase_add_test(tc_core, queue_stress);
+  tcase_add_test(tc_core, queue_stress_on_demand);
+  tcase_add_test(tc_core, queue_throughput);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = queue_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
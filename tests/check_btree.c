@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/btree.h"
+#include "../src/logging.h"
+
+START_TEST(btree_put_get) {
+  BTree *tree = btree_init();
+
+  ck_assert(btree_put(tree, "b", 1, (void*) 2) == NULL);
+  ck_assert(btree_put(tree, "a", 1, (void*) 1) == NULL);
+  ck_assert_int_eq((intptr_t) btree_put(tree, "b", 1, (void*) 3), 2);
+
+  ck_assert_int_eq((intptr_t) btree_get(tree, "a", 1), 1);
+  ck_assert_int_eq((intptr_t) btree_get(tree, "b", 1), 3);
+  ck_assert(btree_get(tree, "c", 1) == NULL);
+  ck_assert_int_eq(btree_size(tree), 2);
+
+  ck_assert_int_eq((intptr_t) btree_remove(tree, "a", 1), 1);
+  ck_assert(btree_remove(tree, "a", 1) == NULL);
+  ck_assert_int_eq(btree_size(tree), 1);
+
+  btree_destroy(tree);
+} END_TEST
+
+START_TEST(btree_key_order) {
+  BTree *tree = btree_init();
+
+  /* keys that only differ after the first 8 bytes, or only in length. */
+  const char *keys[] = { "a", "a\0", "ab", "abcdefgh", "abcdefgh\0", "abcdefghi",
+			 "abcdefgz", "b", "\xff" };
+  size_t key_lens[] = { 1, 2, 2, 8, 9, 9, 8, 1, 1 };
+  size_t count = sizeof(key_lens) / sizeof(size_t);
+  for (size_t i = count ; i > 0 ; i--) {
+    btree_put(tree, keys[i - 1], key_lens[i - 1], (void*) (i - 1));
+  }
+
+  BTreeIterator iter;
+  btree_seek(tree, "", 0, &iter);
+  const char *key;
+  size_t key_len;
+  for (size_t i = 0 ; i < count ; i++) {
+    ck_assert_int_eq((intptr_t) btree_next(&iter, &key, &key_len), i);
+    ck_assert_int_eq(key_len, key_lens[i]);
+  }
+  ck_assert(btree_next(&iter, &key, &key_len) == NULL);
+
+  /* a seek stops right before the first key that is not smaller. */
+  btree_seek(tree, "abcdefgh\0", 9, &iter);
+  ck_assert_int_eq((intptr_t) btree_next(&iter, &key, &key_len), 4);
+  btree_seek(tree, "abcdefgha", 9, &iter);
+  ck_assert_int_eq((intptr_t) btree_next(&iter, &key, &key_len), 5);
+
+  btree_destroy(tree);
+} END_TEST
+
+static int compare_keys(const void *a, const void *b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+START_TEST(btree_random) {
+  BTree *tree = btree_init();
+  size_t count = 100000;
+  char **keys = calloc(count, sizeof(char*));
+
+  srand(7);
+  for (size_t i = 0 ; i < count ; i++) {
+    keys[i] = malloc(32);
+    sprintf(keys[i], "key-%08d-%zu", rand() % 1000000, i);
+    ck_assert(btree_put(tree, keys[i], strlen(keys[i]), keys[i]) == NULL);
+  }
+
+  /* removes two thirds of the keys, which empties out whole leaves. */
+  for (size_t i = 0 ; i < count ; i++) {
+    if (i % 3 != 0) {
+      ck_assert(btree_remove(tree, keys[i], strlen(keys[i])) == keys[i]);
+      free(keys[i]);
+      keys[i] = NULL;
+    }
+  }
+
+  size_t left = 0;
+  for (size_t i = 0 ; i < count ; i++) {
+    if (keys[i] != NULL) {
+      keys[left++] = keys[i];
+    }
+  }
+  ck_assert_int_eq(btree_size(tree), left);
+  qsort(keys, left, sizeof(char*), compare_keys);
+
+  BTreeIterator iter;
+  btree_seek(tree, "", 0, &iter);
+  const char *key;
+  size_t key_len;
+  for (size_t i = 0 ; i < left ; i++) {
+    ck_assert(btree_next(&iter, &key, &key_len) == keys[i]);
+  }
+  ck_assert(btree_next(&iter, &key, &key_len) == NULL);
+
+  for (size_t i = 0 ; i < left ; i++) {
+    ck_assert(btree_get(tree, keys[i], strlen(keys[i])) == keys[i]);
+    ck_assert(btree_remove(tree, keys[i], strlen(keys[i])) == keys[i]);
+    free(keys[i]);
+  }
+  ck_assert_int_eq(btree_size(tree), 0);
+  ck_assert_int_eq(tree->node_count, 1);
+  ck_assert_int_eq(tree->separator_bytes, 0);
+
+  free(keys);
+  btree_destroy(tree);
+} END_TEST
+
+Suite *btree_suite(void) {
+  Suite *suite = suite_create("btree");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, btree_put_get);
+  tcase_add_test(tc_core, btree_key_order);
+  tcase_add_test(tc_core, btree_random);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = btree_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
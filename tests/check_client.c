@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/client.h"
+#include "../src/connection_table.h"
+#include "../src/epoll_info.h"
+#include "../src/http_request.h"
+#include "../src/input_buffer.h"
+#include "../src/io_worker.h"
+#include "../src/logging.h"
+#include "../src/output_buffer.h"
+#include "../src/queue.h"
+#include "../src/request_context.h"
+#include "../src/router.h"
+#include "../src/server.h"
+
+/**
+ * Sets up a server with a single IO worker and actors that nobody reads the
+ * queues of, so that the tests can look at what the worker pushed.
+ */
+static Server *test_server_init(int actor_count, size_t queue_size, int reject_overload) {
+  Server *server = (Server*) CHECK_MEM(calloc(1, sizeof(Server)));
+  server->config = (ServerConfig*) CHECK_MEM(calloc(1, sizeof(ServerConfig)));
+  server->config->reject_overload = reject_overload;
+  server->server_stats = server_stats_init();
+  server->io_worker_count = 1;
+  server->actor_count = actor_count;
+  server->router = router_init(actor_count, ROUTER_SHARD_COUNT, NULL);
+  server->shared_queue = mrmw_queue_init(16);
+
+  server->app_actors = (ActorInfo*) CHECK_MEM(calloc((size_t) actor_count, sizeof(ActorInfo)));
+  for (int i = 0 ; i < actor_count ; i++) {
+    ActorInfo *actor = &server->app_actors[i];
+    actor->id = i;
+    actor->server = server;
+    actor->queue_count = 1;
+    actor->input_queue = (Queue**) CHECK_MEM(calloc(1, sizeof(Queue*)));
+    actor->input_queue[0] = queue_init(queue_size);
+    atomic_init(&actor->parked_requests, 0);
+    atomic_init(&actor->rejected_requests, 0);
+  }
+
+  EpollInfo *epoll_info = epoll_info_init("test", 0);
+  init_request_batches(epoll_info, actor_count);
+  epoll_info->connections = connection_table_init(CONNECTION_TABLE_SIZE);
+  server->io_epoll_infos = (EpollInfo**) CHECK_MEM(calloc(1, sizeof(EpollInfo*)));
+  server->io_epoll_infos[0] = epoll_info;
+  return server;
+}
+
+/**
+ * Opens a connection that read the given data and parsed the first request
+ * out of it, like client_handle_read does before it dispatches.
+ */
+static RequestContext *open_connection(EpollInfo *epoll_info, const char *data) {
+  int fd = open("/dev/null", O_RDWR);
+  CHECK(fd == -1, "Failed to open /dev/null");
+
+  RequestContext *connection = connection_table_open(epoll_info->connections, fd, epoll_info);
+  input_buffer_append(connection->input_buffer, data, strlen(data));
+  ck_assert_int_eq(http_request_parse(connection->input_buffer, 0, 0,
+				      &connection->http_request), PARSE_FINISH);
+  connection->state = CONNECTION_PROCESSING;
+  return connection;
+}
+
+static int has_path(RequestContext *request_context, const char *path) {
+  HttpRequest *request = &request_context->http_request;
+  return request->path_len == strlen(path)
+    && strncmp(request->path, path, request->path_len) == 0;
+}
+
+/**
+ * Opens a connection with a single request for the path and dispatches it.
+ */
+static RequestContext *dispatch_get(Server *server, EpollInfo *epoll_info, const char *path) {
+  char data[128];
+  snprintf(data, sizeof(data), "GET %s HTTP/1.1\r\n\r\n", path);
+  RequestContext *connection = open_connection(epoll_info, data);
+  client_dispatch_request(server, epoll_info, connection);
+  return connection;
+}
+
+/* the requests that the worker answered itself, in order. */
+typedef struct Replies {
+  RequestContext *requests[16];
+  size_t count;
+} Replies;
+
+static void collect_reply(void *data, RequestContext *request_context) {
+  Replies *replies = (Replies*) data;
+  replies->requests[replies->count++] = request_context;
+}
+
+START_TEST(client_keep_alive) {
+  Server *server = test_server_init(1, 16, 0);
+  EpollInfo *epoll_info = server->io_epoll_infos[0];
+
+  const char *requests[] = {
+    "GET /a HTTP/1.1\r\n\r\n",
+    "GET /a HTTP/1.0\r\n\r\n",
+    "GET /a HTTP/1.0\r\nconnection: KEEP-ALIVE\r\n\r\n",
+    "GET /a HTTP/1.1\r\nCONNECTION: Close\r\n\r\n",
+    "GET /a HTTP/1.1\r\nConnection: keep-alive, close\r\n\r\n",
+    "GET /a HTTP/1.1\r\nConnection: Upgrade\r\n\r\n",
+    "GET /a HTTP/1.1\r\nX-Connection: close\r\n\r\n",
+  };
+  int expected[] = { 1, 0, 1, 0, 0, 1, 1 };
+
+  for (size_t i = 0 ; i < sizeof(expected) / sizeof(expected[0]) ; i++) {
+    RequestContext *connection = open_connection(epoll_info, requests[i]);
+    ck_assert_msg(context_keep_alive(connection) == expected[i], "request %zu", i);
+    connection_table_close(epoll_info->connections, connection, REQUEST_SUCCESS);
+  }
+} END_TEST
+
+START_TEST(client_pipelined_dispatch) {
+  Server *server = test_server_init(2, 16, 0);
+  EpollInfo *epoll_info = server->io_epoll_infos[0];
+
+  /* HTTP/1.1 keeps the connection alive without asking for it, the third
+   * request ends the batch and the fourth stays in the buffer. */
+  const char *first = "GET /a HTTP/1.1\r\nHost: test\r\n\r\n"
+    "PUT /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+    "GET /c HTTP/1.1\r\nconnection: CLOSE\r\n\r\n";
+  char data[256];
+  snprintf(data, sizeof(data), "%sGET /d HTTP/1.1\r\n\r\n", first);
+  RequestContext *connection = open_connection(epoll_info, data);
+
+  client_dispatch_request(server, epoll_info, connection);
+  ck_assert_int_eq(connection->pending_requests, 3);
+  ck_assert_int_eq(connection->batch_len, strlen(first));
+  ck_assert_int_eq(connection->keep_alive, 0);
+
+  RequestContext *second = connection->next_request;
+  ck_assert(second != NULL && has_path(second, "/b"));
+  ck_assert_int_eq(second->http_request.body_len, 3);
+  RequestContext *third = second->next_request;
+  ck_assert(third != NULL && has_path(third, "/c"));
+  ck_assert(third->next_request == NULL);
+
+  /* every request ends up at the actor that owns its key, in order. */
+  Replies replies = { .count = 0 };
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(replies.count, 0);
+  RequestContext *sent[] = { connection, second, third };
+  size_t popped[2] = { 0, 0 };
+  for (size_t i = 0 ; i < 3 ; i++) {
+    size_t key_len;
+    const char *key = http_request_key(&sent[i]->http_request, &key_len);
+    int actor_id = router_actor_for_key(server->router, key, key_len);
+    ck_assert(queue_pop(server->app_actors[actor_id].input_queue[0]) == sent[i]);
+    popped[actor_id]++;
+  }
+  for (int i = 0 ; i < 2 ; i++) {
+    ck_assert(queue_pop(server->app_actors[i].input_queue[0]) == NULL);
+    ck_assert_int_eq(atomic_load(&server->app_actors[i].parked_requests), 0);
+  }
+  ck_assert_int_eq(popped[0] + popped[1], 3);
+} END_TEST
+
+START_TEST(client_parked_requests) {
+  Server *server = test_server_init(1, 2, 0);
+  EpollInfo *epoll_info = server->io_epoll_infos[0];
+  ActorInfo *actor = &server->app_actors[0];
+  RequestBatch *batch = &epoll_info->request_batches[0];
+  Queue *queue = actor->input_queue[0];
+
+  Replies replies = { .count = 0 };
+  RequestContext *requests[6];
+  char path[16];
+  for (int i = 0 ; i < 5 ; i++) {
+    snprintf(path, sizeof(path), "/key-%d", i);
+    requests[i] = dispatch_get(server, epoll_info, path);
+  }
+
+  /* the queue takes two, the rest waits in the worker in order. */
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(queue_size(queue), 2);
+  ck_assert_uint_eq(batch->count, 3);
+  ck_assert_uint_eq(batch->parked, 3);
+  ck_assert(batch->requests[0] == requests[2]);
+  ck_assert(batch->requests[2] == requests[4]);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 3);
+
+  /* the requests that are still waiting are not counted again. */
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(batch->count, 3);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 3);
+
+  /* they follow the ones before them once the actor made room. */
+  ck_assert(queue_pop(queue) == requests[0]);
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(batch->count, 2);
+  ck_assert_uint_eq(batch->parked, 2);
+  ck_assert(queue_pop(queue) == requests[1]);
+  ck_assert(queue_pop(queue) == requests[2]);
+
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(batch->count, 0);
+  ck_assert_uint_eq(batch->parked, 0);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 3);
+
+  /* a new request that finds the queue full waits as well. */
+  requests[5] = dispatch_get(server, epoll_info, "/key-5");
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(batch->parked, 1);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 4);
+
+  ck_assert(queue_pop(queue) == requests[3]);
+  ck_assert(queue_pop(queue) == requests[4]);
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert(queue_pop(queue) == requests[5]);
+  ck_assert(queue_pop(queue) == NULL);
+  ck_assert_uint_eq(batch->count, 0);
+  ck_assert_uint_eq(replies.count, 0);
+  ck_assert_int_eq(atomic_load(&actor->rejected_requests), 0);
+} END_TEST
+
+START_TEST(client_reject_overload) {
+  Server *server = test_server_init(1, 2, 1);
+  EpollInfo *epoll_info = server->io_epoll_infos[0];
+  ActorInfo *actor = &server->app_actors[0];
+  RequestBatch *batch = &epoll_info->request_batches[0];
+  Queue *queue = actor->input_queue[0];
+
+  RequestContext *first = dispatch_get(server, epoll_info, "/key-0");
+  RequestContext *second = dispatch_get(server, epoll_info, "/key-1");
+  RequestContext *third = dispatch_get(server, epoll_info, "/key-2");
+  RequestContext *scan = dispatch_get(server, epoll_info, "/?prefix=key");
+  RequestContext *fourth = dispatch_get(server, epoll_info, "/key-3");
+
+  /* what does not fit is answered right away, except for the scan. */
+  Replies replies = { .count = 0 };
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert(queue_pop(queue) == first);
+  ck_assert(queue_pop(queue) == second);
+  ck_assert(queue_pop(queue) == NULL);
+
+  ck_assert_uint_eq(replies.count, 2);
+  ck_assert(replies.requests[0] == third);
+  ck_assert(replies.requests[1] == fourth);
+  for (size_t i = 0 ; i < replies.count ; i++) {
+    OutputBuffer *output = replies.requests[i]->output_buffer;
+    ck_assert(strncmp(output->buffer, "HTTP/1.1 503", 12) == 0);
+  }
+  ck_assert_int_eq(atomic_load(&actor->rejected_requests), 2);
+
+  ck_assert_uint_eq(batch->count, 1);
+  ck_assert(batch->requests[0] == scan);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 1);
+
+  /* the scan goes out once there is room, nothing else is answered. */
+  client_flush_requests(server, epoll_info, collect_reply, &replies);
+  ck_assert_uint_eq(batch->count, 0);
+  ck_assert(queue_pop(queue) == scan);
+  ck_assert_uint_eq(replies.count, 2);
+  ck_assert_int_eq(atomic_load(&actor->parked_requests), 1);
+} END_TEST
+
+Suite *client_suite(void) {
+  Suite *suite = suite_create("client");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, client_keep_alive);
+  tcase_add_test(tc_core, client_pipelined_dispatch);
+  tcase_add_test(tc_core, client_parked_requests);
+  tcase_add_test(tc_core, client_reject_overload);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = client_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
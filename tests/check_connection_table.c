@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/connection_table.h"
+#include "../src/input_buffer.h"
+#include "../src/logging.h"
+#include "../src/output_buffer.h"
+#include "../src/request_context.h"
+#include "../src/timer_wheel.h"
+
+static int open_fd(void) {
+  int fd = open("/dev/null", O_RDWR);
+  CHECK(fd == -1, "Failed to open /dev/null");
+  return fd;
+}
+
+START_TEST(connection_table_reuse) {
+  ConnectionTable *table = connection_table_init(4);
+
+  int fd = open_fd();
+  RequestContext *context = connection_table_open(table, fd, NULL);
+  ck_assert(connection_table_get(table, fd) == context);
+  ck_assert(context->connection == context);
+  output_buffer_append(context->output_buffer, "hello");
+  input_buffer_append(context->input_buffer, "GET", 3);
+
+  connection_table_close(table, context, REQUEST_SUCCESS);
+  ck_assert(connection_table_get(table, fd) == NULL);
+
+  /* the next connection on the same descriptor gets the context back,
+   * emptied out. */
+  ck_assert_int_eq(open_fd(), fd);
+  ck_assert(connection_table_open(table, fd, NULL) == context);
+  ck_assert_int_eq(context->fd, fd);
+  ck_assert_int_eq(context->input_buffer->offset, 0);
+  ck_assert_int_eq(output_buffer_size(context->output_buffer), 0);
+  ck_assert_int_eq(table->allocations, 1);
+
+  /* the table grows for descriptors past its capacity. */
+  int high_fd = dup2(fd, 100);
+  ck_assert_int_eq(high_fd, 100);
+  RequestContext *high = connection_table_open(table, high_fd, NULL);
+  ck_assert(connection_table_get(table, high_fd) == high);
+  ck_assert(connection_table_get(table, fd) == context);
+  ck_assert(table->capacity > 100);
+
+  connection_table_close(table, high, REQUEST_SUCCESS);
+  connection_table_close(table, context, REQUEST_SUCCESS);
+  connection_table_destroy(table);
+} END_TEST
+
+START_TEST(connection_table_pipelined) {
+  ConnectionTable *table = connection_table_init(CONNECTION_TABLE_SIZE);
+
+  int fd = open_fd();
+  RequestContext *connection = connection_table_open(table, fd, NULL);
+  RequestContext *first = connection_table_add_request(table, connection);
+  RequestContext *second = connection_table_add_request(table, connection);
+  ck_assert(first != second);
+  ck_assert(first->connection == connection);
+  ck_assert(first->input_buffer == NULL);
+  ck_assert_int_eq(table->allocations, 3);
+
+  output_buffer_append(first->output_buffer, "response");
+  connection_table_remove_request(table, first, REQUEST_SUCCESS);
+  connection_table_remove_request(table, second, REQUEST_SUCCESS);
+
+  /* the contexts that are done are handed out again before allocating. */
+  RequestContext *third = connection_table_add_request(table, connection);
+  RequestContext *fourth = connection_table_add_request(table, connection);
+  ck_assert(third == second);
+  ck_assert(fourth == first);
+  ck_assert_int_eq(output_buffer_size(fourth->output_buffer), 0);
+  ck_assert_int_eq(fourth->fd, fd);
+  ck_assert_int_eq(table->allocations, 3);
+
+  connection_table_remove_request(table, third, REQUEST_SUCCESS);
+  connection_table_remove_request(table, fourth, REQUEST_SUCCESS);
+  connection_table_close(table, connection, REQUEST_SUCCESS);
+  connection_table_destroy(table);
+} END_TEST
+
+START_TEST(connection_table_timeouts) {
+  ConnectionTable *table = connection_table_init(CONNECTION_TABLE_SIZE);
+  connection_table_set_timeouts(table, 1, 2, 0, 0);
+  ck_assert_int_ne(table->timer_fd, -1);
+  uint64_t start = table->timers->now;
+
+  RequestContext *reading = connection_table_open(table, open_fd(), NULL);
+  RequestContext *idle = connection_table_open(table, open_fd(), NULL);
+  connection_table_set_timeout(table, reading, TIMEOUT_HEADER);
+  connection_table_set_timeout(table, idle, TIMEOUT_KEEP_ALIVE);
+  ck_assert_int_eq(timer_wheel_size(table->timers), 1);
+
+  /* moving on to the body restarts the clock with the longer timeout. */
+  connection_table_set_timeout(table, reading, TIMEOUT_BODY);
+  ck_assert_int_eq(timer_wheel_size(table->timers), 1);
+  ck_assert(connection_table_expire(table, start + 1000 / TIMEOUT_TICK_MS + 1) == NULL);
+  ck_assert(connection_table_expire(table, start + 3000 / TIMEOUT_TICK_MS + 1) == reading);
+  ck_assert_int_eq(reading->timeout, TIMEOUT_EXPIRED);
+  ck_assert(connection_table_expire(table, start + 3000 / TIMEOUT_TICK_MS + 1) == NULL);
+
+  /* an expired connection stays expired till it is closed. */
+  connection_table_set_timeout(table, reading, TIMEOUT_HEADER);
+  ck_assert_int_eq(timer_wheel_size(table->timers), 0);
+
+  connection_table_set_timeout(table, idle, TIMEOUT_HEADER);
+  ck_assert_int_eq(timer_wheel_size(table->timers), 1);
+  connection_table_close(table, idle, REQUEST_SUCCESS);
+  ck_assert_int_eq(timer_wheel_size(table->timers), 0);
+
+  connection_table_close(table, reading, REQUEST_TIMEOUT);
+  connection_table_destroy(table);
+} END_TEST
+
+Suite *connection_table_suite(void) {
+  Suite *suite = suite_create("connection_table");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, connection_table_reuse);
+  tcase_add_test(tc_core, connection_table_pipelined);
+  tcase_add_test(tc_core, connection_table_timeouts);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = connection_table_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "../src/http_request.h"
 #include "../src/input_buffer.h"
 #include "../src/logging.h"
 
@@ -31,7 +32,7 @@ START_TEST(input_buffer_read) {
   int output = fds[1];
   
   dprintf(input, "testing 1 2 3");
-  enum ReadState state = input_buffer_read_into(buffer, output);
+  enum ReadState state = input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   
   ck_assert_int_eq(state, READ_BUSY);
   ck_assert_str_eq(buffer->buffer, "testing 1 2 3");
@@ -49,11 +50,11 @@ START_TEST(input_buffer_mult_reads) {
   int output = fds[1];
 
   dprintf(input, "testing-%d", 1);
-  input_buffer_read_into(buffer, output);
+  input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   ck_assert_str_eq(buffer->buffer, "testing-1");
 
   dprintf(input, "testing-%d", 2);
-  input_buffer_read_into(buffer, output);
+  input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   ck_assert_str_eq(buffer->buffer, "testing-1testing-2");
 
   input_buffer_destroy(buffer);
@@ -70,7 +71,7 @@ START_TEST(input_buffer_resize) {
   const char *str = "testing-1-2-3-4-5-6-7-8-9-10-11-12-13-14-15";
   dprintf(input, "%s", str);
 
-  enum ReadState state = input_buffer_read_into(buffer, output);
+  enum ReadState state = input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   ck_assert_int_eq(READ_BUSY, state);
   ck_assert(strncmp(buffer->buffer, str, strlen(str)) == 0);
   ck_assert_int_eq(buffer->offset, strlen(str));
@@ -90,7 +91,7 @@ START_TEST(input_buffer_reuse) {
 
   const char *str = "testing";
   dprintf(input, "%s", str);
-  input_buffer_read_into(buffer, output);
+  input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   ck_assert(strncmp(buffer->buffer, str, strlen(str)) == 0);
   ck_assert_int_eq(buffer->offset, strlen(str));
 
@@ -99,12 +100,109 @@ START_TEST(input_buffer_reuse) {
 
   const char *str2 = "1-2-3";
   dprintf(input, "%s", str2);
-  input_buffer_read_into(buffer, output);
+  input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE);
   ck_assert(strncmp(buffer->buffer, str2, strlen(str2)) == 0);
   ck_assert_int_eq(buffer->offset, strlen(str2));
 
 } END_TEST
 
+START_TEST(input_buffer_pipelined) {
+  InputBuffer *buffer = input_buffer_init(16);
+  const char *str = "PUT /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+    "GET /b HTTP/1.1\r\n\r\n"
+    "GET /c HTTP/1.1\r\n";
+  input_buffer_append(buffer, str, strlen(str));
+
+  HttpRequest request;
+  ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_FINISH);
+  ck_assert_int_eq(request.body_len, 3);
+  ck_assert(strncmp(request.body, "abc", 3) == 0);
+  size_t first_len = request.request_len;
+
+  ck_assert_int_eq(http_request_parse(buffer, first_len, first_len, &request), PARSE_FINISH);
+  ck_assert(strncmp(request.path, "/b", request.path_len) == 0);
+  size_t batch_len = first_len + request.request_len;
+
+  ck_assert_int_eq(http_request_parse(buffer, batch_len, batch_len, &request),
+		   PARSE_INCOMPLETE);
+
+  /* only the partial request is left, which is completed by the next read. */
+  input_buffer_consume(buffer, batch_len);
+  ck_assert_int_eq(buffer->offset, strlen("GET /c HTTP/1.1\r\n"));
+  size_t prev_len = buffer->offset;
+  input_buffer_append(buffer, "\r\n", 2);
+  ck_assert_int_eq(http_request_parse(buffer, 0, prev_len, &request), PARSE_FINISH);
+  ck_assert(strncmp(request.path, "/c", request.path_len) == 0);
+
+  input_buffer_consume(buffer, request.request_len);
+  ck_assert_int_eq(buffer->offset, 0);
+
+  input_buffer_destroy(buffer);
+} END_TEST
+
+START_TEST(input_buffer_too_large) {
+  InputBuffer *buffer = input_buffer_init(16);
+  const char *str = "PUT /a HTTP/1.1\r\nContent-Length: 67108865\r\n\r\nabc";
+  input_buffer_append(buffer, str, strlen(str));
+
+  /* the request is refused as soon as its headers are in. */
+  HttpRequest request;
+  ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_TOO_LARGE);
+  ck_assert_uint_eq(request.body_len, HTTP_MAX_BODY_SIZE + 1);
+  ck_assert_uint_eq(request.request_len, strlen(str) - 3);
+
+  input_buffer_reset(buffer);
+  str = "PUT /a HTTP/1.1\r\nContent-Length: 67108864\r\n\r\nabc";
+  input_buffer_append(buffer, str, strlen(str));
+  ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_INCOMPLETE);
+
+  input_buffer_destroy(buffer);
+} END_TEST
+
+START_TEST(input_buffer_read_limit) {
+  InputBuffer *buffer = input_buffer_init(4);
+  int fds[2];
+  create_sockets(fds);
+  int input = fds[0];
+  int output = fds[1];
+
+  const char *str = "testing-1-2-3-4-5-6-7-8-9-10-11-12-13-14-15";
+  dprintf(input, "%s", str);
+
+  /* the rest stays in the socket once the limit is reached. */
+  ck_assert_int_eq(input_buffer_read_into(buffer, output, 10), READ_FINISH);
+  ck_assert_int_eq(buffer->offset, 10);
+  ck_assert_int_eq(input_buffer_read_into(buffer, output, 10), READ_FINISH);
+  ck_assert_int_eq(buffer->offset, 10);
+
+  ck_assert_int_eq(input_buffer_read_into(buffer, output, HTTP_MAX_REQUEST_SIZE), READ_BUSY);
+  ck_assert_int_eq(buffer->offset, strlen(str));
+  ck_assert(strncmp(buffer->buffer, str, strlen(str)) == 0);
+
+  input_buffer_destroy(buffer);
+} END_TEST
+
+START_TEST(input_buffer_headers_too_large) {
+  InputBuffer *buffer = input_buffer_init(16);
+  const char *str = "GET /a HTTP/1.1\r\nX-Padding: ";
+  input_buffer_append(buffer, str, strlen(str));
+
+  HttpRequest request;
+  char padding[1024];
+  memset(padding, 'x', sizeof(padding));
+  while (buffer->offset <= HTTP_MAX_HEADER_SIZE) {
+    ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_INCOMPLETE);
+    input_buffer_append(buffer, padding, sizeof(padding));
+  }
+
+  /* headers that never end within the limit are not buffered any further. */
+  ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_ERROR);
+  input_buffer_append(buffer, "\r\n\r\n", 4);
+  ck_assert_int_eq(http_request_parse(buffer, 0, 0, &request), PARSE_ERROR);
+
+  input_buffer_destroy(buffer);
+} END_TEST
+
 Suite *input_buffer_suite(void) {
   Suite *suite = suite_create("input buffer");
   TCase *tc_core = tcase_create("Core");
@@ -113,6 +211,10 @@ Suite *input_buffer_suite(void) {
   tcase_add_test(tc_core, input_buffer_mult_reads);
   tcase_add_test(tc_core, input_buffer_resize);
   tcase_add_test(tc_core, input_buffer_reuse);
+  tcase_add_test(tc_core, input_buffer_pipelined);
+  tcase_add_test(tc_core, input_buffer_too_large);
+  tcase_add_test(tc_core, input_buffer_read_limit);
+  tcase_add_test(tc_core, input_buffer_headers_too_large);
   suite_add_tcase(suite, tc_core);
   return suite;
 }
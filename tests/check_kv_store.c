@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/kv_store.h"
+#include "../src/logging.h"
+#include "../src/slab.h"
+#include "../src/swiss_table.h"
+
+START_TEST(kv_store_put_get) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+
+  ck_assert_int_eq(kv_store_put(store, "key", 3, "value", 5, 0), 1);
+
+  KvItem *item = kv_store_get(store, "key", 3);
+  ck_assert(item != NULL);
+  ck_assert_int_eq(item->value_len, 5);
+  ck_assert(strncmp(kv_item_value(item), "value", 5) == 0);
+  ck_assert(kv_store_get(store, "missing", 7) == NULL);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_replace) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+
+  ck_assert_int_eq(kv_store_put(store, "key", 3, "first", 5, 0), 1);
+  ck_assert_int_eq(kv_store_put(store, "key", 3, "second!", 7, 0), 0);
+  ck_assert_int_eq(kv_store_size(store), 1);
+
+  KvItem *item = kv_store_get(store, "key", 3);
+  ck_assert_int_eq(item->value_len, 7);
+  ck_assert(strncmp(kv_item_value(item), "second!", 7) == 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_remove) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+
+  kv_store_put(store, "key", 3, "value", 5, 0);
+  ck_assert_int_eq(kv_store_delete(store, "key", 3), 1);
+  ck_assert_int_eq(kv_store_delete(store, "key", 3), 0);
+  ck_assert(kv_store_get(store, "key", 3) == NULL);
+  ck_assert_int_eq(kv_store_size(store), 0);
+  ck_assert_int_eq(store->item_bytes, 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_many_keys) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  char key[32];
+
+  for (int i = 0 ; i < 100000 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    kv_store_put(store, key, (size_t) len, key, (size_t) len, 0);
+  }
+  ck_assert_int_eq(kv_store_size(store), 100000);
+
+  for (int i = 0 ; i < 100000 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    KvItem *item = kv_store_get(store, key, (size_t) len);
+    ck_assert(item != NULL);
+    ck_assert(strncmp(kv_item_value(item), key, (size_t) len) == 0);
+    if (i % 2 == 0) {
+      ck_assert_int_eq(kv_store_delete(store, key, (size_t) len), 1);
+    }
+  }
+  ck_assert_int_eq(kv_store_size(store), 50000);
+  /* the keys and values take 10 to 18 bytes. */
+  long used = 0;
+  for (size_t size_class = slab_size_class(sizeof(KvItem) + 10) ;
+       size_class <= slab_size_class(sizeof(KvItem) + 18) ; size_class++) {
+    used += atomic_load(&slab->classes[size_class].used);
+  }
+  ck_assert_int_eq(used, 50000);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_expiration) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  uint64_t now = store->now;
+  char key[32];
+
+  for (int i = 0 ; i < 200 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    kv_store_put(store, key, (size_t) len, key, (size_t) len, now + 1000);
+  }
+  kv_store_put(store, "forever", 7, "value", 5, 0);
+  kv_store_put(store, "later", 5, "value", 5, now + 5000);
+
+  /* replacing a key drops its old expiration. */
+  kv_store_put(store, "key-0", 5, "value", 5, 0);
+  ck_assert_int_eq(kv_store_expire(store, now + 999, 1000), 0);
+
+  /* the keys are expired in batches, the rest is hidden till then. */
+  ck_assert_int_eq(kv_store_expire(store, now + 1000, 50), 50);
+  ck_assert_int_eq(kv_store_size(store), 152);
+  ck_assert(kv_store_get(store, "key-199", 7) == NULL);
+  ck_assert_int_eq(kv_store_delete(store, "key-198", 7), 0);
+  ck_assert_int_eq(kv_store_put(store, "key-197", 7, "value", 5, 0), 1);
+  ck_assert_int_eq(kv_store_expire(store, now + 1000, 1000), 146);
+  ck_assert_int_eq(kv_store_size(store), 4);
+  ck_assert(kv_store_get(store, "key-0", 5) != NULL);
+  ck_assert(kv_store_get(store, "key-197", 7) != NULL);
+
+  ck_assert_int_eq(kv_store_expire(store, now + 5000, 1000), 1);
+  ck_assert(kv_store_get(store, "later", 5) == NULL);
+  ck_assert(kv_store_get(store, "forever", 7) != NULL);
+  ck_assert_int_eq(timer_wheel_size(store->timers), 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_eviction) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  char key[32];
+  char value[100];
+  memset(value, 'v', sizeof(value));
+
+  for (int i = 0 ; i < 1000 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    kv_store_put(store, key, (size_t) len, value, sizeof(value), 0);
+  }
+  size_t limit = kv_store_memory(store);
+  kv_store_set_memory_limit(store, limit);
+
+  /* the key that keeps being read is never picked by the clock. */
+  for (int i = 1000 ; i < 10000 ; i++) {
+    ck_assert(kv_store_get(store, "key-0", 5) != NULL);
+    int len = sprintf(key, "key-%d", i);
+    kv_store_put(store, key, (size_t) len, value, sizeof(value), 0);
+    ck_assert_uint_le(kv_store_memory(store), limit);
+  }
+  ck_assert(kv_store_get(store, "key-0", 5) != NULL);
+  ck_assert(kv_store_get(store, "key-9999", 8) != NULL);
+  ck_assert(kv_store_get(store, "key-1", 5) == NULL);
+  ck_assert_int_eq(atomic_load(&store->evictions), 10000 - kv_store_size(store));
+  ck_assert_int_eq(atomic_load(&store->misses), 1);
+
+  /* lowering the limit evicts right away. */
+  kv_store_set_memory_limit(store, limit / 2);
+  ck_assert_uint_le(kv_store_memory(store), limit / 2);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_eviction_limits) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  char key[32];
+  char value[200];
+  memset(value, 'v', sizeof(value));
+
+  for (int i = 0 ; i < 1000 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    kv_store_put(store, key, (size_t) len, value, 100, 0);
+  }
+  kv_store_set_memory_limit(store, kv_store_memory(store));
+
+  /* replacing a key never evicts it, even when the clock gets to it
+   * while making room for the larger value. */
+  int replaced = 0;
+  for (int i = 0 ; i < 1000 ; i++) {
+    int len = sprintf(key, "key-%d", i);
+    /* looked up without setting its access bit, so the clock can pick it. */
+    if (swiss_table_get(store->index, key, (size_t) len) == NULL) {
+      continue;
+    }
+    ck_assert_int_eq(kv_store_put(store, key, (size_t) len, value, sizeof(value), 0), 0);
+    replaced++;
+    KvItem *item = kv_store_get(store, key, (size_t) len);
+    ck_assert(item != NULL);
+    ck_assert_int_eq(item->value_len, sizeof(value));
+  }
+  ck_assert_int_gt(replaced, 0);
+
+  /* a value larger than the whole budget is refused without evicting. */
+  kv_store_set_memory_limit(store, 1024 * 1024);
+  size_t size = kv_store_size(store);
+  long evictions = atomic_load(&store->evictions);
+  size_t large_len = 2 * 1024 * 1024;
+  char *large = (char*) CHECK_MEM(calloc(1, large_len));
+  ck_assert_int_eq(kv_store_put(store, "large", 5, large, large_len, 0), KV_PUT_TOO_LARGE);
+  ck_assert(kv_store_get(store, "large", 5) == NULL);
+  ck_assert_uint_eq(kv_store_size(store), size);
+  ck_assert_int_eq(atomic_load(&store->evictions), evictions);
+  free(large);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_ordered_scan) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  kv_store_enable_ordered(store);
+  char key[32];
+
+  for (int i = 99 ; i >= 0 ; i--) {
+    int len = sprintf(key, "key-%02d", i);
+    kv_store_put(store, key, (size_t) len, key, (size_t) len, 0);
+  }
+  kv_store_delete(store, "key-11", 6);
+  kv_store_put(store, "key-12", 6, "new", 3, 0);
+  kv_store_put(store, "key-13", 6, "gone", 4, 1);
+  kv_store_expire(store, 2, 0);
+
+  /* the removed and expired keys are skipped and the end is exclusive. */
+  KvItem *items[10];
+  size_t count = kv_store_scan(store, "key-10", 6, "key-15", 6, items, 10);
+  ck_assert_int_eq(count, 3);
+  ck_assert(memcmp(kv_item_key(items[0]), "key-10", 6) == 0);
+  ck_assert(memcmp(kv_item_value(items[1]), "new", 3) == 0);
+  ck_assert(memcmp(kv_item_key(items[2]), "key-14", 6) == 0);
+
+  count = kv_store_scan(store, "key-95", 6, "", 0, items, 10);
+  ck_assert_int_eq(count, 5);
+  ck_assert_int_eq(kv_store_scan(store, "", 0, "", 0, items, 10), 10);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(kv_store_lend_value) {
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+
+  kv_store_put(store, "key", 3, "first", 5, 0);
+  kv_store_put(store, "other", 5, "value", 5, 0);
+  KvItem *item = kv_store_get(store, "key", 3);
+  kv_store_lend(store, item);
+  size_t memory = kv_store_memory(store);
+
+  /* the replaced item is kept around while its value is lent out, and
+   * still counts towards the memory of the store. */
+  kv_store_put(store, "key", 3, "second", 6, 0);
+  ck_assert_int_eq(store->retired_count, 1);
+  ck_assert_uint_gt(kv_store_memory(store), memory);
+  ck_assert(strncmp(kv_item_value(item), "first", 5) == 0);
+
+  /* the items that are not lent out are freed right away. */
+  kv_store_delete(store, "other", 5);
+  ck_assert_int_eq(store->retired_count, 1);
+
+  kv_store_return(item);
+  kv_store_expire(store, kv_store_clock(), 1);
+  ck_assert_int_eq(store->retired_count, 0);
+  ck_assert_int_eq(store->retired_bytes, 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+Suite *kv_store_suite(void) {
+  Suite *suite = suite_create("kv store");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, kv_store_put_get);
+  tcase_add_test(tc_core, kv_store_replace);
+  tcase_add_test(tc_core, kv_store_remove);
+  tcase_add_test(tc_core, kv_store_many_keys);
+  tcase_add_test(tc_core, kv_store_expiration);
+  tcase_add_test(tc_core, kv_store_eviction);
+  tcase_add_test(tc_core, kv_store_eviction_limits);
+  tcase_add_test(tc_core, kv_store_ordered_scan);
+  tcase_add_test(tc_core, kv_store_lend_value);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = kv_store_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -79,6 +79,25 @@ START_TEST(queue_event_fd) {
   queue_destroy(queue);
 } END_TEST
 
+START_TEST(queue_batch) {
+  Queue *queue = queue_init(4);
+  void *in[5] = { (void*) 1, (void*) 2, (void*) 3, (void*) 4, (void*) 5 };
+  void *out[5];
+
+  ck_assert_int_eq(queue_push_batch(queue, in, 5), 4);
+  ck_assert_int_eq(queue_pop_batch(queue, out, 2), 2);
+  ck_assert_int_eq((int) out[0], 1);
+  ck_assert_int_eq((int) out[1], 2);
+
+  ck_assert_int_eq(queue_push_batch(queue, in + 4, 1), 1);
+  ck_assert_int_eq(queue_pop_batch(queue, out, 5), 3);
+  ck_assert_int_eq((int) out[0], 3);
+  ck_assert_int_eq((int) out[2], 5);
+  ck_assert_int_eq(queue_size(queue), 0);
+
+  queue_destroy(queue);
+} END_TEST
+
 Suite *queue_suite(void) {
   Suite *suite = suite_create("lock queue suite");
   TCase *tc_core = tcase_create("Core");
@@ -87,6 +106,7 @@ Suite *queue_suite(void) {
   tcase_add_test(tc_core, queue_get_size);
   tcase_add_test(tc_core, queue_too_small);
   tcase_add_test(tc_core, queue_event_fd);
+  tcase_add_test(tc_core, queue_batch);
   suite_add_tcase(suite, tc_core);
   return suite;
 }
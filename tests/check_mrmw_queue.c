@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+#include "../src/logging.h"
+#include "../src/mrmw_queue.h"
+
+#define THREAD_COUNT 4
+#define MESSAGES_PER_THREAD 200000
+#define MESSAGE_COUNT (THREAD_COUNT * MESSAGES_PER_THREAD)
+
+/* how the consumers wait for messages. */
+enum WaitMode {
+  /* spin on trypop, and trypush for the producers. */
+  WAIT_SPIN,
+  /* block in pop, and in push for the producers. */
+  WAIT_BLOCKING,
+  /* poll the event file descriptor and pop a message per notification,
+   * like the actors do. */
+  WAIT_EVENT,
+};
+
+typedef struct Worker {
+  MrMwQueue *queue;
+  int id;
+  enum WaitMode mode;
+  /* how often every message was consumed. */
+  atomic_char *seen;
+  /* counts down the messages that are left to consume. */
+  atomic_long *remaining;
+} Worker;
+
+static void *produce(void *arg) {
+  Worker *worker = (Worker*) arg;
+  for (uintptr_t i = 0 ; i < MESSAGES_PER_THREAD ; i++) {
+    void *message = (void*) ((uintptr_t) worker->id * MESSAGES_PER_THREAD + i + 1);
+    if (worker->mode == WAIT_BLOCKING) {
+      mrmw_queue_push(worker->queue, message);
+    } else {
+      while (mrmw_queue_trypush(worker->queue, message) != MRMW_QUEUE_SUCCESS) {
+	sched_yield();
+      }
+    }
+  }
+  return NULL;
+}
+
+static uint64_t clock_millis(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * Waits for a notification before every pop. A lost notification leaves a
+ * message behind that nobody is woken up for, so the consumers give up
+ * once nothing happened for a while.
+ */
+static void consume_events(Worker *worker) {
+  struct pollfd pollfd = { mrmw_queue_add_event_fd(worker->queue), POLLIN, 0 };
+  uint64_t last_message = clock_millis();
+  while (atomic_load(worker->remaining) > 0 && clock_millis() - last_message < 2000) {
+    poll(&pollfd, 1, 100);
+
+    void *message;
+    while (mrmw_queue_pop_event(worker->queue, &message) == MRMW_QUEUE_SUCCESS) {
+      uintptr_t index = (uintptr_t) message - 1;
+      atomic_fetch_add(&worker->seen[index], 1);
+      atomic_fetch_sub(worker->remaining, 1);
+      last_message = clock_millis();
+    }
+  }
+}
+
+static void *consume(void *arg) {
+  Worker *worker = (Worker*) arg;
+  if (worker->mode == WAIT_EVENT) {
+    consume_events(worker);
+    return NULL;
+  }
+
+  while (1) {
+    void *message;
+    if (worker->mode == WAIT_BLOCKING) {
+      mrmw_queue_pop(worker->queue, &message);
+    } else if (mrmw_queue_trypop(worker->queue, &message) != MRMW_QUEUE_SUCCESS) {
+      if (atomic_load(worker->remaining) <= 0) {
+	return NULL;
+      }
+      sched_yield();
+      continue;
+    }
+
+    /* the blocking consumers are told to stop with a NULL message. */
+    if (message == NULL) {
+      return NULL;
+    }
+    uintptr_t index = (uintptr_t) message - 1;
+    atomic_fetch_add(&worker->seen[index], 1);
+    atomic_fetch_sub(worker->remaining, 1);
+  }
+}
+
+/* runs the producers and the consumers at the same time, and checks that
+ * every message was consumed exactly once. */
+static void run_stress(size_t queue_size, enum WaitMode mode) {
+  MrMwQueue *queue = mrmw_queue_init(queue_size);
+  atomic_char *seen = (atomic_char*) calloc(MESSAGE_COUNT, sizeof(atomic_char));
+  atomic_long remaining = MESSAGE_COUNT;
+
+  Worker producers[THREAD_COUNT];
+  Worker consumers[THREAD_COUNT];
+  pthread_t producer_threads[THREAD_COUNT];
+  pthread_t consumer_threads[THREAD_COUNT];
+  for (int i = 0 ; i < THREAD_COUNT ; i++) {
+    producers[i] = (Worker) { queue, i, mode, seen, &remaining };
+    consumers[i] = (Worker) { queue, i, mode, seen, &remaining };
+    pthread_create(&consumer_threads[i], NULL, consume, &consumers[i]);
+    pthread_create(&producer_threads[i], NULL, produce, &producers[i]);
+  }
+
+  for (int i = 0 ; i < THREAD_COUNT ; i++) {
+    pthread_join(producer_threads[i], NULL);
+  }
+  if (mode == WAIT_BLOCKING) {
+    for (int i = 0 ; i < THREAD_COUNT ; i++) {
+      mrmw_queue_push(queue, NULL);
+    }
+  }
+  for (int i = 0 ; i < THREAD_COUNT ; i++) {
+    pthread_join(consumer_threads[i], NULL);
+  }
+
+  ck_assert_int_eq(atomic_load(&remaining), 0);
+  for (size_t i = 0 ; i < MESSAGE_COUNT ; i++) {
+    ck_assert_int_eq(seen[i], 1);
+  }
+  ck_assert_uint_eq(mrmw_queue_size(queue), 0);
+
+  free(seen);
+  mrmw_queue_destroy(queue);
+}
+
+START_TEST(mrmw_queue_push_pop) {
+  MrMwQueue *queue = mrmw_queue_init(4);
+  void *message;
+
+  ck_assert_int_eq(mrmw_queue_trypop(queue, &message), MRMW_QUEUE_FAIL);
+  for (uintptr_t i = 1 ; i <= 4 ; i++) {
+    ck_assert_int_eq(mrmw_queue_trypush(queue, (void*) i), MRMW_QUEUE_SUCCESS);
+  }
+  ck_assert_int_eq(mrmw_queue_trypush(queue, (void*) 5), MRMW_QUEUE_FAIL);
+  ck_assert_uint_eq(mrmw_queue_size(queue), 4);
+
+  /* wraps around the end of the ring a couple of times. */
+  for (uintptr_t i = 1 ; i <= 12 ; i++) {
+    ck_assert_int_eq(mrmw_queue_trypop(queue, &message), MRMW_QUEUE_SUCCESS);
+    ck_assert_uint_eq((uintptr_t) message, i);
+    ck_assert_int_eq(mrmw_queue_trypush(queue, (void*) (i + 4)), MRMW_QUEUE_SUCCESS);
+  }
+  ck_assert_uint_eq(mrmw_queue_size(queue), 4);
+
+  mrmw_queue_destroy(queue);
+} END_TEST
+
+START_TEST(mrmw_queue_event_fd) {
+  MrMwQueue *queue = mrmw_queue_init(8);
+  mrmw_queue_trypush(queue, (void*) 1);
+  mrmw_queue_trypush(queue, (void*) 2);
+
+  /* every read takes a single notification. */
+  eventfd_t count;
+  int fd = mrmw_queue_add_event_fd(queue);
+  ck_assert_int_eq(eventfd_read(fd, &count), 0);
+  ck_assert_uint_eq(count, 1);
+  ck_assert_int_eq(eventfd_read(fd, &count), 0);
+  ck_assert_int_eq(eventfd_read(fd, &count), -1);
+
+  mrmw_queue_destroy(queue);
+} END_TEST
+
+START_TEST(mrmw_queue_stress) {
+  run_stress(16, WAIT_SPIN);
+  run_stress(1024, WAIT_SPIN);
+} END_TEST
+
+START_TEST(mrmw_queue_stress_blocking) {
+  run_stress(16, WAIT_BLOCKING);
+} END_TEST
+
+START_TEST(mrmw_queue_stress_events) {
+  run_stress(16, WAIT_EVENT);
+  run_stress(4096, WAIT_EVENT);
+
+  /* every notification was taken along with its message. */
+  MrMwQueue *queue = mrmw_queue_init(4);
+  void *message;
+  mrmw_queue_trypush(queue, (void*) 1);
+  ck_assert_int_eq(mrmw_queue_pop_event(queue, &message), MRMW_QUEUE_SUCCESS);
+  ck_assert_int_eq(mrmw_queue_pop_event(queue, &message), MRMW_QUEUE_FAIL);
+  mrmw_queue_destroy(queue);
+} END_TEST
+
+Suite *mrmw_queue_suite(void) {
+  Suite *suite = suite_create("mrmw queue suite");
+  TCase *tc_core = tcase_create("Core");
+  tcase_set_timeout(tc_core, 60);
+
+  tcase_add_test(tc_core, mrmw_queue_push_pop);
+  tcase_add_test(tc_core, mrmw_queue_event_fd);
+  tcase_add_test(tc_core, mrmw_queue_stress);
+  tcase_add_test(tc_core, mrmw_queue_stress_blocking);
+  tcase_add_test(tc_core, mrmw_queue_stress_events);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = mrmw_queue_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
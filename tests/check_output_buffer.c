@@ -129,6 +129,83 @@ START_TEST(output_buffer_write) {
   output_buffer_destroy(buffer);
 } END_TEST
 
+static void count_release(void *arg) {
+  (*(int*) arg)++;
+}
+
+START_TEST(output_buffer_refs) {
+  errno = 0;
+  OutputBuffer *buffer = output_buffer_init(16);
+  OutputBuffer *other = output_buffer_init(16);
+  int released = 0;
+
+  int fds[2];
+  create_sockets(fds);
+  int input = fds[0];
+  int output = fds[1];
+
+  int size = 4096;
+  int r = setsockopt(input, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  CHECK(r != 0, "Failed to set the send buffer size");
+
+  char *value = malloc(OUTPUT_BUFFER_REF_MIN * 64);
+  for (size_t i = 0 ; i < OUTPUT_BUFFER_REF_MIN * 64 ; i++) {
+    value[i] = (char) ('a' + i % 26);
+  }
+
+  output_buffer_append(buffer, "head ");
+  output_buffer_append_ref(buffer, value, OUTPUT_BUFFER_REF_MIN * 64);
+  output_buffer_on_release(buffer, count_release, &released);
+  output_buffer_append(buffer, " middle ");
+
+  /* small data is copied instead of being referenced. */
+  output_buffer_append_ref(other, "tail", 4);
+  output_buffer_append_ref(other, value, OUTPUT_BUFFER_REF_MIN);
+  output_buffer_on_release(other, count_release, &released);
+  output_buffer_append_buffer(buffer, other);
+  output_buffer_destroy(other);
+  ck_assert_int_eq(released, 0);
+  ck_assert_int_eq(buffer->ref_count, 2);
+
+  size_t expected_len = 5 + OUTPUT_BUFFER_REF_MIN * 64 + 8 + 4 + OUTPUT_BUFFER_REF_MIN;
+  ck_assert_int_eq(output_buffer_size(buffer), expected_len);
+
+  /* the socket only takes part of the output at once, so the writes stop
+   * in the middle of the parts. */
+  char *received = malloc(expected_len);
+  size_t received_len = 0;
+  enum WriteState state;
+  while ((state = output_buffer_write_to(buffer, input)) == WRITE_BUSY) {
+    ssize_t bytes_read = read(output, received + received_len, expected_len - received_len);
+    ck_assert(bytes_read > 0);
+    received_len += (size_t) bytes_read;
+  }
+  ck_assert_int_eq(state, WRITE_FINISH);
+  ssize_t bytes_read;
+  while ((bytes_read = read(output, received + received_len,
+			    expected_len - received_len)) > 0) {
+    received_len += (size_t) bytes_read;
+  }
+  ck_assert_int_eq(received_len, expected_len);
+
+  char *cursor = received;
+  ck_assert(strncmp(cursor, "head ", 5) == 0);
+  cursor += 5;
+  ck_assert(memcmp(cursor, value, OUTPUT_BUFFER_REF_MIN * 64) == 0);
+  cursor += OUTPUT_BUFFER_REF_MIN * 64;
+  ck_assert(strncmp(cursor, " middle tail", 12) == 0);
+  cursor += 12;
+  ck_assert(memcmp(cursor, value, OUTPUT_BUFFER_REF_MIN) == 0);
+
+  output_buffer_reset(buffer);
+  ck_assert_int_eq(released, 2);
+  ck_assert_int_eq(output_buffer_size(buffer), 0);
+
+  free(received);
+  free(value);
+  output_buffer_destroy(buffer);
+} END_TEST
+
 Suite *output_buffer_suite(void) {
   Suite *suite = suite_create("output buffer");
   TCase *tc_core = tcase_create("Core");
@@ -139,6 +216,7 @@ Suite *output_buffer_suite(void) {
   tcase_add_test(tc_core, output_buffer_resize_vargs);
   tcase_add_test(tc_core, output_buffer_reuse);
   tcase_add_test(tc_core, output_buffer_write);
+  tcase_add_test(tc_core, output_buffer_refs);
 
   suite_add_tcase(suite, tc_core);
   return suite;
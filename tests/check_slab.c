@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/logging.h"
+#include "../src/slab.h"
+
+START_TEST(slab_size_classes) {
+  Slab *slab = slab_init();
+
+  for (size_t size = 1 ; size <= SLAB_MAX_SIZE ; size++) {
+    size_t size_class = slab_size_class(size);
+    ck_assert(size_class < SLAB_CLASS_COUNT);
+    ck_assert(slab->classes[size_class].size >= size);
+    if (size_class > 0) {
+      ck_assert(slab->classes[size_class - 1].size < size);
+    }
+  }
+
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(slab_reuse) {
+  Slab *slab = slab_init();
+
+  char *first = slab_alloc(slab, 100);
+  memset(first, 'a', 100);
+  slab_free(slab, first, 100);
+
+  /* objects of the same class are handed out again right away. */
+  char *second = slab_alloc(slab, 110);
+  ck_assert(first == second);
+
+  SlabClass *slab_class = &slab->classes[slab_size_class(100)];
+  ck_assert_int_eq(atomic_load(&slab_class->used), 1);
+  ck_assert_int_eq(atomic_load(&slab_class->total), SLAB_PAGE_SIZE / slab_class->size);
+  ck_assert_int_eq(atomic_load(&slab->page_count), 1);
+
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(slab_many_pages) {
+  Slab *slab = slab_init();
+  size_t per_page = SLAB_PAGE_SIZE / 4096;
+
+  char *prev = NULL;
+  for (size_t i = 0 ; i < per_page * 3 ; i++) {
+    char *ptr = slab_alloc(slab, 4096);
+    ck_assert(ptr != prev);
+    memset(ptr, 'b', 4096);
+    prev = ptr;
+  }
+  ck_assert_int_eq(atomic_load(&slab->page_count), 3);
+  ck_assert_int_eq(atomic_load(&slab->classes[slab_size_class(4096)].used), per_page * 3);
+
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(slab_large) {
+  Slab *slab = slab_init();
+
+  size_t size = SLAB_MAX_SIZE + 1;
+  char *ptr = slab_alloc(slab, size);
+  memset(ptr, 'c', size);
+  ck_assert_int_eq(atomic_load(&slab->large_bytes), size);
+  ck_assert_int_eq(atomic_load(&slab->page_count), 0);
+
+  slab_free(slab, ptr, size);
+  ck_assert_int_eq(atomic_load(&slab->large_bytes), 0);
+
+  slab_destroy(slab);
+} END_TEST
+
+Suite *slab_suite(void) {
+  Suite *suite = suite_create("slab");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, slab_size_classes);
+  tcase_add_test(tc_core, slab_reuse);
+  tcase_add_test(tc_core, slab_many_pages);
+  tcase_add_test(tc_core, slab_large);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = slab_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/kv_store.h"
+#include "../src/logging.h"
+#include "../src/slab.h"
+#include "../src/snapshot.h"
+
+static void wait_done(Snapshot *snapshot, KvStore *store) {
+  struct pollfd poll_fd;
+  poll_fd.fd = snapshot_done_event_fd(snapshot);
+  poll_fd.events = POLLIN;
+  while (snapshot_running(snapshot)) {
+    ck_assert_int_eq(poll(&poll_fd, 1, 5000), 1);
+    snapshot_handle_done(snapshot, store);
+  }
+}
+
+static KvStore *fill_store(Slab *slab, int count) {
+  KvStore *store = kv_store_init(slab);
+  char key[32];
+  char value[64];
+  for (int i = 0 ; i < count ; i++) {
+    int key_len = sprintf(key, "key-%d", i);
+    int value_len = sprintf(value, "value-%d-%.*s", i, i % 40, "0123456789012345678901234567890123456789");
+    kv_store_put(store, key, (size_t) key_len, value, (size_t) value_len, 0);
+  }
+  return store;
+}
+
+START_TEST(snapshot_write_and_load) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  Slab *slab = slab_init();
+  KvStore *store = fill_store(slab, 10000);
+
+  Snapshot *snapshot = snapshot_init(dir, 2, 4);
+  snapshot_start(snapshot, store, 7);
+  ck_assert(snapshot_running(snapshot));
+
+  /* changes made while the snapshot is written are not part of it. */
+  kv_store_delete(store, "key-1", 5);
+  kv_store_put(store, "key-2", 5, "changed", 7, 0);
+  kv_store_put(store, "extra", 5, "value", 5, 0);
+  wait_done(snapshot, store);
+  ck_assert_int_eq(store->retired_count, 0);
+  ck_assert_int_eq(atomic_load(&snapshot->snapshot_count), 1);
+
+  KvStore *loaded = kv_store_init(slab);
+  uint64_t generation = 0;
+  ck_assert_int_eq(snapshot_load(snapshot_init(dir, 2, 4), loaded, &generation), 1);
+  ck_assert_int_eq(generation, 7);
+  ck_assert_int_eq(kv_store_size(loaded), 10000);
+  ck_assert(kv_store_get(loaded, "extra", 5) == NULL);
+
+  char key[32];
+  char value[64];
+  for (int i = 0 ; i < 10000 ; i++) {
+    int key_len = sprintf(key, "key-%d", i);
+    int value_len = sprintf(value, "value-%d-%.*s", i, i % 40, "0123456789012345678901234567890123456789");
+    KvItem *item = kv_store_get(loaded, key, (size_t) key_len);
+    ck_assert(item != NULL);
+    ck_assert_int_eq(item->value_len, value_len);
+    ck_assert(memcmp(kv_item_value(item), value, (size_t) value_len) == 0);
+  }
+
+  /* the mapped items can be replaced and removed like any other. */
+  ck_assert_int_eq(kv_store_put(loaded, "key-3", 5, "new", 3, 0), 0);
+  ck_assert_int_eq(kv_store_delete(loaded, "key-4", 5), 1);
+  ck_assert_int_eq(kv_store_size(loaded), 9999);
+
+  kv_store_destroy(store);
+  kv_store_destroy(loaded);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(snapshot_missing) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  uint64_t generation = 0;
+  ck_assert_int_eq(snapshot_load(snapshot_init(dir, 0, 4), store, &generation), 0);
+  ck_assert_int_eq(kv_store_size(store), 0);
+  ck_assert_int_eq(generation, 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+/* writes a snapshot of a few items and returns it, ready to be damaged. */
+static Snapshot *write_snapshot(char *dir, Slab *slab) {
+  ck_assert(mkdtemp(dir) != NULL);
+  KvStore *store = fill_store(slab, 100);
+  Snapshot *snapshot = snapshot_init(dir, 0, 4);
+  snapshot_start(snapshot, store, 1);
+  wait_done(snapshot, store);
+  kv_store_destroy(store);
+  return snapshot;
+}
+
+START_TEST(snapshot_damaged) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  Slab *slab = slab_init();
+  Snapshot *snapshot = write_snapshot(dir, slab);
+
+  /* flips a byte inside of the items. */
+  int fd = open(snapshot->path, O_RDWR);
+  char byte;
+  off_t offset = (off_t) sizeof(SnapshotHeader) + 100;
+  ck_assert(pread(fd, &byte, 1, offset) == 1);
+  byte ^= 1;
+  ck_assert(pwrite(fd, &byte, 1, offset) == 1);
+  close(fd);
+
+  /* the logs before it are gone, so the actor must not start empty. */
+  uint64_t generation = 0;
+  snapshot_load(snapshot, kv_store_init(slab), &generation);
+} END_TEST
+
+START_TEST(snapshot_truncated) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  Slab *slab = slab_init();
+  Snapshot *snapshot = write_snapshot(dir, slab);
+  ck_assert_int_eq(truncate(snapshot->path, (off_t) sizeof(SnapshotHeader) / 2), 0);
+
+  uint64_t generation = 0;
+  snapshot_load(snapshot, kv_store_init(slab), &generation);
+} END_TEST
+
+START_TEST(snapshot_other_actor_count) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  Slab *slab = slab_init();
+  write_snapshot(dir, slab);
+
+  /* the keys of the snapshot belong to other actors with 2 of them. */
+  uint64_t generation = 0;
+  snapshot_load(snapshot_init(dir, 0, 2), kv_store_init(slab), &generation);
+} END_TEST
+
+START_TEST(snapshot_actor_count_kept) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  snapshot_check_actor_count(dir, 4);
+  snapshot_check_actor_count(dir, 4);
+
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/actors", dir);
+  FILE *file = fopen(path, "r");
+  ck_assert(file != NULL);
+  int stored = 0;
+  ck_assert_int_eq(fscanf(file, "%d", &stored), 1);
+  ck_assert_int_eq(stored, 4);
+  fclose(file);
+} END_TEST
+
+START_TEST(snapshot_actor_count_changed) {
+  char dir[] = "/tmp/jullop-snap-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  snapshot_check_actor_count(dir, 4);
+  snapshot_check_actor_count(dir, 8);
+} END_TEST
+
+Suite *snapshot_suite(void) {
+  Suite *suite = suite_create("snapshot");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, snapshot_write_and_load);
+  tcase_add_test(tc_core, snapshot_missing);
+  tcase_add_exit_test(tc_core, snapshot_damaged, EXIT_FAILURE);
+  tcase_add_exit_test(tc_core, snapshot_truncated, EXIT_FAILURE);
+  tcase_add_exit_test(tc_core, snapshot_other_actor_count, EXIT_FAILURE);
+  tcase_add_test(tc_core, snapshot_actor_count_kept);
+  tcase_add_exit_test(tc_core, snapshot_actor_count_changed, EXIT_FAILURE);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = snapshot_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
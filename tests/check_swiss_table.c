@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/logging.h"
+#include "../src/swiss_table.h"
+
+START_TEST(swiss_table_put_get) {
+  SwissTable *table = swiss_table_init(0);
+
+  ck_assert(swiss_table_put(table, "a", 1, (void*) 1) == NULL);
+  ck_assert(swiss_table_put(table, "b", 1, (void*) 2) == NULL);
+
+  ck_assert_int_eq((intptr_t) swiss_table_get(table, "a", 1), 1);
+  ck_assert_int_eq((intptr_t) swiss_table_get(table, "b", 1), 2);
+  ck_assert(swiss_table_get(table, "c", 1) == NULL);
+  ck_assert_int_eq(swiss_table_size(table), 2);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+START_TEST(swiss_table_replace) {
+  SwissTable *table = swiss_table_init(0);
+
+  swiss_table_put(table, "key", 3, (void*) 1);
+  ck_assert_int_eq((intptr_t) swiss_table_put(table, "key", 3, (void*) 2), 1);
+  ck_assert_int_eq((intptr_t) swiss_table_get(table, "key", 3), 2);
+  ck_assert_int_eq(swiss_table_size(table), 1);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+START_TEST(swiss_table_long_keys) {
+  SwissTable *table = swiss_table_init(0);
+
+  /* the keys share the inline prefix and only differ at the end. */
+  const char *key_1 = "a-very-long-key-that-is-not-inline-1";
+  const char *key_2 = "a-very-long-key-that-is-not-inline-2";
+
+  swiss_table_put(table, key_1, strlen(key_1), (void*) 1);
+  swiss_table_put(table, key_2, strlen(key_2), (void*) 2);
+
+  ck_assert_int_eq((intptr_t) swiss_table_get(table, key_1, strlen(key_1)), 1);
+  ck_assert_int_eq((intptr_t) swiss_table_get(table, key_2, strlen(key_2)), 2);
+  ck_assert(swiss_table_get(table, key_1, strlen(key_1) - 1) == NULL);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+START_TEST(swiss_table_grow_and_remove) {
+  SwissTable *table = swiss_table_init(0);
+  char key[32];
+
+  for (intptr_t i = 1 ; i <= 200000 ; i++) {
+    int len = sprintf(key, "key-%ld", i);
+    ck_assert(swiss_table_put(table, key, (size_t) len, (void*) i) == NULL);
+  }
+  ck_assert_int_eq(swiss_table_size(table), 200000);
+
+  for (intptr_t i = 1 ; i <= 200000 ; i += 2) {
+    int len = sprintf(key, "key-%ld", i);
+    ck_assert_int_eq((intptr_t) swiss_table_remove(table, key, (size_t) len), i);
+  }
+  ck_assert_int_eq(swiss_table_size(table), 100000);
+
+  for (intptr_t i = 1 ; i <= 200000 ; i++) {
+    int len = sprintf(key, "key-%ld", i);
+    void *value = swiss_table_get(table, key, (size_t) len);
+    if (i % 2 == 1) {
+      ck_assert(value == NULL);
+    } else {
+      ck_assert_int_eq((intptr_t) value, i);
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0 ; i < table->capacity ; i++) {
+    if (swiss_table_slot_value(table, i) != NULL) {
+      count++;
+    }
+  }
+  ck_assert_int_eq(count, 100000);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+START_TEST(swiss_table_churn) {
+  /* constantly adding and removing keys must clean up the deleted slots
+   * without growing the table. */
+  SwissTable *table = swiss_table_init(64);
+  size_t capacity = table->capacity;
+  char key[32];
+
+  for (intptr_t i = 1 ; i <= 100000 ; i++) {
+    int len = sprintf(key, "churn-%ld", i);
+    swiss_table_put(table, key, (size_t) len, (void*) i);
+    ck_assert_int_eq((intptr_t) swiss_table_remove(table, key, (size_t) len), i);
+  }
+  ck_assert_int_eq(swiss_table_size(table), 0);
+  ck_assert_int_eq(table->capacity, capacity);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+START_TEST(swiss_table_clock_hand) {
+  SwissTable *table = swiss_table_init(0);
+  size_t hand = 0;
+  ck_assert(swiss_table_clock(table, &hand) == NULL);
+
+  const char *long_key = "a key that is too long to be stored inline";
+  swiss_table_put(table, "a", 1, (void*) 1);
+  swiss_table_put(table, "b", 1, (void*) 2);
+  swiss_table_put(table, long_key, strlen(long_key), (void*) 3);
+
+  /* new keys count as accessed, so the hand has to clear all of them
+   * before picking one. */
+  ck_assert(swiss_table_clock(table, &hand) != NULL);
+
+  /* the accessed keys are skipped till every other key was picked. */
+  ck_assert(swiss_table_touch(table, "a", 1) == (void*) 1);
+  ck_assert(swiss_table_touch(table, long_key, strlen(long_key)) == (void*) 3);
+  ck_assert_int_eq((intptr_t) swiss_table_clock(table, &hand), 2);
+  ck_assert(swiss_table_remove(table, "b", 1) == (void*) 2);
+
+  /* the access bit does not get in the way of lookups. */
+  ck_assert(swiss_table_get(table, long_key, strlen(long_key)) == (void*) 3);
+  intptr_t next = (intptr_t) swiss_table_clock(table, &hand);
+  ck_assert(next == 1 || next == 3);
+  ck_assert_int_eq((intptr_t) swiss_table_clock(table, &hand), 4 - next);
+
+  swiss_table_destroy(table);
+} END_TEST
+
+Suite *swiss_table_suite(void) {
+  Suite *suite = suite_create("swiss table");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, swiss_table_put_get);
+  tcase_add_test(tc_core, swiss_table_replace);
+  tcase_add_test(tc_core, swiss_table_long_keys);
+  tcase_add_test(tc_core, swiss_table_grow_and_remove);
+  tcase_add_test(tc_core, swiss_table_churn);
+  tcase_add_test(tc_core, swiss_table_clock_hand);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = swiss_table_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/logging.h"
+#include "../src/timer_wheel.h"
+
+typedef struct TestTimer {
+  int id;
+  TimerNode node;
+} TestTimer;
+
+START_TEST(timer_wheel_order) {
+  TimerWheel *wheel = timer_wheel_init(1000);
+  TestTimer timers[4];
+  uint64_t expires[4] = { 1005, 1000 + 64 * 64 + 3, 1070, 999 };
+  for (int i = 0 ; i < 4 ; i++) {
+    timers[i].id = i;
+    timer_wheel_add(wheel, &timers[i].node, expires[i]);
+  }
+  ck_assert_int_eq(timer_wheel_size(wheel), 4);
+
+  /* a timer in the past expires right away. */
+  TimerNode *node = timer_wheel_expire(wheel, 1000);
+  ck_assert_int_eq(TIMER_NODE_ENTRY(node, TestTimer, node)->id, 3);
+  ck_assert(timer_wheel_expire(wheel, 1004) == NULL);
+
+  node = timer_wheel_expire(wheel, 100000);
+  ck_assert_int_eq(TIMER_NODE_ENTRY(node, TestTimer, node)->id, 0);
+  node = timer_wheel_expire(wheel, 100000);
+  ck_assert_int_eq(TIMER_NODE_ENTRY(node, TestTimer, node)->id, 2);
+  node = timer_wheel_expire(wheel, 100000);
+  ck_assert_int_eq(TIMER_NODE_ENTRY(node, TestTimer, node)->id, 1);
+  ck_assert(timer_wheel_expire(wheel, 100000) == NULL);
+  ck_assert_int_eq(timer_wheel_size(wheel), 0);
+
+  timer_wheel_destroy(wheel);
+} END_TEST
+
+START_TEST(timer_wheel_remove_timer) {
+  TimerWheel *wheel = timer_wheel_init(0);
+  TestTimer first;
+  TestTimer second;
+  timer_wheel_add(wheel, &first.node, 500);
+  timer_wheel_add(wheel, &second.node, 500);
+
+  timer_wheel_remove(wheel, &first.node);
+  ck_assert(timer_wheel_expire(wheel, 1000) == &second.node);
+  ck_assert(timer_wheel_expire(wheel, 1000) == NULL);
+
+  /* a removed timer can be added again. */
+  timer_wheel_add(wheel, &first.node, 2000);
+  ck_assert(timer_wheel_expire(wheel, 1999) == NULL);
+  ck_assert(timer_wheel_expire(wheel, 2000) == &first.node);
+
+  timer_wheel_destroy(wheel);
+} END_TEST
+
+START_TEST(timer_wheel_random) {
+  uint64_t start = 123456789;
+  TimerWheel *wheel = timer_wheel_init(start);
+  size_t count = 20000;
+  TestTimer *timers = calloc(count, sizeof(TestTimer));
+  uint64_t *expires = calloc(count, sizeof(uint64_t));
+
+  srand(42);
+  for (size_t i = 0 ; i < count ; i++) {
+    timers[i].id = (int) i;
+    /* spread over all of the levels, including the overflow list. */
+    int shift = rand() % 40;
+    uint64_t mask = ((uint64_t) 1 << shift) - 1;
+    expires[i] = start + ((((uint64_t) rand() << 20) ^ (uint64_t) rand()) & mask);
+    timer_wheel_add(wheel, &timers[i].node, expires[i]);
+  }
+  for (size_t i = 0 ; i < count ; i += 3) {
+    timer_wheel_remove(wheel, &timers[i].node);
+    expires[i] = 0;
+  }
+
+  /* advances in uneven steps and checks that every timer expires exactly
+   * in the step that covers its expiration. */
+  uint64_t now = start;
+  size_t expired = 0;
+  while (timer_wheel_size(wheel) > 0) {
+    uint64_t prev = now;
+    now += (uint64_t) (rand() % 3 == 0 ? rand() % 100 : rand()) << (rand() % 10);
+    TimerNode *node;
+    while ((node = timer_wheel_expire(wheel, now)) != NULL) {
+      TestTimer *timer = TIMER_NODE_ENTRY(node, TestTimer, node);
+      ck_assert(expires[timer->id] != 0);
+      ck_assert_uint_le(expires[timer->id], now);
+      ck_assert(expires[timer->id] > prev || (prev == start && expires[timer->id] == start));
+      expires[timer->id] = 0;
+      expired++;
+    }
+  }
+  ck_assert_int_eq(expired, count - (count + 2) / 3);
+
+  free(timers);
+  free(expires);
+  timer_wheel_destroy(wheel);
+} END_TEST
+
+Suite *timer_wheel_suite(void) {
+  Suite *suite = suite_create("timer wheel");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, timer_wheel_order);
+  tcase_add_test(tc_core, timer_wheel_remove_timer);
+  tcase_add_test(tc_core, timer_wheel_random);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = timer_wheel_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/kv_store.h"
+#include "../src/logging.h"
+#include "../src/slab.h"
+#include "../src/wal.h"
+
+static void count_release(void *waiter, void *arg) {
+  (void) waiter;
+  (*(int*) arg)++;
+}
+
+static void wait_durable(Wal *wal, int *released) {
+  struct pollfd poll_fd;
+  poll_fd.fd = wal_done_event_fd(wal);
+  poll_fd.events = POLLIN;
+  while (wal_has_pending(wal)) {
+    ck_assert_int_eq(poll(&poll_fd, 1, 5000), 1);
+    wal_handle_done(wal, count_release, released);
+  }
+}
+
+START_TEST(wal_group_commit_and_replay) {
+  char dir[] = "/tmp/jullop-wal-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  Wal *wal = wal_init(dir, 0);
+  int released = 0;
+
+  wal_append_put(wal, "a", 1, "first", 5, 0);
+  wal_add_waiter(wal, (void*) 1);
+  wal_flush(wal);
+
+  /* everything appended during a flush goes into one more sync. */
+  wal_append_put(wal, "b", 1, "second", 6, 0);
+  wal_add_waiter(wal, (void*) 2);
+  wal_append_delete(wal, "a", 1);
+  wal_add_waiter(wal, (void*) 3);
+  wal_flush(wal);
+
+  wait_durable(wal, &released);
+  ck_assert_int_eq(released, 3);
+  ck_assert_int_le(atomic_load(&wal->sync_count), 2);
+  ck_assert_int_eq(atomic_load(&wal->record_count), 3);
+
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  Wal *reopened = wal_init(dir, 0);
+  wal_replay(reopened, store, 0);
+
+  ck_assert(kv_store_get(store, "a", 1) == NULL);
+  KvItem *item = kv_store_get(store, "b", 1);
+  ck_assert(item != NULL);
+  ck_assert(strncmp(kv_item_value(item), "second", 6) == 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(wal_torn_record) {
+  char dir[] = "/tmp/jullop-wal-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  Wal *wal = wal_init(dir, 3);
+  int released = 0;
+  wal_append_put(wal, "key", 3, "value", 5, 0);
+  wal_flush(wal);
+  wait_durable(wal, &released);
+
+  /* simulates a crash in the middle of writing the next record. */
+  char path[256];
+  snprintf(path, sizeof(path), "%s/actor-3-0.log", dir);
+  int fd = open(path, O_WRONLY | O_APPEND);
+  ck_assert(write(fd, "torn", 4) == 4);
+  close(fd);
+
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  Wal *reopened = wal_init(dir, 3);
+  wal_replay(reopened, store, 0);
+  ck_assert_int_eq(kv_store_size(store), 1);
+
+  /* the torn bytes are gone so new records are readable again. */
+  wal_append_put(reopened, "other", 5, "value", 5, 0);
+  wal_flush(reopened);
+  wait_durable(reopened, &released);
+
+  KvStore *replayed = kv_store_init(slab);
+  wal_replay(wal_init(dir, 3), replayed, 0);
+  ck_assert_int_eq(kv_store_size(replayed), 2);
+
+  kv_store_destroy(store);
+  kv_store_destroy(replayed);
+  slab_destroy(slab);
+} END_TEST
+
+START_TEST(wal_generations) {
+  char dir[] = "/tmp/jullop-wal-XXXXXX";
+  ck_assert(mkdtemp(dir) != NULL);
+
+  Wal *wal = wal_init(dir, 1);
+  int released = 0;
+  wal_append_put(wal, "old", 3, "value", 5, 0);
+  wal_flush(wal);
+  wait_durable(wal, &released);
+
+  ck_assert_int_eq(wal_rotate(wal), 1);
+  uint64_t expires_at = kv_store_clock() + 60000;
+  wal_append_put(wal, "new", 3, "value", 5, expires_at);
+  wal_flush(wal);
+  wait_durable(wal, &released);
+
+  /* the first generation is left out, as if a snapshot covered it. */
+  Slab *slab = slab_init();
+  KvStore *store = kv_store_init(slab);
+  Wal *reopened = wal_init(dir, 1);
+  wal_replay(reopened, store, 1);
+  ck_assert_int_eq(kv_store_size(store), 1);
+  KvItem *item = kv_store_get(store, "new", 3);
+  ck_assert(item != NULL);
+  ck_assert(item->expires_at == expires_at);
+  ck_assert_int_eq(reopened->generation, 2);
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/actor-1-0.log", dir);
+  ck_assert_int_eq(access(path, F_OK), -1);
+  snprintf(path, sizeof(path), "%s/actor-1-1.log", dir);
+  ck_assert_int_eq(access(path, F_OK), 0);
+
+  kv_store_destroy(store);
+  slab_destroy(slab);
+} END_TEST
+
+Suite *wal_suite(void) {
+  Suite *suite = suite_create("wal");
+  TCase *tc_core = tcase_create("Core");
+
+  tcase_add_test(tc_core, wal_group_commit_and_replay);
+  tcase_add_test(tc_core, wal_torn_record);
+  tcase_add_test(tc_core, wal_generations);
+  suite_add_tcase(suite, tc_core);
+  return suite;
+}
+
+int main(void) {
+  Suite *suite = wal_suite();
+  SRunner *runner = srunner_create(suite);
+
+  srunner_run_all(runner, CK_NORMAL);
+  int number_failed = srunner_ntests_failed(runner);
+  
+  srunner_free(runner);
+  return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}